@@ -0,0 +1,557 @@
+/*
+ * archive.c - compact columnar archives of fixes and AIS positions
+ *
+ * See archive.h for the layout.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "archive.h"
+#include "bits.h"
+
+#define ARCHIVE_MAGIC	"GPAR"
+
+/* little-endian floating point, bit patterns and all */
+static void putled64(unsigned char *buf, size_t off, double d)
+{
+    uint64_t v;
+
+    memcpy(&v, &d, sizeof(v));
+    putle64(buf, off, v);
+}
+
+static double getled64u(const unsigned char *buf, size_t off)
+{
+    uint64_t v = getleu64(buf, off);
+    double d;
+
+    memcpy(&d, &v, sizeof(d));
+    return d;
+}
+
+static void putlef32(unsigned char *buf, size_t off, float f)
+{
+    uint32_t v;
+
+    memcpy(&v, &f, sizeof(v));
+    putle32(buf, off, v);
+}
+
+static float getlef32u(const unsigned char *buf, size_t off)
+{
+    uint32_t v = getleu32(buf, off);
+    float f;
+
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static int32_t degrees(double deg)
+/* degrees to stored units */
+{
+    if (isnan(deg) || fabs(deg) > 214.0)
+	return ARCHIVE_NO_POS;
+    return (int32_t)lround(deg * 1e7);
+}
+
+/**************************************************************************
+ *
+ * Writing
+ *
+ **************************************************************************/
+
+void archive_writer_init(struct archive_writer_t *writer, FILE *fp)
+/* start collecting records for an archive stream */
+{
+    writer->fp = fp;
+    writer->nfix = writer->nais = writer->untimed = 0;
+}
+
+static void backfill(struct archive_writer_t *writer, double t)
+/* pending AIS records heard before any time was known were heard by t */
+{
+    unsigned int i;
+
+    if (writer->untimed == 0 || isnan(t))
+	return;
+    for (i = 0; i < writer->nais; i++)
+	if (writer->ais[i].time == -INFINITY)
+	    writer->ais[i].time = t;
+    writer->untimed = 0;
+}
+
+static void stats_pos(struct archive_block_t *block, int32_t lat, int32_t lon)
+/* fold a position into a block's extremes */
+{
+    if (lat == ARCHIVE_NO_POS || lon == ARCHIVE_NO_POS)
+	return;
+    if (lat < block->latmin)
+	block->latmin = lat;
+    if (lat > block->latmax)
+	block->latmax = lat;
+    if (lon < block->lonmin)
+	block->lonmin = lon;
+    if (lon > block->lonmax)
+	block->lonmax = lon;
+}
+
+static void stats_time(struct archive_block_t *block, double t)
+/* fold a time into a block's span */
+{
+    if (t < block->tmin)
+	block->tmin = t;
+    if (t > block->tmax)
+	block->tmax = t;
+}
+
+static int write_block(FILE *fp, struct archive_block_t *block, int width,
+		       const unsigned char *data)
+/* emit one block, header first */
+{
+    unsigned char header[ARCHIVE_HEADER];
+    size_t length = (size_t)block->count * width;
+
+    memset(header, 0, sizeof(header));
+    memcpy(header, ARCHIVE_MAGIC, 4);
+    header[4] = (unsigned char)block->kind;
+    header[5] = ARCHIVE_VERSION;
+    putle32(header, 8, block->count);
+    putle32(header, 12, (uint32_t)length);
+    putled64(header, 16, block->tmin);
+    putled64(header, 24, block->tmax);
+    putle32(header, 32, (uint32_t)block->latmin);
+    putle32(header, 36, (uint32_t)block->latmax);
+    putle32(header, 40, (uint32_t)block->lonmin);
+    putle32(header, 44, (uint32_t)block->lonmax);
+    putle32(header, 48, block->mmsimin);
+    putle32(header, 52, block->mmsimax);
+    if (fwrite(header, sizeof(header), 1, fp) != 1
+	|| fwrite(data, length, 1, fp) != 1
+	|| fflush(fp) != 0)
+	return -1;
+    return 0;
+}
+
+static void block_init(struct archive_block_t *block, int kind,
+		       unsigned int count)
+/* empty extremes, ready to be folded into */
+{
+    block->kind = kind;
+    block->count = count;
+    block->tmin = INFINITY;
+    block->tmax = -INFINITY;
+    block->latmin = block->lonmin = INT32_MAX;
+    block->latmax = block->lonmax = INT32_MIN;
+    block->mmsimin = UINT32_MAX;
+    block->mmsimax = 0;
+}
+
+static int flush_fixes(struct archive_writer_t *writer)
+/* write the pending fixes as a block, column by column */
+{
+    unsigned char *data = writer->data;
+    struct archive_block_t block;
+    unsigned int i, n = writer->nfix;
+    size_t c;
+
+    if (n == 0)
+	return 0;
+    block_init(&block, ARCHIVE_FIX, n);
+    c = 0;
+    for (i = 0; i < n; i++, c += 8) {
+	putled64(data, c, writer->fix[i].time);
+	stats_time(&block, writer->fix[i].time);
+	stats_pos(&block, writer->fix[i].lat, writer->fix[i].lon);
+    }
+    for (i = 0; i < n; i++, c += 4)
+	putle32(data, c, (uint32_t)writer->fix[i].lat);
+    for (i = 0; i < n; i++, c += 4)
+	putle32(data, c, (uint32_t)writer->fix[i].lon);
+    for (i = 0; i < n; i++, c += 4)
+	putle32(data, c, (uint32_t)writer->fix[i].alt);
+    for (i = 0; i < n; i++, c += 4)
+	putlef32(data, c, writer->fix[i].speed);
+    for (i = 0; i < n; i++, c += 4)
+	putlef32(data, c, writer->fix[i].track);
+    for (i = 0; i < n; i++, c += 4)
+	putlef32(data, c, writer->fix[i].climb);
+    for (i = 0; i < n; i++, c += 1)
+	data[c] = writer->fix[i].mode;
+    block.mmsimin = block.mmsimax = 0;
+    writer->nfix = 0;
+    return write_block(writer->fp, &block, ARCHIVE_FIX_WIDTH, data);
+}
+
+static int flush_ais(struct archive_writer_t *writer)
+/* write the pending AIS positions as a block, column by column */
+{
+    unsigned char *data = writer->data;
+    struct archive_block_t block;
+    unsigned int i, n = writer->nais;
+    size_t c;
+
+    if (n == 0)
+	return 0;
+    writer->untimed = 0;
+    block_init(&block, ARCHIVE_AIS, n);
+    c = 0;
+    for (i = 0; i < n; i++, c += 8) {
+	putled64(data, c, writer->ais[i].time);
+	stats_time(&block, writer->ais[i].time);
+	stats_pos(&block, writer->ais[i].lat, writer->ais[i].lon);
+    }
+    for (i = 0; i < n; i++, c += 4) {
+	uint32_t mmsi = writer->ais[i].mmsi;
+
+	putle32(data, c, mmsi);
+	if (mmsi < block.mmsimin)
+	    block.mmsimin = mmsi;
+	if (mmsi > block.mmsimax)
+	    block.mmsimax = mmsi;
+    }
+    for (i = 0; i < n; i++, c += 4)
+	putle32(data, c, (uint32_t)writer->ais[i].lat);
+    for (i = 0; i < n; i++, c += 4)
+	putle32(data, c, (uint32_t)writer->ais[i].lon);
+    for (i = 0; i < n; i++, c += 2)
+	putle16(data, c, writer->ais[i].speed);
+    for (i = 0; i < n; i++, c += 2)
+	putle16(data, c, writer->ais[i].course);
+    for (i = 0; i < n; i++, c += 2)
+	putle16(data, c, writer->ais[i].heading);
+    for (i = 0; i < n; i++, c += 1)
+	data[c] = writer->ais[i].type;
+    for (i = 0; i < n; i++, c += 1)
+	data[c] = writer->ais[i].status;
+    writer->nais = 0;
+    return write_block(writer->fp, &block, ARCHIVE_AIS_WIDTH, data);
+}
+
+int archive_flush(struct archive_writer_t *writer)
+/* write out everything pending, as short blocks if need be */
+{
+    int status = flush_fixes(writer);
+
+    if (flush_ais(writer) != 0)
+	status = -1;
+    return status;
+}
+
+int archive_put_fix(struct archive_writer_t *writer,
+		    const struct gps_fix_t *fix)
+/* add a fix; return -1 if a block had to be written and couldn't be */
+{
+    struct archive_fix_t *rec;
+
+    if (isnan(fix->time) || fix->mode < MODE_2D)
+	return 0;
+    backfill(writer, fix->time);
+    rec = &writer->fix[writer->nfix++];
+    rec->time = fix->time;
+    rec->lat = degrees(fix->latitude);
+    rec->lon = degrees(fix->longitude);
+    if (isnan(fix->altitude) || fabs(fix->altitude) > 2e6)
+	rec->alt = ARCHIVE_NO_POS;
+    else
+	rec->alt = (int32_t)lround(fix->altitude * 1000);
+    rec->speed = (float)fix->speed;
+    rec->track = (float)fix->track;
+    rec->climb = (float)fix->climb;
+    rec->mode = (uint8_t)fix->mode;
+    if (writer->nfix == ARCHIVE_BLOCK)
+	return flush_fixes(writer);
+    return 0;
+}
+
+static uint16_t tenths(unsigned int value, unsigned int missing,
+		       unsigned int scale)
+/* an AIS quantity in stored units, or ARCHIVE_NO_VALUE */
+{
+    if (value == missing)
+	return ARCHIVE_NO_VALUE;
+    return (uint16_t)(value * scale);
+}
+
+int archive_put_ais(struct archive_writer_t *writer,
+		    const struct ais_t *ais, double when)
+/* add an AIS message if it reports a position; -1 on write failure */
+{
+    struct archive_ais_t rec;
+    int lat, lon;
+    double div = AIS_LATLON_DIV;
+
+    rec.time = isnan(when) ? -INFINITY : when;
+    rec.mmsi = ais->mmsi;
+    rec.type = (uint8_t)ais->type;
+    rec.status = 15;		/* "not defined", as in the AIS spec */
+    rec.speed = rec.course = rec.heading = ARCHIVE_NO_VALUE;
+    switch (ais->type) {
+    case 1:
+    case 2:
+    case 3:
+	lat = ais->type1.lat;
+	lon = ais->type1.lon;
+	rec.status = (uint8_t)ais->type1.status;
+	rec.speed = tenths(ais->type1.speed, AIS_SPEED_NOT_AVAILABLE, 1);
+	rec.course = tenths(ais->type1.course, AIS_COURSE_NOT_AVAILABLE, 1);
+	rec.heading = tenths(ais->type1.heading,
+			     AIS_HEADING_NOT_AVAILABLE, 10);
+	break;
+    case 4:
+    case 11:
+	lat = ais->type4.lat;
+	lon = ais->type4.lon;
+	break;
+    case 9:
+	lat = ais->type9.lat;
+	lon = ais->type9.lon;
+	rec.speed = tenths(ais->type9.speed, AIS_SAR_SPEED_NOT_AVAILABLE, 10);
+	rec.course = tenths(ais->type9.course, AIS_COURSE_NOT_AVAILABLE, 1);
+	break;
+    case 18:
+	lat = ais->type18.lat;
+	lon = ais->type18.lon;
+	rec.speed = tenths(ais->type18.speed, AIS_SPEED_NOT_AVAILABLE, 1);
+	rec.course = tenths(ais->type18.course, AIS_COURSE_NOT_AVAILABLE, 1);
+	rec.heading = tenths(ais->type18.heading,
+			     AIS_HEADING_NOT_AVAILABLE, 10);
+	break;
+    case 19:
+	lat = ais->type19.lat;
+	lon = ais->type19.lon;
+	rec.speed = tenths(ais->type19.speed, AIS_SPEED_NOT_AVAILABLE, 1);
+	rec.course = tenths(ais->type19.course, AIS_COURSE_NOT_AVAILABLE, 1);
+	rec.heading = tenths(ais->type19.heading,
+			     AIS_HEADING_NOT_AVAILABLE, 10);
+	break;
+    case 21:
+	lat = ais->type21.lat;
+	lon = ais->type21.lon;
+	break;
+    case 27:
+	div = AIS_LONGRANGE_LATLON_DIV;
+	lat = ais->type27.lat;
+	lon = ais->type27.lon;
+	rec.status = (uint8_t)ais->type27.status;
+	rec.speed = tenths(ais->type27.speed,
+			   AIS_LONGRANGE_SPEED_NOT_AVAILABLE, 10);
+	rec.course = tenths(ais->type27.course,
+			    AIS_LONGRANGE_COURSE_NOT_AVAILABLE, 10);
+	break;
+    default:
+	return 0;		/* no position in it */
+    }
+    /* 91 and 181 degrees are the AIS way of saying "not available" */
+    rec.lat = abs(lat) > 90 * div ? ARCHIVE_NO_POS : degrees(lat / div);
+    rec.lon = abs(lon) > 180 * div ? ARCHIVE_NO_POS : degrees(lon / div);
+    if (rec.time == -INFINITY)
+	writer->untimed++;
+    else
+	backfill(writer, when);
+    writer->ais[writer->nais++] = rec;
+    if (writer->nais == ARCHIVE_BLOCK)
+	return flush_ais(writer);
+    return 0;
+}
+
+/**************************************************************************
+ *
+ * Reading
+ *
+ **************************************************************************/
+
+static int block_width(int kind)
+{
+    return kind == ARCHIVE_FIX ? ARCHIVE_FIX_WIDTH : kind == ARCHIVE_AIS ? ARCHIVE_AIS_WIDTH : 0;
+}
+
+int archive_open(struct archive_reader_t *reader, const char *path)
+/* index the blocks of an archive; 0 on success, -1 on error */
+{
+    unsigned char header[ARCHIVE_HEADER];
+    struct stat sb;
+    long offset = 0;
+    size_t room = 0;
+
+    reader->blocks = NULL;
+    reader->nblocks = 0;
+    if ((reader->fp = fopen(path, "rb")) == NULL)
+	return -1;
+    if (fstat(fileno(reader->fp), &sb) != 0) {
+	archive_close(reader);
+	return -1;
+    }
+    while (fread(header, sizeof(header), 1, reader->fp) == 1) {
+	struct archive_block_t *block;
+	size_t length = (size_t)getleu32(header, 12);
+	size_t count = (size_t)getleu32(header, 8);
+
+	/*
+	 * Stop at anything that isn't a whole block of ours.  No writer
+	 * makes a block longer than ARCHIVE_BLOCK records, and readers
+	 * index by that, so a count past it is damage or worse.
+	 */
+	if (memcmp(header, ARCHIVE_MAGIC, 4) != 0
+	    || header[5] != ARCHIVE_VERSION
+	    || block_width(header[4]) == 0
+	    || count > ARCHIVE_BLOCK
+	    || length != count * (size_t)block_width(header[4])
+	    || offset + ARCHIVE_HEADER + (long)length > (long)sb.st_size)
+	    break;
+	if (reader->nblocks == room) {
+	    struct archive_block_t *more;
+
+	    room = room ? room * 2 : 64;
+	    more = realloc(reader->blocks, room * sizeof(*more));
+	    if (more == NULL) {
+		archive_close(reader);
+		return -1;
+	    }
+	    reader->blocks = more;
+	}
+	block = &reader->blocks[reader->nblocks++];
+	block->offset = offset;
+	block->kind = header[4];
+	block->count = (unsigned int)count;
+	block->tmin = getled64u(header, 16);
+	block->tmax = getled64u(header, 24);
+	block->latmin = getles32(header, 32);
+	block->latmax = getles32(header, 36);
+	block->lonmin = getles32(header, 40);
+	block->lonmax = getles32(header, 44);
+	block->mmsimin = getleu32(header, 48);
+	block->mmsimax = getleu32(header, 52);
+	offset += ARCHIVE_HEADER + (long)length;
+	if (fseek(reader->fp, offset, SEEK_SET) != 0)
+	    break;
+    }
+    return 0;
+}
+
+static unsigned char *load_block(struct archive_reader_t *reader,
+				 const struct archive_block_t *block)
+/* read a block's columns into a fresh buffer */
+{
+    size_t length = (size_t)block->count * block_width(block->kind);
+    unsigned char *data = malloc(length ? length : 1);
+
+    if (data == NULL)
+	return NULL;
+    if (fseek(reader->fp, block->offset + ARCHIVE_HEADER, SEEK_SET) != 0
+	|| fread(data, length, 1, reader->fp) != 1) {
+	free(data);
+	return NULL;
+    }
+    return data;
+}
+
+static bool wanted(const struct archive_block_t *block, int kind,
+		   const struct archive_query_t *query)
+/* can this block hold anything the query wants? */
+{
+    if (block->kind != kind
+	|| block->tmax < query->start || block->tmin > query->end)
+	return false;
+    if (kind == ARCHIVE_AIS && query->mmsi != 0
+	&& (query->mmsi < block->mmsimin || query->mmsi > block->mmsimax))
+	return false;
+    return true;
+}
+
+int archive_read_fixes(struct archive_reader_t *reader,
+		       const struct archive_query_t *query,
+		       archive_fix_hook_t hook, void *arg)
+/* pass each fix in the time range to the hook; count them, -1 on error */
+{
+    size_t b;
+    int found = 0;
+
+    for (b = 0; b < reader->nblocks; b++) {
+	const struct archive_block_t *block = &reader->blocks[b];
+	unsigned int i, n = block->count;
+	unsigned char *data;
+
+	if (!wanted(block, ARCHIVE_FIX, query))
+	    continue;
+	if ((data = load_block(reader, block)) == NULL)
+	    return -1;
+	for (i = 0; i < n; i++) {
+	    struct archive_fix_t rec;
+
+	    rec.time = getled64u(data, 8 * i);
+	    if (rec.time < query->start || rec.time > query->end)
+		continue;
+	    rec.lat = getles32(data, 8 * n + 4 * i);
+	    rec.lon = getles32(data, 12 * n + 4 * i);
+	    rec.alt = getles32(data, 16 * n + 4 * i);
+	    rec.speed = getlef32u(data, 20 * n + 4 * i);
+	    rec.track = getlef32u(data, 24 * n + 4 * i);
+	    rec.climb = getlef32u(data, 28 * n + 4 * i);
+	    rec.mode = data[32 * n + i];
+	    hook(&rec, arg);
+	    found++;
+	}
+	free(data);
+    }
+    return found;
+}
+
+int archive_read_ais(struct archive_reader_t *reader,
+		     const struct archive_query_t *query,
+		     archive_ais_hook_t hook, void *arg)
+/* pass each AIS position in the time range, and of the MMSI if one is
+ * given, to the hook; count them, -1 on error */
+{
+    size_t b;
+    int found = 0;
+
+    for (b = 0; b < reader->nblocks; b++) {
+	const struct archive_block_t *block = &reader->blocks[b];
+	unsigned int i, n = block->count;
+	unsigned char *data;
+
+	if (!wanted(block, ARCHIVE_AIS, query))
+	    continue;
+	if ((data = load_block(reader, block)) == NULL)
+	    return -1;
+	for (i = 0; i < n; i++) {
+	    struct archive_ais_t rec;
+
+	    rec.time = getled64u(data, 8 * i);
+	    rec.mmsi = getleu32(data, 8 * n + 4 * i);
+	    if (rec.time < query->start || rec.time > query->end
+		|| (query->mmsi != 0 && rec.mmsi != query->mmsi))
+		continue;
+	    rec.lat = getles32(data, 12 * n + 4 * i);
+	    rec.lon = getles32(data, 16 * n + 4 * i);
+	    rec.speed = getleu16(data, 20 * n + 2 * i);
+	    rec.course = getleu16(data, 22 * n + 2 * i);
+	    rec.heading = getleu16(data, 24 * n + 2 * i);
+	    rec.type = data[26 * n + i];
+	    rec.status = data[27 * n + i];
+	    hook(&rec, arg);
+	    found++;
+	}
+	free(data);
+    }
+    return found;
+}
+
+void archive_close(struct archive_reader_t *reader)
+/* let go of an archive */
+{
+    if (reader->fp != NULL)
+	(void)fclose(reader->fp);
+    free(reader->blocks);
+    reader->fp = NULL;
+    reader->blocks = NULL;
+    reader->nblocks = 0;
+}
+
+/* end */
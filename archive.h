@@ -0,0 +1,119 @@
+/*
+ * archive.h - compact columnar archives of fixes and AIS positions
+ *
+ * An archive is a sequence of self-contained blocks, so it is written
+ * by appending and two archives concatenate into one.  Each block holds
+ * up to ARCHIVE_BLOCK records of one kind, stored column by column as
+ * fixed-width little-endian values, behind a header giving the count,
+ * the time span, and the extremes of latitude, longitude and MMSI in
+ * the block.  A reader indexes the headers once and then visits only
+ * the blocks that can hold what a query wants.  A block cut short by a
+ * crash at the end of the file is ignored.
+ *
+ * Positions are kept in units of 1e-7 degree, ARCHIVE_NO_POS where
+ * unknown; AIS speeds in 0.1 knot and courses and headings in 0.1
+ * degree, ARCHIVE_NO_VALUE where unknown.  Times are Unix seconds.
+ *
+ * AIS carries no date, so an AIS record is written with the time the
+ * caller last knew, and one put before any time is known (a NaN time)
+ * gets the first time that comes along while it is still pending.  If
+ * its block has to go out first, it is stored at -infinity: before
+ * anything in the archive, so a query from -infinity still finds it.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#ifndef _GPSD_ARCHIVE_H_
+#define _GPSD_ARCHIVE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "gps.h"
+
+#define ARCHIVE_BLOCK		4096	/* records per block, at most */
+#define ARCHIVE_HEADER		64	/* bytes in a block header */
+#define ARCHIVE_VERSION		1
+
+#define ARCHIVE_FIX		1	/* block kinds */
+#define ARCHIVE_AIS		2
+
+#define ARCHIVE_NO_POS		INT32_MIN
+#define ARCHIVE_NO_VALUE	0xffff
+
+#define ARCHIVE_FIX_WIDTH	33	/* bytes per record, all columns */
+#define ARCHIVE_AIS_WIDTH	28
+
+/* a fix as stored: 8+4+4+4+4+4+4+1 = 33 bytes */
+struct archive_fix_t {
+    double time;
+    int32_t lat, lon;		/* 1e-7 degree */
+    int32_t alt;		/* mm, ARCHIVE_NO_POS if unknown */
+    float speed, track, climb;	/* m/s, degrees, m/s; NaN if unknown */
+    uint8_t mode;
+};
+
+/* an AIS position report as stored: 8+4+4+4+2+2+2+1+1 = 28 bytes */
+struct archive_ais_t {
+    double time;		/* when received, as well as we know */
+    uint32_t mmsi;
+    int32_t lat, lon;		/* 1e-7 degree */
+    uint16_t speed;		/* 0.1 knot */
+    uint16_t course, heading;	/* 0.1 degree */
+    uint8_t type;		/* AIS message type */
+    uint8_t status;		/* navigation status, 15 if not given */
+};
+
+/* what the header of a block says */
+struct archive_block_t {
+    long offset;		/* of the header in the file */
+    int kind;
+    unsigned int count;
+    double tmin, tmax;
+    int32_t latmin, latmax, lonmin, lonmax;
+    uint32_t mmsimin, mmsimax;
+};
+
+struct archive_writer_t {
+    FILE *fp;
+    unsigned int nfix, nais;
+    unsigned int untimed;	/* pending AIS records heard before any time */
+    struct archive_fix_t fix[ARCHIVE_BLOCK];
+    struct archive_ais_t ais[ARCHIVE_BLOCK];
+    /* a block's columns, as they go out; fixes are the wider */
+    unsigned char data[ARCHIVE_BLOCK * ARCHIVE_FIX_WIDTH];
+};
+
+struct archive_reader_t {
+    FILE *fp;
+    struct archive_block_t *blocks;
+    size_t nblocks;
+};
+
+/* which records a query wants */
+struct archive_query_t {
+    double start, end;		/* time range, inclusive */
+    uint32_t mmsi;		/* AIS only; 0 for all */
+};
+
+typedef void (*archive_fix_hook_t)(const struct archive_fix_t *, void *);
+typedef void (*archive_ais_hook_t)(const struct archive_ais_t *, void *);
+
+extern void archive_writer_init(struct archive_writer_t *, FILE *);
+extern int archive_put_fix(struct archive_writer_t *,
+			   const struct gps_fix_t *);
+extern int archive_put_ais(struct archive_writer_t *,
+			   const struct ais_t *, double);
+extern int archive_flush(struct archive_writer_t *);
+
+extern int archive_open(struct archive_reader_t *, const char *);
+extern int archive_read_fixes(struct archive_reader_t *,
+			      const struct archive_query_t *,
+			      archive_fix_hook_t, void *);
+extern int archive_read_ais(struct archive_reader_t *,
+			    const struct archive_query_t *,
+			    archive_ais_hook_t, void *);
+extern void archive_close(struct archive_reader_t *);
+
+#endif /* _GPSD_ARCHIVE_H_ */
@@ -0,0 +1,578 @@
+/*
+ * capture.c - record lexer packets with their arrival times, and replay them
+ *
+ * gpsd -W writes every packet any device delivers to a capture file,
+ * stamped with the time its first byte was read and tagged with the
+ * device it came from.  A replay:// device feeds one device's packets
+ * from such a file back into the daemon at their original pace, or
+ * faster, so a field incident can be reproduced as it happened.
+ *
+ * The file is an 8-byte magic, "GPSDCAP1", followed by records, each
+ * a 16-byte little-endian header and a payload:
+ *
+ *	0	u8	kind: CAP_PACKET, CAP_DEVICE or CAP_INDEX
+ *	1	u8	lexer packet type (CAP_PACKET)
+ *	2	u16	device id
+ *	4	u32	payload length
+ *	8	i64	arrival time, Unix nanoseconds
+ *
+ * A CAP_PACKET payload is the packet as the lexer delivered it.  A
+ * CAP_DEVICE record precedes a device's first packet and names it.
+ * Every CAPTURE_INDEX_EVERY packets comes a CAP_INDEX record, stamped
+ * with the latest arrival time, whose payload is the offset of the
+ * previous index record, the count of packets before it and the whole
+ * device table, so a reader can start from any index record.  A clean
+ * close appends a last index and a 16-byte trailer, "GPSDCIDX" and the
+ * offset of that index, from which a reader walks the index chain
+ * backwards instead of scanning the file.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpsd.h"
+#include "bits.h"
+#include "strfuncs.h"
+#include "timespec.h"
+
+#define CAP_MAGIC	"GPSDCAP1"
+#define CAP_TRAILER	"GPSDCIDX"
+#define CAP_HEADER	16
+
+#define CAP_PACKET	1
+#define CAP_DEVICE	2
+#define CAP_INDEX	3
+
+#define CAPTURE_INDEX_EVERY	1024	/* packets between index records */
+#define CAPTURE_DEVICES		64	/* distinct devices in one capture */
+
+static int64_t stamp_ns(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * NS_IN_SEC + ts->tv_nsec;
+}
+
+/**************************************************************************
+ *
+ * Recording
+ *
+ **************************************************************************/
+
+static struct {
+    FILE *fp;
+    struct gpsd_errout_t *errout;
+    long last_index;		/* offset of latest index record, or 0 */
+    unsigned long packets;	/* recorded so far */
+    int64_t last_stamp;
+    time_t flushed;
+    unsigned int ndevices;
+    char paths[CAPTURE_DEVICES][GPS_PATH_MAX];
+} capture;
+
+static bool capture_record(int kind, int type, unsigned int device,
+			   int64_t stamp, const void *data, size_t len)
+/* append one record */
+{
+    unsigned char header[CAP_HEADER];
+
+    header[0] = (unsigned char)kind;
+    header[1] = (unsigned char)type;
+    putle16(header, 2, device);
+    putle32(header, 4, (uint32_t)len);
+    putle64(header, 8, (uint64_t)stamp);
+    return fwrite(header, sizeof(header), 1, capture.fp) == 1
+	&& (len == 0 || fwrite(data, len, 1, capture.fp) == 1);
+}
+
+static bool capture_index(void)
+/* append an index record and make everything so far durable */
+{
+    unsigned char buf[18 + CAPTURE_DEVICES * (4 + GPS_PATH_MAX)];
+    size_t len = 18;
+    long here = ftell(capture.fp);
+    unsigned int i;
+
+    putle64(buf, 0, (uint64_t)capture.last_index);
+    putle64(buf, 8, (uint64_t)capture.packets);
+    putle16(buf, 16, capture.ndevices);
+    for (i = 0; i < capture.ndevices; i++) {
+	size_t pathlen = strlen(capture.paths[i]);
+
+	putle16(buf, len, i);
+	putle16(buf, len + 2, pathlen);
+	memcpy(buf + len + 4, capture.paths[i], pathlen);
+	len += 4 + pathlen;
+    }
+    if (here < 0
+	|| !capture_record(CAP_INDEX, 0, 0, capture.last_stamp, buf, len)
+	|| fflush(capture.fp) != 0)
+	return false;
+    capture.last_index = here;
+    return true;
+}
+
+bool capture_start(struct gpsd_errout_t *errout, const char *path)
+/* begin recording packets to a fresh capture file */
+{
+    memset(&capture, '\0', sizeof(capture));
+    capture.errout = errout;
+    if ((capture.fp = fopen(path, "wb")) == NULL
+	|| fwrite(CAP_MAGIC, 8, 1, capture.fp) != 1) {
+	gpsd_log(errout, LOG_ERROR, "capture: can't write %s: %s\n",
+		 path, strerror(errno));
+	if (capture.fp != NULL)
+	    (void)fclose(capture.fp);
+	capture.fp = NULL;
+	return false;
+    }
+    gpsd_log(errout, LOG_INF, "capture: recording packets to %s\n", path);
+    return true;
+}
+
+static void capture_fail(void)
+/* a write went wrong; stop rather than leave a ragged file growing */
+{
+    gpsd_log(capture.errout, LOG_ERROR,
+	     "capture: write failed, recording stopped: %s\n",
+	     strerror(errno));
+    (void)fclose(capture.fp);
+    capture.fp = NULL;
+}
+
+void capture_packet(struct gps_device_t *session)
+/* record the packet the lexer just delivered, if we are recording */
+{
+    struct gps_lexer_t *lexer = &session->lexer;
+    struct timespec now;
+    unsigned int id;
+
+    if (capture.fp == NULL)
+	return;
+
+    for (id = 0; id < capture.ndevices; id++)
+	if (strcmp(capture.paths[id], session->gpsdata.dev.path) == 0)
+	    break;
+    if (id == capture.ndevices) {
+	if (id == CAPTURE_DEVICES)
+	    return;
+	(void)strlcpy(capture.paths[id], session->gpsdata.dev.path,
+		      GPS_PATH_MAX);
+	capture.ndevices++;
+	if (!capture_record(CAP_DEVICE, 0, id, 0, capture.paths[id],
+			    strlen(capture.paths[id]))) {
+	    capture_fail();
+	    return;
+	}
+    }
+
+    /* arrival of the first byte, as the lexer saw it */
+    if (lexer->first_stamp.tv_sec != 0)
+	capture.last_stamp = stamp_ns(&lexer->first_stamp);
+    else {
+	(void)clock_gettime(CLOCK_REALTIME, &now);
+	capture.last_stamp = stamp_ns(&now);
+    }
+    if (!capture_record(CAP_PACKET, lexer->type, id, capture.last_stamp,
+			lexer->outbuffer, lexer->outbuflen)) {
+	capture_fail();
+	return;
+    }
+    /* an index makes a seek point; a quiet device still gets flushed */
+    if (++capture.packets % CAPTURE_INDEX_EVERY == 0) {
+	if (!capture_index())
+	    capture_fail();
+    } else if (time(NULL) != capture.flushed) {
+	capture.flushed = time(NULL);
+	if (fflush(capture.fp) != 0)
+	    capture_fail();
+    }
+}
+
+void capture_stop(void)
+/* finish a capture with its index trailer */
+{
+    unsigned char trailer[16];
+
+    if (capture.fp == NULL)
+	return;
+    if (capture_index()) {
+	memcpy(trailer, CAP_TRAILER, 8);
+	putle64(trailer, 8, (uint64_t)capture.last_index);
+	(void)fwrite(trailer, sizeof(trailer), 1, capture.fp);
+    }
+    if (fclose(capture.fp) != 0)
+	gpsd_log(capture.errout, LOG_ERROR, "capture: close failed: %s\n",
+		 strerror(errno));
+    capture.fp = NULL;
+    gpsd_log(capture.errout, LOG_INF, "capture: %lu packets recorded\n",
+	     capture.packets);
+}
+
+/**************************************************************************
+ *
+ * Reading
+ *
+ **************************************************************************/
+
+struct capture_mark_t {
+    long offset;		/* of an index record */
+    int64_t stamp;		/* latest arrival before it */
+};
+
+struct capture_reader_t {
+    FILE *fp;
+    struct capture_mark_t *marks;	/* seek points, in file order */
+    size_t nmarks;
+    unsigned int ndevices;
+    char paths[CAPTURE_DEVICES][GPS_PATH_MAX];
+};
+
+struct capture_packet_t {
+    unsigned int device;
+    int type;
+    int64_t stamp;
+    size_t length;
+    unsigned char data[MAX_PACKET_LENGTH*2+1];
+};
+
+static bool reader_header(struct capture_reader_t *reader,
+			  unsigned char *header)
+/* read a record header, if there is a whole one of a kind we know */
+{
+    if (fread(header, CAP_HEADER, 1, reader->fp) != 1)
+	return false;
+    return header[0] >= CAP_PACKET && header[0] <= CAP_INDEX;
+}
+
+static bool reader_index(struct capture_reader_t *reader, size_t len,
+			 long *prev)
+/* take in an index payload: the device table, and the previous index */
+{
+    unsigned char buf[18 + CAPTURE_DEVICES * (4 + GPS_PATH_MAX)];
+    size_t off = 18;
+    unsigned int i, n;
+
+    if (len < 18 || len > sizeof(buf) || fread(buf, len, 1, reader->fp) != 1)
+	return false;
+    *prev = (long)getleu64(buf, 0);
+    n = getleu16(buf, 16);
+    for (i = 0; i < n && off + 4 <= len; i++) {
+	unsigned int id = getleu16(buf, off);
+	size_t pathlen = getleu16(buf, off + 2);
+
+	if (id >= CAPTURE_DEVICES || pathlen >= GPS_PATH_MAX
+	    || off + 4 + pathlen > len)
+	    return false;
+	memcpy(reader->paths[id], buf + off + 4, pathlen);
+	reader->paths[id][pathlen] = '\0';
+	if (id >= reader->ndevices)
+	    reader->ndevices = id + 1;
+	off += 4 + pathlen;
+    }
+    return true;
+}
+
+static bool reader_mark(struct capture_reader_t *reader, long offset,
+			int64_t stamp)
+/* remember a seek point */
+{
+    struct capture_mark_t *more;
+
+    more = realloc(reader->marks, (reader->nmarks + 1) * sizeof(*more));
+    if (more == NULL)
+	return false;
+    reader->marks = more;
+    more[reader->nmarks].offset = offset;
+    more[reader->nmarks].stamp = stamp;
+    reader->nmarks++;
+    return true;
+}
+
+static bool reader_walk(struct capture_reader_t *reader)
+/* collect the seek points back along the chain from the trailer */
+{
+    unsigned char trailer[16], header[CAP_HEADER];
+    long offset;
+    size_t i;
+
+    if (fseek(reader->fp, -16L, SEEK_END) != 0
+	|| fread(trailer, sizeof(trailer), 1, reader->fp) != 1
+	|| memcmp(trailer, CAP_TRAILER, 8) != 0)
+	return false;
+    for (offset = (long)getleu64(trailer, 8); offset > 0; ) {
+	long prev;
+
+	if (fseek(reader->fp, offset, SEEK_SET) != 0
+	    || !reader_header(reader, header) || header[0] != CAP_INDEX
+	    || !reader_mark(reader, offset, getles64(header, 8))
+	    || !reader_index(reader, getleu32(header, 4), &prev)
+	    || prev >= offset)
+	    return false;
+	offset = prev;
+    }
+    /* the walk went backwards */
+    for (i = 0; i < reader->nmarks / 2; i++) {
+	struct capture_mark_t swap = reader->marks[i];
+
+	reader->marks[i] = reader->marks[reader->nmarks - 1 - i];
+	reader->marks[reader->nmarks - 1 - i] = swap;
+    }
+    return true;
+}
+
+static void reader_scan(struct capture_reader_t *reader)
+/* no trailer, so the capture was cut short; find the seek points the
+ * slow way, by hopping from header to header */
+{
+    unsigned char header[CAP_HEADER];
+    long offset = 8, prev;
+
+    reader->nmarks = 0;
+    while (fseek(reader->fp, offset, SEEK_SET) == 0
+	   && reader_header(reader, header)) {
+	size_t len = getleu32(header, 4);
+
+	if (header[0] == CAP_INDEX
+	    && (!reader_mark(reader, offset, getles64(header, 8))
+		|| !reader_index(reader, len, &prev)))
+	    break;
+	offset += CAP_HEADER + (long)len;
+    }
+}
+
+static void capture_close(struct capture_reader_t *reader)
+{
+    if (reader->fp != NULL)
+	(void)fclose(reader->fp);
+    free(reader->marks);
+    reader->fp = NULL;
+    reader->marks = NULL;
+}
+
+static bool capture_open(struct capture_reader_t *reader, const char *path)
+/* open a capture and index its seek points */
+{
+    char magic[8];
+
+    memset(reader, '\0', sizeof(*reader));
+    if ((reader->fp = fopen(path, "rb")) == NULL)
+	return false;
+    if (fread(magic, sizeof(magic), 1, reader->fp) != 1
+	|| memcmp(magic, CAP_MAGIC, sizeof(magic)) != 0) {
+	capture_close(reader);
+	errno = EINVAL;
+	return false;
+    }
+    if (!reader_walk(reader))
+	reader_scan(reader);
+    (void)fseek(reader->fp, 8L, SEEK_SET);
+    return true;
+}
+
+static void capture_seek(struct capture_reader_t *reader, int64_t stamp)
+/* go to the latest seek point before a time; packets from there on
+ * may still be earlier than it */
+{
+    long offset = 8;
+    size_t i;
+
+    for (i = 0; i < reader->nmarks && reader->marks[i].stamp < stamp; i++)
+	offset = reader->marks[i].offset;
+    (void)fseek(reader->fp, offset, SEEK_SET);
+}
+
+static int capture_next(struct capture_reader_t *reader,
+			struct capture_packet_t *packet)
+/* the next packet: 1 if there is one, 0 at the end */
+{
+    unsigned char header[CAP_HEADER];
+
+    while (reader_header(reader, header)) {
+	size_t len = getleu32(header, 4);
+	unsigned int id = getleu16(header, 2);
+	long prev;
+
+	if (header[0] == CAP_INDEX) {
+	    if (!reader_index(reader, len, &prev))
+		return 0;
+	} else if (header[0] == CAP_DEVICE) {
+	    if (id >= CAPTURE_DEVICES || len >= GPS_PATH_MAX
+		|| fread(reader->paths[id], len, 1, reader->fp) != 1)
+		return 0;
+	    reader->paths[id][len] = '\0';
+	    if (id >= reader->ndevices)
+		reader->ndevices = id + 1;
+	} else {
+	    if (len > sizeof(packet->data)
+		|| fread(packet->data, len, 1, reader->fp) != 1)
+		return 0;
+	    packet->device = id;
+	    packet->type = header[1];
+	    packet->stamp = getles64(header, 8);
+	    packet->length = len;
+	    return 1;
+	}
+    }
+    return 0;
+}
+
+/**************************************************************************
+ *
+ * Replay
+ *
+ **************************************************************************/
+
+struct replay_t {
+    struct capture_reader_t reader;
+    struct capture_packet_t packet;
+    struct gpsd_errout_t *errout;
+    int fd;			/* write end of the pipe gpsd reads */
+    int device;			/* which to replay, -1 for the first seen */
+    double speed;		/* 1 is real time, 0 as fast as gpsd reads */
+    double skip;		/* seconds into the capture to start */
+    char path[GPS_PATH_MAX];
+};
+
+static bool replay_write(int fd, const unsigned char *buf, size_t len)
+{
+    while (len > 0) {
+	ssize_t n = write(fd, buf, len);
+
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    return false;
+	}
+	buf += n;
+	len -= (size_t)n;
+    }
+    return true;
+}
+
+static void *replay_thread(void *arg)
+/* pace one device's packets from the capture into the pipe */
+{
+    struct replay_t *replay = (struct replay_t *)arg;
+    struct capture_packet_t *packet = &replay->packet;
+    struct timespec start, due;
+    int64_t first = 0;
+    unsigned long sent = 0;
+    bool started = false;
+
+    if (replay->skip > 0 && capture_next(&replay->reader, packet) == 1) {
+	/* the default device is the capture's first, not the first after */
+	if (replay->device < 0)
+	    replay->device = (int)packet->device;
+	first = packet->stamp + (int64_t)(replay->skip * NS_IN_SEC);
+	capture_seek(&replay->reader, first);
+    }
+    while (capture_next(&replay->reader, packet) == 1) {
+	if (packet->stamp < first)
+	    continue;
+	if (replay->device < 0)
+	    replay->device = (int)packet->device;
+	if ((int)packet->device != replay->device)
+	    continue;
+	if (!started) {
+	    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+	    first = packet->stamp;
+	    started = true;
+	} else if (replay->speed > 0) {
+	    int64_t after = (int64_t)((packet->stamp - first) / replay->speed);
+
+	    due.tv_sec = start.tv_sec + (time_t)(after / NS_IN_SEC);
+	    due.tv_nsec = start.tv_nsec + (long)(after % NS_IN_SEC);
+	    TS_NORM(&due);
+	    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &due, NULL)
+		   == EINTR)
+		continue;
+	}
+	if (!replay_write(replay->fd, packet->data, packet->length))
+	    break;		/* the device was closed */
+	sent++;
+    }
+    gpsd_log(replay->errout, LOG_INF,
+	     "replay: %lu packets from %s replayed\n", sent, replay->path);
+    (void)close(replay->fd);
+    capture_close(&replay->reader);
+    free(replay);
+    return NULL;
+}
+
+socket_t replay_open(struct gps_device_t *session)
+/* open a replay:// pseudo-device; the descriptor gpsd reads is a pipe
+ * fed by a thread.  The path may be followed by ?speed=N (0 for as
+ * fast as possible), &device=N and &skip=S (seconds) */
+{
+    struct replay_t *replay;
+    char *opt, *next;
+    int fds[2];
+    pthread_t thread;
+
+    if ((replay = calloc(1, sizeof(*replay))) == NULL)
+	return -1;
+    replay->errout = &session->context->errout;
+    replay->device = -1;
+    replay->speed = 1;
+    (void)strlcpy(replay->path, session->gpsdata.dev.path + 9,
+		  sizeof(replay->path));
+    if ((opt = strchr(replay->path, '?')) != NULL) {
+	*opt++ = '\0';
+	for (; opt != NULL; opt = next) {
+	    if ((next = strchr(opt, '&')) != NULL)
+		*next++ = '\0';
+	    if (str_starts_with(opt, "speed="))
+		replay->speed = safe_atof(opt + 6);
+	    else if (str_starts_with(opt, "device="))
+		replay->device = atoi(opt + 7);
+	    else if (str_starts_with(opt, "skip="))
+		replay->skip = safe_atof(opt + 5);
+	    else
+		gpsd_log(replay->errout, LOG_WARN,
+			 "replay: unknown option %s\n", opt);
+	}
+    }
+    if (!capture_open(&replay->reader, replay->path)) {
+	gpsd_log(replay->errout, LOG_ERROR, "replay: can't open %s: %s\n",
+		 replay->path, strerror(errno));
+	free(replay);
+	return -1;
+    }
+    if (pipe(fds) != 0) {
+	gpsd_log(replay->errout, LOG_ERROR, "replay: pipe failed: %s\n",
+		 strerror(errno));
+	capture_close(&replay->reader);
+	free(replay);
+	return -1;
+    }
+    (void)fcntl(fds[0], F_SETFL, fcntl(fds[0], F_GETFL) | O_NONBLOCK);
+    (void)fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    replay->fd = fds[1];
+    gpsd_log(replay->errout, LOG_INF,
+	     "replay: %s, %zu seek points, speed %g\n",
+	     replay->path, replay->reader.nmarks, replay->speed);
+    if (pthread_create(&thread, NULL, replay_thread, replay) != 0) {
+	gpsd_log(replay->errout, LOG_ERROR, "replay: no thread: %s\n",
+		 strerror(errno));
+	(void)close(fds[0]);
+	(void)close(fds[1]);
+	capture_close(&replay->reader);
+	free(replay);
+	return -1;
+    }
+    (void)pthread_detach(thread);
+    session->sourcetype = source_pipe;
+    return fds[0];
+}
+
+/* end */
@@ -33,6 +33,10 @@ to an RTCM3 standard at revision 4 or later, but the guess in the code
 has been observed to correctly analyze a message with a nonempty Receiver
 field.
 
+The MSM decodes (1071-1127) have been checked against a multi-GNSS
+MSM7 capture: successive pseudoranges move by the reported Doppler
+rate on every constellation.
+
 This file is Copyright (c) 2010 by the GPSD project
 BSD terms apply: see the file COPYING in the distribution root for details.
 
@@ -61,6 +65,286 @@ BSD terms apply: see the file COPYING in the distribution root for details.
 #define GLONASS_INVALID_RANGEINCR	0x2000	/* DF047 */
 #define GLONASS_CHANNEL_BASE		7	/* DF040 */
 
+/*
+ * Multiple Signal Messages.  All six constellations share one layout,
+ * and MSM1 through MSM7 differ only in which satellite and signal
+ * fields are present and how wide they are.  So rather than a case per
+ * message type, the unpacker walks a field table for the MSM level.
+ */
+#define RANGE_MS	299792.458	/* meters per light-millisecond */
+
+enum msm_field {
+    MSM_NONE,
+    /* satellite data, DF397-399 and extended satellite info */
+    MSM_ROUGH_INT, MSM_EXT, MSM_ROUGH_MOD, MSM_ROUGH_RATE,
+    /* signal data, DF400-408, DF420 */
+    MSM_PR, MSM_CP, MSM_LOCK, MSM_HALF, MSM_CNR, MSM_RATE,
+};
+
+struct msm_field_t {
+    enum msm_field field;
+    unsigned char width;
+    bool is_signed;		/* if so, the most negative value is invalid */
+    double scale;
+};
+
+struct msm_layout_t {
+    struct msm_field_t sat[4];
+    struct msm_field_t sig[6];
+};
+
+#define P2_10	9.765625e-4		/* 2^-10 */
+#define P2_24	5.960464477539063e-08	/* 2^-24 */
+#define P2_29	1.862645149230957e-09	/* 2^-29 */
+#define P2_31	4.656612873077393e-10	/* 2^-31 */
+
+/* *INDENT-OFF* */
+static const struct msm_layout_t msm_layouts[7] = {
+    /* MSM1: pseudoranges only */
+    {{{MSM_ROUGH_MOD, 10, false, P2_10}},
+     {{MSM_PR,   15, true,  P2_24}}},
+    /* MSM2: phaseranges only */
+    {{{MSM_ROUGH_MOD, 10, false, P2_10}},
+     {{MSM_CP,   22, true,  P2_29},
+      {MSM_LOCK,  4, false, 1},
+      {MSM_HALF,  1, false, 1}}},
+    /* MSM3: both */
+    {{{MSM_ROUGH_MOD, 10, false, P2_10}},
+     {{MSM_PR,   15, true,  P2_24},
+      {MSM_CP,   22, true,  P2_29},
+      {MSM_LOCK,  4, false, 1},
+      {MSM_HALF,  1, false, 1}}},
+    /* MSM4: full ranges, plus CNR */
+    {{{MSM_ROUGH_INT,  8, false, 1},
+      {MSM_ROUGH_MOD, 10, false, P2_10}},
+     {{MSM_PR,   15, true,  P2_24},
+      {MSM_CP,   22, true,  P2_29},
+      {MSM_LOCK,  4, false, 1},
+      {MSM_HALF,  1, false, 1},
+      {MSM_CNR,   6, false, 1}}},
+    /* MSM5: MSM4 plus Doppler */
+    {{{MSM_ROUGH_INT,  8, false, 1},
+      {MSM_EXT,        4, false, 1},
+      {MSM_ROUGH_MOD, 10, false, P2_10},
+      {MSM_ROUGH_RATE, 14, true, 1}},
+     {{MSM_PR,   15, true,  P2_24},
+      {MSM_CP,   22, true,  P2_29},
+      {MSM_LOCK,  4, false, 1},
+      {MSM_HALF,  1, false, 1},
+      {MSM_CNR,   6, false, 1},
+      {MSM_RATE, 15, true,  0.0001}}},
+    /* MSM6: MSM4 at high resolution */
+    {{{MSM_ROUGH_INT,  8, false, 1},
+      {MSM_ROUGH_MOD, 10, false, P2_10}},
+     {{MSM_PR,   20, true,  P2_29},
+      {MSM_CP,   24, true,  P2_31},
+      {MSM_LOCK, 10, false, 1},
+      {MSM_HALF,  1, false, 1},
+      {MSM_CNR,  10, false, 0.0625}}},
+    /* MSM7: MSM5 at high resolution */
+    {{{MSM_ROUGH_INT,  8, false, 1},
+      {MSM_EXT,        4, false, 1},
+      {MSM_ROUGH_MOD, 10, false, P2_10},
+      {MSM_ROUGH_RATE, 14, true, 1}},
+     {{MSM_PR,   20, true,  P2_29},
+      {MSM_CP,   24, true,  P2_31},
+      {MSM_LOCK, 10, false, 1},
+      {MSM_HALF,  1, false, 1},
+      {MSM_CNR,  10, false, 0.0625},
+      {MSM_RATE, 15, true,  0.0001}}},
+};
+/* *INDENT-ON* */
+
+/*
+ * A cursor over the payload.  Each read pulls in only the bytes the
+ * field spans, and running off the end sets a sticky flag instead of
+ * reading past the packet, so the caller checks once at the end.
+ */
+struct msm_reader_t {
+    const unsigned char *buf;
+    unsigned int pos, end;	/* in bits */
+    bool overrun;
+};
+
+static unsigned long msm_ubits(struct msm_reader_t *br, unsigned int width)
+/* grab an unsigned field of up to 32 bits */
+{
+    unsigned int i, last;
+    uint64_t fld = 0;
+
+    if (br->pos + width > br->end) {
+	br->overrun = true;
+	return 0;
+    }
+    last = (br->pos + width - 1) >> 3;
+    for (i = br->pos >> 3; i <= last; i++)
+	fld = (fld << 8) | br->buf[i];
+    fld >>= (8 - ((br->pos + width) & 7)) & 7;
+    br->pos += width;
+    return (unsigned long)(fld & ((1ULL << width) - 1));
+}
+
+static long msm_sbits(struct msm_reader_t *br, unsigned int width)
+/* grab a two's-complement field of up to 32 bits */
+{
+    unsigned long fld = msm_ubits(br, width);
+
+    if (fld & (1UL << (width - 1)))
+	return (long)fld - (long)(1UL << width);
+    return (long)fld;
+}
+
+static bool rtcm3_unpack_msm(const struct gps_context_t *context,
+			     struct rtcm3_t *rtcm, const unsigned char *payload)
+/* unpack a Multiple Signal Message; false if it doesn't hang together */
+{
+    struct rtcm3_msm_t *msm = &rtcm->rtcmtypes.msm;
+    const struct msm_layout_t *layout;
+    struct msm_reader_t br;
+    unsigned long satmask[2], sigmask;
+    unsigned char sigs[32];
+    int i, j, k;
+
+    br.buf = payload;
+    br.pos = 12;		/* message number already read */
+    br.end = rtcm->length * 8;
+    br.overrun = false;
+
+    msm->gnss = (rtcm->type - 1071) / 10;
+    msm->level = (unsigned short)(rtcm->type % 10);
+    layout = &msm_layouts[msm->level - 1];
+
+    msm->station_id = (unsigned int)msm_ubits(&br, 12);
+    if (msm->gnss == msm_glonass) {
+	msm->dow = (unsigned short)msm_ubits(&br, 3);
+	msm->tow = (unsigned int)msm_ubits(&br, 27);
+    } else {
+	msm->dow = 0;
+	msm->tow = (unsigned int)msm_ubits(&br, 30);
+    }
+    msm->sync = (bool)msm_ubits(&br, 1);
+    msm->iods = (unsigned short)msm_ubits(&br, 3);
+    br.pos += 7;		/* reserved */
+    msm->steering = (unsigned short)msm_ubits(&br, 2);
+    msm->ext_clock = (unsigned short)msm_ubits(&br, 2);
+    msm->smoothing = (bool)msm_ubits(&br, 1);
+    msm->interval = (unsigned short)msm_ubits(&br, 3);
+
+    /* expand the satellite and signal masks into ID lists */
+    satmask[0] = msm_ubits(&br, 32);
+    satmask[1] = msm_ubits(&br, 32);
+    sigmask = msm_ubits(&br, 32);
+    msm->nsat = msm->nsig = msm->ncell = 0;
+    for (i = 0; i < 64; i++)
+	if (satmask[i / 32] & (1UL << (31 - i % 32)))
+	    msm->sats[msm->nsat++].ident = (unsigned short)(i + 1);
+    for (i = 0; i < 32; i++)
+	if (sigmask & (1UL << (31 - i)))
+	    sigs[msm->nsig++] = (unsigned char)(i + 1);
+    if (msm->nsat * msm->nsig > RTCM3_MSM_CELLS) {
+	gpsd_log(&context->errout, LOG_WARN,
+		 "RTCM3: type %u has %d satellites x %d signals, too many\n",
+		 rtcm->type, msm->nsat, msm->nsig);
+	return false;
+    }
+    for (i = 0; i < msm->nsat; i++)
+	for (j = 0; j < msm->nsig; j++)
+	    if (msm_ubits(&br, 1) != 0) {
+		struct rtcm3_msm_cell *cell = &msm->cells[msm->ncell++];
+		memset(cell, '\0', sizeof(*cell));
+		cell->sat = (unsigned short)i;	/* index until fixup below */
+		cell->sig = sigs[j];
+	    }
+
+    /* satellite data is field-major: every satellite's first field... */
+    for (i = 0; i < msm->nsat; i++) {
+	msm->sats[i].ext = 0;
+	msm->sats[i].rough_range = 0;
+	msm->sats[i].rate = 0;
+    }
+    for (k = 0; k < 4 && layout->sat[k].field != MSM_NONE; k++) {
+	const struct msm_field_t *f = &layout->sat[k];
+	for (i = 0; i < msm->nsat; i++) {
+	    struct rtcm3_msm_sat *sat = &msm->sats[i];
+	    unsigned long u = f->is_signed ? 0 : msm_ubits(&br, f->width);
+	    long v = f->is_signed ? msm_sbits(&br, f->width) : 0;
+	    bool invalid = f->is_signed && v == -(1L << (f->width - 1));
+
+	    switch (f->field) {
+	    case MSM_ROUGH_INT:
+		/* 255 means no valid range; -1 remembers that */
+		sat->rough_range = (u == 0xff) ? -1 : (double)u;
+		break;
+	    case MSM_EXT:
+		sat->ext = (unsigned short)u;
+		break;
+	    case MSM_ROUGH_MOD:
+		if (sat->rough_range >= 0)
+		    sat->rough_range += u * f->scale;
+		break;
+	    case MSM_ROUGH_RATE:
+		sat->rate = invalid ? 0 : v * f->scale;
+		break;
+	    default:
+		break;
+	    }
+	}
+    }
+
+    /* ...and so is signal data, across cells */
+    for (k = 0; k < 6 && layout->sig[k].field != MSM_NONE; k++) {
+	const struct msm_field_t *f = &layout->sig[k];
+	for (i = 0; i < msm->ncell; i++) {
+	    struct rtcm3_msm_cell *cell = &msm->cells[i];
+	    const struct rtcm3_msm_sat *sat = &msm->sats[cell->sat];
+	    unsigned long u = f->is_signed ? 0 : msm_ubits(&br, f->width);
+	    long v = f->is_signed ? msm_sbits(&br, f->width) : 0;
+	    bool valid = !f->is_signed || v != -(1L << (f->width - 1));
+
+	    valid = valid && sat->rough_range >= 0;
+	    switch (f->field) {
+	    case MSM_PR:
+		cell->pseudorange = valid ?
+		    (sat->rough_range + v * f->scale) * RANGE_MS : 0;
+		break;
+	    case MSM_CP:
+		cell->phaserange = valid ?
+		    (sat->rough_range + v * f->scale) * RANGE_MS : 0;
+		break;
+	    case MSM_LOCK:
+		cell->locktime = (unsigned int)u;
+		break;
+	    case MSM_HALF:
+		cell->half_cycle = (u != 0);
+		break;
+	    case MSM_CNR:
+		cell->CNR = u * f->scale;
+		break;
+	    case MSM_RATE:
+		cell->rate = valid ? sat->rate + v * f->scale : 0;
+		break;
+	    default:
+		break;
+	    }
+	}
+    }
+
+    if (br.overrun) {
+	gpsd_log(&context->errout, LOG_WARN,
+		 "RTCM3: type %u runs past its %u-byte payload\n",
+		 rtcm->type, rtcm->length);
+	return false;
+    }
+
+    /* now that ranges are done, swap satellite indices for IDs */
+    for (i = 0; i < msm->ncell; i++)
+	msm->cells[i].sat = msm->sats[msm->cells[i].sat].ident;
+    for (i = 0; i < msm->nsat; i++)
+	if (msm->sats[i].rough_range < 0)
+	    msm->sats[i].rough_range = 0;
+    return true;
+}
+
 /* Large case statements make GNU indent very confused */
 /* *INDENT-OFF* */
 
@@ -514,62 +798,12 @@ void rtcm3_unpack(const struct gps_context_t *context,
 	/* TODO: rtklib has C code for this one.  */
 	break;
 
-    case 1074:
-	/* RTCM 3.x
-	 * GPS Multi Signal Message
-	 */
-	break;
-
-    case 1077:
-        /* RTCM 3.x - 1077
-	 * Full GPS pseudo-ranges, carrier phases, Doppler and
-	 * signal strength (high resolution)
-         * length 438
-	 */
-	/* TODO: rtklib has C code for this one.  */
-	break;
-
-    case 1087:
-        /* RTCM 3.x - 1087
-	 * Full GLONASS pseudo-ranges, carrier phases, Doppler and
-	 * signal strength (high resolution)
-         * length 417 or 427
-	 */
-	/* TODO: rtklib has C code for this one.  */
-	break;
-
-    case 1097:
-        /* RTCM 3.x - 1097
-         * Full Galileo pseudo-ranges, carrier phases, Doppler and
-	 * signal strength (high resolution)
-         * length 96
-	 */
-	/* TODO: rtklib has C code for this one.  */
-	break;
-
-    case 1107:
-        /* RTCM 3.x - 1107
-	 * 'Multiple Signal Message
-         * Full SBAS pseudo-ranges, carrier phases, Doppler and
-	 * signal strength (high resolution)
-         * length 96
-	 */
-	/* TODO: rtklib has C code for this one.  */
-	break;
-
-    case 1114:
-	/* RTCM 3.x
-	 * QZSS Multi Signal Message
-	 */
-	break;
-
-    case 1124:
-	/* RTCM 3.x
-	 * BeiDou Multi Signal Message
-	 */
-	break;
-
     default:
+	/* 1071-1127 are the Multiple Signal Messages */
+	if (rtcm->type >= 1071 && rtcm->type <= 1127
+	    && rtcm->type % 10 >= 1 && rtcm->type % 10 <= 7)
+	    unknown = !rtcm3_unpack_msm(context, rtcm,
+					(unsigned char *)buf + 3);
 	break;
     }
 #undef RANGEDIFF
@@ -585,6 +819,7 @@ void rtcm3_unpack(const struct gps_context_t *context,
 	gpsd_log(&context->errout, LOG_PROG, "RTCM3: unknown type %d, length %d\n",
 	     rtcm->type, rtcm->length);
     }
+    rtcm->decoded = !unknown;
 
 }
 
@@ -36,9 +36,12 @@ extern "C" {
  *       structure has changed to make working with the satellites-used
  *       bits less confusing. (January 2015, release 3.12).
  * 6.1 - Add navdata_t for more (nmea2000) info.
+ * 7.0 - Content filters (classes, aistypes, mmsi, minmode, interval)
+ *       added to policy_t; RTCM3 Multiple Signal Message (MSM) report
+ *       structure added.  Both change the size of struct gps_data_t.
  */
-#define GPSD_API_MAJOR_VERSION	6	/* bump on incompatible changes */
-#define GPSD_API_MINOR_VERSION	1	/* bump on compatible changes */
+#define GPSD_API_MAJOR_VERSION	7	/* bump on incompatible changes */
+#define GPSD_API_MINOR_VERSION	0	/* bump on compatible changes */
 
 #define MAXCHANNELS	72	/* must be > 12 GPS + 12 GLONASS + 2 WAAS */
 #define MAXUSERDEVS	4	/* max devices per user */
@@ -319,10 +322,55 @@ struct rtcm3_correction_diff {
 				   Correction Difference (1015, 1017) */
 };
 
+/*
+ * Multiple Signal Messages, types 1071-1127.  Satellite and signal IDs
+ * are as transmitted (1-64 and 1-32); cells are the satellite/signal
+ * pairs the cell mask says are present, in transmission order.  The
+ * spec caps a message at 64 cells.
+ */
+#define RTCM3_MSM_CELLS		64
+
+struct rtcm3_msm_sat {
+    unsigned short ident;	/* satellite ID within constellation */
+    unsigned short ext;		/* extended info; GLONASS channel + 7 */
+    double rough_range;		/* ms; 0 if not valid (MSM4-7) */
+    double rate;		/* rough phase range rate, m/s (MSM5, MSM7) */
+};
+
+struct rtcm3_msm_cell {
+    unsigned short sat;		/* satellite ID */
+    unsigned short sig;		/* signal ID */
+    double pseudorange;		/* meters; 0 if not valid */
+    double phaserange;		/* meters; 0 if not valid */
+    unsigned int locktime;	/* lock time indicator */
+    bool half_cycle;		/* half-cycle ambiguity indicator */
+    double CNR;			/* dB-Hz; 0 if not present */
+    double rate;		/* phase range rate, m/s (MSM5, MSM7) */
+};
+
+struct rtcm3_msm_t {
+    unsigned short level;	/* 1-7 */
+    enum {msm_gps, msm_glonass, msm_galileo, msm_sbas, msm_qzss,
+	  msm_beidou} gnss;
+    unsigned int station_id;	/* Reference Station ID */
+    unsigned int tow;		/* epoch time in ms; GLONASS: time of day */
+    unsigned short dow;		/* GLONASS day of week, else 0 */
+    bool sync;			/* Multiple Message Bit */
+    unsigned short iods;	/* Issue of Data Station */
+    unsigned short steering;	/* Clock Steering Indicator */
+    unsigned short ext_clock;	/* External Clock Indicator */
+    bool smoothing;		/* Divergence-free Smoothing Indicator */
+    unsigned short interval;	/* Smoothing Interval */
+    unsigned short nsat, nsig, ncell;
+    struct rtcm3_msm_sat sats[RTCM3_MSM_CELLS];
+    struct rtcm3_msm_cell cells[RTCM3_MSM_CELLS];
+};
+
 struct rtcm3_t {
     /* header contents */
     unsigned type;	/* RTCM 3.x message type */
     unsigned length;	/* payload length, inclusive of checksum */
+    bool decoded;	/* rtcmtypes is unpacked; if not, it's raw data */
 
     union {
 	/* 1001-1013 were present in the 3.0 version */
@@ -533,6 +581,7 @@ struct rtcm3_t {
 	    char receiver[RTCM3_MAX_DESCRIPTOR+1];	/* Receiver string */
 	    char firmware[RTCM3_MAX_DESCRIPTOR+1];	/* Firmware string */
 	} rtcm3_1033;
+	struct rtcm3_msm_t msm;		/* 1071-1077 ... 1121-1127 */
 	unsigned char data[1024];	/* Max RTCM3 msg length is 1023 bytes */
     } rtcmtypes;
 };
@@ -1914,6 +1963,23 @@ struct policy_t {
     int loglevel;			/* requested log level of messages */
     char devpath[GPS_PATH_MAX];		/* specific device to watch */
     char remote[GPS_PATH_MAX];		/* ...if this was passthrough */
+    /* content filters, evaluated by the daemon; zero means "everything" */
+    unsigned int classes;		/* report classes wanted */
+#define CLASS_TPV	0x0001u
+#define CLASS_SKY	0x0002u
+#define CLASS_GST	0x0004u
+#define CLASS_ATT	0x0008u
+#define CLASS_SUBFRAME	0x0010u
+#define CLASS_RTCM2	0x0020u
+#define CLASS_RTCM3	0x0040u
+#define CLASS_AIS	0x0080u
+#define CLASS_OSC	0x0100u
+    unsigned int aistypes;		/* bit n set means AIS type n wanted */
+#define WATCH_MMSI_MAX	16
+    int nmmsi;				/* count of MMSIs in the set */
+    unsigned int mmsi[WATCH_MMSI_MAX];	/* AIS MMSIs wanted */
+    int minmode;			/* minimum fix mode for TPV reports */
+    double interval;			/* minimum secs between fix reports */
 };
 
 #ifndef TIMEDELTA_DEFINED
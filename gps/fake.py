@@ -79,6 +79,7 @@ import select
 import signal
 import socket
 import stat
+import struct
 import subprocess
 import sys
 import termios  # fcntl, array, struct
@@ -118,6 +119,11 @@ WRITE_PAD_SLOWDOWN = 0.01
 # If a test takes longer than this, we deem it to have timed out
 TEST_TIMEOUT = 60
 
+# Packet captures written by gpsd -W; see capture.c for the layout
+CAPTURE_MAGIC = b"GPSDCAP1"
+CAPTURE_RECORD = struct.Struct("<BBHIq")
+CAPTURE_PACKET = 1
+
 
 def GetDelay(slow=False):
     "Get appropriate per-line delay."
@@ -143,8 +149,11 @@ class TestLoadError(TestError):
 class TestLoad(object):
     "Digest a logfile into a list of sentences we can cycle through."
 
-    def __init__(self, logfp, predump=False, slow=False, oneshot=False):
+    def __init__(self, logfp, predump=False, slow=False, oneshot=False,
+                 rate=1.0):
         self.sentences = []  # This is the interesting part
+        self.stamps = None   # Arrival times, for a capture
+        self.rate = rate
         if isinstance(logfp, str):
             logfp = open(logfp, "rb")
         self.name = logfp.name
@@ -157,6 +166,12 @@ class TestLoad(object):
         self.delimiter = None
         # Stash away a copy in case we need to resplit
         text = logfp.read()
+        if text.startswith(CAPTURE_MAGIC):
+            self.__load_capture(text)
+            if oneshot:
+                self.sentences.append(b"# EOF\n")
+                self.stamps.append(self.stamps[-1])
+            return
         logfp = open(logfp.name, 'rb')
         # Grab the packets in the normal way
         getter = sniffer.new()
@@ -231,6 +246,37 @@ class TestLoad(object):
             self.sentences.append(b"# EOF\n")
 
 
+    def __load_capture(self, text):
+        "Take the packets of the first device heard from a gpsd capture."
+        offset = len(CAPTURE_MAGIC)
+        device = ptype = None
+        self.stamps = []
+        while offset + CAPTURE_RECORD.size <= len(text):
+            (kind, pkind, dev, length, stamp) = \
+                CAPTURE_RECORD.unpack_from(text, offset)
+            if kind not in (1, 2, 3):
+                break       # the index trailer, or a torn record
+            offset += CAPTURE_RECORD.size
+            packet = text[offset:offset + length]
+            offset += length
+            if kind != CAPTURE_PACKET or len(packet) < length:
+                continue
+            if device is None:
+                (device, ptype) = (dev, pkind)
+            if dev == device:
+                if self.predump:
+                    print(repr(packet))
+                self.sentences.append(packet)
+                self.stamps.append(stamp / 1e9)
+        if not self.sentences:
+            raise TestLoadError("no packets in capture %s" % self.name)
+        self.textual = (ptype == sniffer.NMEA_PACKET)
+        if self.textual:
+            self.legend = "gpsfake: line %d: "
+        else:
+            self.legend = "gpsfake: packet %d"
+
+
 class PacketError(TestError):
     pass
 
@@ -242,6 +288,7 @@ class FakeGPS(object):
         self.go_predicate = lambda: True
         self.readers = 0
         self.index = 0
+        self.replay_start = None
         self.progress("gpsfake: %s provides %d sentences\n"
                       % (self.testload.name, len(self.testload.sentences)))
 
@@ -257,6 +304,19 @@ class FakeGPS(object):
             # Delay specified number of seconds
             delay = line.split()[1]
             time.sleep(int(delay))
+        stamps = self.testload.stamps
+        if stamps and self.testload.rate > 0:
+            # A capture goes at its recorded pace, scaled
+            i = self.index % len(stamps)
+            if i == 0:
+                self.replay_start = time.time()
+            due = self.replay_start + (stamps[i] - stamps[0]) \
+                / self.testload.rate
+            if due > time.time():
+                time.sleep(due - time.time())
+            self.write(line)
+            self.index += 1
+            return
         # self.write has to be set by the derived class
         self.write(line)
         time.sleep(self.testload.delay)
@@ -635,12 +695,13 @@ class TestSession(object):
         "Set a default go predicate for the session."
         self.default_predicate = pred
 
-    def gps_add(self, logfile, speed=19200, pred=None, oneshot=False):
+    def gps_add(self, logfile, speed=19200, pred=None, oneshot=False,
+                rate=1.0):
         "Add a simulated GPS being fed by the specified logfile."
         self.progress("gpsfake: gps_add(%s, %d)\n" % (logfile, speed))
         if logfile not in self.fakegpslist:
             testload = TestLoad(logfile, predump=self.predump, slow=self.slow,
-                                oneshot=oneshot)
+                                oneshot=oneshot, rate=rate)
             if testload.sourcetype == "UDP" or self.udp:
                 newgps = FakeUDP(testload, ipaddr="127.0.0.1",
                                  port=freeport(socket.SOCK_DGRAM),
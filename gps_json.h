@@ -26,6 +26,7 @@ void json_att_dump(const struct gps_data_t *, char *, size_t);
 void json_oscillator_dump(const struct gps_data_t *, char *, size_t);
 void json_subframe_dump(const struct gps_data_t *, char buf[], size_t);
 void json_device_dump(const struct gps_device_t *, char *, size_t);
+extern const struct json_enum_t json_class_names[];
 void json_watch_dump(const struct policy_t *, char *, size_t);
 int json_watch_read(const char *, struct policy_t *,
 		    const char **);
@@ -679,7 +679,7 @@ int main(int argc, char **argv)
 	    for (hunting = true; hunting; )
 	    {
 		fd_set efds;
-		switch(gpsd_await_data(&rfds, &efds, maxfd, &all_fds, &context.errout))
+		switch(gpsd_await_data(&rfds, &efds, maxfd, &all_fds, NULL, NULL, &context.errout))
 		{
 		case AWAIT_GOT_INPUT:
 		    break;
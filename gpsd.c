@@ -24,8 +24,12 @@
 #include <sys/types.h>
 #include <sys/time.h>		/* for select() */
 #include <sys/select.h>
+#include <sys/mman.h>		/* for mlockall() */
+#include <sys/resource.h>	/* for setrlimit() */
+#include <sched.h>		/* for sched_get_priority_min() */
 #include <stdio.h>
 #include <stdint.h>		/* for uint32_t, etc. */
+#include <limits.h>		/* for CHAR_BIT */
 #include <time.h>
 #include <string.h>
 #include <stdlib.h>
@@ -106,6 +110,13 @@
 #define COMMAND_TIMEOUT		60*15
 #define NOREAD_TIMEOUT		60*3
 #define RELEASE_TIMEOUT		60
+/*
+ * Correction sinks that are behind sit in the select write set, so we
+ * wake when they have room.  Look in at least this often anyway, so a
+ * caster client that stops reading gets hung up on once its sink has
+ * made no progress for NOREAD_TIMEOUT seconds.
+ */
+#define RELAY_STALL_CHECK	1
 #define DEVICE_REAWAKE		0.01
 #define DEVICE_RECONNECT	2
 
@@ -159,6 +170,9 @@ static bool nowait = false;
 #define NOWAIT true
 #endif /* FORCE_NOWAIT */
 static bool batteryRTC = false;
+#ifdef PPS_ENABLE
+static bool lock_memory = false;
+#endif /* PPS_ENABLE */
 static jmp_buf restartbuf;
 static struct gps_context_t context;
 #if defined(SYSTEMD_ENABLE)
@@ -233,22 +247,49 @@ static void typelist(void)
 static void usage(void)
 {
     (void)printf("usage: gpsd [-b] [-D n] [-F sockfile] [-G] [-h] [-n] [-N] [-P pidfile] [-S port] device...\n\
-  Options include: \n\
-  -b		     	    = bluetooth-safe: open data sources read-only\n\
-  -D integer (default 0)    = set debug level \n\
+  Options include: \n"
+#ifdef PPS_ENABLE
+"  -A cpulist		    = pin PPS threads to CPUs, or 'isolated'\n"
+#endif /* PPS_ENABLE */
+#ifndef FIXED_PORT_SPEED
+"  -B file		    = remember devices' line settings in file\n"
+#endif /* FIXED_PORT_SPEED */
+"  -b		     	    = bluetooth-safe: open data sources read-only\n"
+#if defined(NTPSHM_ENABLE) && defined(PPS_ENABLE)
+"  -C file		    = keep learned fix-time offsets in file\n"
+#endif /* defined(NTPSHM_ENABLE) && defined(PPS_ENABLE) */
+"  -D integer (default 0)    = set debug level \n\
   -F sockfile		    = specify control socket location\n"
 #ifndef FORCE_GLOBAL_ENABLE
 "  -G         		    = make gpsd listen on INADDR_ANY\n"
 #endif /* FORCE_GLOBAL_ENABLE */
 "  -h		     	    = help message \n"
+#ifdef PPS_ENABLE
+"  -L			    = lock the daemon's memory so it is never paged\n"
+#endif /* PPS_ENABLE */
 #ifndef FORCE_NOWAIT
 "  -n			    = don't wait for client connects to poll GPS\n"
 #endif /* FORCE_NOWAIT */
 "  -N			    = don't go into background\n\
   -P pidfile	      	    = set file to record process ID\n\
-  -r               	    = use GPS time even if no fix\n\
-  -S integer (default %s) = set port for daemon \n\
-  -V			    = emit version and exit.\n"
+  -r               	    = use GPS time even if no fix\n"
+#ifdef PPS_ENABLE
+"  -R priority		    = run PPS threads SCHED_FIFO at priority\n"
+#endif /* PPS_ENABLE */
+"\
+  -S integer (default %s) = set port for daemon \n"
+#if defined(NTPSHM_ENABLE) && defined(PPS_ENABLE)
+"  -T			    = time fixes with learned offsets, not fudges\n"
+#endif /* defined(NTPSHM_ENABLE) && defined(PPS_ENABLE) */
+#ifdef NTPSHM_ENABLE
+"  -U device=unit[,unit]	    = put device's time, and PPS, on these NTP units\n"
+#endif /* NTPSHM_ENABLE */
+"\
+  -V			    = emit version and exit.\n\
+  -W file		    = record every packet, with arrival times, to file\n"
+#ifdef PPS_ENABLE
+"  -Y offset[,jitter]	    = simulated PPS on pty test devices, in usec\n"
+#endif /* PPS_ENABLE */
 #ifdef NETFEED_ENABLE
 "A device may be a local serial device for GPS input, or a URL in one \n\
 of the following forms:\n\
@@ -256,6 +297,7 @@ of the following forms:\n\
      udp://host[:port]\n\
      {dgpsip|ntrip}://[user:passwd@]host[:port][/stream]\n\
      gpsd://host[:port][/device][?protocol]\n\
+     replay://capture[?speed=N][&device=N][&skip=seconds]\n\
 in which case it specifies an input source for device, DGPS or ntrip data.\n"
 #endif /* NETFEED_ENABLE */
 "\n\
@@ -264,6 +306,54 @@ The following driver types are compiled into this gpsd instance:\n",
     typelist();
 }
 
+#ifdef PPS_ENABLE
+static unsigned long cpu_list(const char *list)
+/* CPU mask from a list like "2,5-7", or the kernel's isolated CPUs */
+{
+    char buf[BUFSIZ];
+    unsigned long mask = 0;
+    char *next;
+
+    if (strcmp(list, "isolated") == 0) {
+	/* cores kept free of other work by the isolcpus= boot option */
+	FILE *fp = fopen("/sys/devices/system/cpu/isolated", "r");
+
+	buf[0] = '\0';
+	if (fp != NULL) {
+	    if (fgets(buf, sizeof(buf), fp) == NULL)
+		buf[0] = '\0';
+	    (void)fclose(fp);
+	}
+	if (buf[0] == '\0' || buf[0] == '\n')
+	    gpsd_log(&context.errout, LOG_WARN,
+		     "PPS: no isolated CPUs, not pinning PPS threads\n");
+    } else
+	(void)strlcpy(buf, list, sizeof(buf));
+
+    for (next = buf; *next != '\0' && !isspace((unsigned char)*next);) {
+	long lo = strtol(next, &next, 10), hi = lo;
+
+	if (*next == '-')
+	    hi = strtol(next + 1, &next, 10);
+	if (lo < 0 || hi < lo || hi >= (long)(sizeof(mask) * CHAR_BIT)) {
+	    gpsd_log(&context.errout, LOG_ERROR,
+		     "PPS: bad CPU list '%s'\n", list);
+	    return 0;
+	}
+	for (; lo <= hi; lo++)
+	    mask |= 1UL << lo;
+	if (*next == ',')
+	    next++;
+	else if (*next != '\0' && !isspace((unsigned char)*next)) {
+	    gpsd_log(&context.errout, LOG_ERROR,
+		     "PPS: bad CPU list '%s'\n", list);
+	    return 0;
+	}
+    }
+    return mask;
+}
+#endif /* PPS_ENABLE */
+
 #ifdef CONTROL_SOCKET_ENABLE
 static socket_t filesock(char *filename)
 {
@@ -515,12 +605,29 @@ static int passivesocks(char *service, char *tcp_or_udp,
 }
 /* *INDENT-ON* */
 
+/*
+ * Report classes subject to the WATCH interval option.  These are the
+ * ones that come around every cycle on high-rate devices.  A report
+ * suppressed inside the interval is remembered as held, along with a
+ * snapshot of the device state as of that complete report, and the
+ * most recent snapshot is shipped when the interval expires.  So a
+ * decimated watcher always gets the latest complete value rather than
+ * the first one in each window, and never a half-updated mid-cycle one.
+ */
+#define DECIMATED	3
+static const gps_mask_t decimated[DECIMATED] = {
+    REPORT_IS, SATELLITE_SET, ATTITUDE_SET,
+};
+
 struct subscriber_t
 {
     int fd;			/* client file descriptor. -1 if unused */
     time_t active;		/* when subscriber last polled for data */
     struct policy_t policy;	/* configurable bits */
     pthread_mutex_t mutex;	/* serialize access to fd */
+    timestamp_t reported[MAX_DEVICES][DECIMATED];	/* last shipments */
+    gps_mask_t held[MAX_DEVICES];	/* decimated reports awaiting flush */
+    bool relay;			/* fd is a raw RTCM stream, see rtcmrelay.c */
 };
 
 #define subscribed(sub, devp)    (sub->policy.watcher && (sub->policy.devpath[0]=='\0' || strcmp(sub->policy.devpath, devp->gpsdata.dev.path)==0))
@@ -564,6 +671,10 @@ static void detach_client(struct subscriber_t *sub)
 	return;
     }
     c_ip = netlib_sock2ip(sub->fd);
+    if (sub->relay) {
+	rtcm_relay_forget(NULL, sub->fd);
+	sub->relay = false;
+    }
     (void)shutdown(sub->fd, SHUT_RDWR);
     gpsd_log(&context.errout, LOG_SPIN,
 	     "close(%d) in detach_client()\n",
@@ -583,10 +694,25 @@ static void detach_client(struct subscriber_t *sub)
     sub->policy.timing = false;
     sub->policy.split24 = false;
     sub->policy.devpath[0] = '\0';
+    sub->policy.classes = 0;
+    sub->policy.aistypes = 0;
+    sub->policy.nmmsi = 0;
+    sub->policy.minmode = 0;
+    sub->policy.interval = 0;
+    memset(sub->reported, 0, sizeof(sub->reported));
+    memset(sub->held, 0, sizeof(sub->held));
     sub->fd = UNALLOCATED_FD;
     unlock_subscriber(sub);
 }
 
+static void relay_stream(struct subscriber_t *sub)
+/* turn a client into a raw correction stream, which must carry no JSON */
+{
+    sub->policy.watcher = false;
+    memset(sub->held, 0, sizeof(sub->held));
+    sub->relay = true;
+}
+
 static ssize_t throttled_write(struct subscriber_t *sub, char *buf,
 			       size_t len)
 /* write to client -- throttle if it's gone or we're close to buffer overrun */
@@ -675,6 +801,7 @@ static void deactivate_device(struct gps_device_t *device)
     if (!BAD_SOCKET(device->gpsdata.gps_fd)) {
 	FD_CLR(device->gpsdata.gps_fd, &all_fds);
 	adjust_max_fd(device->gpsdata.gps_fd, false);
+	rtcm_relay_forget(device, device->gpsdata.gps_fd);
 #ifdef NTPSHM_ENABLE
 	ntpshm_link_deactivate(device);
 #endif /* NTPSHM_ENABLE */
@@ -1357,6 +1484,111 @@ static void handle_request(struct subscriber_t *sub,
 	}
 	str_rstrip_char(reply, ',');
 	(void)strlcat(reply, "]}\r\n", replylen);
+    } else if (str_starts_with(buf, "RELAY")
+	       && (buf[5] == ';' || buf[5] == '=')) {
+	buf += 5;
+	if (*buf == ';') {
+	    ++buf;
+	} else {
+	    char path[GPS_PATH_MAX];
+	    bool stream;
+	    int ntypes;
+	    unsigned int types[RELAY_TYPES_MAX];
+	    /* *INDENT-OFF* */
+	    const struct json_attr_t relay_attrs[] = {
+		{"class",  t_check,   .dflt.check = "RELAY"},
+		{"device", t_string,  .addr.string = path,
+				         .len = sizeof(path)},
+		{"stream", t_boolean, .addr.boolean = &stream,
+				         .dflt.boolean = false},
+		{"types",  t_array,
+		    .addr.array.element_type = t_uinteger,
+		    .addr.array.arr.uintegers.store = types,
+		    .addr.array.count = &ntypes,
+		    .addr.array.maxlen = RELAY_TYPES_MAX},
+		{NULL},
+	    };
+	    /* *INDENT-ON* */
+	    int status;
+
+	    path[0] = '\0';
+	    ntypes = 0;
+	    status = json_read_object(buf + 1, relay_attrs, &end);
+	    if (end == NULL)
+		buf += strlen(buf);
+	    else {
+		if (*end == ';')
+		    ++end;
+		buf = end;
+	    }
+	    if (status != 0) {
+		(void)snprintf(reply, replylen,
+			       "{\"class\":\"ERROR\",\"message\":\"Invalid RELAY: %s\"}\r\n",
+			       json_error_string(status));
+		gpsd_log(&context.errout, LOG_ERROR, "response: %s\n", reply);
+		goto bailout;
+	    } else if (stream) {
+		/* this connection becomes a raw correction stream */
+		if (rtcm_relay_client(sub->fd, types, ntypes) == NULL) {
+		    (void)strlcpy(reply,
+				  "{\"class\":\"ERROR\",\"message\":\"No free relay slot\"}\r\n",
+				  replylen);
+		    goto bailout;
+		}
+		relay_stream(sub);
+		/* no reply, as it would land in the binary stream */
+		buf += strlen(buf);
+		goto bailout;
+	    } else if (path[0] != '\0') {
+		struct relay_sink_t *sink;
+		devp = find_device(path);
+		if (devp == NULL || devp->device_type == NULL
+		    || devp->device_type->rtcm_writer == NULL
+		    || (sink = rtcm_relay_rover(devp)) == NULL) {
+		    (void)snprintf(reply, replylen,
+				   "{\"class\":\"ERROR\",\"message\":\"Can't relay to %s\"}\r\n",
+				   path);
+		    gpsd_log(&context.errout, LOG_ERROR,
+			     "response: %s\n", reply);
+		    goto bailout;
+		}
+		rtcm_relay_filter(sink, types, ntypes);
+	    }
+	}
+	rtcm_relay_dump(reply, replylen);
+#ifdef NETFEED_ENABLE
+    } else if (str_starts_with(buf, "DGNSS;")) {
+	buf += 6;
+	(void)strlcpy(reply, "{\"class\":\"DGNSS\",\"sources\":[", replylen);
+	for (devp = devices; devp < devices + MAX_DEVICES; devp++)
+	    if (allocated_device(devp)
+		&& (devp->servicetype == service_ntrip
+		    || devp->servicetype == service_dgpsip))
+		netgnss_dump(devp, reply, replylen);
+	str_rstrip_char(reply, ',');
+	(void)strlcat(reply, "]}\r\n", replylen);
+#endif /* NETFEED_ENABLE */
+#if defined(NTPSHM_ENABLE) && defined(PPS_ENABLE)
+    } else if (str_starts_with(buf, "STATS;")) {
+	buf += 6;
+	(void)strlcpy(reply, "{\"class\":\"STATS\",\"pps\":[", replylen);
+	for (devp = devices; devp < devices + MAX_DEVICES; devp++)
+	    if (allocated_device(devp))
+		pps_stats_dump(devp, reply, replylen);
+	str_rstrip_char(reply, ',');
+	(void)strlcat(reply, "]}\r\n", replylen);
+#endif /* NTPSHM_ENABLE && PPS_ENABLE */
+#ifdef TIMING_ENABLE
+    } else if (str_starts_with(buf, "LATENCY;")) {
+	buf += 8;
+	(void)strlcpy(reply, "{\"class\":\"LATENCY\",\"devices\":[",
+		      replylen);
+	for (devp = devices; devp < devices + MAX_DEVICES; devp++)
+	    if (allocated_device(devp))
+		gpsd_latency_dump(devp, reply, replylen);
+	str_rstrip_char(reply, ',');
+	(void)strlcat(reply, "]}\r\n", replylen);
+#endif /* TIMING_ENABLE */
     } else if (str_starts_with(buf, "VERSION;")) {
 	buf += 8;
 	json_version_dump(reply, replylen);
@@ -1417,6 +1649,94 @@ static void raw_report(struct subscriber_t *sub, struct gps_device_t *device)
 #endif /* BINARY_ENABLE */
 }
 
+/* last complete report of each decimated class, shared by all watchers */
+static struct gps_data_t held_data[MAX_DEVICES][DECIMATED];
+static gps_mask_t held_fresh[MAX_DEVICES];	/* snapshots taken this report */
+
+static gps_mask_t content_filter(struct subscriber_t *sub,
+				 struct gps_device_t *device,
+				 gps_mask_t changed)
+/* apply a subscriber's WATCH content filters to a report mask */
+{
+    /* *INDENT-OFF* */
+    static const struct {
+	unsigned int class;
+	gps_mask_t mask;
+    } class_masks[] = {
+	{CLASS_TPV,	 REPORT_IS},
+	{CLASS_SKY,	 SATELLITE_SET},
+	{CLASS_GST,	 GST_SET},
+	{CLASS_ATT,	 ATTITUDE_SET},
+	{CLASS_SUBFRAME, SUBFRAME_SET},
+	{CLASS_RTCM2,	 RTCM2_SET},
+	{CLASS_RTCM3,	 RTCM3_SET},
+	{CLASS_AIS,	 AIS_SET},
+	{CLASS_OSC,	 OSCILLATOR_SET},
+    };
+    /* *INDENT-ON* */
+    const struct policy_t *pp = &sub->policy;
+    int i;
+
+    if (pp->classes != 0)
+	for (i = 0; i < NITEMS(class_masks); i++)
+	    if ((pp->classes & class_masks[i].class) == 0)
+		changed &= ~class_masks[i].mask;
+
+    if ((changed & REPORT_IS) != 0 && device->gpsdata.fix.mode < pp->minmode)
+	changed &= ~REPORT_IS;
+
+#ifdef AIVDM_ENABLE
+    if ((changed & AIS_SET) != 0) {
+	const struct ais_t *ais = &device->gpsdata.ais;
+	if (pp->aistypes != 0
+	    && (ais->type > 31 || (pp->aistypes & (1u << ais->type)) == 0))
+	    changed &= ~AIS_SET;
+	else if (pp->nmmsi > 0) {
+	    for (i = 0; i < pp->nmmsi; i++)
+		if (pp->mmsi[i] == ais->mmsi)
+		    break;
+	    if (i == pp->nmmsi)
+		changed &= ~AIS_SET;
+	}
+    }
+#endif /* AIVDM_ENABLE */
+
+    return changed;
+}
+
+static gps_mask_t filter_report(struct subscriber_t *sub,
+				struct gps_device_t *device,
+				gps_mask_t changed)
+/* apply content filters, then the WATCH interval, to a report mask */
+{
+    const struct policy_t *pp = &sub->policy;
+    int i;
+
+    changed = content_filter(sub, device, changed);
+
+    if (pp->interval > 0 && (changed & (REPORT_IS|SATELLITE_SET|ATTITUDE_SET)) != 0) {
+	int d = (int)(device - devices);
+	timestamp_t now = timestamp();
+	for (i = 0; i < DECIMATED; i++)
+	    if ((changed & decimated[i]) != 0) {
+		if (now - sub->reported[d][i] < pp->interval) {
+		    /* too soon; hold it for flush_held_reports() */
+		    changed &= ~decimated[i];
+		    sub->held[d] |= decimated[i];
+		    if ((held_fresh[d] & decimated[i]) == 0) {
+			held_data[d][i] = device->gpsdata;
+			held_fresh[d] |= decimated[i];
+		    }
+		} else {
+		    sub->reported[d][i] = now;
+		    sub->held[d] &= ~decimated[i];
+		}
+	    }
+    }
+
+    return changed;
+}
+
 static void pseudonmea_report(struct subscriber_t *sub,
 			  gps_mask_t changed,
 			  struct gps_device_t *device)
@@ -1460,6 +1780,78 @@ static void pseudonmea_report(struct subscriber_t *sub,
 #endif /* AIVDM_ENABLE */
     }
 }
+
+static double flush_held_reports(void)
+/* ship held decimated reports whose interval has run out */
+{
+    struct subscriber_t *sub;
+    double wait = -1;
+    timestamp_t now = timestamp();
+
+    for (sub = subscribers; sub < subscribers + MAX_CLIENTS; sub++) {
+	int d, i;
+
+	if (sub->fd == UNALLOCATED_FD || !sub->policy.watcher)
+	    continue;
+	for (d = 0; d < MAX_DEVICES; d++) {
+	    struct gps_device_t *device = &devices[d];
+	    gps_mask_t due = 0;
+
+	    if (sub->held[d] == 0)
+		continue;
+	    if (!allocated_device(device) || !subscribed(sub, device)
+		|| sub->policy.interval <= 0) {
+		sub->held[d] = 0;
+		continue;
+	    }
+	    for (i = 0; i < DECIMATED; i++) {
+		double left;
+
+		if ((sub->held[d] & decimated[i]) == 0)
+		    continue;
+		left = sub->reported[d][i] + sub->policy.interval - now;
+		if (left <= 0) {
+		    due |= decimated[i];
+		    sub->reported[d][i] = now;
+		} else if (wait < 0 || left < wait)
+		    wait = left;
+	    }
+	    if (due == 0)
+		continue;
+	    sub->held[d] &= ~due;
+
+	    /*
+	     * The live device state may be mid-cycle, so each class is
+	     * reported from its snapshot, swapped in for the duration.
+	     * The policy may have changed since the hold, so the
+	     * content filters are run again against the snapshot.
+	     */
+	    for (i = 0; i < DECIMATED; i++) {
+		static struct gps_data_t live;
+		gps_mask_t wanted;
+
+		if ((due & decimated[i]) == 0)
+		    continue;
+		live = device->gpsdata;
+		device->gpsdata = held_data[d][i];
+		wanted = content_filter(sub, device, decimated[i]);
+		if (wanted != 0 && sub->policy.nmea)
+		    pseudonmea_report(sub, wanted, device);
+		if (wanted != 0 && sub->policy.json) {
+		    char buf[GPS_JSON_RESPONSE_MAX * 4];
+
+		    json_data_report(wanted, device, &sub->policy,
+				     buf, sizeof(buf));
+		    if (buf[0] != '\0')
+			(void)throttled_write(sub, buf, strlen(buf));
+		}
+		device->gpsdata = live;
+	    }
+	}
+    }
+
+    return wait;
+}
 #endif /* SOCKET_EXPORT_ENABLE */
 
 static void all_reports(struct gps_device_t *device, gps_mask_t changed)
@@ -1468,6 +1860,9 @@ static void all_reports(struct gps_device_t *device, gps_mask_t changed)
 #ifdef SOCKET_EXPORT_ENABLE
     struct subscriber_t *sub;
 
+    /* snapshots held from earlier reports stay; new holds retake them */
+    held_fresh[device - devices] = 0;
+
     /* add any just-identified device to watcher lists */
     if ((changed & DRIVER_IS) != 0) {
 	bool listeners = false;
@@ -1498,7 +1893,9 @@ static void all_reports(struct gps_device_t *device, gps_mask_t changed)
 #endif /* SOCKET_EXPORT_ENABLE */
 
     /*
-     * If the device provided an RTCM packet, repeat it to all devices.
+     * If the device provided an RTCM packet, queue it for every rover
+     * and caster client.  The actual writes happen in the main loop,
+     * so a slow rover can't hold up the rest of the daemon.
      */
     if ((changed & RTCM2_SET) != 0 || (changed & RTCM3_SET) != 0) {
 	if ((changed & RTCM2_SET) != 0
@@ -1513,24 +1910,27 @@ static void all_reports(struct gps_device_t *device, gps_mask_t changed)
 		     device->lexer.outbuflen);
 	} else {
 	    struct gps_device_t *dp;
+	    const unsigned char *frame = device->lexer.outbuffer;
+	    unsigned int type;
+
+	    /* RTCM3 carries its message number right after the header */
+	    if ((changed & RTCM3_SET) != 0)
+		type = ((unsigned int)frame[3] << 4) | (frame[4] >> 4);
+	    else
+		type = device->gpsdata.rtcm2.type;
+
+	    /* keep the rover list in step with driver identification */
 	    for (dp = devices; dp < devices+MAX_DEVICES; dp++) {
-		if (allocated_device(dp)) {
-/* *INDENT-OFF* */
-		    if (dp->device_type->rtcm_writer != NULL) {
-			if (dp->device_type->rtcm_writer(dp,
-							     (const char *)device->lexer.outbuffer,
-							     device->lexer.outbuflen) == 0)
-			    gpsd_log(&context.errout, LOG_ERROR,
-				     "Write to RTCM sink failed\n");
-			else {
-			    gpsd_log(&context.errout, LOG_IO,
-				     "<= DGPS: %zd bytes of RTCM relayed.\n",
-				     device->lexer.outbuflen);
-			}
-		    }
-/* *INDENT-ON* */
-		}
+		if (!allocated_device(dp) || dp == device)
+		    continue;
+		if (dp->device_type != NULL
+		    && dp->device_type->rtcm_writer != NULL)
+		    (void)rtcm_relay_rover(dp);
+		else
+		    rtcm_relay_forget(dp, dp->gpsdata.gps_fd);
 	    }
+	    rtcm_relay_put(&context, device, type,
+			   frame, device->lexer.outbuflen);
 	}
     }
 
@@ -1571,6 +1971,10 @@ static void all_reports(struct gps_device_t *device, gps_mask_t changed)
 	ntp_latch(device, &td);
 
 #if defined(PPS_ENABLE)
+#ifdef NTPSHM_ENABLE
+	fixoffset_update(device, &td);
+#endif /* NTPSHM_ENABLE */
+
 	/* propagate this in-band-time to all PPS-only devices */
 	for (ppsonly = devices; ppsonly < devices + MAX_DEVICES; ppsonly++)
 	    if (ppsonly->sourcetype == source_pps)
@@ -1653,7 +2057,10 @@ static void all_reports(struct gps_device_t *device, gps_mask_t changed)
 
 	/* some listeners may be in watcher mode */
 	if (sub->policy.watcher) {
-	    if (changed & DATA_IS) {
+	    /* content filters run before any serialization */
+	    gps_mask_t wanted = filter_report(sub, device, changed);
+
+	    if (wanted & DATA_IS) {
 		/* guard keeps mask dumper from eating CPU */
 		if (context.errout.debug >= LOG_PROG)
 		    gpsd_log(&context.errout, LOG_PROG,
@@ -1665,23 +2072,32 @@ static void all_reports(struct gps_device_t *device, gps_mask_t changed)
 			     "time to report a fix\n");
 
 		if (sub->policy.nmea)
-		    pseudonmea_report(sub, changed, device);
+		    pseudonmea_report(sub, wanted, device);
 
 		if (sub->policy.json)
 		{
 		    char buf[GPS_JSON_RESPONSE_MAX * 4];
 
-		    if ((changed & AIS_SET) != 0)
+		    if ((wanted & AIS_SET) != 0)
 			if (device->gpsdata.ais.type == 24
 			    && device->gpsdata.ais.type24.part != both
 			    && !sub->policy.split24)
 			    continue;
 
-		    json_data_report(changed,
+		    json_data_report(wanted,
 				     device, &sub->policy,
 				     buf, sizeof(buf));
-		    if (buf[0] != '\0')
+#ifdef TIMING_ENABLE
+		    if ((wanted & REPORT_IS) != 0)
+			gpsd_latency_mark(device, LAT_REPORT);
+#endif /* TIMING_ENABLE */
+		    if (buf[0] != '\0') {
 			(void)throttled_write(sub, buf, strlen(buf));
+#ifdef TIMING_ENABLE
+			if ((wanted & REPORT_IS) != 0)
+			    gpsd_latency_mark(device, LAT_SEND);
+#endif /* TIMING_ENABLE */
+		    }
 
 		}
 	    }
@@ -1697,7 +2113,49 @@ static int handle_gpsd_request(struct subscriber_t *sub, const char *buf)
     char reply[GPS_JSON_RESPONSE_MAX + 1];
 
     reply[0] = '\0';
-    if (buf[0] == '?') {
+    if (str_starts_with(buf, "GET /")) {
+	/*
+	 * An NTRIP 1.0 rover asking us for corrections.  The mountpoint
+	 * RTCM is everything we relay; otherwise it names the message
+	 * types wanted, e.g. GET /1005,1077,1087.  As with any caster,
+	 * asking for no mountpoint or one we don't have gets the
+	 * sourcetable, after which the connection is closed.
+	 */
+	char mount[BUFSIZ];
+	unsigned int types[RELAY_TYPES_MAX];
+	int ntypes;
+
+	(void)strlcpy(mount, buf + 5, sizeof(mount));
+	mount[strcspn(mount, " \r\n")] = '\0';
+	if (strcmp(mount, "RTCM") == 0)
+	    ntypes = 0;
+	else if (mount[0] == '\0'
+		 || (ntypes = rtcm_relay_types(mount, types,
+					       RELAY_TYPES_MAX)) < 0) {
+	    static const char str[] =
+		"STR;RTCM;gpsd;RTCM;;0;;gpsd;;0.00;0.00;0;0;gpsd;none;N;N;0;\r\n"
+		"ENDSOURCETABLE\r\n";
+
+	    gpsd_log(&context.errout, LOG_INF,
+		     "client(%d) asked for unknown mountpoint /%s\n",
+		     sub_index(sub), mount);
+	    (void)snprintf(reply, sizeof(reply),
+			   "SOURCETABLE 200 OK\r\n"
+			   "Server: gpsd/%s\r\n"
+			   "Content-Type: text/plain\r\n"
+			   "Content-Length: %zu\r\n\r\n%s",
+			   VERSION, sizeof(str) - 1, str);
+	    (void)throttled_write(sub, reply, strlen(reply));
+	    return -1;
+	}
+	if (rtcm_relay_client(sub->fd, types, ntypes) == NULL)
+	    (void)strlcpy(reply, "HTTP/1.0 503 Service Unavailable\r\n\r\n", sizeof(reply));
+	else {
+	    /* the OK goes out before the sink can be written */
+	    (void)strlcpy(reply, "ICY 200 OK\r\n\r\n", sizeof(reply));
+	    relay_stream(sub);
+	}
+    } else if (buf[0] == '?') {
 	const char *end;
 	for (end = buf; *buf != '\0'; buf = end)
 	    if (isspace((unsigned char) *buf))
@@ -1712,6 +2170,11 @@ static int handle_gpsd_request(struct subscriber_t *sub, const char *buf)
 #endif /* SOCKET_EXPORT_ENABLE */
 
 #if defined(CONTROL_SOCKET_ENABLE) && defined(PPS_ENABLE) && defined(SOCKET_EXPORT_ENABLE)
+#define PPS_STATS_PERIOD	60	/* seconds between STATS to PPS watchers */
+
+/* PPS threads poke this so the main loop reports their edges promptly */
+static int pps_wakeup[2] = {-1, -1};
+
 static void ship_pps_message(struct gps_device_t *session,
 				   struct timedelta_t *td)
 /* on PPS interrupt, ship a message to all clients */
@@ -1738,6 +2201,72 @@ static void ship_pps_message(struct gps_device_t *session,
      */
     session->gpsdata.online = timestamp();
 }
+
+static void wake_for_pps(struct gps_device_t *session UNUSED,
+			 struct timedelta_t *td UNUSED)
+/* runs in a PPS thread: get the main loop to look at the edge rings */
+{
+    if (pps_wakeup[1] >= 0)
+	ignore_return(write(pps_wakeup[1], "", 1));
+}
+
+static void ship_pps_edges(void)
+/* report each accepted edge the PPS threads have seen since last time */
+{
+    struct gps_device_t *device;
+    char drain[64];
+
+    if (pps_wakeup[0] >= 0)
+	while (read(pps_wakeup[0], drain, sizeof(drain)) > 0)
+	    continue;
+    for (device = devices; device < devices + MAX_DEVICES; device++) {
+	struct pps_edge_t edge;
+	unsigned long lost;
+
+	if (!allocated_device(device))
+	    continue;
+	lost = device->pps_cursor.lost;
+	while (pps_thread_next(&device->pps_thread, &device->pps_cursor,
+			       &edge) > 0) {
+	    if (edge.td.real.tv_sec == 0)
+		continue;
+	    ship_pps_message(device, &edge.td);
+#ifdef NTPSHM_ENABLE
+	    holdover_edge(device, &edge.td);
+	    if (edge.td.real.tv_sec % PPS_STATS_PERIOD == 0) {
+		/* what ?STATS would say, so watchers needn't poll */
+		char buf[BUFSIZ];
+
+		(void)strlcpy(buf, "{\"class\":\"STATS\",\"pps\":[",
+			      sizeof(buf));
+		pps_stats_dump(device, buf, sizeof(buf));
+		str_rstrip_char(buf, ',');
+		(void)strlcat(buf, "]}\r\n", sizeof(buf));
+		notify_watchers(device, false, true, "%s", buf);
+	    }
+#endif /* NTPSHM_ENABLE */
+	}
+	if (device->pps_cursor.lost != lost)
+	    gpsd_log(&context.errout, LOG_WARN,
+		     "PPS:%s %lu edges overwritten before they were reported\n",
+		     device->gpsdata.dev.path, device->pps_cursor.lost - lost);
+#ifdef NTPSHM_ENABLE
+	{
+	    struct timedelta_t td;
+	    int precision;
+
+	    /* the edge that didn't come, as the holdover model has it */
+	    if (holdover_tick(device, &td, &precision))
+		notify_watchers(device, true, true,
+				"{\"class\":\"PPS\",\"device\":\"%s\",\"real_sec\":%ld, \"real_nsec\":%ld,\"clock_sec\":%ld,\"clock_nsec\":%ld,\"precision\":%d,\"holdover\":true}\r\n",
+				device->gpsdata.dev.path,
+				td.real.tv_sec, td.real.tv_nsec,
+				td.clock.tv_sec, td.clock.tv_nsec,
+				precision);
+	}
+#endif /* NTPSHM_ENABLE */
+    }
+}
 #endif
 
 
@@ -1837,6 +2366,10 @@ static void gpsd_terminate(struct gps_context_t *context CONDITIONALLY_UNUSED)
     }
 #ifdef PPS_ENABLE
     context->pps_hook = NULL;	/* tell any PPS-watcher thread to die */
+#ifdef NTPSHM_ENABLE
+    if (context->fixcal_path != NULL)
+	fixoffset_save(context, devices, MAX_DEVICES);
+#endif /* NTPSHM_ENABLE */
 #endif /* PPS_ENABLE */
 }
 
@@ -1866,17 +2399,20 @@ int main(int argc, char *argv[])
     bool device_opened = false;
     bool go_background = true;
     volatile bool in_restart;
+#if defined(NTPSHM_ENABLE) && defined(PPS_ENABLE)
+    static time_t fixcal_saved;
+#endif /* defined(NTPSHM_ENABLE) && defined(PPS_ENABLE) */
 
     gps_context_init(&context, "gpsd");
 
 #ifdef CONTROL_SOCKET_ENABLE
     INVALIDATE_SOCKET(csock);
 #if defined(PPS_ENABLE) && defined(SOCKET_EXPORT_ENABLE)
-    context.pps_hook = ship_pps_message;
+    context.pps_hook = wake_for_pps;
 #endif /* PPS_ENABLE && SOCKET_EXPORT_ENABLE */
 #endif /* CONTROL_SOCKET_ENABLE */
 
-    while ((option = getopt(argc, argv, "F:D:S:bGhlNnrP:V")) != -1) {
+    while ((option = getopt(argc, argv, "A:B:C:F:D:S:bGhlLNnrP:R:TU:VW:Y:")) != -1) {
 	switch (option) {
 	case 'D':
 	    context.errout.debug = (int)strtol(optarg, 0, 0);
@@ -1892,6 +2428,11 @@ int main(int argc, char *argv[])
 	case 'N':
 	    go_background = false;
 	    break;
+#ifndef FIXED_PORT_SPEED
+	case 'B':
+	    context.speedcache_path = optarg;
+	    break;
+#endif /* FIXED_PORT_SPEED */
 	case 'b':
 	    context.readonly = true;
 	    break;
@@ -1916,12 +2457,72 @@ int main(int argc, char *argv[])
 	case 'r':
 	    batteryRTC = true;
 	    break;
+#ifdef PPS_ENABLE
+	case 'A':
+	    context.pps_cpus = cpu_list(optarg);
+	    break;
+	case 'L':
+	    lock_memory = true;
+	    break;
+	case 'R':
+	    context.pps_priority = (int)strtol(optarg, 0, 0);
+	    if (context.pps_priority < sched_get_priority_min(SCHED_FIFO)
+		|| context.pps_priority > sched_get_priority_max(SCHED_FIFO)) {
+		gpsd_log(&context.errout, LOG_ERROR,
+			 "PPS: SCHED_FIFO priority must be %d to %d\n",
+			 sched_get_priority_min(SCHED_FIFO),
+			 sched_get_priority_max(SCHED_FIFO));
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+	case 'Y':
+	    {
+		char *end;
+		long offset = strtol(optarg, &end, 10), jitter = 0;
+
+		if (*end == ',')
+		    jitter = strtol(end + 1, &end, 10);
+		if (*end != '\0' || offset < 0 || offset >= 1000000
+		    || jitter < 0 || jitter >= 1000000) {
+		    gpsd_log(&context.errout, LOG_ERROR,
+			     "-Y wants offset[,jitter], microseconds under 1s\n");
+		    exit(EXIT_FAILURE);
+		}
+		context.pps_simulate = true;
+		context.pps_sim_offset = offset * 1000;
+		context.pps_sim_jitter = jitter * 1000;
+	    }
+	    break;
+#endif /* PPS_ENABLE */
 	case 'P':
 	    pid_file = optarg;
 	    break;
+#if defined(NTPSHM_ENABLE) && defined(PPS_ENABLE)
+	case 'C':
+	    context.fixcal_path = optarg;
+	    break;
+	case 'T':
+	    context.fixoffset_apply = true;
+	    break;
+#endif /* defined(NTPSHM_ENABLE) && defined(PPS_ENABLE) */
+#ifdef NTPSHM_ENABLE
+	case 'U':
+	    if (!ntpshm_map(&context, optarg)) {
+		gpsd_log(&context.errout, LOG_ERROR,
+			 "bad or too many NTP unit mappings at '%s'\n",
+			 optarg);
+		exit(EXIT_FAILURE);
+	    }
+	    break;
+#endif /* NTPSHM_ENABLE */
 	case 'V':
 	    (void)printf("%s: %s (revision %s)\n", argv[0], VERSION, REVISION);
 	    exit(EXIT_SUCCESS);
+	case 'W':
+	    /* opened now, so a relative path means what the user meant */
+	    if (!capture_start(&context.errout, optarg))
+		exit(EXIT_FAILURE);
+	    break;
 	case 'h':
 	case '?':
 	default:
@@ -2056,7 +2657,46 @@ int main(int argc, char *argv[])
      * to use segments 0 and 1.
      */
     (void)ntpshm_context_init(&context);
+#ifdef PPS_ENABLE
+    if (context.fixcal_path != NULL && !fixoffset_load(&context))
+	gpsd_log(&context.errout, LOG_WARN,
+		 "NTP: can't read fix offsets from %s: %s\n",
+		 context.fixcal_path, strerror(errno));
+    fixcal_saved = time(NULL);
+#endif /* PPS_ENABLE */
 #endif /* NTPSHM_ENABLE */
+#ifndef FIXED_PORT_SPEED
+    if (context.speedcache_path != NULL && !gpsd_speedcache_load(&context))
+	gpsd_log(&context.errout, LOG_WARN,
+		 "SER: can't read sync settings from %s: %s\n",
+		 context.speedcache_path, strerror(errno));
+#endif /* FIXED_PORT_SPEED */
+
+#ifdef PPS_ENABLE
+    /* page faults would land in the middle of PPS timestamping */
+    if (lock_memory && mlockall(MCL_CURRENT | MCL_FUTURE) != 0)
+	gpsd_log(&context.errout, LOG_WARN,
+		 "PPS: mlockall() failed, errno %s\n", strerror(errno));
+    if (0 == getuid()) {
+	/*
+	 * Hotplugged devices start their PPS threads after we drop
+	 * privileges; raising these limits now lets them still have
+	 * the scheduling, and locked memory, asked for.
+	 */
+	struct rlimit rl;
+
+#ifdef RLIMIT_RTPRIO
+	if (context.pps_priority > 0) {
+	    rl.rlim_cur = rl.rlim_max = (rlim_t)context.pps_priority;
+	    (void)setrlimit(RLIMIT_RTPRIO, &rl);
+	}
+#endif /* RLIMIT_RTPRIO */
+	if (lock_memory) {
+	    rl.rlim_cur = rl.rlim_max = RLIM_INFINITY;
+	    (void)setrlimit(RLIMIT_MEMLOCK, &rl);
+	}
+    }
+#endif /* PPS_ENABLE */
 
 #if defined(DBUS_EXPORT_ENABLE)
     /* we need to connect to dbus as root */
@@ -2203,10 +2843,25 @@ int main(int argc, char *argv[])
 #ifdef CONTROL_SOCKET_ENABLE
     FD_ZERO(&control_fds);
 #endif /* CONTROL_SOCKET_ENABLE */
+#if defined(CONTROL_SOCKET_ENABLE) && defined(PPS_ENABLE) && defined(SOCKET_EXPORT_ENABLE)
+    /* PPS threads must never block on us, so both ends are non-blocking */
+    if (pps_wakeup[0] < 0 && pipe(pps_wakeup) == 0) {
+	(void)fcntl(pps_wakeup[0], F_SETFL,
+		    fcntl(pps_wakeup[0], F_GETFL) | O_NONBLOCK);
+	(void)fcntl(pps_wakeup[1], F_SETFL,
+		    fcntl(pps_wakeup[1], F_GETFL) | O_NONBLOCK);
+    }
+    if (pps_wakeup[0] >= 0) {
+	FD_SET(pps_wakeup[0], &all_fds);
+	adjust_max_fd(pps_wakeup[0], true);
+    }
+#endif
 
     /* initialize the GPS context's time fields */
     gpsd_time_init(&context, time(NULL));
 
+    rtcm_relay_init();
+
     /*
      * If we got here via SIGINT, reopen any command-line devices. PPS
      * through these won't work, as we've dropped privileges and can
@@ -2222,9 +2877,57 @@ int main(int argc, char *argv[])
 	}
 
     while (0 == signalled) {
-	fd_set efds;
+	fd_set efds, wfds;
+	struct timespec flushtime, *timeout = NULL;
+	double wait = -1;
+	bool backlog;
+
+	/* push queued corrections; sinks still behind wait for room */
+	FD_ZERO(&wfds);
+	if ((backlog = rtcm_relay_service(&context, &wfds)))
+	    wait = RELAY_STALL_CHECK;
+#ifdef SOCKET_EXPORT_ENABLE
+	{
+	    /* wake up in time to ship reports held by WATCH interval */
+	    double held = flush_held_reports();
+	    if (held >= 0 && (wait < 0 || held < wait))
+		wait = held;
+	}
+#endif /* SOCKET_EXPORT_ENABLE */
+#ifdef NETFEED_ENABLE
+	/* network DGNSS connects, retries and reports run on timers */
+	for (device = devices; device < devices + MAX_DEVICES; device++) {
+	    bool listen;
+	    double next;
 
-	switch(gpsd_await_data(&rfds, &efds, maxfd, &all_fds, &context.errout))
+	    if (!allocated_device(device)
+		|| device->gpsdata.gps_fd < 0
+		|| (device->servicetype != service_ntrip
+		    && device->servicetype != service_dgpsip))
+		continue;
+	    next = netgnss_service(device, &listen);
+	    if (next >= 0 && (wait < 0 || next < wait))
+		wait = next;
+	    if (device->gpsdata.gps_fd < 0)
+		continue;
+	    if (listen && !FD_ISSET(device->gpsdata.gps_fd, &all_fds)) {
+		FD_SET(device->gpsdata.gps_fd, &all_fds);
+		adjust_max_fd(device->gpsdata.gps_fd, true);
+	    } else if (!listen && FD_ISSET(device->gpsdata.gps_fd, &all_fds)) {
+		FD_CLR(device->gpsdata.gps_fd, &all_fds);
+		adjust_max_fd(device->gpsdata.gps_fd, false);
+	    }
+	}
+#endif /* NETFEED_ENABLE */
+	if (wait >= 0) {
+	    flushtime.tv_sec = (time_t)wait;
+	    flushtime.tv_nsec = (long)((wait - flushtime.tv_sec) * 1e9);
+	    timeout = &flushtime;
+	}
+
+	switch(gpsd_await_data(&rfds, &efds, maxfd, &all_fds,
+			       backlog ? &wfds : NULL, timeout,
+			       &context.errout))
 	{
 	case AWAIT_GOT_INPUT:
 	    break;
@@ -2246,6 +2949,19 @@ int main(int argc, char *argv[])
 	    exit(EXIT_FAILURE);
 	}
 
+#if defined(CONTROL_SOCKET_ENABLE) && defined(PPS_ENABLE) && defined(SOCKET_EXPORT_ENABLE)
+	/* PPS edges go out ahead of anything else */
+	ship_pps_edges();
+#endif
+
+#if defined(NTPSHM_ENABLE) && defined(PPS_ENABLE)
+	if (context.fixcal_path != NULL
+	    && time(NULL) - fixcal_saved >= FIXCAL_PERIOD) {
+	    fixoffset_save(&context, devices, MAX_DEVICES);
+	    fixcal_saved = time(NULL);
+	}
+#endif /* defined(NTPSHM_ENABLE) && defined(PPS_ENABLE) */
+
 #ifdef SOCKET_EXPORT_ENABLE
 	/* always be open to new client connections */
 	for (i = 0; i < AFCOUNT; i++) {
@@ -2411,13 +3127,24 @@ int main(int argc, char *argv[])
 		     * COMMAND_TIMEOUT useful.
 		     */
 		    sub->active = time(NULL);
-		    if (handle_gpsd_request(sub, buf) < 0)
+		    /* relay streams ignore anything the client sends */
+		    if (!sub->relay && handle_gpsd_request(sub, buf) < 0)
 			detach_client(sub);
 		}
 	    } else {
 		unlock_subscriber(sub);
 
-		if (!sub->policy.watcher
+		if (sub->relay) {
+		    /* relay streams never talk, so watch their reading */
+		    time_t stalled = rtcm_relay_stalled(sub->fd);
+		    if (stalled < 0 || stalled > NOREAD_TIMEOUT) {
+			gpsd_log(&context.errout, LOG_WARN,
+				 "relay client(%d) %s.\n",
+				 sub_index(sub),
+				 stalled < 0 ? "lost its sink" : "stalled");
+			detach_client(sub);
+		    }
+		} else if (!sub->policy.watcher
 		    && time(NULL) - sub->active > COMMAND_TIMEOUT) {
 		    gpsd_log(&context.errout, LOG_WARN,
 			     "client(%d) timed out on command wait.\n",
@@ -2520,6 +3247,7 @@ int main(int argc, char *argv[])
 	     "received terminating signal %d.\n", (int)signalled);
 shutdown:
     gpsd_terminate(&context);
+    capture_stop();
 
     gpsd_log(&context.errout, LOG_WARN, "exiting.\n");
 
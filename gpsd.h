@@ -50,9 +50,15 @@ extern "C" {
  * 3.11 A precision field, log2 of the time source jitter, has been added
  *      to the PPS report.  See ntpshm.h for more details.
  * 3.12 OSC message added to repertoire.
+ * 3.13 WATCH gains content filters: classes, aistypes, mmsi, minmode
+ *      and interval.
+ * 3.14 RELAY command added for correction fan-out to rovers and clients.
+ * 3.15 DGNSS command added to report network correction source state.
+ * 3.16 STATS command added to report PPS thread statistics.
+ * 3.17 LATENCY command added to report per-stage fix report latency.
  */
 #define GPSD_PROTO_MAJOR_VERSION	3	/* bump on incompatible changes */
-#define GPSD_PROTO_MINOR_VERSION	12	/* bump on compatible changes */
+#define GPSD_PROTO_MINOR_VERSION	17	/* bump on compatible changes */
 
 #define JSON_DATE_MAX	24	/* ISO8601 timestamp with 2 decimal places */
 
@@ -60,6 +66,10 @@ extern "C" {
 #define DEFAULT_GPSD_SOCKET	"/var/run/gpsd.sock"
 #endif
 
+#ifndef DEFAULT_GPSD_CACHE
+#define DEFAULT_GPSD_CACHE	"/var/cache/gpsd"	/* GPSD_CACHE_DIR overrides */
+#endif
+
 /* Some internal capabilities depend on which drivers we're compiling. */
 #if !defined(AIVDM_ENABLE) && defined(NMEA2000_ENABLE)
 #define AIVDM_ENABLE
@@ -107,7 +117,7 @@ enum isgpsstat_t {
 
 #define RTCM_MAX	(RTCM2_WORDS_MAX * sizeof(isgps30bits_t))
 /* RTCM is more variable length than RTCM 2 */
-#define RTCM3_MAX	512
+#define RTCM3_MAX	1029	/* 3 header + 1023 payload + 3 CRC */
 
 /*
  * The packet buffers need to be as long than the longest packet we
@@ -142,6 +152,8 @@ struct gpsd_errout_t {
     char *label;
 };
 
+#define LEXER_STAMPS	32	/* reads remembered for first-byte stamps */
+
 struct gps_lexer_t {
     /* packet-getter internals */
     int	type;
@@ -186,9 +198,28 @@ struct gps_lexer_t {
     unsigned long retry_counter;	/* count sniff retries */
     unsigned counter;			/* packets since last driver switch */
     struct gpsd_errout_t errout;		/* how to report errors */
+    /* when recent reads completed, so packets can be stamped by the
+     * arrival of their first byte rather than by when they were parsed */
+    unsigned long recv_counter;		/* bytes read so far */
+    struct {
+	unsigned long end;		/* recv_counter after this read */
+	struct timespec at;		/* when it completed */
+    } stamps[LEXER_STAMPS];
+    unsigned int stamp_next;		/* oldest, next to be overwritten */
+    bool kernel_stamps;			/* socket, take SO_TIMESTAMPNS times */
+    const unsigned char *map;		/* input in memory instead of fd */
+    size_t maplen, mapoff;		/* its size, and how much is taken */
+    struct timespec first_stamp;	/* read of last packet's first byte */
+    size_t first_lag;			/* bytes in that read after it */
+    /* what losing and regaining sync on a noisy line has cost */
+    unsigned long discarded;		/* bytes thrown away */
+    unsigned long resyncs;		/* times sync was lost */
+    bool hunting;			/* discarding since the last packet */
 #ifdef TIMING_ENABLE
     timestamp_t start_time;		/* timestamp of first input */
     unsigned long start_char;		/* char counter at first input */
+    struct timespec mono_read;		/* first byte of last packet read */
+    struct timespec mono_packet;	/* last packet complete */
 #endif /* TIMING_ENABLE */
     /*
      * ISGPS200 decoding context.
@@ -224,6 +255,7 @@ extern void packet_reset(struct gps_lexer_t *);
 extern void packet_pushback(struct gps_lexer_t *);
 extern void packet_parse(struct gps_lexer_t *);
 extern ssize_t packet_get(int, struct gps_lexer_t *);
+extern void packet_map(struct gps_lexer_t *, const unsigned char *, size_t);
 extern int packet_sniff(struct gps_lexer_t *);
 #define packet_buffered_input(lexer) ((lexer)->inbuffer + (lexer)->inbuflen - (lexer)->inbufptr)
 
@@ -237,8 +269,12 @@ extern int packet_sniff(struct gps_lexer_t *);
 /* this is where we choose the confidence level to use in reports */
 #define GPSD_CONFIDENCE	CEP95_SIGMA
 
-#define NTPSHMSEGS	(MAX_DEVICES * 2)	/* number of NTP SHM segments */
+#define NTPSHMSEGS	256	/* NTP SHM units we may use, NTP0 to NTP255 */
+#define NTPSHM_PREALLOC	(MAX_DEVICES * 2)	/* units attached at startup */
 #define NTP_MIN_FIXES	3  /* # fixes to wait for before shipping NTP time */
+#define FIXCAL_MAX	(MAX_DEVICES * 4)	/* learned offsets remembered */
+#define FIXCAL_PERIOD	600	/* seconds between saves of them */
+#define SPEEDCACHE_MAX	(MAX_DEVICES * 4)	/* sync settings remembered */
 
 
 #define AIVDM_CHANNELS	2		/* A, B */
@@ -272,11 +308,39 @@ struct gps_context_t {
     /* we need the volatile here to tell the C compiler not to
      * 'optimize' as 'dead code' the writes to SHM */
     volatile struct shmTime *shmTime[NTPSHMSEGS];
+    volatile struct shmTimeX *shmTimeX[NTPSHMSEGS];	/* extended format */
     bool shmTimeInuse[NTPSHMSEGS];
+    struct {
+	char path[GPS_PATH_MAX];	/* device this mapping is for */
+	int clock, pps;			/* units it gets, -1 for any */
+    } shmUnits[MAX_DEVICES];		/* fixed units set with -U */
 #endif /* NTPSHM_ENABLE */
 #ifdef PPS_ENABLE
     void (*pps_hook)(struct gps_device_t *, struct timedelta_t *);
+    int pps_priority;			/* SCHED_FIFO priority for PPS threads */
+    unsigned long pps_cpus;		/* CPU mask for PPS threads, 0 = any */
+    bool pps_simulate;			/* timer PPS on pty test devices, -Y */
+    long pps_sim_offset, pps_sim_jitter;	/* ns, for simulated edges */
+    bool fixoffset_apply;		/* learned offsets replace fudges */
+    const char *fixcal_path;		/* where learned offsets persist */
+    struct {
+	char path[GPS_PATH_MAX];	/* device */
+	unsigned int baudrate;		/* speed the offset holds at */
+	long long offset;		/* nanoseconds */
+	unsigned long samples;		/* how many went into it */
+    } fixcal[FIXCAL_MAX];
 #endif /* PPS_ENABLE */
+#ifndef FIXED_PORT_SPEED
+    const char *speedcache_path;	/* where sync settings persist */
+    bool speedcache_dirty;		/* times changed since the last save */
+    struct {
+	char path[GPS_PATH_MAX];	/* device; empty if the slot is free */
+	unsigned int baudrate;		/* line settings it last synced at */
+	char parity;
+	unsigned int stopbits;
+	time_t when;			/* so the stalest is dropped first */
+    } speedcache[SPEEDCACHE_MAX];
+#endif /* FIXED_PORT_SPEED */
 #ifdef SHM_EXPORT_ENABLE
     /* we don't want the compiler to treat writes to shmexport as dead code,
      * and we don't want them reordered either */
@@ -428,6 +492,9 @@ typedef enum {service_unknown,
 	      service_ntrip,
 } servicetype_t;
 
+#define NTRIP_LINE_MAX	1024	/* longest sourcetable line we accept */
+#define NETGNSS_OUTBUF	1024	/* room for one request or a few reports */
+
 /*
  * Private state information about an NTRIP stream.
  */
@@ -463,10 +530,115 @@ struct ntrip_stream_t
     int bitrate;
 };
 
+#ifdef TIMING_ENABLE
+#include "histogram.h"
+
+/*
+ * Stages of a fix report's trip through the daemon, timed on
+ * CLOCK_MONOTONIC: the read that brought in the first byte of the
+ * reporting packet, that packet complete, the driver done parsing it,
+ * the first client's TPV built, and the write of it returning.
+ */
+#define LAT_READ	0
+#define LAT_PACKET	1
+#define LAT_PARSE	2
+#define LAT_REPORT	3
+#define LAT_SEND	4
+#define LAT_STAGES	5
+
+struct latency_t {
+    struct timespec mark[LAT_STAGES];	/* zero until reached */
+    struct histogram_t stage[LAT_STAGES];	/* ns from the stage before;
+						 * [LAT_READ] is end to end */
+};
+#endif /* TIMING_ENABLE */
+
 #ifdef PPS_ENABLE
+#include <pthread.h>
 #include "ppsthread.h"
+#include "histogram.h"
+
+#define CHRONY_QUEUE	8	/* samples held while chronyd isn't reading */
+
+#define FIXOFFSET_WINDOW	64	/* seconds of latency the median is over */
+#define FIXOFFSET_MIN		16	/* samples before an estimate is trusted */
+#define FIXOFFSET_GAIN		8	/* inverse EWMA gain on the medians */
+
+#define HOLDOVER_POINTS		240	/* minutes of PPS offset history */
+#define HOLDOVER_MIN		10	/* minutes of it before holdover works */
+#define HOLDOVER_MAX		300	/* longest PPS outage bridged, seconds */
+
+/*
+ * Trend of GPS time less the unsteered clock (CLOCK_MONOTONIC_RAW where
+ * there is one), to stand in for PPS while it's gone.  Offsets are kept
+ * from base, whole seconds taken at the first edge, so that they stay
+ * small enough for doubles to hold to the nanosecond.
+ */
+struct holdover_t {
+    struct {
+	time_t when;			/* middle of the minute */
+	double offset;			/* mean over the minute, seconds */
+    } points[HOLDOVER_POINTS];
+    int next, count;
+    time_t base;			/* GPS time - raw clock, seconds */
+    time_t minute;			/* the minute being accumulated */
+    double sum;
+    int edges;
+    /* least-squares fit: offset(t) = intercept + slope * (t - tref) */
+    bool valid;
+    time_t tref;			/* newest point's time */
+    double tbar;			/* mean point time, from tref */
+    double intercept, slope, sxx, residual;
+    time_t last_edge;			/* second of the last real edge */
+    time_t last_hint;			/* last second we stood in for */
+    unsigned long hints;
+};
+
+/* learned delay from a PPS edge to the arrival of the fix naming it */
+struct fixoffset_t {
+    long long window[FIXOFFSET_WINDOW];	/* recent latencies, ns */
+    unsigned int next, count;
+    unsigned int baudrate;		/* what they were measured at */
+    unsigned long samples;		/* since the estimate began */
+    bool valid;
+    long long offset;			/* the estimate, ns */
+};
+
+/* a PPS sample bound for chronyd, at full precision */
+struct chrony_sample_t {
+    unsigned long seq;		/* counts every sample offered */
+    struct timedelta_t td;	/* GPS & system time of the edge */
+    int leap;			/* leap second notification */
+    int precision;		/* log2 seconds, as in the PPS report */
+};
+
+/* our side of the chrony SOCK refclock connection, kept under ntp_lock */
+struct chrony_t {
+    char path[GPS_PATH_MAX];	/* chronyd's socket */
+    time_t retry;		/* earliest time to try reconnecting */
+    unsigned long seq, sent, deferred, dropped, reconnects;
+    int head, count;		/* samples waiting in queue */
+    struct chrony_sample_t queue[CHRONY_QUEUE];
+};
 #endif /* PPS_ENABLE */
 
+#ifndef FIXED_PORT_SPEED
+/*
+ * What the characters read at one hunt setting say about the line: how
+ * fast they come when it's busy, and how many fail framing or parity.
+ */
+struct autobaud_t {
+    timestamp_t last;			/* when the last read returned */
+    double busy;			/* seconds between back-to-back reads */
+    unsigned long paced;		/* characters those reads brought */
+    unsigned long chars;		/* all characters read at the setting */
+    bool icount;			/* the UART counts errors for us */
+    long rx0, errors0;			/* its counts when the setting began */
+    unsigned int tried;			/* bitmask of hunt rates tried */
+    bool cached;			/* on remembered settings, tried once */
+};
+#endif /* FIXED_PORT_SPEED */
+
 struct gps_device_t {
 /* session object, encapsulates all global state */
     struct gps_data_t gpsdata;
@@ -485,6 +657,7 @@ struct gps_device_t {
 #endif
 #ifndef FIXED_PORT_SPEED
     unsigned int baudindex;
+    struct autobaud_t autobaud;
 #endif /* FIXED_PORT_SPEED */
     int saved_baud;
     struct gps_lexer_t lexer;
@@ -492,25 +665,43 @@ struct gps_device_t {
     int subframe_count;
     char subtype[64];			/* firmware version or subtype ID */
     time_t opentime;
+    timestamp_t huntstart;		/* when sync was sought; 0 once locked */
+    unsigned int huntspeeds;		/* speed changes while seeking it */
     time_t releasetime;
     bool zerokill;
     time_t reawake;
 #ifdef TIMING_ENABLE
     timestamp_t sor;	/* timestamp start of this reporting cycle */
     unsigned long chars;	/* characters in the cycle */
+    struct latency_t latency;	/* of fix reports, main thread only */
+    struct histogram_t locktime;	/* ns from opening to sync, per open */
 #endif /* TIMING_ENABLE */
 #ifdef NTP_ENABLE
     bool ship_to_ntpd;
 #ifdef NTPSHM_ENABLE
     volatile struct shmTime *shm_clock;
+    volatile struct shmTimeX *shmx_clock;
 #endif /* NTPSHM_ENABLE */
 # ifdef PPS_ENABLE
     volatile struct shmTime *shm_pps;
+    volatile struct shmTimeX *shmx_pps;
     int chronyfd;			/* for talking to chrony */
+    struct chrony_t chrony;		/* written under ntp_lock */
+    /* held by whoever writes shm_pps or chrony: the PPS thread's report
+     * hook, or the main thread standing in for a missing edge */
+    pthread_mutex_t ntp_lock;
+    time_t pps_shipped;			/* last real edge sent, under ntp_lock */
 # endif /* PPS_ENABLE */
 #endif /* NTP_ENABLE */
 #ifdef PPS_ENABLE
     volatile struct pps_thread_t pps_thread;
+    struct pps_cursor_t pps_cursor;	/* main loop's place in the edge ring */
+    /* written by the PPS thread's report hook, all in nanoseconds */
+    volatile struct histogram_t pps_offset;	/* GPS time - system time */
+    volatile struct histogram_t pps_latency;	/* edge to NTP/chrony report */
+    volatile struct histogram_t pps_fixdelta;	/* in-band fix to edge */
+    struct fixoffset_t fixoffset;	/* main thread only */
+    struct holdover_t holdover;		/* main thread only */
 #endif /* PPS_ENABLE */
     double mag_var;			/* magnetic variation in degrees */
     bool back_to_nmea;			/* back to NMEA on revert? */
@@ -738,9 +929,29 @@ struct gps_device_t {
 	    ntrip_conn_established,
 	    ntrip_conn_err
 	} conn_state; 	/* connection state for multi stage connect */
-	bool works;		/* marks a working connection, so we try to reconnect once */
 	bool sourcetable_parse;	/* have we read the sourcetable header? */
+	bool cached;		/* stream details came from the disk cache */
+	FILE *cache;		/* sourcetable being saved to disk, if any */
+	char buf[NTRIP_LINE_MAX];	/* unparsed tail of the last read */
+	size_t buflen;
     } ntrip;
+    /*
+     * Connection bookkeeping shared by the network DGNSS services.  Like
+     * the ntrip block this is not zeroed on activation, so the counters
+     * and the reconnect schedule survive a dropped connection.
+     */
+    struct {
+	bool connecting;	/* non-blocking connect() in progress */
+	struct addrinfo *addrs;	/* server's addresses, while connecting */
+	struct addrinfo *addr;	/* the one being tried */
+	timestamp_t started;	/* when the current attempt began */
+	timestamp_t up;		/* when the stream was last established */
+	timestamp_t retry;	/* if nonzero, time of the next attempt */
+	double backoff;		/* current reconnect delay, seconds */
+	char out[NETGNSS_OUTBUF];	/* requests and reports not yet sent */
+	size_t outlen;
+	unsigned long connects, failures, reports, dropped;
+    } netgnss;
     /* State of a DGPSIP connection */
     struct {
 	bool reported;
@@ -813,6 +1024,17 @@ extern void netgnss_report(struct gps_context_t *,
 			 struct gps_device_t *,
 			 struct gps_device_t *);
 extern void netgnss_autoconnect(struct gps_context_t *, double, double);
+extern socket_t netgnss_connect(struct gps_device_t *,
+				const char *, const char *);
+extern bool netgnss_send(struct gps_device_t *, const char *, size_t);
+extern void netgnss_established(struct gps_device_t *);
+extern void netgnss_fail(struct gps_device_t *);
+extern bool netgnss_eof(const struct gps_device_t *);
+extern bool netgnss_streaming(const struct gps_device_t *);
+extern int netgnss_advance(struct gps_device_t *);
+extern double netgnss_service(struct gps_device_t *, bool *);
+extern void netgnss_close(struct gps_device_t *);
+extern void netgnss_dump(const struct gps_device_t *, char *, size_t);
 
 extern int dgpsip_open(struct gps_device_t *, const char *);
 extern void dgpsip_report(struct gps_context_t *,
@@ -821,6 +1043,7 @@ extern void dgpsip_report(struct gps_context_t *,
 extern void dgpsip_autoconnect(struct gps_context_t *,
 			       double, double, const char *);
 extern int ntrip_open(struct gps_device_t *, char *);
+extern void ntrip_close(struct gps_device_t *);
 extern void ntrip_report(struct gps_context_t *,
 			 struct gps_device_t *,
 			 struct gps_device_t *);
@@ -831,6 +1054,15 @@ extern bool gpsd_set_raw(struct gps_device_t *);
 extern ssize_t gpsd_serial_write(struct gps_device_t *,
 				 const char *, const size_t);
 extern bool gpsd_next_hunt_setting(struct gps_device_t *);
+#ifndef FIXED_PORT_SPEED
+extern void gpsd_autobaud_sample(struct gps_device_t *, ssize_t);
+extern void gpsd_autobaud_note(struct autobaud_t *, timestamp_t, size_t);
+extern double gpsd_autobaud_estimate(const struct autobaud_t *);
+extern int gpsd_autobaud_pick(unsigned int, double, double);
+extern unsigned int gpsd_hunt_rate(int);
+extern bool gpsd_speedcache_load(struct gps_context_t *);
+extern void gpsd_speedcache_save(struct gps_context_t *);
+#endif /* FIXED_PORT_SPEED */
 extern int gpsd_switch_driver(struct gps_device_t *, char *);
 #ifdef HAVE_TERMIOS_H
 extern void gpsd_set_speed(struct gps_device_t *, speed_t, char, unsigned int);
@@ -839,6 +1071,7 @@ extern speed_t gpsd_get_speed_old(const struct gps_device_t *);
 #endif /* HAVE_TERMIOS_H */
 extern int gpsd_get_stopbits(const struct gps_device_t *);
 extern char gpsd_get_parity(const struct gps_device_t *);
+extern long long gpsd_line_time(const struct gps_device_t *, size_t);
 extern void gpsd_assert_sync(struct gps_device_t *);
 extern void gpsd_close(struct gps_device_t *);
 
@@ -871,6 +1104,10 @@ extern void gpsd_position_fix_dump(struct gps_device_t *,
 				   char[], size_t);
 extern void gpsd_clear_data(struct gps_device_t *);
 extern socket_t netlib_connectsock(int, const char *, const char *, const char *);
+struct addrinfo;
+extern int netlib_lookup(int, const char *, const char *, const char *,
+			 struct addrinfo **);
+extern socket_t netlib_connect_next(struct addrinfo **);
 extern socket_t netlib_localsocket(const char *, int);
 extern const char *netlib_errstr(const int);
 extern char *netlib_sock2ip(socket_t);
@@ -884,11 +1121,21 @@ extern unsigned int ais_binary_encode(struct ais_t *ais, unsigned char *bits, in
 #ifdef NTP_ENABLE
 extern void ntp_latch(struct gps_device_t *device,  struct timedelta_t *td);
 #ifdef NTPSHM_ENABLE
+extern bool ntpshm_map(struct gps_context_t *, const char *);
 extern void ntpshm_context_init(struct gps_context_t *);
 extern void ntpshm_session_init(struct gps_device_t *);
 extern int ntpshm_put(struct gps_device_t *, volatile struct shmTime *, struct timedelta_t *);
 extern void ntpshm_link_deactivate(struct gps_device_t *);
 extern void ntpshm_link_activate(struct gps_device_t *);
+#ifdef PPS_ENABLE
+extern void pps_stats_dump(const struct gps_device_t *, char *, size_t);
+extern void fixoffset_update(struct gps_device_t *, struct timedelta_t *);
+extern void holdover_edge(struct gps_device_t *, struct timedelta_t *);
+extern bool holdover_tick(struct gps_device_t *, struct timedelta_t *, int *);
+extern bool fixoffset_load(struct gps_context_t *);
+extern void fixoffset_save(struct gps_context_t *, struct gps_device_t *,
+			   int);
+#endif /* PPS_ENABLE */
 #endif /* NTPSHM_ENABLE */
 #endif /* NTP_ENABLE */
 
@@ -915,6 +1162,29 @@ extern bool shm_acquire(struct gps_context_t *);
 extern void shm_release(struct gps_context_t *);
 extern void shm_update(struct gps_context_t *, struct gps_data_t *);
 
+/* rtcmrelay.c */
+#define RELAY_TYPES_MAX	16	/* message types in one sink's filter */
+struct relay_sink_t;
+extern void rtcm_relay_init(void);
+extern int rtcm_relay_types(const char *, unsigned int *, int);
+extern struct relay_sink_t *rtcm_relay_rover(struct gps_device_t *);
+extern struct relay_sink_t *rtcm_relay_client(socket_t,
+					      const unsigned int *, int);
+extern void rtcm_relay_filter(struct relay_sink_t *,
+			      const unsigned int *, int);
+extern void rtcm_relay_forget(struct gps_device_t *, socket_t);
+extern void rtcm_relay_put(struct gps_context_t *, struct gps_device_t *,
+			   unsigned int, const unsigned char *, size_t);
+extern bool rtcm_relay_service(struct gps_context_t *, fd_set *);
+extern time_t rtcm_relay_stalled(socket_t);
+extern void rtcm_relay_dump(char *, size_t);
+
+/* capture.c */
+extern bool capture_start(struct gpsd_errout_t *, const char *);
+extern void capture_packet(struct gps_device_t *);
+extern void capture_stop(void);
+extern socket_t replay_open(struct gps_device_t *);
+
 /* dbusexport.c */
 #if defined(DBUS_EXPORT_ENABLE)
 int initialize_dbus_connection (void);
@@ -940,6 +1210,18 @@ extern void gpsd_init(struct gps_device_t *,
 		      struct gps_context_t *,
 		      const char *);
 extern void gpsd_clear(struct gps_device_t *);
+extern bool gpsd_keyfile_load(struct gps_context_t *, const char *,
+			      const char *, int,
+			      bool (*)(struct gps_context_t *, int,
+				       const char *, const char *));
+extern void gpsd_keyfile_save(struct gps_context_t *, const char *,
+			      const char *, const char *, int,
+			      void (*)(const struct gps_context_t *, int,
+				       FILE *));
+#ifdef TIMING_ENABLE
+extern void gpsd_latency_mark(struct gps_device_t *, int);
+extern void gpsd_latency_dump(const struct gps_device_t *, char *, size_t);
+#endif /* TIMING_ENABLE */
 extern int gpsd_open(struct gps_device_t *);
 #define O_CONTINUE	0
 #define O_PROBEONLY	1
@@ -954,8 +1236,12 @@ extern int gpsd_await_data(fd_set *,
 			   fd_set *,
 			    const int,
 			    fd_set *,
+			    fd_set *,
+			    const struct timespec *,
 			    struct gpsd_errout_t *errout);
 extern gps_mask_t gpsd_poll(struct gps_device_t *);
+extern void gpsd_error_model(struct gps_device_t *,
+			     struct gps_fix_t *, struct gps_fix_t *);
 #define DEVICE_EOF	-3
 #define DEVICE_ERROR	-2
 #define DEVICE_UNREADY	-1
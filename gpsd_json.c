@@ -367,6 +367,11 @@ void json_device_dump(const struct gps_device_t *device,
 			       device->device_type->min_cycle);
 #endif /* RECONFIGURE_ENABLE */
 	}
+#ifdef PPS_ENABLE
+	if (device->fixoffset.valid)
+	    str_appendf(reply, replylen, "\"fixoffset\":%.9f,",
+			device->fixoffset.offset / 1e9);
+#endif /* PPS_ENABLE */
     }
     str_rstrip_char(reply, ',');
     (void)strlcat(reply, "}\r\n", replylen);
@@ -387,6 +392,36 @@ void json_watch_dump(const struct policy_t *ccp,
 		   ccp->pps ? "true" : "false");
     if (ccp->devpath[0] != '\0')
 	str_appendf(reply, replylen, "\"device\":\"%s\",", ccp->devpath);
+    if (ccp->classes != 0) {
+	const struct json_enum_t *cp;
+	(void)strlcat(reply, "\"classes\":[", replylen);
+	for (cp = json_class_names; cp->name != NULL; cp++)
+	    if ((ccp->classes & (unsigned int)cp->value) != 0)
+		str_appendf(reply, replylen, "\"%s\",", cp->name);
+	str_rstrip_char(reply, ',');
+	(void)strlcat(reply, "],", replylen);
+    }
+    if (ccp->aistypes != 0) {
+	int i;
+	(void)strlcat(reply, "\"aistypes\":[", replylen);
+	for (i = 1; i < 32; i++)
+	    if ((ccp->aistypes & (1u << i)) != 0)
+		str_appendf(reply, replylen, "%d,", i);
+	str_rstrip_char(reply, ',');
+	(void)strlcat(reply, "],", replylen);
+    }
+    if (ccp->nmmsi > 0) {
+	int i;
+	(void)strlcat(reply, "\"mmsi\":[", replylen);
+	for (i = 0; i < ccp->nmmsi; i++)
+	    str_appendf(reply, replylen, "%u,", ccp->mmsi[i]);
+	str_rstrip_char(reply, ',');
+	(void)strlcat(reply, "],", replylen);
+    }
+    if (ccp->minmode > 0)
+	str_appendf(reply, replylen, "\"minmode\":%d,", ccp->minmode);
+    if (ccp->interval > 0)
+	str_appendf(reply, replylen, "\"interval\":%.3f,", ccp->interval);
     str_rstrip_char(reply, ',');
     (void)strlcat(reply, "}\r\n", replylen);
 }
@@ -831,6 +866,69 @@ void json_rtcm2_dump(const struct rtcm2_t *rtcm,
 #endif /* defined(RTCM104V2_ENABLE) */
 
 #if defined(RTCM104V3_ENABLE)
+static void json_rtcm3_msm_dump(const struct rtcm3_t *rtcm,
+				char buf[], size_t buflen)
+/* dump a Multiple Signal Message; fields absent at this level are omitted */
+{
+    /*
+     * A full MSM7, 64 cells on as many satellites, comes to about 12K:
+     * more than other reports, but within GPS_JSON_RESPONSE_MAX * 4,
+     * which the daemon and libgps both size their buffers to.
+     */
+    static const char *gnss_names[] = {
+	"GPS", "GLONASS", "Galileo", "SBAS", "QZSS", "BeiDou",
+    };
+    const struct rtcm3_msm_t *msm = &rtcm->rtcmtypes.msm;
+    bool ranges = msm->level >= 4;
+    bool rates = msm->level == 5 || msm->level == 7;
+    bool pr = msm->level != 2;
+    bool cp = msm->level >= 2;
+    int i;
+
+    str_appendf(buf, buflen,
+		"\"gnss\":\"%s\",\"msm\":%u,\"station_id\":%u,\"tow\":%u,",
+		gnss_names[msm->gnss], msm->level, msm->station_id, msm->tow);
+    if (msm->gnss == msm_glonass)
+	str_appendf(buf, buflen, "\"dow\":%u,", msm->dow);
+    str_appendf(buf, buflen,
+		"\"sync\":%s,\"iods\":%u,\"steering\":%u,\"ext_clock\":%u,"
+		"\"smoothing\":%s,\"interval\":%u,",
+		JSON_BOOL(msm->sync), msm->iods, msm->steering,
+		msm->ext_clock, JSON_BOOL(msm->smoothing), msm->interval);
+
+    (void)strlcat(buf, "\"sats\":[", buflen);
+    for (i = 0; i < msm->nsat; i++) {
+	const struct rtcm3_msm_sat *sat = &msm->sats[i];
+	str_appendf(buf, buflen, "{\"ident\":%u,\"rr\":%.10f",
+		    sat->ident, sat->rough_range);
+	if (rates)
+	    str_appendf(buf, buflen, ",\"ext\":%u,\"rate\":%.0f",
+			sat->ext, sat->rate);
+	(void)strlcat(buf, "},", buflen);
+    }
+    str_rstrip_char(buf, ',');
+    (void)strlcat(buf, "],\"cells\":[", buflen);
+    for (i = 0; i < msm->ncell; i++) {
+	const struct rtcm3_msm_cell *cell = &msm->cells[i];
+	str_appendf(buf, buflen, "{\"sat\":%u,\"sig\":%u",
+		    cell->sat, cell->sig);
+	if (pr)
+	    str_appendf(buf, buflen, ",\"prange\":%.4f", cell->pseudorange);
+	if (cp)
+	    str_appendf(buf, buflen,
+			",\"cphase\":%.4f,\"lockt\":%u,\"half\":%s",
+			cell->phaserange, cell->locktime,
+			JSON_BOOL(cell->half_cycle));
+	if (ranges)
+	    str_appendf(buf, buflen, ",\"CNR\":%.4f", cell->CNR);
+	if (rates)
+	    str_appendf(buf, buflen, ",\"rate\":%.4f", cell->rate);
+	(void)strlcat(buf, "},", buflen);
+    }
+    str_rstrip_char(buf, ',');
+    (void)strlcat(buf, "],", buflen);
+}
+
 void json_rtcm3_dump(const struct rtcm3_t *rtcm,
 		     const char *device,
 		     char buf[], size_t buflen)
@@ -1250,6 +1348,12 @@ void json_rtcm3_dump(const struct rtcm3_t *rtcm,
 	break;
 
     default:
+	if (rtcm->type >= 1071 && rtcm->type <= 1127
+	    && rtcm->type % 10 >= 1 && rtcm->type % 10 <= 7
+	    && rtcm->decoded) {
+	    json_rtcm3_msm_dump(rtcm, buf, buflen);
+	    break;
+	}
 	(void)strlcat(buf, "\"data\":[", buflen);
 	for (n = 0; n < rtcm->length; n++)
 	    str_appendf(buf, buflen,
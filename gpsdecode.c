@@ -7,9 +7,18 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 #include <unistd.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "gpsd.h"
+#include "archive.h"
 #include "bits.h"
 #include "gps_json.h"
 #include "strfuncs.h"
@@ -20,6 +29,8 @@ static bool json = true;
 static bool pseudonmea = false;
 static bool split24 = false;
 static bool minlength = false;
+static bool mapped = false;
+static bool archive = false;
 static unsigned int ntypes = 0;
 static unsigned int typelist[32];
 static struct gps_context_t context;
@@ -517,7 +528,8 @@ static bool filter(gps_mask_t changed, struct gps_device_t *session)
     return false;
 }
 
-static void pseudonmea_report(gps_mask_t changed, struct gps_device_t *device)
+static void pseudonmea_report(gps_mask_t changed, struct gps_device_t *device,
+			      FILE *fpout)
 /* report pseudo-NMEA in appropriate circumstances */
 {
     if (GPS_PACKET_TYPE(device->lexer.type)
@@ -526,28 +538,60 @@ static void pseudonmea_report(gps_mask_t changed, struct gps_device_t *device)
 
 	if ((changed & REPORT_IS) != 0) {
 	    nmea_tpv_dump(device, buf, sizeof(buf));
-	    (void)fputs(buf, stdout);
+	    (void)fputs(buf, fpout);
 	}
 
 	if ((changed & SATELLITE_SET) != 0) {
 	    nmea_sky_dump(device, buf, sizeof(buf));
-	    (void)fputs(buf, stdout);
+	    (void)fputs(buf, fpout);
 	}
 
 	if ((changed & SUBFRAME_SET) != 0) {
 	    nmea_subframe_dump(device, buf, sizeof(buf));
-	    (void)fputs(buf, stdout);
+	    (void)fputs(buf, fpout);
 	}
 #ifdef AIVDM_ENABLE
 	if ((changed & AIS_SET) != 0) {
 	    nmea_ais_dump(device, buf, sizeof(buf));
-	    (void)fputs(buf, stdout);
+	    (void)fputs(buf, fpout);
 	}
 #endif /* AIVDM_ENABLE */
     }
 }
 
-static void decode(FILE *fpin, FILE*fpout)
+static double ais_time(const struct ais_t *ais, double last)
+/* the best guess at when an AIS message was heard */
+{
+    struct tm tm;
+
+    /* base stations and UTC responses say what time it is */
+    if ((ais->type == 4 || ais->type == 11)
+	&& ais->type4.year != AIS_YEAR_NOT_AVAILABLE
+	&& ais->type4.month != AIS_MONTH_NOT_AVAILABLE
+	&& ais->type4.day != AIS_DAY_NOT_AVAILABLE
+	&& ais->type4.hour < AIS_HOUR_NOT_AVAILABLE
+	&& ais->type4.minute < AIS_MINUTE_NOT_AVAILABLE
+	&& ais->type4.second < AIS_SECOND_NOT_AVAILABLE) {
+	memset(&tm, '\0', sizeof(tm));
+	tm.tm_year = (int)ais->type4.year - 1900;
+	tm.tm_mon = (int)ais->type4.month - 1;
+	tm.tm_mday = (int)ais->type4.day;
+	tm.tm_hour = (int)ais->type4.hour;
+	tm.tm_min = (int)ais->type4.minute;
+	tm.tm_sec = (int)ais->type4.second;
+	return (double)mkgmtime(&tm);
+    }
+    return last;
+}
+
+/* what a decode got through, for throughput reports */
+struct decode_stats_t {
+    unsigned long packets;
+    unsigned long bytes;
+    unsigned long discarded, resyncs;	/* lexer sync losses */
+};
+
+static void decode(FILE *fpin, FILE*fpout, struct decode_stats_t *stats)
 /* sensor data on fpin to dump format on fpout */
 {
     struct gps_device_t session;
@@ -556,7 +600,12 @@ static void decode(FILE *fpin, FILE*fpout)
 #if defined(SOCKET_EXPORT_ENABLE) || defined(AIVDM_ENABLE)
     char buf[GPS_JSON_RESPONSE_MAX * 4];
 #endif
+    void *map = MAP_FAILED;
+    struct stat sb;
     int i;
+    /* big, so not on the stack */
+    static struct archive_writer_t writer;
+    double when = NAN;
 
     //This looks like a good idea, but it breaks regression tests
     //(void)strlcpy(session.gpsdata.dev.path, "stdin", sizeof(session.gpsdata.dev.path));
@@ -576,6 +625,19 @@ static void decode(FILE *fpin, FILE*fpout)
 		  sizeof(session.gpsdata.dev.path));
     for (i = 0; i < (int)(sizeof(minima)/sizeof(minima[0])); i++)
 	minima[i] = MAX_PACKET_LENGTH+1;
+    if (mapped) {
+	/* only a regular file can be mapped; anything else is read */
+	if (fstat(fileno(fpin), &sb) == 0 && S_ISREG(sb.st_mode)
+	    && sb.st_size > 0
+	    && (map = mmap(NULL, (size_t)sb.st_size, PROT_READ, MAP_PRIVATE,
+			   fileno(fpin), 0)) != MAP_FAILED) {
+	    (void)madvise(map, (size_t)sb.st_size, MADV_SEQUENTIAL);
+	    packet_map(&session.lexer, map, (size_t)sb.st_size);
+	} else if (verbose >= 1)
+	    (void)fprintf(stderr, "gpsdecode: input not mapped, reading it\n");
+    }
+    if (archive)
+	archive_writer_init(&writer, fpout);
 
     for (;;)
     {
@@ -583,6 +645,8 @@ static void decode(FILE *fpin, FILE*fpout)
 
 	if (changed == ERROR_SET || changed == NODATA_IS)
 	    break;
+	if ((changed & PACKET_SET) != 0)
+	    stats->packets++;
 	if (session.lexer.type == COMMENT_PACKET)
 	    gpsd_set_century(&session);
 	if (verbose >= 1 && TEXTUAL_PACKET_TYPE(session.lexer.type))
@@ -594,7 +658,17 @@ static void decode(FILE *fpin, FILE*fpout)
 	    continue;
 	if (!filter(changed, &session))
 	    continue;
-	else if (json) {
+	else if (archive) {
+	    if ((changed & REPORT_IS) != 0) {
+		if (!isnan(session.gpsdata.fix.time))
+		    when = session.gpsdata.fix.time;
+		(void)archive_put_fix(&writer, &session.gpsdata.fix);
+	    }
+	    if ((changed & AIS_SET) != 0) {
+		when = ais_time(&session.gpsdata.ais, when);
+		(void)archive_put_ais(&writer, &session.gpsdata.ais, when);
+	    }
+	} else if (json) {
 	    if ((changed & PASSTHROUGH_IS) != 0) {
 		(void)fputs((char *)session.lexer.outbuffer, fpout);
 		(void)fputs("\n", fpout);
@@ -622,8 +696,16 @@ static void decode(FILE *fpin, FILE*fpout)
 #endif /* AIVDM_ENABLE */
 	}
 	if (policy.nmea)
-	    pseudonmea_report(changed, &session);
+	    pseudonmea_report(changed, &session, fpout);
     }
+    stats->bytes = session.lexer.char_counter;
+    stats->discarded = session.lexer.discarded;
+    stats->resyncs = session.lexer.resyncs;
+    if (archive && archive_flush(&writer) != 0)
+	(void)fprintf(stderr, "gpsdecode: archive write failed: %s\n",
+		      strerror(errno));
+    if (map != MAP_FAILED)
+	(void)munmap(map, (size_t)sb.st_size);
 
     if (minlength)
     {
@@ -638,7 +720,8 @@ static void decode(FILE *fpin, FILE*fpout)
 			break;
 		    }
 		}
-		printf("%s (%d): %u\n", np, i-1, (unsigned int)minima[i]);
+		(void)fprintf(fpout, "%s (%d): %u\n",
+			      np, i-1, (unsigned int)minima[i]);
 	    }
 	}
     }
@@ -688,15 +771,192 @@ static void encode(FILE *fpin, FILE *fpout)
 }
 #endif /* SOCKET_EXPORT_ENABLE */
 
+/**************************************************************************
+ *
+ * Batch mode
+ *
+ **************************************************************************/
+
+static void throughput(int nfiles, const struct decode_stats_t *stats,
+		       struct timespec *start)
+/* report packets and bytes per second since start on stderr */
+{
+    struct timespec now;
+    unsigned long packets = 0, bytes = 0, discarded = 0, resyncs = 0;
+    double elapsed;
+    int i;
+
+    (void)clock_gettime(CLOCK_MONOTONIC, &now);
+    elapsed = (now.tv_sec - start->tv_sec)
+	+ (now.tv_nsec - start->tv_nsec) / 1e9;
+    for (i = 0; i < nfiles; i++) {
+	packets += stats[i].packets;
+	bytes += stats[i].bytes;
+	discarded += stats[i].discarded;
+	resyncs += stats[i].resyncs;
+    }
+    if (elapsed <= 0)
+	elapsed = 1e-9;
+    (void)fprintf(stderr,
+		  "gpsdecode: %d file%s, %lu packets, %lu bytes in %.3f s: "
+		  "%.0f packets/s, %.2f MB/s; %lu bytes discarded "
+		  "in %lu resyncs\n",
+		  nfiles, nfiles == 1 ? "" : "s", packets, bytes, elapsed,
+		  packets / elapsed, bytes / elapsed / 1e6, discarded, resyncs);
+}
+
+static bool copy_out(FILE *from, FILE *to)
+/* append a spooled output to the real one */
+{
+    char buf[BUFSIZ];
+    size_t n;
+
+    rewind(from);
+    while ((n = fread(buf, 1, sizeof(buf), from)) > 0)
+	if (fwrite(buf, 1, n, to) != n)
+	    return false;
+    return !ferror(from);
+}
+
+#define SPOOL_AHEAD	4	/* per job, files spooled ahead of the output */
+
+static int batch(int nfiles, char **files, int jobs, const char *suffix,
+		 bool report)
+/* decode many files, up to jobs at a time, each in its own process */
+{
+    /*
+     * Workers are processes rather than threads because the decoders
+     * keep some state in statics (the lexer among them), which they
+     * could not share.  A worker reports its counts through a shared
+     * mapping and its output through a spool file, which we copy to
+     * standard output in argument order as each file's turn comes.
+     * A file slow to decode holds up the shipping of those after it,
+     * so no file is started more than jobs * SPOOL_AHEAD places past
+     * the first not yet shipped: that bounds the spools open at once,
+     * and the disk they take, however many files there are.  With a
+     * suffix, each file's output goes beside it instead, unspooled.
+     */
+    struct decode_stats_t *stats;
+    FILE **spool;
+    pid_t *pids;
+    bool *done;
+    struct timespec start;
+    int next = 0, running = 0, flushed = 0, failures = 0;
+
+    stats = mmap(NULL, nfiles * sizeof(*stats), PROT_READ | PROT_WRITE,
+		 MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    spool = calloc(nfiles, sizeof(*spool));
+    pids = calloc(nfiles, sizeof(*pids));
+    done = calloc(nfiles, sizeof(*done));
+    if (stats == MAP_FAILED || spool == NULL || pids == NULL || done == NULL) {
+	(void)fprintf(stderr, "gpsdecode: out of memory for batch\n");
+	return EXIT_FAILURE;
+    }
+    memset(stats, 0, nfiles * sizeof(*stats));
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+
+    while (flushed < nfiles) {
+	int status;
+	pid_t pid;
+
+	while (running < jobs && next < nfiles
+	       && (suffix != NULL || next - flushed < jobs * SPOOL_AHEAD)) {
+	    int i = next++;
+
+	    if (suffix == NULL && (spool[i] = tmpfile()) == NULL) {
+		(void)fprintf(stderr, "gpsdecode: can't spool %s: %s\n",
+			      files[i], strerror(errno));
+		done[i] = true;
+		failures++;
+		continue;
+	    }
+	    (void)fflush(stdout);
+	    pid = fork();
+	    if (pid == 0) {
+		FILE *fpin, *fpout = spool[i];
+		char outname[PATH_MAX];
+
+		if ((fpin = fopen(files[i], "rb")) == NULL) {
+		    (void)fprintf(stderr, "gpsdecode: can't open %s: %s\n",
+				  files[i], strerror(errno));
+		    _exit(EXIT_FAILURE);
+		}
+		if (suffix != NULL) {
+		    (void)snprintf(outname, sizeof(outname), "%s%s",
+				   files[i], suffix);
+		    if ((fpout = fopen(outname, "w")) == NULL) {
+			(void)fprintf(stderr,
+				      "gpsdecode: can't create %s: %s\n",
+				      outname, strerror(errno));
+			_exit(EXIT_FAILURE);
+		    }
+		}
+		decode(fpin, fpout, &stats[i]);
+		_exit(fclose(fpout) == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+	    } else if (pid < 0) {
+		(void)fprintf(stderr, "gpsdecode: fork failed: %s\n",
+			      strerror(errno));
+		done[i] = true;
+		failures++;
+		continue;
+	    }
+	    pids[i] = pid;
+	    running++;
+	}
+
+	if (running > 0 && (pid = wait(&status)) > 0) {
+	    int i;
+
+	    for (i = 0; i < next; i++)
+		if (pids[i] == pid) {
+		    pids[i] = 0;
+		    done[i] = true;
+		    running--;
+		    if (!WIFEXITED(status)
+			|| WEXITSTATUS(status) != EXIT_SUCCESS)
+			failures++;
+		    break;
+		}
+	}
+
+	/* ship whatever is now complete in order */
+	while (flushed < next && done[flushed]) {
+	    if (spool[flushed] != NULL) {
+		if (!copy_out(spool[flushed], stdout))
+		    failures++;
+		(void)fclose(spool[flushed]);
+	    }
+	    flushed++;
+	}
+    }
+    (void)fflush(stdout);
+
+    if (report)
+	throughput(nfiles, stats, &start);
+    (void)munmap(stats, nfiles * sizeof(*stats));
+    free(spool);
+    free(pids);
+    free(done);
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 int main(int argc, char **argv)
 {
     int c;
     enum { doencode, dodecode } mode = dodecode;
+    int jobs = 1;
+    const char *suffix = NULL;
+    bool report = false;
 
     gps_context_init(&context, "gpsdecode");
 
-    while ((c = getopt(argc, argv, "cdejmnpst:uvVD:")) != EOF) {
+    while ((c = getopt(argc, argv, "bcdejmno:pst:uvJ:MPVD:")) != EOF) {
 	switch (c) {
+	case 'b':
+	    archive = true;
+	    json = false;
+	    break;
+
 	case 'c':
 	    json = false;
 	    break;
@@ -722,6 +982,27 @@ int main(int argc, char **argv)
 	    pseudonmea = true;
 	    break;
 
+	case 'o':
+	    suffix = optarg;
+	    break;
+
+	case 'J':
+	    jobs = atoi(optarg);
+	    if (jobs < 1) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+		jobs = cpus > 0 ? (int)cpus : 1;
+	    }
+	    break;
+
+	case 'M':
+	    mapped = true;
+	    break;
+
+	case 'P':
+	    report = true;
+	    break;
+
 	case 's':
 	    split24 = true;
 	    break;
@@ -757,12 +1038,22 @@ int main(int argc, char **argv)
 
 	case '?':
 	default:
-	    (void)fputs("gpsdecode [-v]\n", stderr);
+	    (void)fputs("gpsdecode [-bcdejmnsuvMPV] [-t typelist] [-D debuglevel]\n"
+			"          [-J jobs] [-o suffix] [file...]\n", stderr);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    argc -= optind;
+    argv += optind;
+
+    if (argc > 0) {
+	if (mode == doencode) {
+	    (void)fprintf(stderr,
+			  "gpsdecode: files can only be given to decode.\n");
 	    exit(EXIT_FAILURE);
 	}
+	exit(batch(argc, argv, jobs, suffix, report));
     }
-    //argc -= optind;
-    //argv += optind;
 
     if (mode == doencode) {
 #ifdef SOCKET_EXPORT_ENABLE
@@ -771,8 +1062,15 @@ int main(int argc, char **argv)
 	(void)fprintf(stderr, "gpsdecode: encoding support isn't compiled.\n");
 	exit(EXIT_FAILURE);
 #endif /* SOCKET_EXPORT_ENABLE */
-    } else
-	decode(stdin, stdout);
+    } else {
+	struct decode_stats_t stats = {0, 0};
+	struct timespec start;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &start);
+	decode(stdin, stdout, &stats);
+	if (report)
+	    throughput(1, &stats, &start);
+    }
     exit(EXIT_SUCCESS);
 }
 
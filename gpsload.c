@@ -0,0 +1,811 @@
+/*
+ * gpsload - drive a gpsd instance hard with many fake devices and clients
+ *
+ * gpsfake feeds one packet per device per pass of a Python loop, which
+ * is fine for regression tests but can't make gpsd break a sweat.  This
+ * spawns a gpsd, cuts the given logs into packets with gpsd's own lexer,
+ * and feeds them to any number of pty, TCP or UDP fake devices at a
+ * fixed rate each from a single poll() loop, while any number of fake
+ * clients WATCH the result.  At the end it reports the packet rate
+ * achieved, the reports each client got and missed, the latency from
+ * the write of the packet that completed a fix to the client's receipt
+ * of the TPV naming it, and the CPU time gpsd spent.
+ *
+ * gpsd handles MAX_DEVICES devices and MAX_CLIENTS clients; for big
+ * runs build it with larger max_devices and max_clients.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+
+/* posix_openpt() and friends need _XOPEN_SOURCE, cfmakeraw() _DEFAULT_SOURCE */
+#define _DEFAULT_SOURCE
+#define _XOPEN_SOURCE 700
+
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "gpsd.h"
+#include "gps_json.h"
+#include "histogram.h"
+#include "revision.h"
+#include "strfuncs.h"
+#include "timespec.h"
+
+#define DRAIN_SECONDS	2	/* for reports still in flight at the end */
+#define CLIENT_BUF	(GPS_JSON_RESPONSE_MAX * 4)
+
+enum transport {pty, tcp, udp};
+static const char *transports[] = {"pty", "tcp", "udp"};
+
+/* a log cut into packets, and the fixes they complete */
+struct packet_t {
+    unsigned char *data;
+    size_t len;
+    int report;			/* index into fixtimes, or -1 */
+};
+
+struct log_t {
+    const char *name;
+    struct packet_t *packets;
+    size_t npackets;
+    double *fixtimes;		/* times of the fixes the log reports */
+    size_t nreports;
+};
+
+struct device_t {
+    struct log_t *log;
+    char path[GPS_PATH_MAX];
+    int fd;			/* -1 until a TCP device is connected */
+    int listener;		/* TCP only */
+    int slave;			/* pty only, held open across gpsd closes */
+    struct sockaddr_in to;	/* UDP only */
+    size_t next;		/* packet to send */
+    size_t offset;		/* of it, already sent */
+    struct timespec due;
+    struct timespec *written;	/* per report, when it was completed */
+    size_t cursor;		/* report last matched */
+    unsigned long packets, bytes, reports, stalls;
+};
+
+/* what a client asks to watch */
+static const struct watch_t {
+    const char *name;
+    const char *request;
+    bool json;			/* so its TPVs can be timed */
+} watches[] = {
+    {"json", "?WATCH={\"enable\":true,\"json\":true};\n", true},
+    {"scaled", "?WATCH={\"enable\":true,\"json\":true,\"scaled\":true};\n",
+     true},
+    {"nmea", "?WATCH={\"enable\":true,\"nmea\":true};\n", false},
+    {"raw", "?WATCH={\"enable\":true,\"raw\":1};\n", false},
+};
+#define NWATCHES	(int)(sizeof(watches) / sizeof(watches[0]))
+
+struct client_t {
+    int fd;
+    const struct watch_t *watch;
+    bool slow;
+    struct timespec next_read;	/* slow clients only */
+    char buf[CLIENT_BUF];
+    size_t len;
+    unsigned long reports, lines, unmatched, bytes;
+    bool dropped;
+};
+
+static struct gps_context_t context;
+static struct device_t *devices;
+static int ndevices;
+static struct client_t *clients;
+static int nclients;
+static volatile sig_atomic_t interrupted;
+
+static void onsig(int sig)
+{
+    interrupted = sig;
+}
+
+static void ts_add_ns(struct timespec *ts, long long ns)
+{
+    ts->tv_sec += (time_t)(ns / NS_IN_SEC);
+    ts->tv_nsec += (long)(ns % NS_IN_SEC);
+    TS_NORM(ts);
+}
+
+static bool load_log(struct log_t *log, const char *name)
+/* cut a log into packets with the daemon's lexer and drivers, noting
+ * which packets complete a fix */
+{
+    struct gps_device_t session;
+    int fd;
+    size_t room = 0;
+
+    memset(log, '\0', sizeof(*log));
+    log->name = name;
+    if ((fd = open(name, O_RDONLY)) < 0) {
+	(void)fprintf(stderr, "gpsload: can't open %s: %s\n",
+		      name, strerror(errno));
+	return false;
+    }
+    gpsd_time_init(&context, time(NULL));
+    context.readonly = true;
+    gpsd_init(&session, &context, NULL);
+    gpsd_clear(&session);
+    session.gpsdata.gps_fd = fd;
+    (void)strlcpy(session.gpsdata.dev.path, name,
+		  sizeof(session.gpsdata.dev.path));
+    for (;;) {
+	gps_mask_t changed = gpsd_poll(&session);
+	struct packet_t *packet;
+
+	if (changed == ERROR_SET || changed == NODATA_IS)
+	    break;
+	if ((changed & PACKET_SET) == 0
+	    || session.lexer.type == COMMENT_PACKET)
+	    continue;
+	if (log->npackets == room) {
+	    room = room ? room * 2 : 256;
+	    log->packets = realloc(log->packets, room * sizeof(*packet));
+	    log->fixtimes = realloc(log->fixtimes, room * sizeof(double));
+	    if (log->packets == NULL || log->fixtimes == NULL) {
+		(void)fputs("gpsload: out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	    }
+	}
+	packet = &log->packets[log->npackets++];
+	packet->len = session.lexer.outbuflen;
+	if ((packet->data = malloc(packet->len)) == NULL) {
+	    (void)fputs("gpsload: out of memory\n", stderr);
+	    exit(EXIT_FAILURE);
+	}
+	memcpy(packet->data, session.lexer.outbuffer, packet->len);
+	packet->report = -1;
+	if ((changed & REPORT_IS) != 0 && !isnan(session.gpsdata.fix.time)) {
+	    packet->report = (int)log->nreports;
+	    log->fixtimes[log->nreports++] = session.gpsdata.fix.time;
+	}
+    }
+    (void)close(fd);
+    if (log->npackets == 0) {
+	(void)fprintf(stderr, "gpsload: no packets in %s\n", name);
+	return false;
+    }
+    return true;
+}
+
+static bool control(const char *sockpath, const char *command)
+/* send one command to gpsd's control socket; true if it said OK */
+{
+    char reply[BUFSIZ];
+    socket_t sock = netlib_localsocket(sockpath, SOCK_STREAM);
+    ssize_t n;
+
+    if (sock < 0)
+	return false;
+    n = write(sock, command, strlen(command));
+    if (n > 0)
+	n = read(sock, reply, sizeof(reply) - 1);
+    (void)close(sock);
+    return n >= 2 && strncmp(reply, "OK", 2) == 0;
+}
+
+static int free_port(int type)
+/* a port nobody is using, or so it was a moment ago */
+{
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    int sock = socket(AF_INET, type, 0), port = -1;
+
+    memset(&sin, '\0', sizeof(sin));
+    sin.sin_family = AF_INET;
+    sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock >= 0 && bind(sock, (struct sockaddr *)&sin, sizeof(sin)) == 0
+	&& getsockname(sock, (struct sockaddr *)&sin, &len) == 0)
+	port = ntohs(sin.sin_port);
+    if (sock >= 0)
+	(void)close(sock);
+    return port;
+}
+
+static bool device_open(struct device_t *dev, enum transport transport,
+			int udpsock)
+/* make the fake device end of a data source, and name it for gpsd */
+{
+    struct termios term;
+    struct sockaddr_in sin;
+    socklen_t len = sizeof(sin);
+    int port;
+
+    dev->fd = dev->listener = dev->slave = -1;
+    switch (transport) {
+    case pty:
+	if ((dev->fd = posix_openpt(O_RDWR | O_NOCTTY)) < 0
+	    || grantpt(dev->fd) != 0 || unlockpt(dev->fd) != 0
+	    || ptsname(dev->fd) == NULL)
+	    return false;
+	(void)strlcpy(dev->path, ptsname(dev->fd), sizeof(dev->path));
+	if ((dev->slave = open(dev->path, O_RDWR | O_NOCTTY)) < 0)
+	    return false;
+	/* gpsd is running as nobody by the time it opens this */
+	(void)fchmod(dev->slave, S_IRUSR | S_IWUSR | S_IRGRP | S_IWGRP
+		     | S_IROTH | S_IWOTH);
+	if (tcgetattr(dev->slave, &term) == 0) {
+	    cfmakeraw(&term);
+	    (void)tcsetattr(dev->slave, TCSANOW, &term);
+	}
+	break;
+    case tcp:
+	memset(&sin, '\0', sizeof(sin));
+	sin.sin_family = AF_INET;
+	sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((dev->listener = socket(AF_INET, SOCK_STREAM, 0)) < 0
+	    || bind(dev->listener, (struct sockaddr *)&sin, sizeof(sin)) != 0
+	    || listen(dev->listener, 1) != 0
+	    || getsockname(dev->listener, (struct sockaddr *)&sin, &len) != 0)
+	    return false;
+	(void)snprintf(dev->path, sizeof(dev->path), "tcp://127.0.0.1:%d",
+		       ntohs(sin.sin_port));
+	break;
+    case udp:
+	if ((port = free_port(SOCK_DGRAM)) < 0)
+	    return false;
+	memset(&dev->to, '\0', sizeof(dev->to));
+	dev->to.sin_family = AF_INET;
+	dev->to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	dev->to.sin_port = htons((uint16_t)port);
+	dev->fd = udpsock;
+	(void)snprintf(dev->path, sizeof(dev->path), "udp://127.0.0.1:%d",
+		       port);
+	break;
+    }
+    if (dev->fd >= 0 && transport != udp)
+	(void)fcntl(dev->fd, F_SETFL, fcntl(dev->fd, F_GETFL) | O_NONBLOCK);
+    dev->written = calloc(dev->log->nreports + 1, sizeof(struct timespec));
+    return dev->written != NULL;
+}
+
+static void device_send(struct device_t *dev, enum transport transport,
+			const struct timespec *now)
+/* ship the next packet, or what is left of it */
+{
+    struct packet_t *packet = &dev->log->packets[dev->next];
+    ssize_t n;
+
+    if (transport == udp)
+	n = sendto(dev->fd, packet->data, packet->len, 0,
+		   (struct sockaddr *)&dev->to, sizeof(dev->to));
+    else
+	n = write(dev->fd, packet->data + dev->offset,
+		  packet->len - dev->offset);
+    if (n < 0) {
+	if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ECONNREFUSED)
+	    dev->stalls++;
+	return;
+    }
+    dev->bytes += (size_t)n;
+    if (transport != udp && dev->offset + (size_t)n < packet->len) {
+	dev->offset += (size_t)n;
+	return;
+    }
+    dev->offset = 0;
+    dev->packets++;
+    if (packet->report >= 0) {
+	dev->written[packet->report] = *now;
+	dev->reports++;
+    }
+    dev->next = (dev->next + 1) % dev->log->npackets;
+}
+
+static char *json_field(char *line, const char *name, char *out, size_t len)
+/* copy a string-valued member out of a JSON line */
+{
+    char key[32], *p, *end;
+
+    (void)snprintf(key, sizeof(key), "\"%s\":\"", name);
+    if ((p = strstr(line, key)) == NULL)
+	return NULL;
+    p += strlen(key);
+    if ((end = strchr(p, '"')) == NULL || (size_t)(end - p) >= len)
+	return NULL;
+    memcpy(out, p, (size_t)(end - p));
+    out[end - p] = '\0';
+    return out;
+}
+
+static void client_line(struct client_t *client, char *line,
+			const struct timespec *now, struct histogram_t *lat)
+/* account for one report a client got */
+{
+    char path[GPS_PATH_MAX], when[64];
+    struct device_t *dev = NULL;
+    double fixtime;
+    size_t i;
+
+    client->lines++;
+    if (!client->watch->json)
+	return;
+    if (strstr(line, "\"class\":\"TPV\"") == NULL)
+	return;
+    client->reports++;
+    if (json_field(line, "device", path, sizeof(path)) == NULL
+	|| json_field(line, "time", when, sizeof(when)) == NULL) {
+	client->unmatched++;
+	return;
+    }
+    for (i = 0; i < (size_t)ndevices; i++)
+	if (strcmp(devices[i].path, path) == 0) {
+	    dev = &devices[i];
+	    break;
+	}
+    if (dev == NULL || dev->log->nreports == 0) {
+	client->unmatched++;
+	return;
+    }
+    fixtime = iso8601_to_unix(when);
+    /* reports come in log order, so look from where we last matched */
+    for (i = 0; i < dev->log->nreports; i++) {
+	size_t r = (dev->cursor + i) % dev->log->nreports;
+
+	if (fabs(dev->log->fixtimes[r] - fixtime) < 0.002
+	    && dev->written[r].tv_sec != 0) {
+	    dev->cursor = r;
+	    /* a slow client's latency is its own backlog, not gpsd's */
+	    if (!client->slow)
+		hist_record(lat, timespec_diff_ns(*now, dev->written[r]));
+	    return;
+	}
+    }
+    client->unmatched++;
+}
+
+static void client_read(struct client_t *client, const struct timespec *now,
+			struct histogram_t *lat)
+/* take in what gpsd sent a client, a line at a time */
+{
+    size_t room = sizeof(client->buf) - client->len - 1;
+    ssize_t n;
+    char *line, *nl;
+
+    if (client->slow) {
+	/* a client that can't keep up: a little, once a second */
+	if (timespec_diff_ns(*now, client->next_read) < 0)
+	    return;
+	client->next_read = *now;
+	client->next_read.tv_sec++;
+	if (room > 512)
+	    room = 512;
+    }
+    n = read(client->fd, client->buf + client->len, room);
+    if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+	client->dropped = true;
+	(void)close(client->fd);
+	client->fd = -1;
+	return;
+    }
+    if (n < 0)
+	return;
+    client->bytes += (size_t)n;
+    client->len += (size_t)n;
+    client->buf[client->len] = '\0';
+    for (line = client->buf; (nl = strchr(line, '\n')) != NULL;
+	 line = nl + 1) {
+	*nl = '\0';
+	client_line(client, line, now, lat);
+    }
+    client->len -= (size_t)(line - client->buf);
+    memmove(client->buf, line, client->len);
+    /* a line too long for us is not one we care about */
+    if (client->len == sizeof(client->buf) - 1)
+	client->len = 0;
+}
+
+static pid_t spawn(const char *gpsd, const char *sockpath, const char *port)
+/* start a daemon of our own and wait for it to take clients, which it
+ * does after its control socket is up */
+{
+    pid_t pid = fork();
+    int i;
+
+    if (pid == 0) {
+	(void)execlp(gpsd, gpsd, "-N", "-n", "-F", sockpath, "-S", port,
+		     (char *)NULL);
+	(void)fprintf(stderr, "gpsload: can't run %s: %s\n",
+		      gpsd, strerror(errno));
+	_exit(EXIT_FAILURE);
+    }
+    for (i = 0; pid > 0 && i < 100; i++) {
+	socket_t sock = netlib_connectsock(AF_INET, "127.0.0.1", port, "tcp");
+
+	if (sock >= 0) {
+	    (void)close(sock);
+	    return pid;
+	}
+	(void)usleep(50000);
+    }
+    return -1;
+}
+
+static long long percentile(const struct histogram_t *hist, double p)
+/* in microseconds; a bucket's bound may lie past the largest sample */
+{
+    long long ns = hist_percentile(hist, p);
+
+    return (ns < hist->max ? ns : hist->max) / 1000;
+}
+
+static int watch_list(char *arg, const struct watch_t **list)
+/* parse a comma-separated list of watch policies */
+{
+    char *name, *save = NULL;
+    int n = 0, w;
+
+    for (name = strtok_r(arg, ",", &save); name != NULL && n < NWATCHES * 4;
+	 name = strtok_r(NULL, ",", &save)) {
+	for (w = 0; w < NWATCHES; w++)
+	    if (strcmp(name, watches[w].name) == 0)
+		break;
+	if (w == NWATCHES)
+	    return 0;
+	list[n++] = &watches[w];
+    }
+    return n;
+}
+
+static void usage(void)
+{
+    (void)fputs("usage: gpsload [-j] [-c clients] [-d devices] [-g gpsd] "
+		"[-n name]\n"
+		"               [-p json|scaled|nmea|raw,...] [-r rate] "
+		"[-s slow-clients]\n"
+		"               [-t seconds] [-T pty|tcp|udp] logfile...\n",
+		stderr);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *gpsd = "gpsd", *name = NULL;
+    const struct watch_t *policy[NWATCHES * 4] = {&watches[0]};
+    int npolicies = 1, njson = 0;
+    bool json = false;
+    enum transport transport = pty;
+    double rate = 10, seconds = 10;
+    int nslow = 0, nlogs, option, i, udpsock = -1;
+    long long period;
+    struct log_t *logs;
+    char sockpath[64], port[16], command[GPS_PATH_MAX + 8];
+    struct timespec start, stop, now;
+    struct histogram_t latency;
+    struct pollfd *fds;
+    struct rusage usage_gpsd;
+    unsigned long packets = 0, bytes = 0, reports = 0, stalls = 0;
+    unsigned long minrx = 0, maxrx = 0, totrx = 0, missing = 0;
+    unsigned long unmatched = 0, dropped = 0, delivered = 0;
+    bool draining = false;
+    pid_t pid;
+    double elapsed, cpu;
+    char policies[NWATCHES * 4 * 8] = "", label[128];
+
+    ndevices = nclients = 1;
+    while ((option = getopt(argc, argv, "c:d:g:jn:p:r:s:t:T:")) != -1) {
+	switch (option) {
+	case 'c':
+	    nclients = atoi(optarg);
+	    break;
+	case 'd':
+	    ndevices = atoi(optarg);
+	    break;
+	case 'g':
+	    gpsd = optarg;
+	    break;
+	case 'j':
+	    json = true;
+	    break;
+	case 'n':
+	    name = optarg;
+	    break;
+	case 'p':
+	    if ((npolicies = watch_list(optarg, policy)) == 0)
+		usage();
+	    break;
+	case 'r':
+	    rate = safe_atof(optarg);
+	    break;
+	case 's':
+	    nslow = atoi(optarg);
+	    break;
+	case 't':
+	    seconds = safe_atof(optarg);
+	    break;
+	case 'T':
+	    if (strcmp(optarg, "pty") == 0)
+		transport = pty;
+	    else if (strcmp(optarg, "tcp") == 0)
+		transport = tcp;
+	    else if (strcmp(optarg, "udp") == 0)
+		transport = udp;
+	    else
+		usage();
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind >= argc || ndevices < 1 || nclients < 0 || rate < 0
+	|| nslow > nclients)
+	usage();
+
+    gps_context_init(&context, "gpsload");
+    nlogs = argc - optind;
+    if ((logs = calloc((size_t)nlogs, sizeof(*logs))) == NULL
+	|| (devices = calloc((size_t)ndevices, sizeof(*devices))) == NULL
+	|| (clients = calloc((size_t)nclients + 1, sizeof(*clients))) == NULL
+	|| (fds = calloc((size_t)(2 * ndevices + nclients),
+			 sizeof(*fds))) == NULL) {
+	(void)fputs("gpsload: out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < nlogs; i++)
+	if (!load_log(&logs[i], argv[optind + i]))
+	    exit(EXIT_FAILURE);
+
+    (void)signal(SIGPIPE, SIG_IGN);
+    (void)signal(SIGINT, onsig);
+    (void)signal(SIGTERM, onsig);
+    (void)snprintf(sockpath, sizeof(sockpath), "/tmp/gpsload.%d.sock",
+		   (int)getpid());
+    (void)snprintf(port, sizeof(port), "%d", free_port(SOCK_STREAM));
+    if ((pid = spawn(gpsd, sockpath, port)) < 0) {
+	(void)fprintf(stderr, "gpsload: %s did not start\n", gpsd);
+	exit(EXIT_FAILURE);
+    }
+
+    /* watchers first, so they see every device from its first fix */
+    for (i = 0; i < nclients; i++) {
+	struct client_t *client = &clients[i];
+
+	client->fd = netlib_connectsock(AF_INET, "127.0.0.1", port, "tcp");
+	client->watch = policy[i % npolicies];
+	client->slow = i < nslow;
+	if (client->fd < 0
+	    || write(client->fd, client->watch->request,
+		     strlen(client->watch->request)) <= 0) {
+	    (void)fprintf(stderr, "gpsload: client %d can't connect\n", i);
+	    client->dropped = true;
+	    client->fd = -1;
+	    continue;
+	}
+	(void)fcntl(client->fd, F_SETFL,
+		    fcntl(client->fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    if (transport == udp && (udpsock = socket(AF_INET, SOCK_DGRAM, 0)) < 0) {
+	(void)fprintf(stderr, "gpsload: no UDP socket: %s\n", strerror(errno));
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < ndevices; i++) {
+	struct device_t *dev = &devices[i];
+
+	dev->log = &logs[i % nlogs];
+	if (!device_open(dev, transport, udpsock)) {
+	    (void)fprintf(stderr, "gpsload: can't make device %d: %s\n",
+			  i, strerror(errno));
+	    exit(EXIT_FAILURE);
+	}
+	(void)snprintf(command, sizeof(command), "+%s\r\n", dev->path);
+	if (!control(sockpath, command))
+	    (void)fprintf(stderr, "gpsload: gpsd refused %s; "
+			  "is max_devices big enough?\n", dev->path);
+    }
+
+    /* stagger the devices across one packet period */
+    period = rate > 0 ? (long long)(1e9 / rate) : 0;
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < ndevices; i++) {
+	long long lag = period * i / ndevices;
+
+	devices[i].due = start;
+	ts_add_ns(&devices[i].due, lag);
+    }
+    stop = start;
+    ts_add_ns(&stop, (long long)(seconds * 1e9));
+    hist_clear(&latency);
+
+    while (interrupted == 0) {
+	long long wait = 100000000LL;	/* ns */
+	int nfds = 0;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	if (!draining && timespec_diff_ns(now, stop) >= 0) {
+	    draining = true;
+	    stop.tv_sec += DRAIN_SECONDS;
+	} else if (draining && timespec_diff_ns(now, stop) >= 0)
+	    break;
+
+	for (i = 0; i < ndevices && !draining; i++) {
+	    struct device_t *dev = &devices[i];
+	    long long until;
+
+	    if (dev->fd < 0)
+		continue;
+	    /* a device that can't keep up skips ahead, not bursts */
+	    if (period > 0 && timespec_diff_ns(now, dev->due) > NS_IN_SEC)
+		dev->due = now;
+	    while (dev->offset == 0 && timespec_diff_ns(now, dev->due) >= 0) {
+		unsigned long before = dev->packets;
+
+		device_send(dev, transport, &now);
+		if (dev->packets == before)
+		    break;		/* blocked or partial */
+		if (period == 0) {
+		    dev->due = now;
+		    break;
+		}
+		ts_add_ns(&dev->due, period);
+	    }
+	    until = timespec_diff_ns(dev->due, now);
+	    if (until < wait)
+		wait = until > 0 ? until : 0;
+	}
+
+	/* devices: accept, drain what gpsd writes them, finish partials */
+	for (i = 0; i < ndevices; i++) {
+	    struct device_t *dev = &devices[i];
+
+	    if (dev->fd < 0 && dev->listener >= 0) {
+		fds[nfds].fd = dev->listener;
+		fds[nfds++].events = POLLIN;
+	    } else if (dev->fd >= 0 && transport != udp) {
+		fds[nfds].fd = dev->fd;
+		fds[nfds++].events = POLLIN | (dev->offset ? POLLOUT : 0);
+	    }
+	}
+	for (i = 0; i < nclients; i++)
+	    if (clients[i].fd >= 0) {
+		fds[nfds].fd = clients[i].fd;
+		fds[nfds++].events = POLLIN;
+	    }
+	if (poll(fds, (nfds_t)nfds, (int)(wait / 1000000)) < 0
+	    && errno != EINTR)
+	    break;
+
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	nfds = 0;
+	for (i = 0; i < ndevices; i++) {
+	    struct device_t *dev = &devices[i];
+	    char junk[BUFSIZ];
+
+	    if (dev->fd < 0 && dev->listener >= 0) {
+		if ((fds[nfds++].revents & POLLIN) != 0
+		    && (dev->fd = accept(dev->listener, NULL, NULL)) >= 0)
+		    (void)fcntl(dev->fd, F_SETFL,
+				fcntl(dev->fd, F_GETFL) | O_NONBLOCK);
+	    } else if (dev->fd >= 0 && transport != udp) {
+		short revents = fds[nfds++].revents;
+
+		if ((revents & POLLIN) != 0)
+		    (void)read(dev->fd, junk, sizeof(junk));
+		if ((revents & POLLOUT) != 0 && !draining)
+		    device_send(dev, transport, &now);
+	    }
+	}
+	for (i = 0; i < nclients; i++)
+	    if (clients[i].fd >= 0
+		&& (fds[nfds++].revents & (POLLIN | POLLHUP | POLLERR)) != 0)
+		client_read(&clients[i], &now, &latency);
+    }
+    elapsed = (double)timespec_diff_ns(now, start) / 1e9 - DRAIN_SECONDS;
+
+    (void)kill(pid, SIGTERM);
+    (void)waitpid(pid, NULL, 0);
+    (void)getrusage(RUSAGE_CHILDREN, &usage_gpsd);
+    (void)unlink(sockpath);
+
+    for (i = 0; i < ndevices; i++) {
+	packets += devices[i].packets;
+	bytes += devices[i].bytes;
+	reports += devices[i].reports;
+	stalls += devices[i].stalls;
+    }
+    for (i = 0; i < nclients; i++) {
+	unsigned long rx = clients[i].reports;
+
+	delivered += clients[i].bytes;
+	if (clients[i].dropped)
+	    dropped++;
+	/* only JSON watchers get reports we can count, and a slow
+	 * one's shortfall is of our making */
+	if (clients[i].watch == NULL || !clients[i].watch->json
+	    || clients[i].slow)
+	    continue;
+	if (njson++ == 0 || rx < minrx)
+	    minrx = rx;
+	if (rx > maxrx)
+	    maxrx = rx;
+	totrx += rx;
+	if (rx < reports)
+	    missing += reports - rx;
+	unmatched += clients[i].unmatched;
+    }
+    cpu = usage_gpsd.ru_utime.tv_sec + usage_gpsd.ru_utime.tv_usec / 1e6
+	+ usage_gpsd.ru_stime.tv_sec + usage_gpsd.ru_stime.tv_usec / 1e6;
+    for (i = 0; i < npolicies; i++)
+	(void)snprintf(policies + strlen(policies),
+		       sizeof(policies) - strlen(policies), "%s%s",
+		       i > 0 ? "," : "", policy[i]->name);
+    if (name == NULL) {
+	(void)snprintf(label, sizeof(label), "%s-d%d-r%g-c%d-s%d-%s",
+		       transports[transport], ndevices, rate, nclients, nslow,
+		       policies);
+	name = label;
+    }
+
+    if (json) {
+	/* one line a CI job can keep, to watch the trend */
+	(void)printf("{\"class\":\"LOAD\",\"name\":\"%s\","
+		     "\"revision\":\"%s\",\"transport\":\"%s\","
+		     "\"devices\":%d,\"rate\":%g,\"clients\":%d,"
+		     "\"slow\":%d,\"policies\":\"%s\",\"seconds\":%.3f,"
+		     "\"packets\":%lu,\"bytes\":%lu,\"packets_per_sec\":%.1f,"
+		     "\"stalls\":%lu,\"reports\":%lu,\"received_min\":%lu,"
+		     "\"received_mean\":%.1f,\"received_max\":%lu,"
+		     "\"missed\":%lu,\"dropped\":%lu,\"unmatched\":%lu,"
+		     "\"delivered_bytes\":%lu,",
+		     name, REVISION, transports[transport], ndevices, rate,
+		     nclients, nslow, policies, elapsed, packets, bytes,
+		     elapsed > 0 ? packets / elapsed : 0, stalls, reports,
+		     minrx, njson > 0 ? (double)totrx / njson : 0, maxrx,
+		     missing, dropped, unmatched, delivered);
+	(void)printf("\"latency_us\":{\"count\":%lu,\"min\":%lld,"
+		     "\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld,"
+		     "\"max\":%lld},", latency.count,
+		     latency.min / 1000, percentile(&latency, 50),
+		     percentile(&latency, 90), percentile(&latency, 99),
+		     percentile(&latency, 99.9), latency.max / 1000);
+	(void)printf("\"cpu_seconds\":%.3f,\"cpu_ns_per_packet\":%.0f,"
+		     "\"maxrss_kb\":%ld}\n", cpu,
+		     packets > 0 ? cpu * 1e9 / packets : 0,
+		     usage_gpsd.ru_maxrss);
+	exit(EXIT_SUCCESS);
+    }
+
+    (void)printf("run:     %s, %.1f s\n", name, elapsed);
+    (void)printf("fed:     %lu packets, %lu bytes, %.0f packets/s, "
+		 "%lu stalls\n", packets, bytes,
+		 elapsed > 0 ? packets / elapsed : 0, stalls);
+    (void)printf("reports: %lu fixes completed; per JSON client min %lu, "
+		 "mean %.0f, max %lu\n", reports, minrx,
+		 njson > 0 ? (double)totrx / njson : 0, maxrx);
+    (void)printf("sent:    %lu bytes to clients\n", delivered);
+    (void)printf("lost:    %lu reports missed, %lu clients dropped, "
+		 "%lu unmatched\n", missing, dropped, unmatched);
+    if (latency.count > 0)
+	(void)printf("latency: %lu samples, us: min %lld, p50 %lld, p90 %lld, "
+		     "p99 %lld, p99.9 %lld, max %lld\n", latency.count,
+		     latency.min / 1000, percentile(&latency, 50),
+		     percentile(&latency, 90), percentile(&latency, 99),
+		     percentile(&latency, 99.9), latency.max / 1000);
+    (void)printf("gpsd:    %.2f s CPU, %.0f ns per packet, %ld KB peak RSS\n",
+		 cpu, packets > 0 ? cpu * 1e9 / packets : 0,
+		 usage_gpsd.ru_maxrss);
+    exit(EXIT_SUCCESS);
+}
+
+/* gpsload.c ends here */
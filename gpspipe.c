@@ -16,6 +16,9 @@
  * This will dump the GPSD and the NMEA sentences from gpsd to stdout
  *      gpspipe -wr
  *
+ * This will write fixes and AIS positions to a columnar archive
+ *      gpspipe -A -o track.gar
+ *
  * Original code by: Gary E. Miller <gem@rellim.com>.  Cleanup by ESR.
  *
  * This file is Copyright (c) 2010 by the GPSD project
@@ -34,6 +37,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <signal.h>
 #include <string.h>
 #include <strings.h>
 #include <fcntl.h>
@@ -55,6 +59,8 @@
 #include <unistd.h>
 
 #include "gpsd.h"
+#include "archive.h"
+#include "gps_json.h"
 
 #include "gpsd_config.h"
 #include "gpsdclient.h"
@@ -72,6 +78,13 @@ static int fd_out = 1;		/* output initially goes to standard output */
 static char serbuf[255];
 static int debug;
 
+/* for -A; big, so not on the stack */
+static struct archive_writer_t writer;
+static char archbuf[GPS_JSON_RESPONSE_MAX * 4];
+static size_t archlen;
+static bool archtrunc;
+static volatile sig_atomic_t archstop;
+
 static void open_serial(char *device)
 /* open the serial port and set it up */
 {
@@ -108,6 +121,52 @@ static void open_serial(char *device)
 #endif /* HAVE_TERMIOS_H */
 }
 
+static void archive_exit(void)
+/* don't lose the partial blocks */
+{
+    if (archive_flush(&writer) != 0)
+	(void)fprintf(stderr, "gpspipe: archive write error, %s(%d)\n",
+		      strerror(errno), errno);
+}
+
+static void archive_stop(int sig)
+/* let the main loop exit, and the exit handler flush */
+{
+    (void)sig;
+    archstop = 1;
+}
+
+static void archive_char(char c)
+/* collect JSON a character at a time, filing reports a line at a time */
+{
+    struct timespec now;
+
+    if (c != '\n') {
+	if (archlen < sizeof(archbuf) - 1)
+	    archbuf[archlen++] = c;
+	else
+	    archtrunc = true;
+	return;
+    }
+    archbuf[archlen] = '\0';
+    if (!archtrunc && archlen > 0) {
+	gpsdata.set = 0;
+	(void)gps_unpack(archbuf, &gpsdata);
+	if ((gpsdata.set & MODE_SET) != 0
+	    && archive_put_fix(&writer, &gpsdata.fix) != 0)
+	    archive_exit();
+	if ((gpsdata.set & AIS_SET) != 0) {
+	    /* AIS carries no date, so file it under when we heard it */
+	    (void)clock_gettime(CLOCK_REALTIME, &now);
+	    if (archive_put_ais(&writer, &gpsdata.ais,
+				now.tv_sec + now.tv_nsec / 1e9) != 0)
+		archive_exit();
+	}
+    }
+    archlen = 0;
+    archtrunc = false;
+}
+
 static void usage(void)
 {
     (void)fprintf(stderr,
@@ -118,6 +177,7 @@ static void usage(void)
 		  "-r Dump raw NMEA.\n"
 		  "-R Dump super-raw mode (GPS binary).\n"
 		  "-w Dump gpsd native data.\n"
+		  "-A Write fixes and AIS positions as a binary archive.\n"
 		  "-S Set scaled flag.\n"
 		  "-2 Set the split24 flag.\n"
 		  "-l Sleep for ten seconds before connecting to gpsd.\n"
@@ -130,7 +190,7 @@ static void usage(void)
 		  "-p Include profiling info in the JSON.\n"
 		  "-P Include PPS JSON in NMEA or raw mode.\n"
 		  "-V Print version and exit.\n\n"
-		  "You must specify one, or more, of -r, -R, or -w\n"
+		  "You must specify one, or more, of -r, -R, or -w, or else -A\n"
 		  "You must use -o if you use -d.\n");
 }
 
@@ -147,6 +207,8 @@ int main(int argc, char **argv)
     bool raw = false;
     bool watch = false;
     bool profile = false;
+    bool archive = false;
+    time_t flushed = 0;
     int option_u = 0;                   // option to show uSeconds
     long count = -1;
     int option;
@@ -160,8 +222,12 @@ int main(int argc, char **argv)
     char *outfile = NULL;
 
     flags = WATCH_ENABLE;
-    while ((option = getopt(argc, argv, "?dD:lhrRwStT:vVn:s:o:pPu2")) != -1) {
+    while ((option = getopt(argc, argv, "?AdD:lhrRwStT:vVn:s:o:pPu2")) != -1) {
 	switch (option) {
+	case 'A':
+	    flags |= WATCH_JSON;
+	    archive = true;
+	    break;
 	case 'D':
 	    debug = atoi(optarg);
 #ifdef CLIENTDEBUG_ENABLE
@@ -253,11 +319,20 @@ int main(int argc, char **argv)
 	exit(EXIT_FAILURE);
     }
 
-    if (!raw && !watch && !binary) {
+    if (!raw && !watch && !binary && !archive) {
+	(void)fprintf(stderr,
+		      "gpspipe: one of '-R', '-r', '-w' or '-A' is required.\n");
+	exit(EXIT_FAILURE);
+    }
+
+    if (archive && (raw || watch || binary || timestamp || serialport)) {
 	(void)fprintf(stderr,
-		      "gpspipe: one of '-R', '-r', or '-w' is required.\n");
+		      "gpspipe: '-A' can't be mixed with other output.\n");
 	exit(EXIT_FAILURE);
     }
+    /* the archive wants positions as the AIS spec has them */
+    if (archive)
+	flags &= ~WATCH_SCALED;
 
     /* Daemonize if the user requested it. */
     if (daemonize)
@@ -276,7 +351,9 @@ int main(int argc, char **argv)
     if (outfile == NULL) {
 	fp = stdout;
     } else {
-	if (binary)
+	if (archive)
+	    fp = fopen(outfile, "ab");	/* archives grow by appending */
+	else if (binary)
 	    fp = fopen(outfile, "wb");
 	else
 	    fp = fopen(outfile, "w");
@@ -289,6 +366,15 @@ int main(int argc, char **argv)
 	}
     }
 
+    if (archive) {
+	archive_writer_init(&writer, fp);
+	(void)atexit(archive_exit);
+	(void)signal(SIGINT, archive_stop);
+	(void)signal(SIGTERM, archive_stop);
+	(void)signal(SIGHUP, archive_stop);
+	flushed = time(NULL);
+    }
+
     /* Open the serial port and set it up. */
     if (serialport)
 	open_serial(serialport);
@@ -313,6 +399,14 @@ int main(int argc, char **argv)
 	int r = 0;
 	struct timeval tv;
 
+	if (archstop)
+	    exit(EXIT_SUCCESS);
+	/* bound what a crash can lose from a slow trickle of reports */
+	if (archive && time(NULL) - flushed >= 60) {
+	    archive_exit();
+	    flushed = time(NULL);
+	}
+
 	tv.tv_sec = 0;
 	tv.tv_usec = 100000;
 	FD_ZERO(&fds);
@@ -323,7 +417,7 @@ int main(int argc, char **argv)
 	    (void)fprintf(stderr, "gpspipe: select error %s(%d)\n",
 			  strerror(errno), errno);
 	    exit(EXIT_FAILURE);
-	} else if (r == 0)
+	} else if (r <= 0)
 		continue;
 
 	if (vflag)
@@ -337,6 +431,13 @@ int main(int argc, char **argv)
 	    int j = 0;
 	    for (i = 0; i < r; i++) {
 		char c = buf[i];
+
+		if (archive) {
+		    archive_char(c);
+		    if (c == '\n' && count > 0 && --count <= 0)
+			exit(EXIT_SUCCESS);
+		    continue;
+		}
 		if (j < (int)(sizeof(serbuf) - 1)) {
 		    serbuf[j++] = buf[i];
 		}
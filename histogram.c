@@ -0,0 +1,98 @@
+/*
+ * histogram.c - log-linear histograms of nanosecond intervals
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+
+#include <stdbool.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "os_compat.h"
+#include "strfuncs.h"
+
+static int hist_index(unsigned long long value)
+/* the bucket a magnitude falls in */
+{
+    int bits = 0, range;
+
+    if (value < HIST_SUB)
+	return (int)value;
+    while ((value >> bits) >= 2 * HIST_SUB)
+	bits++;
+    /* now value >> bits is in [HIST_SUB, 2 * HIST_SUB) */
+    range = bits + 1;
+    if (range >= HIST_RANGES)
+	return HIST_BUCKETS - 1;
+    return range * HIST_SUB + (int)((value >> bits) - HIST_SUB);
+}
+
+static long long hist_value(int index)
+/* the middle of a bucket */
+{
+    int range = index / HIST_SUB, sub = index % HIST_SUB;
+
+    if (range == 0)
+	return sub;
+    return ((long long)(HIST_SUB + sub) << (range - 1))
+	+ ((1LL << (range - 1)) / 2);
+}
+
+void hist_clear(volatile struct histogram_t *hist)
+/* forget every sample */
+{
+    memset((void *)hist, 0, sizeof(*hist));
+}
+
+void hist_record(volatile struct histogram_t *hist, long long value)
+/* add one sample */
+{
+    if (hist->count == 0 || value < hist->min)
+	hist->min = value;
+    if (hist->count == 0 || value > hist->max)
+	hist->max = value;
+    hist->sum += (double)value;
+    hist->buckets[hist_index(value < 0 ? -value : value)]++;
+    hist->count++;
+}
+
+long long hist_percentile(volatile const struct histogram_t *hist,
+			  double percent)
+/* magnitude that percent of the samples do not exceed */
+{
+    unsigned long want, seen = 0;
+    int i;
+
+    if (hist->count == 0)
+	return 0;
+    want = (unsigned long)(hist->count * percent / 100.0 + 0.5);
+    if (want == 0)
+	want = 1;
+    for (i = 0; i < HIST_BUCKETS; i++) {
+	seen += hist->buckets[i];
+	if (seen >= want)
+	    return hist_value(i);
+    }
+    return hist_value(HIST_BUCKETS - 1);
+}
+
+void hist_dump(volatile const struct histogram_t *hist, const char *name,
+	       char *reply, size_t replylen)
+/* append a histogram summary as a named JSON object, plus a comma */
+{
+    str_appendf(reply, replylen, "\"%s\":{\"count\":%lu", name, hist->count);
+    if (hist->count > 0)
+	str_appendf(reply, replylen,
+		    ",\"min\":%lld,\"max\":%lld,\"mean\":%lld,"
+		    "\"p50\":%lld,\"p90\":%lld,\"p99\":%lld,\"p999\":%lld",
+		    hist->min, hist->max,
+		    (long long)(hist->sum / hist->count),
+		    hist_percentile(hist, 50),
+		    hist_percentile(hist, 90),
+		    hist_percentile(hist, 99),
+		    hist_percentile(hist, 99.9));
+    (void)strlcat(reply, "},", replylen);
+}
+
+/* end */
@@ -0,0 +1,41 @@
+/*
+ * histogram.h - log-linear histograms of nanosecond intervals
+ *
+ * These are in the style of HdrHistogram: a value lands in one of
+ * HIST_SUB buckets spanning its power of two, so any value is known to
+ * within 1/HIST_SUB of itself however large it is, and a histogram is a
+ * fixed-size array that is cheap to update from a time-critical thread.
+ *
+ * Values are signed; percentiles are of their magnitudes, while min,
+ * max and mean keep the sign.  A histogram has a single writer.  Readers
+ * in other threads may see a sample half-recorded, which skews the
+ * summary by at most one sample.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#ifndef _GPSD_HISTOGRAM_H_
+#define _GPSD_HISTOGRAM_H_
+
+#include <stddef.h>
+
+#define HIST_SUB_BITS	4		/* 16 buckets per power of two */
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_RANGES	34		/* covers up to 2^37 ns, about 137 s */
+#define HIST_BUCKETS	(HIST_RANGES * HIST_SUB)
+
+struct histogram_t {
+    unsigned long count;
+    long long min, max;			/* nanoseconds */
+    double sum;				/* nanoseconds, for the mean */
+    unsigned int buckets[HIST_BUCKETS];
+};
+
+extern void hist_clear(volatile struct histogram_t *);
+extern void hist_record(volatile struct histogram_t *, long long);
+extern long long hist_percentile(volatile const struct histogram_t *,
+				 double);
+extern void hist_dump(volatile const struct histogram_t *, const char *,
+		      char *, size_t);
+
+#endif /* _GPSD_HISTOGRAM_H_ */
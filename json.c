@@ -609,9 +609,7 @@ int json_read_array(const char *cp, const struct json_array_t *arr,
 	goto breakout;
 
     for (offset = 0; offset < arr->maxlen; offset++) {
-#ifndef JSON_MINIMAL
 	char *ep = NULL;
-#endif /* JSON_MINIMAL */
 	json_debug_trace((1, "Looking at %s\n", cp));
 	switch (arr->element_type) {
 	case t_string:
@@ -652,24 +650,21 @@ int json_read_array(const char *cp, const struct json_array_t *arr,
 		return substatus;
 	    }
 	    break;
+	/* integer lists are needed by WATCH filters, so always compiled */
 	case t_integer:
-#ifndef JSON_MINIMAL
 	    arr->arr.integers.store[offset] = (int)strtol(cp, &ep, 0);
 	    if (ep == cp)
 		return JSON_ERR_BADNUM;
 	    else
 		cp = ep;
 	    break;
-#endif /* JSON_MINIMAL */
 	case t_uinteger:
-#ifndef JSON_MINIMAL
 	    arr->arr.uintegers.store[offset] = (unsigned int)strtoul(cp, &ep, 0);
 	    if (ep == cp)
 		return JSON_ERR_BADNUM;
 	    else
 		cp = ep;
 	    break;
-#endif /* JSON_MINIMAL */
 	case t_short:
 #ifndef JSON_MINIMAL
 	    arr->arr.shorts.store[offset] = (short)strtol(cp, &ep, 0);
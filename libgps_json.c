@@ -376,6 +376,7 @@ int json_pps_read(const char *buf, struct gps_data_t *gpsdata,
 			         .dflt.integer = 0},
 	{"precision", t_integer, .addr.integer = &precision,
 			         .dflt.integer = 0},
+	{"holdover",  t_ignore},
 	{NULL},
 	/* *INDENT-ON* */
     };
@@ -578,6 +579,11 @@ int libgps_json_unpack(const char *buf,
 	    gpsdata->set |= OSCILLATOR_SET;
 	}
 	return status;
+    } else if (str_starts_with(classtag, "\"class\":\"STATS\"")
+	       || str_starts_with(classtag, "\"class\":\"LATENCY\"")) {
+	/* timing statistics are for monitoring tools; nowhere to put them */
+	gpsdata->set &= ~UNION_SET;
+	return 0;
     } else
 	return -1;
 }
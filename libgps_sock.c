@@ -43,9 +43,9 @@
 struct privdata_t
 {
     bool newstyle;
-    /* data buffered from the last read */
+    /* data buffered from the last read; as big as the daemon's reports */
     ssize_t waiting;
-    char buffer[GPS_JSON_RESPONSE_MAX * 2];
+    char buffer[GPS_JSON_RESPONSE_MAX * 4];
 #ifdef LIBGPS_DEBUG
     int waitcount;
 #endif /* LIBGPS_DEBUG */
@@ -27,6 +27,7 @@
 
 #include <stdbool.h>
 #include <libgen.h>
+#include <limits.h>
 #include <math.h>
 #include <string.h>
 #include <stdarg.h>
@@ -45,6 +46,7 @@
 #include "gpsd.h"
 #include "matrix.h"
 #include "strfuncs.h"
+#include "timespec.h"
 #if defined(NMEA2000_ENABLE)
 #include "driver_nmea2000.h"
 #endif /* defined(NMEA2000_ENABLE) */
@@ -321,6 +323,7 @@ void gpsd_init(struct gps_device_t *session, struct gps_context_t *context,
     session->sourcetype = source_unknown;	/* gpsd_open() sets this */
     session->servicetype = service_unknown;	/* gpsd_open() sets this */
     session->context = context;
+    memset(&session->netgnss, 0, sizeof(session->netgnss));
     memset( session->subtype, 0, sizeof( session->subtype));
     gps_clear_fix(&session->gpsdata.fix);
     gps_clear_fix(&session->newdata);
@@ -333,6 +336,7 @@ void gpsd_init(struct gps_device_t *session, struct gps_context_t *context,
 #ifdef TIMING_ENABLE
     session->sor = 0.0;
     session->chars = 0;
+    hist_clear(&session->locktime);
 #endif /* TIMING_ENABLE */
     /* tty-level initialization */
     gpsd_tty_init(session);
@@ -361,6 +365,16 @@ void gpsd_deactivate(struct gps_device_t *session)
     gpsd_log(&session->context->errout, LOG_INF,
 	     "closing GPS=%s (%d)\n",
 	     session->gpsdata.dev.path, session->gpsdata.gps_fd);
+    if (session->lexer.discarded > 0)
+	gpsd_log(&session->context->errout, LOG_INF,
+		 "%s: lost sync %lu times, discarding %lu of %lu bytes\n",
+		 session->gpsdata.dev.path, session->lexer.resyncs,
+		 session->lexer.discarded, session->lexer.char_counter);
+#ifdef NETFEED_ENABLE
+    if (session->servicetype == service_ntrip
+	|| session->servicetype == service_dgpsip)
+	netgnss_close(session);
+#endif /* NETFEED_ENABLE */
 #if defined(NMEA2000_ENABLE)
     if (session->sourcetype == source_can)
         (void)nmea2000_close(session);
@@ -432,15 +446,98 @@ void gpsd_clear(struct gps_device_t *session)
 #ifdef PPS_ENABLE
     /* set up the context structure for the PPS thread monitor */
     memset((void *)&session->pps_thread, 0, sizeof(session->pps_thread));
+    memset(&session->pps_cursor, 0, sizeof(session->pps_cursor));
+    hist_clear(&session->pps_offset);
+    hist_clear(&session->pps_latency);
+    hist_clear(&session->pps_fixdelta);
+    memset(&session->fixoffset, 0, sizeof(session->fixoffset));
+    memset(&session->holdover, 0, sizeof(session->holdover));
     session->pps_thread.devicefd = session->gpsdata.gps_fd;
     session->pps_thread.devicename = session->gpsdata.dev.path;
     session->pps_thread.log_hook = ppsthread_log;
     session->pps_thread.context = (void *)session;
 #endif /* PPS_ENABLE */
+#ifdef TIMING_ENABLE
+    memset(&session->latency, 0, sizeof(session->latency));
+#endif /* TIMING_ENABLE */
 
     session->opentime = time(NULL);
+    session->huntstart = timestamp();
+    session->huntspeeds = 0;
 }
 
+static void gpsd_lock_mark(struct gps_device_t *session)
+/* the first packet since opening the device; note how long sync took */
+{
+    timestamp_t locktime = timestamp() - session->huntstart;
+
+    gpsd_log(&session->context->errout, LOG_INF,
+	     "%s: sync after %.3f sec, %lu bytes discarded, "
+	     "%u speed changes\n",
+	     session->gpsdata.dev.path, locktime,
+	     session->lexer.discarded, session->huntspeeds);
+#ifdef TIMING_ENABLE
+    hist_record(&session->locktime, (long long)(locktime * 1e9));
+#endif /* TIMING_ENABLE */
+    session->huntstart = 0;
+}
+
+#ifdef TIMING_ENABLE
+void gpsd_latency_mark(struct gps_device_t *session, int stage)
+/* a fix report has reached a stage; time it from the one before */
+{
+    struct latency_t *lat = &session->latency;
+
+    /* not being timed, or already timed for an earlier client */
+    if (lat->mark[stage - 1].tv_sec == 0 || lat->mark[stage].tv_sec != 0)
+	return;
+    (void)clock_gettime(CLOCK_MONOTONIC, &lat->mark[stage]);
+    hist_record(&lat->stage[stage],
+		timespec_diff_ns(lat->mark[stage], lat->mark[stage - 1]));
+    if (stage == LAT_SEND)
+	hist_record(&lat->stage[LAT_READ],
+		    timespec_diff_ns(lat->mark[LAT_SEND],
+				     lat->mark[LAT_READ]));
+}
+
+void gpsd_latency_dump(const struct gps_device_t *session,
+		       char *reply, size_t replylen)
+/* append a device's fix report latencies as a JSON object, plus a comma */
+{
+    const struct latency_t *lat = &session->latency;
+
+    if (lat->stage[LAT_PACKET].count == 0 && session->locktime.count == 0)
+	return;
+    str_appendf(reply, replylen, "{\"path\":\"%s\",",
+		session->gpsdata.dev.path);
+    hist_dump(&session->locktime, "lock", reply, replylen);
+    hist_dump(&lat->stage[LAT_PACKET], "packet", reply, replylen);
+    hist_dump(&lat->stage[LAT_PARSE], "parse", reply, replylen);
+    hist_dump(&lat->stage[LAT_REPORT], "report", reply, replylen);
+    hist_dump(&lat->stage[LAT_SEND], "send", reply, replylen);
+    hist_dump(&lat->stage[LAT_READ], "total", reply, replylen);
+    str_rstrip_char(reply, ',');
+    (void)strlcat(reply, "},", replylen);
+}
+#endif /* TIMING_ENABLE */
+
+#ifdef NETFEED_ENABLE
+static void gpsd_kernel_stamps(struct gps_device_t *session, socket_t dsock)
+/* ask the kernel to timestamp data arriving on a feed socket */
+{
+#ifdef SO_TIMESTAMPNS
+    int on = 1;
+
+    if (setsockopt(dsock, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) == 0)
+	session->lexer.kernel_stamps = true;
+    else
+	gpsd_log(&session->context->errout, LOG_WARN,
+		 "no kernel timestamps on fd %d: %s\n",
+		 dsock, strerror(errno));
+#endif /* SO_TIMESTAMPNS */
+}
+#endif /* NETFEED_ENABLE */
+
 int gpsd_open(struct gps_device_t *session)
 /* open a device for access to its data *
  * return: the opened file descriptor
@@ -485,6 +582,7 @@ int gpsd_open(struct gps_device_t *session)
 		     "TCP device opened on fd %d\n", dsock);
 	session->gpsdata.gps_fd = dsock;
 	session->sourcetype = source_tcp;
+	gpsd_kernel_stamps(session, dsock);
 	return session->gpsdata.gps_fd;
     /* or could be UDP */
     } else if (str_starts_with(session->gpsdata.dev.path, "udp://")) {
@@ -512,6 +610,7 @@ int gpsd_open(struct gps_device_t *session)
 		     "UDP device opened on fd %d\n", dsock);
 	session->gpsdata.gps_fd = dsock;
 	session->sourcetype = source_udp;
+	gpsd_kernel_stamps(session, dsock);
 	return session->gpsdata.gps_fd;
     }
 #endif /* NETFEED_ENABLE */
@@ -542,6 +641,9 @@ int gpsd_open(struct gps_device_t *session)
 	return session->gpsdata.gps_fd;
     }
 #endif /* PASSTHROUGH_ENABLE */
+    /* or a capture to be played back */
+    if (str_starts_with(session->gpsdata.dev.path, "replay://"))
+	return replay_open(session);
 #if defined(NMEA2000_ENABLE)
     if (str_starts_with(session->gpsdata.dev.path, "nmea2000://")) {
         return nmea2000_open(session);
@@ -846,8 +948,8 @@ static gps_mask_t fill_dop(const struct gpsd_errout_t *errout,
     return DOP_SET;
 }
 
-static void gpsd_error_model(struct gps_device_t *session,
-			     struct gps_fix_t *fix, struct gps_fix_t *oldfix)
+void gpsd_error_model(struct gps_device_t *session,
+		      struct gps_fix_t *fix, struct gps_fix_t *oldfix)
 /* compute errors and derived quantities */
 {
     /*
@@ -1020,8 +1122,11 @@ int gpsd_await_data(fd_set *rfds,
 		    fd_set *efds,
 		     const int maxfd,
 		     fd_set *all_fds,
+		     fd_set *wfds,
+		     const struct timespec *timeout,
 		     struct gpsd_errout_t *errout)
-/* await data from any socket in the all_fds set */
+/* await data from any socket in the all_fds set, room to write on any
+ * in wfds (which may be NULL), or until timeout expires */
 {
     int status;
 
@@ -1038,11 +1143,15 @@ int gpsd_await_data(fd_set *rfds,
      *
      * pselect() is preferable to vanilla select, to eliminate
      * the once-per-second wakeup when no sensors are attached.
-     * This cuts power consumption.
+     * This cuts power consumption.  Callers that have timed work
+     * pending pass a timeout; everyone else passes NULL and sleeps
+     * until input arrives.  A timeout is reported as AWAIT_GOT_INPUT
+     * with an empty rfds, and so is a descriptor in wfds becoming
+     * writable.
      */
     errno = 0;
 
-    status = pselect(maxfd + 1, rfds, NULL, NULL, NULL, NULL);
+    status = pselect(maxfd + 1, rfds, wfds, NULL, timeout, NULL);
     if (status == -1) {
 	if (errno == EINTR)
 	    return AWAIT_NOT_READY;
@@ -1234,6 +1343,10 @@ gps_mask_t gpsd_poll(struct gps_device_t *session)
 	}
 	return NODATA_IS;
     } else /* (newlen > 0) */ {
+#ifndef FIXED_PORT_SPEED
+	if (session->device_type == NULL)
+	    gpsd_autobaud_sample(session, newlen);
+#endif /* FIXED_PORT_SPEED */
 	gpsd_log(&session->context->errout, LOG_RAW,
 		 "packet sniff on %s finds type %d\n",
 		 session->gpsdata.dev.path, session->lexer.type);
@@ -1291,6 +1404,8 @@ gps_mask_t gpsd_poll(struct gps_device_t *session)
 			break;
 		    }
 	    }
+	    if (session->huntstart > 0)
+		gpsd_lock_mark(session);
 	    session->badcount = 0;
 	    session->gpsdata.dev.driver_mode = (session->lexer.type > NMEA_PACKET) ? MODE_BINARY : MODE_NMEA;
 	    /* FALL THROUGH */
@@ -1311,6 +1426,7 @@ gps_mask_t gpsd_poll(struct gps_device_t *session)
     } else {			/* we have recognized a packet */
 	gps_mask_t received = PACKET_SET;
 	session->gpsdata.online = timestamp();
+	capture_packet(session);
 
 	gpsd_log(&session->context->errout, LOG_RAW + 3,
 		 "Accepted packet on %s.\n",
@@ -1401,7 +1517,19 @@ gps_mask_t gpsd_poll(struct gps_device_t *session)
 #ifdef TIMING_ENABLE
 	/* are we going to generate a report? if so, count characters */
 	if ((received & REPORT_IS) != 0) {
+	    struct latency_t *lat = &session->latency;
+
 	    session->chars = session->lexer.char_counter - session->lexer.start_char;
+	    /* start timing this report on its way to the clients */
+	    memset(lat->mark, 0, sizeof(lat->mark));
+	    lat->mark[LAT_READ] = session->lexer.mono_read;
+	    lat->mark[LAT_PACKET] = session->lexer.mono_packet;
+	    if (lat->mark[LAT_READ].tv_sec != 0) {
+		hist_record(&lat->stage[LAT_PACKET],
+			    timespec_diff_ns(lat->mark[LAT_PACKET],
+					     lat->mark[LAT_READ]));
+		gpsd_latency_mark(session, LAT_PARSE);
+	    }
 	}
 #endif /* TIMING_ENABLE */
 
@@ -1492,27 +1620,45 @@ int gpsd_multipoll(const bool data_ready,
 
 #ifdef NETFEED_ENABLE
 	/*
-	 * Strange special case - the opening transaction on an NTRIP connection
-	 * may not yet be completed.  Try to ratchet things forward.
+	 * Strange special case - the connect or opening transaction on a
+	 * network DGNSS connection may not yet be completed.  Try to
+	 * ratchet things forward.
 	 */
-	if (device->servicetype == service_ntrip
-	    && device->ntrip.conn_state != ntrip_conn_established) {
+	if ((device->servicetype == service_ntrip
+	     || device->servicetype == service_dgpsip)
+	    && !netgnss_streaming(device)) {
+	    int status = netgnss_advance(device);
 
-	    (void)ntrip_open(device, "");
-	    if (device->ntrip.conn_state == ntrip_conn_err) {
+	    if (status == DEVICE_ERROR) {
 		gpsd_log(&device->context->errout, LOG_WARN,
 			 "connection to ntrip server failed\n");
 		device->ntrip.conn_state = ntrip_conn_init;
-		return DEVICE_ERROR;
-	    } else {
-		return DEVICE_READY;
 	    }
+	    return status;
 	}
 #endif /* NETFEED_ENABLE */
 
 	for (fragments = 0; ; fragments++) {
 	    gps_mask_t changed = gpsd_poll(device);
 
+#ifdef NETFEED_ENABLE
+	    /* a dropped DGNSS server is retried after a delay */
+	    if (device->servicetype == service_ntrip
+		|| device->servicetype == service_dgpsip) {
+		if (changed == EOF_IS || changed == ERROR_SET
+		    || (changed == NODATA_IS && fragments == 0
+			&& netgnss_eof(device))) {
+		    gpsd_log(&device->context->errout, LOG_WARN,
+			     "%s: server closed the connection\n",
+			     device->gpsdata.dev.path);
+		    netgnss_fail(device);
+		    return DEVICE_UNREADY;
+		}
+		/* an empty read that isn't EOF: nothing more yet */
+		if (changed == NODATA_IS)
+		    break;
+	    }
+#endif /* NETFEED_ENABLE */
 	    if (changed == EOF_IS) {
 		gpsd_log(&device->context->errout, LOG_WARN,
 			 "device signed off %s\n",
@@ -1536,18 +1682,6 @@ int gpsd_multipoll(const bool data_ready,
 		    if (device->zerokill) {
 			/* failed timeout-and-reawake, kill it */
 			gpsd_deactivate(device);
-			if (device->ntrip.works) {
-			    device->ntrip.works = false; // reset so we try this once only
-			    if (gpsd_activate(device, O_CONTINUE) < 0) {
-				gpsd_log(&device->context->errout, LOG_WARN,
-					 "reconnect to ntrip server failed\n");
-				return DEVICE_ERROR;
-			    } else {
-				gpsd_log(&device->context->errout, LOG_INFO,
-					 "reconnecting to ntrip server\n");
-				return DEVICE_READY;
-			    }
-			}
 		    } else if (reawake_time == 0) {
 			return DEVICE_ERROR;
 		    } else {
@@ -1658,10 +1792,33 @@ void ntp_latch(struct gps_device_t *device, struct timedelta_t *td)
     /* this should be an invariant of the way this function is called */
     assert(isnan(device->newdata.time)==0);
 
-    (void)clock_gettime(CLOCK_REALTIME, &td->clock);
+    /*
+     * Prefer the arrival of the first byte of the packet that carried
+     * the time; stamping now would add read batching and parse delay.
+     */
+    if (device->lexer.first_stamp.tv_sec != 0) {
+	td->clock = device->lexer.first_stamp;
+	/* on a serial line the read completed after the bytes behind it */
+	if ((device->sourcetype == source_rs232
+	     || device->sourcetype == source_usb)
+	    && device->lexer.first_lag > 0) {
+	    long long lag = gpsd_line_time(device, device->lexer.first_lag);
+
+	    td->clock.tv_sec -= (time_t)(lag / NS_IN_SEC);
+	    td->clock.tv_nsec -= (long)(lag % NS_IN_SEC);
+	    TS_NORM(&td->clock);
+	}
+    } else
+	(void)clock_gettime(CLOCK_REALTIME, &td->clock);
     fix_time = device->newdata.time;
 
 #ifdef TIMEHINT_ENABLE
+#ifdef PPS_ENABLE
+    /* what PPS has taught us about this receiver beats a fixed fudge */
+    if (device->context->fixoffset_apply && device->fixoffset.valid)
+	fix_time += device->fixoffset.offset / 1e9;
+    else
+#endif /* PPS_ENABLE */
     /* assume zero when there's no offset method */
     if (device->device_type == NULL
 	|| device->device_type->time_offset == NULL)
@@ -1685,4 +1842,68 @@ void ntp_latch(struct gps_device_t *device, struct timedelta_t *td)
 }
 #endif /* NTP_ENABLE */
 
+/*
+ * Persistent per-device state (learned fix offsets, sync settings) is
+ * kept in small text files of one line per device: the device path,
+ * then fields that are the caller's business.  Lines starting with #
+ * are comments.
+ */
+
+bool gpsd_keyfile_load(struct gps_context_t *context, const char *filename,
+		       const char *what, int max,
+		       bool (*take)(struct gps_context_t *, int,
+				    const char *, const char *))
+/* read a per-device state file; a missing file is not an error */
+{
+    FILE *fp;
+    char line[GPS_PATH_MAX + 64];
+    int n = 0;
+
+    if ((fp = fopen(filename, "r")) == NULL)
+	return errno == ENOENT;
+    while (fgets(line, sizeof(line), fp) != NULL && n < max) {
+	char path[GPS_PATH_MAX];
+	int rest;
+
+	if (line[0] == '#')
+	    continue;
+	/* 127 is GPS_PATH_MAX - 1 */
+	if (sscanf(line, "%127s %n", path, &rest) != 1
+	    || !take(context, n, path, line + rest)) {
+	    gpsd_log(&context->errout, LOG_WARN,
+		     "%s: bad line in %s: %s", what, filename, line);
+	    continue;
+	}
+	n++;
+    }
+    (void)fclose(fp);
+    gpsd_log(&context->errout, LOG_INF,
+	     "%s: %d loaded from %s\n", what, n, filename);
+    return true;
+}
+
+void gpsd_keyfile_save(struct gps_context_t *context, const char *filename,
+		       const char *what, const char *header, int max,
+		       void (*put)(const struct gps_context_t *, int, FILE *))
+/* write out a per-device state file, a line per slot as put() has it */
+{
+    char tmp[PATH_MAX];
+    FILE *fp;
+    int i;
+
+    /* write and rename, so a crash never leaves half a file */
+    (void)snprintf(tmp, sizeof(tmp), "%s.tmp", filename);
+    if ((fp = fopen(tmp, "w")) == NULL) {
+	gpsd_log(&context->errout, LOG_WARN,
+		 "%s: can't save to %s: %s\n", what, tmp, strerror(errno));
+	return;
+    }
+    (void)fprintf(fp, "# %s\n", header);
+    for (i = 0; i < max; i++)
+	put(context, i, fp);
+    if (fclose(fp) != 0 || rename(tmp, filename) != 0)
+	gpsd_log(&context->errout, LOG_WARN,
+		 "%s: can't save to %s: %s\n", what, filename, strerror(errno));
+}
+
 /* end */
@@ -4,11 +4,11 @@
  * BSD terms apply: see the file COPYING in the distribution root for details.
  */
 #include <sys/types.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
-#include <fcntl.h>
 #include <netdb.h>
 #include <sys/socket.h>
 #include <unistd.h>
@@ -18,42 +18,31 @@
 int dgpsip_open(struct gps_device_t *device, const char *dgpsserver)
 /* open a connection to a DGPSIP server */
 {
-    char *colon, *dgpsport = "rtcm-sc104";
-    int opts;
+    char server[strlen(dgpsserver) + 1], *colon, *dgpsport = "rtcm-sc104";
+    char hn[256], buf[BUFSIZ];
 
+    device->servicetype = service_dgpsip;
     device->dgpsip.reported = false;
-    if ((colon = strchr(dgpsserver, ':')) != NULL) {
+    (void)strlcpy(server, dgpsserver, sizeof(server));
+    if ((colon = strchr(server, ':')) != NULL) {
 	dgpsport = colon + 1;
 	*colon = '\0';
     }
-    if (!getservbyname(dgpsport, "tcp"))
+    if (!isdigit((unsigned char)dgpsport[0]) && !getservbyname(dgpsport, "tcp"))
 	dgpsport = DEFAULT_RTCM_PORT;
 
-    device->gpsdata.gps_fd =
-	netlib_connectsock(AF_UNSPEC, dgpsserver, dgpsport, "tcp");
-    // cppcheck-suppress pointerPositive
-    if (device->gpsdata.gps_fd >= 0) {
-	char hn[256], buf[BUFSIZ];
-	gpsd_log(&device->context->errout, LOG_PROG,
-		 "connection to DGPS server %s established.\n",
-		 dgpsserver);
+    if (netgnss_connect(device, server, dgpsport) < 0)
+	return -1;
+    if (device->netgnss.retry == 0) {
 	(void)gethostname(hn, sizeof(hn));
-	/* greeting required by some RTCM104 servers; others will ignore it */
+	/*
+	 * Greeting required by some RTCM104 servers; others will ignore
+	 * it.  It is queued until the connect completes.
+	 */
 	(void)snprintf(buf, sizeof(buf), "HELO %s gpsd %s\r\nR\r\n", hn,
 		       VERSION);
-	if (write(device->gpsdata.gps_fd, buf, strlen(buf)) != (ssize_t) strlen(buf))
-	    gpsd_log(&device->context->errout, LOG_ERROR,
-		     "hello to DGPS server %s failed\n",
-		     dgpsserver);
-    } else
-	gpsd_log(&device->context->errout, LOG_ERROR,
-		 "can't connect to DGPS server %s, netlib error %d.\n",
-		 dgpsserver, device->gpsdata.gps_fd);
-    opts = fcntl(device->gpsdata.gps_fd, F_GETFL);
-
-    if (opts >= 0)
-	(void)fcntl(device->gpsdata.gps_fd, F_SETFL, opts | O_NONBLOCK);
-    device->servicetype = service_dgpsip;
+	(void)netgnss_send(device, buf, strlen(buf));
+    }
     return device->gpsdata.gps_fd;
 }
 
@@ -66,20 +55,18 @@ void dgpsip_report(struct gps_context_t *context,
      * 10 is an arbitrary number, the point is to have gotten several good
      * fixes before reporting usage to our DGPSIP server.
      */
-    if (context->fixcnt > 10 && !dgpsip->dgpsip.reported) {
+    if (context->fixcnt > 10 && !dgpsip->dgpsip.reported
+	&& netgnss_streaming(dgpsip)) {
+	char buf[BUFSIZ];
 	dgpsip->dgpsip.reported = true;
-	if (dgpsip->gpsdata.gps_fd > -1) {
-	    char buf[BUFSIZ];
-	    (void)snprintf(buf, sizeof(buf), "R %0.8f %0.8f %0.2f\r\n",
-			   gps->gpsdata.fix.latitude,
-			   gps->gpsdata.fix.longitude,
-			   gps->gpsdata.fix.altitude);
-	    if (write(dgpsip->gpsdata.gps_fd, buf, strlen(buf)) ==
-		(ssize_t) strlen(buf))
-		gpsd_log(&context->errout, LOG_IO, "=> dgps %s\n", buf);
-	    else
-		gpsd_log(&context->errout, LOG_IO, "write to dgps FAILED\n");
-	}
+	(void)snprintf(buf, sizeof(buf), "R %0.8f %0.8f %0.2f\r\n",
+		       gps->gpsdata.fix.latitude,
+		       gps->gpsdata.fix.longitude,
+		       gps->gpsdata.fix.altitude);
+	if (netgnss_send(dgpsip, buf, strlen(buf))) {
+	    dgpsip->netgnss.reports++;
+	    gpsd_log(&context->errout, LOG_IO, "=> dgps %s\n", buf);
+	} else
+	    gpsd_log(&context->errout, LOG_IO, "write to dgps FAILED\n");
     }
 }
-
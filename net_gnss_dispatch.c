@@ -6,9 +6,11 @@
 
 #include <string.h>
 #include <errno.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/socket.h>
+#include <netdb.h>
 #include <unistd.h>
 
 #include "gpsd.h"
@@ -17,6 +19,12 @@
 #define NETGNSS_DGPSIP	"dgpsip://"
 #define NETGNSS_NTRIP	"ntrip://"
 
+#define NETGNSS_CONNECT_TIMEOUT	10	/* seconds allowed for connect() */
+#define NETGNSS_BACKOFF_MIN	1	/* first reconnect delay, seconds */
+#define NETGNSS_BACKOFF_MAX	300	/* reconnect delay ceiling, seconds */
+#define NETGNSS_STABLE		60	/* uptime that resets the delay */
+#define NETGNSS_TICK		0.05	/* poll interval for connects and output */
+
 bool netgnss_uri_check(char *name)
 /* is given string a valid URI for GNSS/DGPS service? */
 {
@@ -26,9 +34,23 @@ bool netgnss_uri_check(char *name)
 }
 
 
+static void netgnss_forget(struct gps_device_t *dev)
+/* done with the server's addresses, one way or the other */
+{
+    if (dev->netgnss.addrs != NULL)
+	freeaddrinfo(dev->netgnss.addrs);
+    dev->netgnss.addrs = dev->netgnss.addr = NULL;
+}
+
 int netgnss_uri_open(struct gps_device_t *dev, char *netgnss_service)
 /* open a connection to a DGNSS service */
 {
+    /* a fresh attempt; forget any pending connect, output or retry */
+    netgnss_forget(dev);
+    dev->netgnss.connecting = false;
+    dev->netgnss.retry = 0;
+    dev->netgnss.outlen = 0;
+
 #ifdef NTRIP_ENABLE
     if (str_starts_with(netgnss_service, NETGNSS_NTRIP)) {
 	dev->ntrip.conn_state = ntrip_conn_init;
@@ -61,4 +83,318 @@ void netgnss_report(struct gps_context_t *context,
 #endif
 }
 
+static void netgnss_hold(struct gps_device_t *dev, socket_t s)
+/* make s the device's socket, keeping the descriptor number it already has */
+{
+    if (s < 0)
+	return;
+    if (dev->gpsdata.gps_fd < 0)
+	dev->gpsdata.gps_fd = s;
+    else {
+	/* the event loop's fd_set still refers to the old number */
+	(void)dup2(s, dev->gpsdata.gps_fd);
+	(void)close(s);
+    }
+}
+
+socket_t netgnss_connect(struct gps_device_t *dev,
+			 const char *host, const char *port)
+/*
+ * Start a non-blocking connect; on failure, schedule a retry.  The
+ * addresses the name resolves to are kept, so that if the connect to
+ * one fails later, netgnss_step() can go on to the next.
+ */
+{
+    socket_t s;
+
+    netgnss_forget(dev);
+    dev->netgnss.started = timestamp();
+    dev->netgnss.connects++;
+    if ((s = netlib_lookup(AF_UNSPEC, host, port, "tcp",
+			   &dev->netgnss.addrs)) == 0) {
+	dev->netgnss.addr = dev->netgnss.addrs;
+	s = netlib_connect_next(&dev->netgnss.addr);
+    }
+    if (s < 0) {
+	gpsd_log(&dev->context->errout, LOG_ERROR,
+		 "%s: can't connect to %s:%s, %s\n",
+		 dev->gpsdata.dev.path, host, port, netlib_errstr(s));
+	netgnss_fail(dev);
+    } else {
+	netgnss_hold(dev, s);
+	dev->netgnss.connecting = true;
+	gpsd_log(&dev->context->errout, LOG_PROG,
+		 "%s: connecting to %s:%s on fd %d\n",
+		 dev->gpsdata.dev.path, host, port, dev->gpsdata.gps_fd);
+    }
+    return dev->gpsdata.gps_fd;
+}
+
+void netgnss_fail(struct gps_device_t *dev)
+/* drop the connection and back off before trying again */
+{
+    timestamp_t now = timestamp();
+
+#ifdef NTRIP_ENABLE
+    if (dev->servicetype == service_ntrip)
+	ntrip_close(dev);
+#endif
+    /*
+     * An unconnected socket closes the link to the server while keeping
+     * the descriptor number reserved, so nothing else can take it while
+     * it is still in the event loop's bookkeeping.
+     */
+    netgnss_hold(dev, socket(AF_INET, SOCK_STREAM, 0));
+    netgnss_forget(dev);
+    dev->netgnss.connecting = false;
+    dev->netgnss.outlen = 0;
+    dev->netgnss.failures++;
+    if (dev->netgnss.up != 0 && now - dev->netgnss.up > NETGNSS_STABLE)
+	dev->netgnss.backoff = 0;
+    dev->netgnss.up = 0;
+    if (dev->netgnss.backoff < NETGNSS_BACKOFF_MIN)
+	dev->netgnss.backoff = NETGNSS_BACKOFF_MIN;
+    else if ((dev->netgnss.backoff *= 2) > NETGNSS_BACKOFF_MAX)
+	dev->netgnss.backoff = NETGNSS_BACKOFF_MAX;
+    dev->netgnss.retry = now + dev->netgnss.backoff;
+    gpsd_log(&dev->context->errout, LOG_WARN,
+	     "%s: connection lost, retrying in %.0f seconds\n",
+	     dev->gpsdata.dev.path, dev->netgnss.backoff);
+}
+
+void netgnss_established(struct gps_device_t *dev)
+/* the server has started sending corrections */
+{
+    dev->netgnss.up = timestamp();
+    gpsd_log(&dev->context->errout, LOG_INF,
+	     "%s: streaming, %.3f seconds after connect\n",
+	     dev->gpsdata.dev.path, dev->netgnss.up - dev->netgnss.started);
+}
+
+bool netgnss_eof(const struct gps_device_t *dev)
+/* has the server closed its end, or did a read just come up empty? */
+{
+    char c;
+    ssize_t n = recv(dev->gpsdata.gps_fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+
+    if (n < 0)
+	return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+    return n == 0;
+}
+
+static bool netgnss_next(struct gps_device_t *dev)
+/* the connect failed; start one to the server's next address, if any */
+{
+    socket_t s;
+
+    if (dev->netgnss.addr == NULL)
+	return false;
+    dev->netgnss.addr = dev->netgnss.addr->ai_next;
+    if ((s = netlib_connect_next(&dev->netgnss.addr)) < 0)
+	return false;
+    netgnss_hold(dev, s);
+    dev->netgnss.started = timestamp();
+    gpsd_log(&dev->context->errout, LOG_PROG,
+	     "%s: trying the server's next address on fd %d\n",
+	     dev->gpsdata.dev.path, dev->gpsdata.gps_fd);
+    return true;
+}
+
+bool netgnss_streaming(const struct gps_device_t *dev)
+/* is the connection past its handshake and carrying corrections? */
+{
+    if (dev->netgnss.connecting || dev->netgnss.retry != 0)
+	return false;
+#ifdef NTRIP_ENABLE
+    if (dev->servicetype == service_ntrip)
+	return dev->ntrip.conn_state == ntrip_conn_established;
+#endif
+    return true;
+}
+
+static int netgnss_flush(struct gps_device_t *dev)
+/* write as much queued output as the socket takes without blocking */
+{
+    while (dev->netgnss.outlen > 0) {
+	ssize_t n = write(dev->gpsdata.gps_fd,
+			  dev->netgnss.out, dev->netgnss.outlen);
+	if (n < 0) {
+	    if (errno == EINTR)
+		continue;
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
+		return 0;
+	    return -1;
+	}
+	dev->netgnss.outlen -= (size_t)n;
+	memmove(dev->netgnss.out, dev->netgnss.out + n, dev->netgnss.outlen);
+    }
+    return 0;
+}
+
+bool netgnss_send(struct gps_device_t *dev, const char *buf, size_t len)
+/* queue output for the server; false if it had to be dropped */
+{
+    if (dev->netgnss.outlen + len > sizeof(dev->netgnss.out)) {
+	dev->netgnss.dropped++;
+	return false;
+    }
+    memcpy(dev->netgnss.out + dev->netgnss.outlen, buf, len);
+    dev->netgnss.outlen += len;
+    if (!dev->netgnss.connecting && netgnss_flush(dev) < 0) {
+	gpsd_log(&dev->context->errout, LOG_WARN,
+		 "%s: write error %d\n", dev->gpsdata.dev.path, errno);
+	return false;
+    }
+    return true;
+}
+
+static bool netgnss_step(struct gps_device_t *dev)
+/* finish a pending connect and push queued output; false on failure */
+{
+    if (dev->netgnss.connecting) {
+	struct pollfd pfd;
+	int err = 0;
+	socklen_t len = sizeof(err);
+
+	pfd.fd = dev->gpsdata.gps_fd;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, 0) <= 0) {
+	    if (timestamp() - dev->netgnss.started < NETGNSS_CONNECT_TIMEOUT)
+		return true;
+	    gpsd_log(&dev->context->errout, LOG_ERROR,
+		     "%s: connect timed out\n", dev->gpsdata.dev.path);
+	    if (netgnss_next(dev))
+		return true;
+	    netgnss_fail(dev);
+	    return false;
+	}
+	if (getsockopt(dev->gpsdata.gps_fd, SOL_SOCKET, SO_ERROR,
+		       (void *)&err, &len) == -1 || err != 0) {
+	    gpsd_log(&dev->context->errout, LOG_ERROR,
+		     "%s: connect failed, %s\n",
+		     dev->gpsdata.dev.path, strerror(err ? err : errno));
+	    if (netgnss_next(dev))
+		return true;
+	    netgnss_fail(dev);
+	    return false;
+	}
+	netgnss_forget(dev);
+	dev->netgnss.connecting = false;
+	gpsd_log(&dev->context->errout, LOG_PROG,
+		 "%s: connected after %.3f seconds\n",
+		 dev->gpsdata.dev.path, timestamp() - dev->netgnss.started);
+	/* DGPSIP has no handshake; corrections follow the greeting */
+	if (dev->servicetype == service_dgpsip)
+	    netgnss_established(dev);
+    }
+    if (netgnss_flush(dev) < 0) {
+	gpsd_log(&dev->context->errout, LOG_ERROR,
+		 "%s: write error %d\n", dev->gpsdata.dev.path, errno);
+	netgnss_fail(dev);
+	return false;
+    }
+    return true;
+}
+
+int netgnss_advance(struct gps_device_t *dev)
+/* input on a connection that is not yet streaming; ratchet it forward */
+{
+    if (dev->netgnss.retry != 0 || !netgnss_step(dev))
+	return DEVICE_UNREADY;
+    if (dev->netgnss.connecting)
+	return DEVICE_READY;
+#ifdef NTRIP_ENABLE
+    if (dev->servicetype == service_ntrip) {
+	(void)ntrip_open(dev, "");
+	if (dev->ntrip.conn_state == ntrip_conn_err)
+	    return DEVICE_ERROR;
+	if (dev->netgnss.retry != 0)
+	    return DEVICE_UNREADY;
+    }
+#endif
+    return DEVICE_READY;
+}
+
+double netgnss_service(struct gps_device_t *dev, bool *listen)
+/*
+ * Run the timers of a network DGNSS connection from the event loop.
+ * Sets *listen to whether the socket should be selected for input and
+ * returns how many seconds may pass before the next call, or -1.
+ */
+{
+    timestamp_t now = timestamp();
+
+    *listen = false;
+    if (dev->netgnss.retry != 0) {
+	if (now < dev->netgnss.retry)
+	    return dev->netgnss.retry - now;
+	gpsd_log(&dev->context->errout, LOG_INF,
+		 "%s: reconnecting, attempt %lu\n",
+		 dev->gpsdata.dev.path, dev->netgnss.connects + 1);
+	(void)netgnss_uri_open(dev, dev->gpsdata.dev.path);
+	if (dev->netgnss.retry != 0)
+	    return dev->netgnss.retry - now;
+    }
+    if (!netgnss_step(dev))
+	return dev->netgnss.retry - now;
+    *listen = true;
+    if (dev->netgnss.connecting || dev->netgnss.outlen > 0)
+	return NETGNSS_TICK;
+    return -1;
+}
+
+void netgnss_close(struct gps_device_t *dev)
+/* the device is being deactivated; drop any connection state */
+{
+#ifdef NTRIP_ENABLE
+    if (dev->servicetype == service_ntrip)
+	ntrip_close(dev);
+#endif
+    netgnss_forget(dev);
+    dev->netgnss.connecting = false;
+    dev->netgnss.retry = 0;
+    dev->netgnss.outlen = 0;
+    dev->netgnss.up = 0;
+}
+
+void netgnss_dump(const struct gps_device_t *dev, char *reply, size_t replylen)
+/* append the state and counters of a network DGNSS source as JSON */
+{
+    const char *state;
+    timestamp_t now = timestamp();
+
+    if (dev->gpsdata.gps_fd < 0)
+	state = "closed";
+    else if (dev->netgnss.retry != 0)
+	state = "waiting";
+    else if (dev->netgnss.connecting)
+	state = "connecting";
+    else if (netgnss_streaming(dev))
+	state = "streaming";
+    else
+	state = "handshake";
+    str_appendf(reply, replylen,
+		"{\"path\":\"%s\",\"state\":\"%s\",",
+		dev->gpsdata.dev.path, state);
+#ifdef NTRIP_ENABLE
+    if (dev->servicetype == service_ntrip)
+	str_appendf(reply, replylen,
+		    "\"mountpoint\":\"%s\",\"cached\":%s,",
+		    dev->ntrip.stream.mountpoint,
+		    dev->ntrip.cached ? "true" : "false");
+#endif
+    if (dev->netgnss.up != 0)
+	str_appendf(reply, replylen, "\"uptime\":%.0f,",
+		    now - dev->netgnss.up);
+    if (dev->netgnss.retry != 0)
+	str_appendf(reply, replylen, "\"retry\":%.1f,",
+		    dev->netgnss.retry - now);
+    str_appendf(reply, replylen,
+		"\"connects\":%lu,\"failures\":%lu,\"backoff\":%.0f,"
+		"\"chars\":%lu,\"reports\":%lu,\"dropped\":%lu},",
+		dev->netgnss.connects, dev->netgnss.failures,
+		dev->netgnss.backoff, dev->lexer.char_counter,
+		dev->netgnss.reports, dev->netgnss.dropped);
+}
+
 /* end */
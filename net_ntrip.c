@@ -8,13 +8,14 @@
 #include <stdbool.h>
 #include <string.h>
 #include <errno.h>
-#include <fcntl.h>
+#include <limits.h>
 #include <math.h>
 #include <strings.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <netdb.h>
 #include <sys/socket.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "gpsd.h"
@@ -30,6 +31,8 @@
 #define NTRIP_ICY		"ICY 200 OK"
 #define NTRIP_UNAUTH		"401 Unauthorized"
 
+#define NTRIP_CACHE_AGE		86400	/* seconds a saved sourcetable is trusted */
+
 static char *ntrip_field_iterate(char *start,
 				 char *prev,
 				 const char *eol,
@@ -158,184 +161,250 @@ static void ntrip_str_parse(char *str, size_t len,
     while ((s = ntrip_field_iterate(NULL, s, eol, errout)));
 }
 
-static int ntrip_sourcetable_parse(struct gps_device_t *device)
+static void ntrip_cache_path(const struct ntrip_stream_t *stream,
+			     char *path, size_t len)
+/* where the sourcetable of a caster is kept between connections */
+{
+    const char *dir = getenv("GPSD_CACHE_DIR");
+
+    if (dir == NULL || *dir == '\0')
+	dir = DEFAULT_GPSD_CACHE;
+    (void)snprintf(path, len, "%s/ntrip-%s-%s.str",
+		   dir, stream->url, stream->port);
+}
+
+static int ntrip_sourcetable_line(struct gps_device_t *device,
+				  char *line, size_t llen)
+/* digest one sourcetable line: -1 if the stream is unusable, 1 at the end */
 {
     struct ntrip_stream_t hold;
-    ssize_t llen, len = 0;
-    char *line;
-    bool sourcetable = false;
-    bool match = false;
-    char buf[BUFSIZ];
-    size_t blen = sizeof(buf);
+
+    if (str_starts_with(line, NTRIP_ENDSOURCETABLE))
+	return 1;
+
+    gpsd_log(&device->context->errout, LOG_DATA,
+	     "next Ntrip source table line %s\n", line);
+
+    /* todo: parse headers */
+
+    /* parse STR */
+    if (str_starts_with(line, NTRIP_STR)) {
+	ntrip_str_parse(line + strlen(NTRIP_STR),
+			llen - strlen(NTRIP_STR),
+			&hold, &device->context->errout);
+	if (strcmp(device->ntrip.stream.mountpoint, hold.mountpoint) == 0) {
+	    /* todo: support for RTCM 3.0, SBAS (WAAS, EGNOS), ... */
+	    if (hold.format == fmt_unknown) {
+		gpsd_log(&device->context->errout, LOG_ERROR,
+			 "Ntrip stream %s format not supported\n",
+			 line);
+		return -1;
+	    }
+	    /* todo: support encryption and compression algorithms */
+	    if (hold.compr_encryp != cmp_enc_none) {
+		gpsd_log(&device->context->errout, LOG_ERROR,
+			 "Ntrip stream %s compression/encryption algorithm not supported\n",
+			 line);
+		return -1;
+	    }
+	    /* todo: support digest authentication */
+	    if (hold.authentication != auth_none
+		    && hold.authentication != auth_basic) {
+		gpsd_log(&device->context->errout, LOG_ERROR,
+			 "Ntrip stream %s authentication method not supported\n",
+			line);
+		return -1;
+	    }
+	    /* no memcpy, so we can keep the other infos */
+	    device->ntrip.stream.format = hold.format;
+	    device->ntrip.stream.carrier = hold.carrier;
+	    device->ntrip.stream.latitude = hold.latitude;
+	    device->ntrip.stream.longitude = hold.longitude;
+	    device->ntrip.stream.nmea = hold.nmea;
+	    device->ntrip.stream.compr_encryp = hold.compr_encryp;
+	    device->ntrip.stream.authentication = hold.authentication;
+	    device->ntrip.stream.fee = hold.fee;
+	    device->ntrip.stream.bitrate = hold.bitrate;
+	    device->ntrip.stream.set = true;
+	}
+	/* todo: compare stream location to own location to
+	 * find nearest stream if user hasn't provided one */
+    }
+    /* todo: parse CAS */
+    /* else if (str_starts_with(line, NTRIP_CAS)); */
+
+    /* todo: parse NET */
+    /* else if (str_starts_with(line, NTRIP_NET)); */
+
+    return 0;
+}
+
+static bool ntrip_cache_load(struct gps_device_t *device)
+/* look the stream up in a recent enough saved sourcetable */
+{
+    char path[PATH_MAX], line[NTRIP_LINE_MAX];
+    struct stat sb;
+    FILE *fp;
+
+    ntrip_cache_path(&device->ntrip.stream, path, sizeof(path));
+    if (stat(path, &sb) != 0 || time(NULL) - sb.st_mtime > NTRIP_CACHE_AGE)
+	return false;
+    if ((fp = fopen(path, "r")) == NULL)
+	return false;
+    while (fgets(line, (int)sizeof(line), fp) != NULL) {
+	size_t len = strcspn(line, NTRIP_BR);
+
+	line[len] = '\0';
+	if (ntrip_sourcetable_line(device, line, len) != 0)
+	    break;
+    }
+    (void)fclose(fp);
+    if (device->ntrip.stream.set)
+	gpsd_log(&device->context->errout, LOG_PROG,
+		 "Ntrip stream %s found in cached sourcetable %s\n",
+		 device->ntrip.stream.mountpoint, path);
+    return device->ntrip.stream.set;
+}
+
+static void ntrip_cache_start(struct gps_device_t *device)
+/* begin saving the sourcetable as it arrives */
+{
+    char path[PATH_MAX];
+
+    ntrip_cache_path(&device->ntrip.stream, path, sizeof(path));
+    (void)strlcat(path, ".tmp", sizeof(path));
+    if ((device->ntrip.cache = fopen(path, "w")) == NULL)
+	gpsd_log(&device->context->errout, LOG_PROG,
+		 "can't save Ntrip sourcetable to %s, %s\n",
+		 path, strerror(errno));
+}
+
+static void ntrip_cache_finish(struct gps_device_t *device, bool keep)
+/* install or discard the sourcetable being saved */
+{
+    char path[PATH_MAX], tmp[PATH_MAX];
+
+    if (device->ntrip.cache == NULL)
+	return;
+    ntrip_cache_path(&device->ntrip.stream, path, sizeof(path));
+    (void)strlcpy(tmp, path, sizeof(tmp));
+    (void)strlcat(tmp, ".tmp", sizeof(tmp));
+    if (fclose(device->ntrip.cache) != 0 || !keep
+	|| rename(tmp, path) != 0)
+	(void)unlink(tmp);
+    device->ntrip.cache = NULL;
+}
+
+static int ntrip_sourcetable_parse(struct gps_device_t *device)
+/* consume sourcetable input: -1 on a bad reply, 1 when it's all in, else 0 */
+{
     int fd = device->gpsdata.gps_fd;
+    char *buf = device->ntrip.buf;
 
     for (;;) {
-	char *eol;
+	char *line, *eol;
 	ssize_t rlen;
 
-	memset(&buf[len], 0, (size_t) (blen - len));
-	rlen = read(fd, &buf[len], (size_t) (blen - 1 - len));
+	if (device->ntrip.buflen >= sizeof(device->ntrip.buf) - 1) {
+	    gpsd_log(&device->context->errout, LOG_ERROR,
+		     "Ntrip source table line too long on fd %d\n", fd);
+	    return -1;
+	}
+	rlen = read(fd, buf + device->ntrip.buflen,
+		    sizeof(device->ntrip.buf) - 1 - device->ntrip.buflen);
 	if (rlen == -1) {
-	    if (errno == EINTR) {
+	    if (errno == EINTR)
 		continue;
-	    }
-	    if (sourcetable && !match && errno == EAGAIN) { // we have not yet found a match, but there currently is no more data
+	    if (errno == EAGAIN || errno == EWOULDBLOCK)
 		return 0;
-	    }
-	    if (match) {
-		return 1;
-	    }
 	    gpsd_log(&device->context->errout, LOG_ERROR,
 		     "ntrip stream read error %d on fd %d\n",
 		     errno, fd);
-	    return -1;
-	} else if (rlen == 0) { // server closed the connection
+	    netgnss_fail(device);
+	    return 0;
+	} else if (rlen == 0) {
+	    /* some casters close without a final line terminator */
+	    if (device->ntrip.sourcetable_parse
+		&& str_starts_with(buf, NTRIP_ENDSOURCETABLE)) {
+		ntrip_cache_finish(device, true);
+		return 1;
+	    }
 	    gpsd_log(&device->context->errout, LOG_ERROR,
-		     "ntrip stream unexpected close %d on fd %d during sourcetable read\n",
-		     errno, fd);
-	    return -1;
+		     "ntrip stream unexpected close on fd %d during sourcetable read\n",
+		     fd);
+	    netgnss_fail(device);
+	    return 0;
 	}
-
+	device->ntrip.buflen += (size_t)rlen;
+	buf[device->ntrip.buflen] = '\0';
 	line = buf;
-	rlen = len += rlen;
 
 	gpsd_log(&device->context->errout, LOG_RAW,
 		 "Ntrip source table buffer %s\n", buf);
 
-	sourcetable = device->ntrip.sourcetable_parse;
-	if (!sourcetable) {
+	if (!device->ntrip.sourcetable_parse) {
 	    /* parse SOURCETABLE */
-	    if (str_starts_with(line, NTRIP_SOURCETABLE)) {
-		sourcetable = true;
-		device->ntrip.sourcetable_parse = true;
-		llen = (ssize_t) strlen(NTRIP_SOURCETABLE);
-		line += llen;
-		len -= llen;
-	    } else {
+	    if (device->ntrip.buflen < strlen(NTRIP_SOURCETABLE)
+		&& strncmp(buf, NTRIP_SOURCETABLE, device->ntrip.buflen) == 0)
+		continue;
+	    if (!str_starts_with(line, NTRIP_SOURCETABLE)) {
 		gpsd_log(&device->context->errout, LOG_WARN,
 			 "Received unexpexted Ntrip reply %s.\n",
 			 buf);
 		return -1;
 	    }
+	    device->ntrip.sourcetable_parse = true;
+	    line += strlen(NTRIP_SOURCETABLE);
+	    ntrip_cache_start(device);
 	}
 
-	while (len > 0) {
-	    /* parse ENDSOURCETABLE */
-	    if (str_starts_with(line, NTRIP_ENDSOURCETABLE))
-		goto done;
-
-	    /* coverity[string_null] - nul-terminated by previous memset */
-	    if (!(eol = strstr(line, NTRIP_BR)))
-		break;
-
-	    gpsd_log(&device->context->errout, LOG_DATA,
-		     "next Ntrip source table line %s\n", line);
+	/* coverity[string_null] - nul-terminated above */
+	while ((eol = strstr(line, NTRIP_BR)) != NULL) {
+	    int status;
 
 	    *eol = '\0';
-	    llen = (ssize_t) (eol - line);
-
-	    /* todo: parse headers */
-
-	    /* parse STR */
-	    if (str_starts_with(line, NTRIP_STR)) {
-		ntrip_str_parse(line + strlen(NTRIP_STR),
-				(size_t) (llen - strlen(NTRIP_STR)),
-				&hold, &device->context->errout);
-		if (strcmp(device->ntrip.stream.mountpoint, hold.mountpoint) == 0) {
-		    /* todo: support for RTCM 3.0, SBAS (WAAS, EGNOS), ... */
-		    if (hold.format == fmt_unknown) {
-			gpsd_log(&device->context->errout, LOG_ERROR,
-				 "Ntrip stream %s format not supported\n",
-				 line);
-			return -1;
-		    }
-		    /* todo: support encryption and compression algorithms */
-		    if (hold.compr_encryp != cmp_enc_none) {
-			gpsd_log(&device->context->errout, LOG_ERROR,
-				 "Ntrip stream %s compression/encryption algorithm not supported\n",
-				 line);
-			return -1;
-		    }
-		    /* todo: support digest authentication */
-		    if (hold.authentication != auth_none
-			    && hold.authentication != auth_basic) {
-			gpsd_log(&device->context->errout, LOG_ERROR,
-				 "Ntrip stream %s authentication method not supported\n",
-				line);
-			return -1;
-		    }
-		    /* no memcpy, so we can keep the other infos */
-		    device->ntrip.stream.format = hold.format;
-		    device->ntrip.stream.carrier = hold.carrier;
-		    device->ntrip.stream.latitude = hold.latitude;
-		    device->ntrip.stream.longitude = hold.longitude;
-		    device->ntrip.stream.nmea = hold.nmea;
-		    device->ntrip.stream.compr_encryp = hold.compr_encryp;
-		    device->ntrip.stream.authentication = hold.authentication;
-		    device->ntrip.stream.fee = hold.fee;
-		    device->ntrip.stream.bitrate = hold.bitrate;
-		    device->ntrip.stream.set = true;
-		    match = true;
-		}
-		/* todo: compare stream location to own location to
-		 * find nearest stream if user hasn't provided one */
+	    if (device->ntrip.cache != NULL)
+		(void)fprintf(device->ntrip.cache, "%s" NTRIP_BR, line);
+	    /* the line parser punches holes in its argument */
+	    status = ntrip_sourcetable_line(device, line,
+					    (size_t)(eol - line));
+	    line = eol + strlen(NTRIP_BR);
+	    if (status == -1) {
+		ntrip_cache_finish(device, false);
+		return -1;
+	    } else if (status == 1) {
+		ntrip_cache_finish(device, true);
+		return 1;
 	    }
-	    /* todo: parse CAS */
-	    /* else if (str_starts_with(line, NTRIP_CAS)); */
-
-	    /* todo: parse NET */
-	    /* else if (str_starts_with(line, NTRIP_NET)); */
-
-	    llen += strlen(NTRIP_BR);
-	    line += llen;
-	    len -= llen;
-	    gpsd_log(&device->context->errout, LOG_RAW,
-		     "Remaining Ntrip source table buffer %zd %s\n", len,
-		     line);
 	}
-	/* message too big to fit into buffer */
-	if ((size_t)len == blen - 1)
-	    return -1;
 
-	if (len > 0)
-	    memmove(buf, &buf[rlen - len], (size_t) len);
+	/* keep the partial line for the next read */
+	device->ntrip.buflen -= (size_t)(line - buf);
+	memmove(buf, line, device->ntrip.buflen);
+	buf[device->ntrip.buflen] = '\0';
     }
-
-done:
-    return match ? 1 : -1;
 }
 
-static int ntrip_stream_req_probe(const struct ntrip_stream_t *stream,
-				  struct gpsd_errout_t *errout)
+static int ntrip_stream_req_probe(struct gps_device_t *device)
+/* ask the caster for its sourcetable */
 {
-    int dsock;
-    ssize_t r;
+    const struct ntrip_stream_t *stream = &device->ntrip.stream;
     char buf[BUFSIZ];
 
-    dsock = netlib_connectsock(AF_UNSPEC, stream->url, stream->port, "tcp");
-    if (dsock < 0) {
-	gpsd_log(errout, LOG_ERROR,
-		 "ntrip stream connect error %d in req probe\n", dsock);
+    device->ntrip.conn_state = ntrip_conn_sent_probe;
+    device->ntrip.sourcetable_parse = false;
+    device->ntrip.buflen = 0;
+    if (netgnss_connect(device, stream->url, stream->port) < 0)
 	return -1;
-    }
-    gpsd_log(errout, LOG_SPIN,
-	     "ntrip stream for req probe connected on fd %d\n", dsock);
     (void)snprintf(buf, sizeof(buf),
 	    "GET / HTTP/1.1\r\n"
 	    "User-Agent: NTRIP gpsd/%s\r\n"
 	    "Host: %s\r\n"
 	    "Connection: close\r\n"
 	    "\r\n", VERSION, stream->url);
-    r = write(dsock, buf, strlen(buf));
-    if (r != (ssize_t)strlen(buf)) {
-	gpsd_log(errout, LOG_ERROR,
-		 "ntrip stream write error %d on fd %d during probe request %zd\n",
-		 errno, dsock, r);
-	(void)close(dsock);
-	return -1;
-    }
-    /* coverity[leaked_handle] This is an intentional allocation */
-    return dsock;
+    if (device->netgnss.retry == 0)
+	(void)netgnss_send(device, buf, strlen(buf));
+    return device->gpsdata.gps_fd;
 }
 
 static int ntrip_auth_encode(const struct ntrip_stream_t *stream,
@@ -362,25 +431,16 @@ static int ntrip_auth_encode(const struct ntrip_stream_t *stream,
     return 0;
 }
 
-/* *INDENT-ON* */
-
-static int ntrip_stream_get_req(const struct ntrip_stream_t *stream,
-				const struct gpsd_errout_t *errout)
+static int ntrip_stream_get_req(struct gps_device_t *device)
+/* ask the caster for our stream */
 {
-    int dsock;
+    const struct ntrip_stream_t *stream = &device->ntrip.stream;
     char buf[BUFSIZ];
 
-    dsock = netlib_connectsock(AF_UNSPEC, stream->url, stream->port, "tcp");
-    if (BAD_SOCKET(dsock)) {
-	gpsd_log(errout, LOG_ERROR,
-		 "ntrip stream connect error %d\n", dsock);
+    device->ntrip.conn_state = ntrip_conn_sent_get;
+    device->ntrip.buflen = 0;
+    if (netgnss_connect(device, stream->url, stream->port) < 0)
 	return -1;
-    }
-
-    gpsd_log(errout, LOG_SPIN,
-	     "netlib_connectsock() returns socket on fd %d\n",
-	     dsock);
-
     (void)snprintf(buf, sizeof(buf),
 	    "GET /%s HTTP/1.1\r\n"
 	    "User-Agent: NTRIP gpsd/%s\r\n"
@@ -389,67 +449,102 @@ static int ntrip_stream_get_req(const struct ntrip_stream_t *stream,
 	    "%s"
 	    "Connection: close\r\n"
 	    "\r\n", stream->mountpoint, VERSION, stream->url, stream->authStr);
-    if (write(dsock, buf, strlen(buf)) != (ssize_t) strlen(buf)) {
-	gpsd_log(errout, LOG_ERROR,
-		 "ntrip stream write error %d on fd %d during get request\n", errno,
-		 dsock);
-	(void)close(dsock);
-	return -1;
-    }
-    return dsock;
+    if (device->netgnss.retry == 0)
+	(void)netgnss_send(device, buf, strlen(buf));
+    return device->gpsdata.gps_fd;
 }
 
-static int ntrip_stream_get_parse(const struct ntrip_stream_t *stream,
-				  const int dsock,
-				  const struct gpsd_errout_t *errout)
+static int ntrip_stream_get_parse(struct gps_device_t *device)
+/* read the reply to our GET: -1 on a bad reply, 1 on success, else 0 */
 {
-    char buf[BUFSIZ];
-    int opts;
-    memset(buf, 0, sizeof(buf));
-    while (read(dsock, buf, sizeof(buf) - 1) == -1) {
-	if (errno == EINTR)
+    const struct ntrip_stream_t *stream = &device->ntrip.stream;
+    char *buf = device->ntrip.buf, *eol;
+    ssize_t rlen;
+    size_t rest;
+
+    for (;;) {
+	rlen = read(device->gpsdata.gps_fd, buf + device->ntrip.buflen,
+		    sizeof(device->ntrip.buf) - 1 - device->ntrip.buflen);
+	if (rlen > 0)
+	    break;
+	if (rlen == -1 && errno == EINTR)
 	    continue;
-	gpsd_log(errout, LOG_ERROR,
+	if (rlen == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
+	    return 0;
+	gpsd_log(&device->context->errout, LOG_ERROR,
 		 "ntrip stream read error %d on fd %d during get rsp\n", errno,
-		 dsock);
-	goto close;
+		 device->gpsdata.gps_fd);
+	netgnss_fail(device);
+	return 0;
     }
+    device->ntrip.buflen += (size_t)rlen;
+    buf[device->ntrip.buflen] = '\0';
 
     /* parse 401 Unauthorized */
-    /* coverity[string_null] - guaranteed terminated by the memset above */
+    /* coverity[string_null] - nul-terminated above */
     if (strstr(buf, NTRIP_UNAUTH)!=NULL) {
-	gpsd_log(errout, LOG_ERROR,
+	gpsd_log(&device->context->errout, LOG_ERROR,
 		 "not authorized for Ntrip stream %s/%s\n", stream->url,
 		 stream->mountpoint);
-	goto close;
+	netgnss_fail(device);
+	return 0;
     }
     /* parse SOURCETABLE */
     if (strstr(buf, NTRIP_SOURCETABLE)!=NULL) {
-	gpsd_log(errout, LOG_ERROR,
+	gpsd_log(&device->context->errout, LOG_ERROR,
 		 "Broadcaster doesn't recognize Ntrip stream %s:%s/%s\n",
 		 stream->url, stream->port, stream->mountpoint);
-	goto close;
+	/* the saved sourcetable, if that is what we went by, is stale */
+	if (device->ntrip.cached) {
+	    char path[PATH_MAX];
+	    ntrip_cache_path(stream, path, sizeof(path));
+	    (void)unlink(path);
+	}
+	netgnss_fail(device);
+	return 0;
+    }
+    if ((eol = strstr(buf, NTRIP_BR)) == NULL) {
+	if (device->ntrip.buflen < sizeof(device->ntrip.buf) - 1)
+	    return 0;
+	eol = buf + device->ntrip.buflen;
     }
+    *eol = '\0';
     /* parse ICY 200 OK */
     if (strstr(buf, NTRIP_ICY)==NULL) {
-	gpsd_log(errout, LOG_ERROR,
+	gpsd_log(&device->context->errout, LOG_ERROR,
 		 "Unknown reply %s from Ntrip service %s:%s/%s\n", buf,
 		 stream->url, stream->port, stream->mountpoint);
-	goto close;
+	return -1;
     }
-    opts = fcntl(dsock, F_GETFL);
 
-    if (opts >= 0)
-	(void)fcntl(dsock, F_SETFL, opts | O_NONBLOCK);
+    /* corrections that came in with the reply belong to the packet lexer */
+    eol += strlen(NTRIP_BR);
+    if (eol < buf + device->ntrip.buflen)
+	rest = device->ntrip.buflen - (size_t)(eol - buf);
+    else
+	rest = 0;
+    if (rest > sizeof(device->lexer.inbuffer) - device->lexer.inbuflen)
+	rest = sizeof(device->lexer.inbuffer) - device->lexer.inbuflen;
+    memcpy(device->lexer.inbuffer + device->lexer.inbuflen, eol, rest);
+    device->lexer.inbuflen += rest;
+    device->ntrip.buflen = 0;
+    return 1;
+}
 
-    return dsock;
-close:
-    (void)close(dsock);
-    return -1;
+void ntrip_close(struct gps_device_t *device)
+/* abandon any sourcetable that was being saved */
+{
+    ntrip_cache_finish(device, false);
+    device->ntrip.buflen = 0;
 }
 
 int ntrip_open(struct gps_device_t *device, char *caster)
-    /* open a connection to a Ntrip broadcaster */
+/*
+ * Open a connection to a Ntrip broadcaster.  Nothing here blocks on the
+ * network; each call advances the connection as far as the input that
+ * has arrived allows, and transport failures are retried with backoff
+ * by the netgnss layer.
+ */
 {
     char *amp, *colon, *slash;
     char *auth = NULL;
@@ -464,9 +559,9 @@ int ntrip_open(struct gps_device_t *device, char *caster)
 	case ntrip_conn_init:
 	    /* this has to be done here, because it is needed for multi-stage connection */
 	    device->servicetype = service_ntrip;
-	    device->ntrip.works = false;
 	    device->ntrip.sourcetable_parse = false;
 	    device->ntrip.stream.set = false;
+	    device->ntrip.cached = false;
 	    (void)strlcpy(tmp, caster, sizeof(t));
 
 	    if ((amp = strchr(tmp, '@')) != NULL) {
@@ -474,7 +569,6 @@ int ntrip_open(struct gps_device_t *device, char *caster)
 		    auth = tmp;
 		    *amp = '\0';
 		    tmp = amp + 1;
-		    url = tmp;
 		} else {
 		    gpsd_log(&device->context->errout, LOG_ERROR,
 			     "can't extract user-ID and password from %s\n",
@@ -483,6 +577,7 @@ int ntrip_open(struct gps_device_t *device, char *caster)
 		    return -1;
 		}
 	    }
+	    url = tmp;
 	    if ((slash = strchr(tmp, '/')) != NULL) {
 		*slash = '\0';
 		stream = slash + 1;
@@ -524,49 +619,46 @@ int ntrip_open(struct gps_device_t *device, char *caster)
 			      port,
 			      sizeof(device->ntrip.stream.port));
 
-	    ret = ntrip_stream_req_probe(&device->ntrip.stream,
-					 &device->context->errout);
-	    if (ret == -1) {
-		device->ntrip.conn_state = ntrip_conn_err;
-		return -1;
-	    }
-	    device->gpsdata.gps_fd = ret;
-	    device->ntrip.conn_state = ntrip_conn_sent_probe;
-	    return ret;
+	    /* a saved sourcetable spares us the probe connection */
+	    if (!ntrip_cache_load(device))
+		return ntrip_stream_req_probe(device);
+	    device->ntrip.cached = true;
+	    /* FALLTHROUGH */
 	case ntrip_conn_sent_probe:
-	    ret = ntrip_sourcetable_parse(device);
-	    if (ret == -1) {
-		device->ntrip.conn_state = ntrip_conn_err;
-		return -1;
-	    }
-	    if (ret == 0 && device->ntrip.stream.set == false) {
-		return ret;
+	    if (!device->ntrip.cached) {
+		ret = ntrip_sourcetable_parse(device);
+		if (ret == -1) {
+		    device->ntrip.conn_state = ntrip_conn_err;
+		    return -1;
+		}
+		if (ret == 0)
+		    return device->gpsdata.gps_fd;
+		if (!device->ntrip.stream.set) {
+		    gpsd_log(&device->context->errout, LOG_ERROR,
+			     "Ntrip stream %s not in the sourcetable of %s:%s\n",
+			     device->ntrip.stream.mountpoint,
+			     device->ntrip.stream.url,
+			     device->ntrip.stream.port);
+		    device->ntrip.conn_state = ntrip_conn_err;
+		    return -1;
+		}
 	    }
-	    (void)close(device->gpsdata.gps_fd);
 	    if (ntrip_auth_encode(&device->ntrip.stream, device->ntrip.stream.credentials, device->ntrip.stream.authStr, sizeof(device->ntrip.stream.authStr)) != 0) {
 		device->ntrip.conn_state = ntrip_conn_err;
 		return -1;
 	    }
-	    ret = ntrip_stream_get_req(&device->ntrip.stream,
-				       &device->context->errout);
-	    if (ret == -1) {
-		device->ntrip.conn_state = ntrip_conn_err;
-		return -1;
-	    }
-	    device->gpsdata.gps_fd = ret;
-	    device->ntrip.conn_state = ntrip_conn_sent_get;
-	    break;
+	    return ntrip_stream_get_req(device);
 	case ntrip_conn_sent_get:
-	    ret = ntrip_stream_get_parse(&device->ntrip.stream,
-					 device->gpsdata.gps_fd,
-					 &device->context->errout);
+	    ret = ntrip_stream_get_parse(device);
 	    if (ret == -1) {
 		device->ntrip.conn_state = ntrip_conn_err;
 		return -1;
 	    }
-	    device->ntrip.conn_state = ntrip_conn_established;
-	    device->ntrip.works = true; // we know, this worked.
-	    break;
+	    if (ret == 1) {
+		device->ntrip.conn_state = ntrip_conn_established;
+		netgnss_established(device);
+	    }
+	    return device->gpsdata.gps_fd;
 	case ntrip_conn_established:
 	case ntrip_conn_err:
 	    return -1;
@@ -589,11 +681,11 @@ void ntrip_report(struct gps_context_t *context,
      */
     count ++;
     if (caster->ntrip.stream.nmea != 0 && context->fixcnt > 10 && (count % 5)==0) {
-	if (caster->gpsdata.gps_fd > -1) {
+	if (netgnss_streaming(caster)) {
 	    char buf[BUFSIZ];
 	    gpsd_position_fix_dump(gps, buf, sizeof(buf));
-	    if (write(caster->gpsdata.gps_fd, buf, strlen(buf)) ==
-		    (ssize_t) strlen(buf)) {
+	    if (netgnss_send(caster, buf, strlen(buf))) {
+		caster->netgnss.reports++;
 		gpsd_log(&context->errout, LOG_IO, "=> dgps %s\n", buf);
 	    } else {
 		gpsd_log(&context->errout, LOG_IO, "ntrip report write failed\n");
@@ -5,6 +5,7 @@
 
 #include "gpsd_config.h"
 #include <string.h>
+#include <errno.h>
 #include <fcntl.h>
 #ifdef HAVE_NETDB_H
 #include <netdb.h>
@@ -48,17 +49,14 @@
 # endif
 #endif
 
-socket_t netlib_connectsock(int af, const char *host, const char *service,
-			    const char *protocol)
+int netlib_lookup(int af, const char *host, const char *service,
+		  const char *protocol, struct addrinfo **result)
+/* resolve host and service into a list of addresses to try in turn */
 {
     struct protoent *ppe;
     struct addrinfo hints;
-    struct addrinfo *result, *rp;
-    int ret, type, proto, one = 1;
-    socket_t s;
-    bool bind_me;
+    int type, proto;
 
-    INVALIDATE_SOCKET(s);
     ppe = getprotobyname(protocol);
     if (strcmp(protocol, "udp") == 0) {
 	type = SOCK_DGRAM;
@@ -68,62 +66,62 @@ socket_t netlib_connectsock(int af, const char *host, const char *service,
 	proto = (ppe) ? ppe->p_proto : IPPROTO_TCP;
     }
 
-    /* we probably ought to pass this in as an explicit flag argument */
-    bind_me = (type == SOCK_DGRAM);
-
     memset(&hints, 0, sizeof(struct addrinfo));
     hints.ai_family = af;
     hints.ai_socktype = type;
     hints.ai_protocol = proto;
-    if (bind_me)
+    /* we probably ought to pass this in as an explicit flag argument */
+    if (type == SOCK_DGRAM)
 	hints.ai_flags = AI_PASSIVE;
-    if ((ret = getaddrinfo(host, service, &hints, &result))) {
+    if (getaddrinfo(host, service, &hints, result) != 0)
 	return NL_NOHOST;
-    }
-
-    /*
-     * From getaddrinfo(3):
-     *     Normally, the application should try using the addresses in the
-     *     order in which they are returned.  The sorting function used within
-     *     getaddrinfo() is defined in RFC 3484).
-     * From RFC 3484 (Section 10.3):
-     *     The default policy table gives IPv6 addresses higher precedence than
-     *     IPv4 addresses.
-     * Thus, with the default parameters, we get IPv6 addresses first.
-     */
-    for (rp = result; rp != NULL; rp = rp->ai_next) {
-	ret = NL_NOCONNECT;
-	if ((s = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0)
-	    ret = NL_NOSOCK;
-	else if (setsockopt
-		 (s, SOL_SOCKET, SO_REUSEADDR, (char *)&one,
-		  sizeof(one)) == -1) {
-	    ret = NL_NOSOCKOPT;
-	} else {
-	    if (bind_me) {
-		if (bind(s, rp->ai_addr, rp->ai_addrlen) == 0) {
-		    ret = 0;
-		    break;
-		}
-	    } else {
-		if (connect(s, rp->ai_addr, rp->ai_addrlen) == 0) {
-		    ret = 0;
-		    break;
-		}
-	    }
-	}
+    return 0;
+}
 
-	if (!BAD_SOCKET(s)) {
+static void netlib_close(socket_t s)
+{
 #ifdef HAVE_WINSOCK2_H
-	  (void)closesocket(s);
+    (void)closesocket(s);
 #else
-	  (void)close(s);
+    (void)close(s);
 #endif
+}
+
+static socket_t netlib_open(const struct addrinfo *rp, bool nonblock)
+/*
+ * Bind (UDP) or connect (TCP) a socket to one address, and set it up
+ * as we like it.  With nonblock set, the socket is made non-blocking
+ * before connect(), so a connection still in progress is returned as
+ * success; the caller learns the outcome when it becomes writable.
+ */
+{
+    int one = 1;
+    bool bind_me = (rp->ai_socktype == SOCK_DGRAM);
+    socket_t s;
+
+    if ((s = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol)) < 0)
+	return NL_NOSOCK;
+    if (setsockopt(s, SOL_SOCKET, SO_REUSEADDR, (char *)&one,
+		   sizeof(one)) == -1) {
+	netlib_close(s);
+	return NL_NOSOCKOPT;
+    }
+    if (bind_me) {
+	if (bind(s, rp->ai_addr, rp->ai_addrlen) != 0) {
+	    netlib_close(s);
+	    return NL_NOCONNECT;
+	}
+    } else {
+#ifdef HAVE_FCNTL
+	if (nonblock)
+	    (void)fcntl(s, F_SETFL, fcntl(s, F_GETFL) | O_NONBLOCK);
+#endif /* HAVE_FCNTL */
+	if (connect(s, rp->ai_addr, rp->ai_addrlen) != 0
+	    && !(nonblock && errno == EINPROGRESS)) {
+	    netlib_close(s);
+	    return NL_NOCONNECT;
 	}
     }
-    freeaddrinfo(result);
-    if (ret != 0 || BAD_SOCKET(s))
-	return ret;
 
 #ifdef IPTOS_LOWDELAY
     {
@@ -142,7 +140,7 @@ socket_t netlib_connectsock(int af, const char *host, const char *service,
      * a large packet.  See http://en.wikipedia.org/wiki/Nagle%27s_algorithm
      * for discussion.
      */
-    if (type == SOCK_STREAM)
+    if (rp->ai_socktype == SOCK_STREAM)
 	setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&one, sizeof(one));
 #endif
 
@@ -156,6 +154,46 @@ socket_t netlib_connectsock(int af, const char *host, const char *service,
     return s;
 }
 
+socket_t netlib_connectsock(int af, const char *host, const char *service,
+			    const char *protocol)
+{
+    struct addrinfo *result, *rp;
+    socket_t s = NL_NOCONNECT;
+
+    if (netlib_lookup(af, host, service, protocol, &result) != 0)
+	return NL_NOHOST;
+    /*
+     * From getaddrinfo(3):
+     *     Normally, the application should try using the addresses in the
+     *     order in which they are returned.  The sorting function used within
+     *     getaddrinfo() is defined in RFC 3484).
+     * From RFC 3484 (Section 10.3):
+     *     The default policy table gives IPv6 addresses higher precedence than
+     *     IPv4 addresses.
+     * Thus, with the default parameters, we get IPv6 addresses first.
+     */
+    for (rp = result; rp != NULL; rp = rp->ai_next)
+	if ((s = netlib_open(rp, false)) >= 0)
+	    break;
+    freeaddrinfo(result);
+    return s;
+}
+
+socket_t netlib_connect_next(struct addrinfo **rp)
+/*
+ * Start a non-blocking connect to *rp, or failing that to the first
+ * address after it that will take one, and leave *rp at that address
+ * so that the caller can move on from it if the connect comes to grief.
+ * Resolve the list with netlib_lookup(); name lookup is synchronous.
+ */
+{
+    socket_t s = NL_NOCONNECT;
+
+    for (; *rp != NULL; *rp = (*rp)->ai_next)
+	if ((s = netlib_open(*rp, true)) >= 0)
+	    break;
+    return s;
+}
 
 const char *netlib_errstr(const int err)
 {
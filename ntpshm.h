@@ -7,6 +7,7 @@
 #define GPSD_NTPSHM_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <time.h>
 #include <sys/time.h>
 #include <sys/ipc.h>
@@ -53,6 +54,37 @@ struct shmTime
 };
 
 
+/*
+ * The extended segment gpsd writes alongside each shmTime, at key
+ * NTPX_BASE + unit.  It carries both timestamps to the nanosecond in
+ * 64-bit seconds, with fixed-size fields so 32- and 64-bit processes
+ * agree on the layout, and is guarded by a sequence lock: the writer
+ * makes seq odd, stores, then makes it even again.  A reader that
+ * copies everything with seq even and unchanged has a consistent
+ * sample, never a torn one, however the copy is interleaved with a
+ * write.  Readers never write the segment.
+ */
+#define NTPX_BASE	0x4e545830	/* "NTX0" */
+#define NTPX_MAGIC	0x4e545058	/* "NTPX" */
+#define NTPX_VERSION	1
+
+struct shmTimeX
+{
+    int32_t magic;		/* NTPX_MAGIC once the writer set it up */
+    int32_t version;		/* NTPX_VERSION */
+    volatile uint32_t seq;	/* odd while a sample is being written */
+    int32_t unit;		/* matches the shmTime unit */
+    int64_t clock_sec;		/* GPS time of the sample */
+    int64_t clock_nsec;
+    int64_t receive_sec;	/* system time of the sample */
+    int64_t receive_nsec;
+    uint64_t samples;		/* samples written so far */
+    int32_t leap;		/* leap notification, as in shmTime */
+    int32_t precision;		/* log(2) of source jitter */
+    char device[64];		/* path of the device feeding it */
+    int32_t reserved[8];
+};
+
 /*
  * These types are internal to GPSD
  */
@@ -81,6 +113,9 @@ struct shmTime *shm_get(int, bool, bool);
 extern char *ntp_name(const int);
 enum segstat_t ntp_read(struct shmTime *, struct shm_stat_t *, const bool);
 void ntp_write(volatile struct shmTime *, struct timedelta_t *, int, int);
+struct shmTimeX *shmx_get(int, bool, bool);
+enum segstat_t ntpx_read(volatile struct shmTimeX *, struct shm_stat_t *);
+void ntpx_write(volatile struct shmTimeX *, struct timedelta_t *, int, int);
 
 #endif /* GPSD_NTPSHM_H */
 
@@ -24,6 +24,7 @@
 #define NTPSEGMENTS	256	/* NTPx for x any byte */
 
 static struct shmTime *segments[NTPSEGMENTS + 1];
+static struct shmTimeX *xsegments[NTPSEGMENTS + 1];
 
 int main(int argc, char **argv)
 {
@@ -31,6 +32,7 @@ int main(int argc, char **argv)
     int	i;
     bool killall = false;
     bool verbose = false;
+    bool extended = false;
     int nsamples = INT_MAX;
     time_t timeout = (time_t)0, starttime = time(NULL);
     /* a copy of all old segments */
@@ -38,7 +40,7 @@ int main(int argc, char **argv)
 
     memset( shm_stat_old, 0 ,sizeof( shm_stat_old));
 
-    while ((option = getopt(argc, argv, "hn:st:vV")) != -1) {
+    while ((option = getopt(argc, argv, "hn:st:vVx")) != -1) {
 	switch (option) {
 	case 'n':
 	    nsamples = atoi(optarg);
@@ -52,6 +54,9 @@ int main(int argc, char **argv)
 	case 'v':
 	    verbose = true;
 	    break;
+	case 'x':
+	    extended = true;
+	    break;
 	case 'V':
 	    (void)fprintf(stderr, "%s: version %s (revision %s)\n",
 			  argv[0], VERSION, REVISION);
@@ -59,13 +64,14 @@ int main(int argc, char **argv)
 	case 'h':
 	    (void)fprintf(
 	        stderr,
-                "usage: ntpshmmon [-s] [-n max] [-t timeout] [-v] [-h] [-V]\n"
+                "usage: ntpshmmon [-s] [-n max] [-t timeout] [-v] [-h] [-V] [-x]\n"
                 "  -h           print this help\n"
                 "  -n nsamples  exit after nsamples\n"
                 "  -s           remove SHMs and exit\n"
                 "  -t nseconds  exit after nseconds\n"
                 "  -v           be verbose\n"
                 "  -V           print version and exit\n"
+                "  -x           read gpsd's extended segments instead\n"
 		);
 	    exit(EXIT_SUCCESS);
 	default:
@@ -76,6 +82,12 @@ int main(int argc, char **argv)
 
     /* grab all segments, keep the non-null ones */
     for (i = 0; i < NTPSEGMENTS; i++) {
+	if (extended) {
+	    xsegments[i] = shmx_get(i, false, true);
+	    if (verbose && xsegments[i] != NULL)
+		(void)fprintf(stderr, "extended unit %d opened\n", i);
+	    continue;
+	}
 	segments[i] = shm_get(i, false, true);
 	if (verbose && segments[i] != NULL)
 	    (void)fprintf(stderr, "unit %d opened\n", i);
@@ -87,6 +99,9 @@ int main(int argc, char **argv)
 	for (pp = segments; pp < segments + NTPSEGMENTS; pp++)
 	    if (*pp != NULL)
 		(void)shmdt((void *)(*pp));
+	for (i = 0; i < NTPSEGMENTS; i++)
+	    if (xsegments[i] != NULL)
+		(void)shmdt((void *)xsegments[i]);
 	exit(EXIT_SUCCESS);
     }
 
@@ -107,7 +122,10 @@ int main(int argc, char **argv)
 
 	for (i = 0; i < NTPSEGMENTS; i++) {
 	    long long diff;  /* 32 bit long is too short for a timespec */
-	    enum segstat_t status = ntp_read(segments[i], &shm_stat, false);
+	    /* extended segments are seqlocked, so reads never tear */
+	    enum segstat_t status = extended
+		? ntpx_read(xsegments[i], &shm_stat)
+		: ntp_read(segments[i], &shm_stat, false);
 	    if (verbose)
 		(void)fprintf(stderr, "unit %d status %d\n", i, status);
 	    switch(status) {
@@ -42,12 +42,31 @@ struct shmTime *shm_get(const int unit, const bool create, const bool forall)
     return p;
 }
 
+struct shmTimeX *shmx_get(const int unit, const bool create,
+			  const bool forall)
+/* initialize an extended SHM segment */
+{
+    struct shmTimeX *p = NULL;
+    int shmid;
+
+    shmid = shmget((key_t)(NTPX_BASE + unit), sizeof(struct shmTimeX),
+		   (create ? IPC_CREAT : 0) | (forall ? 0666 : 0600));
+    if (shmid == -1) { /* error */
+	return NULL;
+    }
+    p = (struct shmTimeX *)shmat (shmid, 0, 0);
+    if (p == (struct shmTimeX *)-1) { /* error */
+	return NULL;
+    }
+    return p;
+}
+
 char *ntp_name(const int unit)
 /* return the name of a specified segment */
 {
-    static char name[5] = "NTP\0";
+    static char name[8];
 
-    name[3] = (char)('0' + unit);
+    (void)snprintf(name, sizeof(name), "NTP%d", unit);
 
     return name;
 }
@@ -175,4 +194,60 @@ enum segstat_t ntp_read(struct shmTime *shm_in, struct shm_stat_t *shm_stat, con
     return shm_stat->status;
 }
 
+#define NTPX_TRIES	10	/* reads to attempt before calling it a clash */
+
+enum segstat_t ntpx_read(volatile struct shmTimeX *shm,
+			 struct shm_stat_t *shm_stat)
+/* take a consistent copy of the latest sample in an extended segment */
+{
+    struct shmTimeX copy;
+    uint32_t seq;
+    int tries;
+
+    if (shm == NULL) {
+	shm_stat->status = NO_SEGMENT;
+	return NO_SEGMENT;
+    }
+
+    shm_stat->tvc.tv_sec = shm_stat->tvc.tv_nsec = 0;
+
+    if (shm->magic != NTPX_MAGIC) {
+	shm_stat->status = NOT_READY;
+	return NOT_READY;
+    }
+    if (shm->version != NTPX_VERSION) {
+	shm_stat->status = BAD_MODE;
+	return BAD_MODE;
+    }
+
+    for (tries = 0; tries < NTPX_TRIES; tries++) {
+	seq = shm->seq;
+	memory_barrier();
+	if ((seq & 1) != 0)
+	    continue;		/* the writer is in the middle of it */
+	memcpy(&copy, (void *)shm, sizeof(copy));
+	memory_barrier();
+	if (seq == shm->seq)
+	    break;
+    }
+    if (tries == NTPX_TRIES) {
+	shm_stat->status = CLASH;
+	return CLASH;
+    }
+    if (copy.samples == 0) {
+	shm_stat->status = NOT_READY;
+	return NOT_READY;
+    }
+
+    shm_stat->status = OK;
+    shm_stat->tvt.tv_sec = (time_t)copy.clock_sec;
+    shm_stat->tvt.tv_nsec = (long)copy.clock_nsec;
+    shm_stat->tvr.tv_sec = (time_t)copy.receive_sec;
+    shm_stat->tvr.tv_nsec = (long)copy.receive_nsec;
+    shm_stat->leap = copy.leap;
+    shm_stat->precision = copy.precision;
+
+    return shm_stat->status;
+}
+
 /* end */
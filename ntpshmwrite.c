@@ -24,9 +24,8 @@
 
 #define LEAP_NOWARNING  0x0     /* normal, no leap second warning */
 
-void ntp_write(volatile struct shmTime *shmseg,
-	       struct timedelta_t *td, int precision, int leap_notify)
-/* put a received fix time into shared memory for NTP */
+static int leap_filter(struct timedelta_t *td, int leap_notify)
+/* pass a leap notification only in the months a leap second may come */
 {
     struct tm tm;
 
@@ -44,6 +43,14 @@ void ntp_write(volatile struct shmTime *shmseg,
         /* Not june, not December, no way */
         leap_notify = LEAP_NOWARNING;
     }
+    return leap_notify;
+}
+
+void ntp_write(volatile struct shmTime *shmseg,
+	       struct timedelta_t *td, int precision, int leap_notify)
+/* put a received fix time into shared memory for NTP */
+{
+    leap_notify = leap_filter(td, leap_notify);
 
     /* we use the shmTime mode 1 protocol
      *
@@ -78,4 +85,23 @@ void ntp_write(volatile struct shmTime *shmseg,
     shmseg->valid = 1;
 }
 
+void ntpx_write(volatile struct shmTimeX *shmseg,
+		struct timedelta_t *td, int precision, int leap_notify)
+/* put a received fix time into an extended segment */
+{
+    leap_notify = leap_filter(td, leap_notify);
+
+    shmseg->seq++;		/* odd: readers will wait or retry */
+    memory_barrier();
+    shmseg->clock_sec = (int64_t)td->real.tv_sec;
+    shmseg->clock_nsec = (int64_t)td->real.tv_nsec;
+    shmseg->receive_sec = (int64_t)td->clock.tv_sec;
+    shmseg->receive_nsec = (int64_t)td->clock.tv_nsec;
+    shmseg->leap = leap_notify;
+    shmseg->precision = precision;
+    shmseg->samples++;
+    memory_barrier();
+    shmseg->seq++;		/* even again: the sample is whole */
+}
+
 /* end */
@@ -33,6 +33,9 @@ PERMISSIONS
 #include <ctype.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>		/* for htons() */
 #include <unistd.h>
@@ -41,6 +44,7 @@ PERMISSIONS
 #include "gpsd.h"
 #include "crc24q.h"
 #include "strfuncs.h"
+#include "timespec.h"
 
 /*
  * The packet-recognition state machine.  This takes an incoming byte stream
@@ -209,139 +213,149 @@ static bool character_pushback(struct gps_lexer_t *lexer, unsigned int newstate)
     return false;
 }
 
-static bool nextstate(struct gps_lexer_t *lexer, unsigned char c)
+/*
+ * What each byte can begin, seen from ground state: a mask of the packet
+ * types whose leaders start with it, and the state it leads to.  A byte
+ * with an empty mask can only be discarded, which lets packet_parse()
+ * skip a run of them in one go while hunting.  RTCM2 is a bitstream, so
+ * any byte carrying its tag is a candidate; such a byte goes to RTCM2
+ * first, and a leader claims it only if no RTCM2 message completes (or,
+ * for a pushback, no RTCM2 sync is found either).
+ */
+struct lead_t {
+    unsigned int types;		/* PACKET_TYPEMASK()s of what can start here */
+    unsigned short state;	/* where it leads; GROUND_STATE if nowhere */
+    unsigned short pushback;	/* or where it's pushed back to, if not */
+};
+
+static struct lead_t leads[256];
+
+static void lead(unsigned char c, int type, unsigned int state)
+/* note that a byte can begin a packet type, and the state it leads to */
 {
-    static int n = 0;
+    leads[c].types |= PACKET_TYPEMASK(type);
+    leads[c].state = (unsigned short)state;
+}
+
+static void leads_init(void)
+/* fill in the lead-in table, once */
+{
+    static bool done = false;
+
+    if (done)
+	return;
 #ifdef RTCM104V2_ENABLE
-    enum isgpsstat_t isgpsstat;
+    {
+	unsigned int c;
+
+	/* ASCII characters 64-127, @ through DEL, carry ISGPS data */
+	for (c = 0x40; c < 0x80; c++)
+	    leads[c].types |= PACKET_TYPEMASK(RTCM2_PACKET);
+    }
 #endif /* RTCM104V2_ENABLE */
-#ifdef SUPERSTAR2_ENABLE
-    static unsigned char ctmp;
-#endif /* SUPERSTAR2_ENABLE */
-    n++;
-    switch (lexer->state) {
-    case GROUND_STATE:
-	n = 0;
-#ifdef STASH_ENABLE
-	lexer->stashbuflen = 0;
-#endif
-	if (c == '#') {
-	    lexer->state = COMMENT_BODY;
-	    break;
-	}
+    lead('#', COMMENT_PACKET, COMMENT_BODY);
 #ifdef NMEA0183_ENABLE
-	if (c == '$') {
-	    lexer->state = NMEA_DOLLAR;
-	    break;
-	}
-	if (c == '!') {
-	    lexer->state = NMEA_BANG;
-	    break;
-	}
+    lead('$', NMEA_PACKET, NMEA_DOLLAR);
+    lead('!', NMEA_PACKET, NMEA_BANG);
+#ifdef AIVDM_ENABLE
+    lead('!', AIVDM_PACKET, NMEA_BANG);
+#endif /* AIVDM_ENABLE */
 #endif /* NMEA0183_ENABLE */
-#if defined(TNT_ENABLE) || defined(GARMINTXT_ENABLE) || defined(ONCORE_ENABLE)
-	if (c == '@') {
-#ifdef RTCM104V2_ENABLE
-	    if (rtcm2_decode(lexer, c) == ISGPS_MESSAGE) {
-		lexer->state = RTCM2_RECOGNIZED;
-		break;
-	    }
-#endif /* RTCM104V2_ENABLE */
-	    lexer->state = AT1_LEADER;
-	    break;
-	}
-#endif
-#if defined(SIRF_ENABLE) || defined(SKYTRAQ_ENABLE)
-	if (c == 0xa0) {
-	    lexer->state = SIRF_LEADER_1;
-	    break;
-	}
-#endif /* SIRF_ENABLE || SKYTRAQ_ENABLE */
+#ifdef TNT_ENABLE
+    lead('@', NMEA_PACKET, AT1_LEADER);
+#endif /* TNT_ENABLE */
+#ifdef GARMINTXT_ENABLE
+    lead('@', GARMINTXT_PACKET, AT1_LEADER);
+#endif /* GARMINTXT_ENABLE */
+#ifdef ONCORE_ENABLE
+    lead('@', ONCORE_PACKET, AT1_LEADER);
+#endif /* ONCORE_ENABLE */
+#ifdef SIRF_ENABLE
+    lead(0xa0, SIRF_PACKET, SIRF_LEADER_1);
+#endif /* SIRF_ENABLE */
+#ifdef SKYTRAQ_ENABLE
+    lead(0xa0, SKY_PACKET, SIRF_LEADER_1);
+#endif /* SKYTRAQ_ENABLE */
 #ifdef SUPERSTAR2_ENABLE
-	if (c == SOH) {
-	    lexer->state = SUPERSTAR2_LEADER;
-	    break;
-	}
+    lead(SOH, SUPERSTAR2_PACKET, SUPERSTAR2_LEADER);
 #endif /* SUPERSTAR2_ENABLE */
-#if defined(TSIP_ENABLE) || defined(EVERMORE_ENABLE) || defined(GARMIN_ENABLE)
-	if (c == DLE) {
-	    lexer->state = DLE_LEADER;
-	    break;
-	}
-#endif /* TSIP_ENABLE || EVERMORE_ENABLE || GARMIN_ENABLE */
+#ifdef TSIP_ENABLE
+    lead(DLE, TSIP_PACKET, DLE_LEADER);
+#endif /* TSIP_ENABLE */
+#ifdef EVERMORE_ENABLE
+    lead(DLE, EVERMORE_PACKET, DLE_LEADER);
+#endif /* EVERMORE_ENABLE */
+#ifdef GARMIN_ENABLE
+    lead(DLE, GARMIN_PACKET, DLE_LEADER);
+#endif /* GARMIN_ENABLE */
+    /* the TripMate and EarthMate hellos lead on to RTCM2 */
 #ifdef TRIPMATE_ENABLE
-	if (c == 'A') {
-#ifdef RTCM104V2_ENABLE
-	    if (rtcm2_decode(lexer, c) == ISGPS_MESSAGE) {
-		lexer->state = RTCM2_RECOGNIZED;
-		break;
-	    }
-#endif /* RTCM104V2_ENABLE */
-	    lexer->state = ASTRAL_1;
-	    break;
-	}
+    lead('A', RTCM2_PACKET, ASTRAL_1);
 #endif /* TRIPMATE_ENABLE */
 #ifdef EARTHMATE_ENABLE
-	if (c == 'E') {
-#ifdef RTCM104V2_ENABLE
-	    if (rtcm2_decode(lexer, c) == ISGPS_MESSAGE) {
-		lexer->state = RTCM2_RECOGNIZED;
-		break;
-	    }
-#endif /* RTCM104V2_ENABLE */
-	    lexer->state = EARTHA_1;
-	    break;
-	}
+    lead('E', RTCM2_PACKET, EARTHA_1);
 #endif /* EARTHMATE_ENABLE */
 #ifdef ZODIAC_ENABLE
-	if (c == 0xff) {
-	    lexer->state = ZODIAC_LEADER_1;
-	    break;
-	}
+    lead(0xff, ZODIAC_PACKET, ZODIAC_LEADER_1);
 #endif /* ZODIAC_ENABLE */
 #ifdef UBLOX_ENABLE
-	if (c == 0xb5) {
-	    lexer->state = UBX_LEADER_1;
-	    break;
-	}
+    lead(0xb5, UBX_PACKET, UBX_LEADER_1);
 #endif /* UBLOX_ENABLE */
 #ifdef ITRAX_ENABLE
-	if (c == '<') {
-	    lexer->state = ITALK_LEADER_1;
-	    break;
-	}
+    lead('<', ITALK_PACKET, ITALK_LEADER_1);
 #endif /* ITRAX_ENABLE */
 #ifdef NAVCOM_ENABLE
-	if (c == 0x02) {
-	    lexer->state = NAVCOM_LEADER_1;
-	    break;
-	}
+    lead(0x02, NAVCOM_PACKET, NAVCOM_LEADER_1);
 #endif /* NAVCOM_ENABLE */
 #ifdef GEOSTAR_ENABLE
-	if (c == 'P') {
-	    lexer->state = GEOSTAR_LEADER_1;
-	    break;
-	}
+    /* GeoStar takes its leader before RTCM2 gets a look at it */
+    leads['P'].types = 0;
+    lead('P', GEOSTAR_PACKET, GEOSTAR_LEADER_1);
 #endif /* GEOSTAR_ENABLE */
-#ifdef RTCM104V2_ENABLE
-	if ((isgpsstat = rtcm2_decode(lexer, c)) == ISGPS_SYNC) {
-	    lexer->state = RTCM2_SYNC_STATE;
-	    break;
-	} else if (isgpsstat == ISGPS_MESSAGE) {
-	    lexer->state = RTCM2_RECOGNIZED;
-	    break;
-	}
-#endif /* RTCM104V2_ENABLE */
 #ifdef RTCM104V3_ENABLE
-	if (c == 0xD3) {
-	    lexer->state = RTCM3_LEADER_1;
-	    break;
-	}
+    lead(0xD3, RTCM3_PACKET, RTCM3_LEADER_1);
 #endif /* RTCM104V3_ENABLE */
 #ifdef PASSTHROUGH_ENABLE
-	if (c == '{')
-	    return character_pushback(lexer, JSON_LEADER);
+    leads['{'].types |= PACKET_TYPEMASK(JSON_PACKET);
+    leads['{'].pushback = JSON_LEADER;
 #endif /* PASSTHROUGH_ENABLE */
+    done = true;
+}
+
+static bool nextstate(struct gps_lexer_t *lexer, unsigned char c)
+{
+    static int n = 0;
+    const struct lead_t *lead;
+#ifdef RTCM104V2_ENABLE
+    enum isgpsstat_t isgpsstat;
+#endif /* RTCM104V2_ENABLE */
+#ifdef SUPERSTAR2_ENABLE
+    static unsigned char ctmp;
+#endif /* SUPERSTAR2_ENABLE */
+    n++;
+    switch (lexer->state) {
+    case GROUND_STATE:
+	n = 0;
+#ifdef STASH_ENABLE
+	lexer->stashbuflen = 0;
+#endif
+	lead = &leads[c];
+	if (lead->types == 0)
+	    break;
+#ifdef RTCM104V2_ENABLE
+	if ((lead->types & PACKET_TYPEMASK(RTCM2_PACKET)) != 0) {
+	    if ((isgpsstat = rtcm2_decode(lexer, c)) == ISGPS_MESSAGE) {
+		lexer->state = RTCM2_RECOGNIZED;
+		break;
+	    } else if (isgpsstat == ISGPS_SYNC && lead->state == GROUND_STATE) {
+		lexer->state = RTCM2_SYNC_STATE;
+		break;
+	    }
+	}
+#endif /* RTCM104V2_ENABLE */
+	if (lead->pushback != GROUND_STATE)
+	    return character_pushback(lexer, lead->pushback);
+	lexer->state = lead->state;
 	break;
     case COMMENT_BODY:
 	if (c == '\n')
@@ -1517,6 +1531,30 @@ static bool nextstate(struct gps_lexer_t *lexer, unsigned char c)
     return true;	/* no pushback */
 }
 
+static void packet_stamp_first(struct gps_lexer_t *lexer)
+/* find the read that brought in the first byte of the input buffer */
+{
+    unsigned long first;
+    unsigned int i;
+
+    lexer->first_stamp.tv_sec = lexer->first_stamp.tv_nsec = 0;
+    lexer->first_lag = 0;
+    /* input that didn't come through packet_get() has no stamp */
+    if (lexer->inbuflen > lexer->recv_counter)
+	return;
+    first = lexer->recv_counter - lexer->inbuflen;
+    /* oldest first; if that read has been forgotten, the lag says so */
+    for (i = 0; i < LEXER_STAMPS; i++) {
+	unsigned int n = (lexer->stamp_next + i) % LEXER_STAMPS;
+
+	if (lexer->stamps[n].end > first) {
+	    lexer->first_stamp = lexer->stamps[n].at;
+	    lexer->first_lag = (size_t)(lexer->stamps[n].end - first - 1);
+	    return;
+	}
+    }
+}
+
 static void packet_accept(struct gps_lexer_t *lexer, int packet_type)
 /* packet grab succeeded, move to output buffer */
 {
@@ -1527,6 +1565,27 @@ static void packet_accept(struct gps_lexer_t *lexer, int packet_type)
 	lexer->outbuflen = packetlen;
 	lexer->outbuffer[packetlen] = '\0';
 	lexer->type = packet_type;
+	packet_stamp_first(lexer);
+	if (packet_type == BAD_PACKET) {
+	    lexer->discarded += packetlen;
+	    if (!lexer->hunting)
+		lexer->resyncs++;
+	    lexer->hunting = true;
+	} else
+	    lexer->hunting = false;
+#ifdef TIMING_ENABLE
+	/* the read stamp is realtime; carry its age over to monotonic */
+	(void)clock_gettime(CLOCK_MONOTONIC, &lexer->mono_packet);
+	lexer->mono_read = lexer->mono_packet;
+	if (lexer->first_stamp.tv_sec != 0) {
+	    struct timespec now, age;
+
+	    (void)clock_gettime(CLOCK_REALTIME, &now);
+	    TS_SUB(&age, &now, &lexer->first_stamp);
+	    if (age.tv_sec >= 0 && age.tv_nsec >= 0)
+		TS_SUB(&lexer->mono_read, &lexer->mono_packet, &age);
+	}
+#endif /* TIMING_ENABLE */
 	if (lexer->errout.debug >= LOG_RAW+1) {
 	    char scratchbuf[MAX_PACKET_LENGTH*4+1];
 	    gpsd_log(&lexer->errout, LOG_RAW+1,
@@ -1611,6 +1670,10 @@ static void character_discard(struct gps_lexer_t *lexer)
 {
     memmove(lexer->inbuffer, lexer->inbuffer + 1, (size_t)-- lexer->inbuflen);
     lexer->inbufptr = lexer->inbuffer;
+    lexer->discarded++;
+    if (!lexer->hunting)
+	lexer->resyncs++;
+    lexer->hunting = true;
     if (lexer->errout.debug >= LOG_RAW+1) {
 	char scratchbuf[MAX_PACKET_LENGTH*4+1];
 	gpsd_log(&lexer->errout, LOG_RAW + 1,
@@ -1621,6 +1684,37 @@ static void character_discard(struct gps_lexer_t *lexer)
     }
 }
 
+static size_t character_skip(struct gps_lexer_t *lexer)
+/* discard a run of characters that can begin no packet, in one shift */
+{
+    size_t skip = 0;
+
+    while (skip < lexer->inbuflen && leads[lexer->inbuffer[skip]].types == 0)
+	skip++;
+    if (skip == 0)
+	return 0;
+    lexer->inbuflen -= skip;
+    memmove(lexer->inbuffer, lexer->inbuffer + skip, lexer->inbuflen);
+    lexer->inbufptr = lexer->inbuffer;
+    lexer->char_counter += skip;
+    lexer->discarded += skip;
+    if (!lexer->hunting)
+	lexer->resyncs++;
+    lexer->hunting = true;
+#ifdef STASH_ENABLE
+    lexer->stashbuflen = 0;
+#endif /* STASH_ENABLE */
+    if (lexer->errout.debug >= LOG_RAW+1) {
+	char scratchbuf[MAX_PACKET_LENGTH*4+1];
+	gpsd_log(&lexer->errout, LOG_RAW + 1,
+		 "%zu characters skipped, buffer %zu chars = %s\n",
+		 skip, lexer->inbuflen,
+		 gpsd_packetdump(scratchbuf, sizeof(scratchbuf),
+				    (char *)lexer->inbuffer, lexer->inbuflen));
+    }
+    return skip;
+}
+
 /* get 0-origin big-endian words relative to start of packet buffer */
 #define getword(i) (short)(lexer->inbuffer[2*(i)] | (lexer->inbuffer[2*(i)+1] << 8))
 
@@ -1630,11 +1724,21 @@ void lexer_init(struct gps_lexer_t *lexer)
 {
     lexer->char_counter = 0;
     lexer->retry_counter = 0;
+    lexer->recv_counter = 0;
+    memset(lexer->stamps, 0, sizeof(lexer->stamps));
+    lexer->stamp_next = 0;
+    lexer->kernel_stamps = false;
+    lexer->map = NULL;
+    lexer->maplen = lexer->mapoff = 0;
+    lexer->discarded = lexer->resyncs = 0;
+    lexer->hunting = false;
 #ifdef PASSTHROUGH_ENABLE
     lexer->json_depth = 0;
 #endif /* PASSTHROUGH_ENABLE */
 #ifdef TIMING_ENABLE
     lexer->start_time = 0.0;
+    lexer->mono_read.tv_sec = lexer->mono_read.tv_nsec = 0;
+    lexer->mono_packet.tv_sec = lexer->mono_packet.tv_nsec = 0;
 #endif /* TIMING_ENABLE */
     packet_reset(lexer);
     errout_reset(&lexer->errout);
@@ -1645,8 +1749,15 @@ void packet_parse(struct gps_lexer_t *lexer)
 {
     lexer->outbuflen = 0;
     while (packet_buffered_input(lexer) > 0) {
-	unsigned char c = *lexer->inbufptr++;
+	unsigned char c;
 	unsigned int oldstate = lexer->state;
+
+	/* hunting through garbage? drop what can't start a packet at once */
+	if (lexer->state == GROUND_STATE
+	    && lexer->inbufptr == lexer->inbuffer
+	    && character_skip(lexer) > 0)
+	    continue;
+	c = *lexer->inbufptr++;
 	if (!nextstate(lexer, c))
 	    continue;
 	gpsd_log(&lexer->errout, LOG_RAW + 2,
@@ -2334,14 +2445,92 @@ void packet_parse(struct gps_lexer_t *lexer)
 
 #undef getword
 
+#ifdef SO_TIMESTAMPNS
+static ssize_t packet_recvmsg(int fd, struct gps_lexer_t *lexer,
+			      struct timespec *when)
+/* read from a socket, getting the kernel's arrival time if it has one */
+{
+    struct iovec iov;
+    struct msghdr msg;
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct cmsghdr *cmsg;
+    ssize_t recvd;
+
+    iov.iov_base = lexer->inbuffer + lexer->inbuflen;
+    iov.iov_len = sizeof(lexer->inbuffer) - lexer->inbuflen;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    recvd = recvmsg(fd, &msg, 0);
+    (void)clock_gettime(CLOCK_REALTIME, when);
+    if (recvd <= 0)
+	return recvd;
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
+	 cmsg = CMSG_NXTHDR(&msg, cmsg))
+	if (cmsg->cmsg_level == SOL_SOCKET
+	    && cmsg->cmsg_type == SCM_TIMESTAMPNS)
+	    memcpy(when, CMSG_DATA(cmsg), sizeof(*when));
+    return recvd;
+}
+#endif /* SO_TIMESTAMPNS */
+
+void packet_map(struct gps_lexer_t *lexer, const unsigned char *base,
+		size_t len)
+/* take input from memory, such as a mapped file, instead of a read() */
+{
+    lexer->map = base;
+    lexer->maplen = len;
+    lexer->mapoff = 0;
+}
+
+static ssize_t packet_map_fill(struct gps_lexer_t *lexer)
+/* top up the input buffer from the mapping, when a packet may not fit */
+{
+    size_t room = sizeof(lexer->inbuffer) - lexer->inbuflen;
+    size_t left = lexer->maplen - lexer->mapoff;
+
+    /*
+     * The lexer works in place in its input buffer, so the bytes are
+     * copied; what a mapping saves is the system call per packet that
+     * a read() costs.  Refilling only once less than a maximum-length
+     * packet is buffered makes each copy as large as it can be.
+     */
+    if (packet_buffered_input(lexer) >= MAX_PACKET_LENGTH)
+	return 0;
+    if (room > left)
+	room = left;
+    memcpy(lexer->inbuffer + lexer->inbuflen, lexer->map + lexer->mapoff,
+	   room);
+    lexer->mapoff += room;
+    return (ssize_t)room;
+}
+
 ssize_t packet_get(int fd, struct gps_lexer_t *lexer)
 /* grab a packet; return -1=>I/O error, 0=>EOF, or a length */
 {
     ssize_t recvd;
+    struct timespec now;
 
     errno = 0;
-    recvd = read(fd, lexer->inbuffer + lexer->inbuflen,
-		 sizeof(lexer->inbuffer) - (lexer->inbuflen));
+    if (lexer->map != NULL) {
+	recvd = packet_map_fill(lexer);
+	/* a file has no arrival times; stamp when we took it */
+	if (recvd > 0)
+	    (void)clock_gettime(CLOCK_REALTIME, &now);
+    } else
+#ifdef SO_TIMESTAMPNS
+    if (lexer->kernel_stamps)
+	recvd = packet_recvmsg(fd, lexer, &now);
+    else
+#endif /* SO_TIMESTAMPNS */
+    {
+	recvd = read(fd, lexer->inbuffer + lexer->inbuflen,
+		     sizeof(lexer->inbuffer) - (lexer->inbuflen));
+	/* as close to the read as we can get without kernel help */
+	(void)clock_gettime(CLOCK_REALTIME, &now);
+    }
     if (recvd == -1) {
 	if ((errno == EAGAIN) || (errno == EINTR)) {
 	    gpsd_log(&lexer->errout, LOG_RAW + 2, "no bytes ready\n");
@@ -2362,6 +2551,12 @@ ssize_t packet_get(int fd, struct gps_lexer_t *lexer)
 				     (char *)lexer->inbufptr, (size_t) recvd));
 	}
 	lexer->inbuflen += recvd;
+	if (recvd > 0) {
+	    lexer->recv_counter += recvd;
+	    lexer->stamps[lexer->stamp_next].end = lexer->recv_counter;
+	    lexer->stamps[lexer->stamp_next].at = now;
+	    lexer->stamp_next = (lexer->stamp_next + 1) % LEXER_STAMPS;
+	}
     }
     gpsd_log(&lexer->errout, LOG_SPIN,
 	     "packet_get() fd %d -> %zd (%d)\n",
@@ -2381,6 +2576,10 @@ ssize_t packet_get(int fd, struct gps_lexer_t *lexer)
 
     /* if input buffer is full, discard */
     if (sizeof(lexer->inbuffer) == (lexer->inbuflen)) {
+	lexer->discarded += lexer->inbufptr - lexer->inbuffer;
+	if (!lexer->hunting)
+	    lexer->resyncs++;
+	lexer->hunting = true;
 	/* coverity[tainted_data] */
 	packet_discard(lexer);
 	lexer->state = GROUND_STATE;
@@ -2406,6 +2605,9 @@ ssize_t packet_get(int fd, struct gps_lexer_t *lexer)
      */
     if (lexer->outbuflen > 0)
 	return (ssize_t) lexer->outbuflen;
+    else if (lexer->map != NULL && lexer->mapoff < lexer->maplen)
+	/* nothing taken this time, but a mapping isn't at EOF till used up */
+	return (ssize_t)(lexer->maplen - lexer->mapoff);
     else
 	/*
 	 * Otherwise recvd is the size of whatever packet fragment we got.
@@ -2418,6 +2620,7 @@ ssize_t packet_get(int fd, struct gps_lexer_t *lexer)
 void packet_reset(struct gps_lexer_t *lexer)
 /* return the packet machine to the ground state */
 {
+    leads_init();
     lexer->type = BAD_PACKET;
     lexer->state = GROUND_STATE;
     lexer->inbuflen = 0;
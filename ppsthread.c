@@ -55,11 +55,17 @@
 #include <stdbool.h>
 #include <limits.h>
 #include <errno.h>
+#include <stdint.h>
 #include <math.h>
 #include <sys/socket.h>
 #include <sys/time.h>
 #include <unistd.h>
+#include <sched.h>
 #include <pthread.h>		/* pacifies OpenBSD's compiler */
+#ifdef __linux__
+#include <sys/syscall.h>	/* for SYS_sched_setaffinity */
+#include <sys/timerfd.h>	/* for simulated PPS */
+#endif /* __linux__ */
 
 /* use RFC 2783 PPS API */
 /* this needs linux >= 2.6.34 and
@@ -85,6 +91,7 @@
 #include "timespec.h"
 #include "ppsthread.h"
 #include "os_compat.h"
+#include "compiler.h"		/* for memory_barrier() */
 
 /*
  * Tell GCC that we want thread-safe behavior with _REENTRANT;
@@ -123,6 +130,7 @@ static int get_edge_tiocmiwait( volatile struct pps_thread_t *,
 struct inner_context_t {
     volatile struct pps_thread_t	*pps_thread;
     bool pps_canwait;                   /* can RFC2783 wait? */
+    int sim_fd;				/* timer for simulated edges, or -1 */
 #if defined(HAVE_SYS_TIMEPPS_H)
     int pps_caps;                       /* RFC2783 getcaps() */
     pps_handle_t kernelpps_handle;
@@ -138,32 +146,124 @@ static int get_edge_rfc2783(struct inner_context_t *,
                          volatile struct timedelta_t *);
 #endif  /* defined(HAVE_SYS_TIMEPPS_H) */
 
-static pthread_mutex_t ppslast_mutex = PTHREAD_MUTEX_INITIALIZER;
+/*
+ * Everything shared between the PPS thread and the rest of gpsd has
+ * exactly one writer, so instead of a mutex it is guarded by a sequence
+ * count that the writer makes odd while it is storing.  A reader copies
+ * the data and keeps the copy only if the count was even and unchanged
+ * across it.  The PPS thread never waits on a slow reader, and readers
+ * only ever retry across a write that takes a few dozen instructions.
+ */
 
-static void thread_lock(volatile struct pps_thread_t *pps_thread)
+static void read_fixin(volatile struct pps_thread_t *pps_thread,
+		       volatile struct timedelta_t *td)
+/* consistent copy of the last fix time, which the main thread writes */
 {
-    int pthread_err = pthread_mutex_lock(&ppslast_mutex);
-    if ( 0 != pthread_err ) {
-	char errbuf[BUFSIZ] = "unknown error";
-	(void)strerror_r(errno, errbuf, sizeof(errbuf));
-	pps_thread->log_hook(pps_thread, THREAD_ERROR,
-		"PPS:%s pthread_mutex_lock() : %s\n",
-	        pps_thread->devicename, errbuf);
+    unsigned long lock;
+
+    do {
+	lock = pps_thread->fixin_lock;
+	memory_barrier();
+	*td = pps_thread->fix_in;
+	memory_barrier();
+    } while ((lock & 1) != 0 || lock != pps_thread->fixin_lock);
+}
+
+static void pps_publish(volatile struct pps_thread_t *thread_context,
+			struct timespec *clock_ts, int edge, int source,
+			struct timedelta_t *ppstimes)
+/* put an edge in the ring, overwriting the oldest; ppstimes if accepted */
+{
+    unsigned long seq = thread_context->edges + 1;
+    volatile struct pps_edge_t *slot = &thread_context->ring[seq % PPS_RING];
+
+    slot->seq = 0;		/* readers of the old contents will notice */
+    memory_barrier();
+    if (ppstimes != NULL)
+	slot->td = *ppstimes;
+    else {
+	slot->td.real.tv_sec = 0;
+	slot->td.real.tv_nsec = 0;
+	slot->td.clock = *clock_ts;
     }
+    slot->assert = edge;
+    slot->source = source;
+    memory_barrier();
+    slot->seq = seq;
+    memory_barrier();
+    thread_context->edges = seq;
 }
 
-static void thread_unlock(volatile struct pps_thread_t *pps_thread)
+static void thread_schedule(volatile struct pps_thread_t *thread_context)
+/* called by the thread itself: apply the scheduling it was asked for */
 {
-    int pthread_err = pthread_mutex_unlock(&ppslast_mutex);
-    if ( 0 != pthread_err ) {
-	char errbuf[BUFSIZ] = "unknown error";
-	(void)strerror_r(errno, errbuf, sizeof(errbuf));
-	pps_thread->log_hook(pps_thread, THREAD_ERROR,
-		    "TPPS:%s pthread_mutex_unlock() : %s\n",
-		    pps_thread->devicename, errno, errbuf);
+    char errbuf[BUFSIZ] = "unknown error";
+
+    if (thread_context->cpus != 0) {
+#if defined(__linux__) && defined(SYS_sched_setaffinity)
+	/*
+	 * The raw system call takes a plain bit mask and thread 0 means
+	 * the caller, which spares us _GNU_SOURCE and cpu_set_t.
+	 */
+	unsigned long mask = thread_context->cpus;
+
+	if (syscall(SYS_sched_setaffinity, 0, sizeof(mask), &mask) != 0) {
+	    (void)strerror_r(errno, errbuf, sizeof(errbuf));
+	    thread_context->log_hook(thread_context, THREAD_WARN,
+		"PPS:%s CPU affinity %#lx failed: %s\n",
+		thread_context->devicename, mask, errbuf);
+	} else
+	    thread_context->log_hook(thread_context, THREAD_INF,
+		"PPS:%s pinned to CPUs %#lx\n",
+		thread_context->devicename, mask);
+#else
+	thread_context->log_hook(thread_context, THREAD_WARN,
+	    "PPS:%s CPU affinity not supported here\n",
+	    thread_context->devicename);
+#endif /* __linux__ */
+    }
+
+    if (thread_context->priority > 0) {
+	struct sched_param param;
+	int err;
+
+	memset(&param, 0, sizeof(param));
+	param.sched_priority = thread_context->priority;
+	err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if (err != 0) {
+	    (void)strerror_r(err, errbuf, sizeof(errbuf));
+	    thread_context->log_hook(thread_context, THREAD_WARN,
+		"PPS:%s SCHED_FIFO priority %d failed: %s\n",
+		thread_context->devicename, thread_context->priority, errbuf);
+	} else
+	    thread_context->log_hook(thread_context, THREAD_INF,
+		"PPS:%s running SCHED_FIFO at priority %d\n",
+		thread_context->devicename, thread_context->priority);
     }
 }
 
+static void count_jitter(volatile struct pps_thread_t *thread_context,
+			 long long cycle)
+/* histogram how far a cycle (in usec) is from the nearest nominal rate */
+{
+    long long nominal, off;
+    int bin;
+
+    if (180000 < cycle && 220000 > cycle)		/* 5Hz */
+	nominal = 200000;
+    else if (900000 < cycle && 1100000 > cycle)		/* 1Hz */
+	nominal = 1000000;
+    else if (1800000 < cycle && 2200000 > cycle)	/* 0.5Hz */
+	nominal = 2000000;
+    else
+	return;		/* not a cycle, a pulse width or a glitch */
+
+    off = cycle > nominal ? cycle - nominal : nominal - cycle;
+    for (bin = 0; off > 0 && bin < PPS_JITTER_BINS - 1; bin++)
+	off >>= 1;
+    thread_context->jitter[bin]++;
+}
+
 #if defined(HAVE_SYS_TIMEPPS_H)
 #ifdef __linux__
 /* Obtain contents of specified sysfs variable; null string if failure */
@@ -477,9 +577,7 @@ static int get_edge_tiocmiwait( volatile struct pps_thread_t *thread_context,
 
     /* duplicate copy in get_edge_rfc2783 */
     /* quick, grab a copy of last_fixtime before it changes */
-    thread_lock(thread_context);
-    *last_fixtime = thread_context->fix_in;
-    thread_unlock(thread_context);
+    read_fixin(thread_context, last_fixtime);
     /* end duplicate copy in get_edge_rfc2783 */
 
     /* get the time after we just woke up */
@@ -587,9 +685,7 @@ static int get_edge_rfc2783(struct inner_context_t *inner_context,
         /* get_edge_tiocmiwait() got this if !pps_canwait */
 
 	/* quick, grab a copy of last fixtime before it changes */
-	thread_lock(thread_context);
-	*last_fixtime = thread_context->fix_in;
-	thread_unlock(thread_context);
+	read_fixin(thread_context, last_fixtime);
     }
 
 
@@ -647,6 +743,56 @@ static int get_edge_rfc2783(struct inner_context_t *inner_context,
 }
 #endif  /* defined(HAVE_SYS_TIMEPPS_H) */
 
+#ifdef __linux__
+/* wait for, and get, a simulated edge: a timer set for the next second
+ * plus the thread's sim_offset, give or take up to sim_jitter ns.
+ * The edge is stamped when the thread wakes, as with TIOCMIWAIT, so
+ * the wakeup latency of the box shows up in the jitter statistics.
+ * The jitter comes from a fixed-seed generator, so runs repeat.
+ * return -1 for error
+ *         0 for OK
+ */
+static int get_edge_simulated(struct inner_context_t *inner_context,
+			      struct timespec *clock_ts,
+			      unsigned long *rng,
+			      volatile struct timedelta_t *last_fixtime)
+{
+    volatile struct pps_thread_t *thread_context = inner_context->pps_thread;
+    struct itimerspec when;
+    struct timespec now;
+    uint64_t expirations;
+    long long at;
+
+    (void)clock_gettime(CLOCK_REALTIME, &now);
+    at = thread_context->sim_offset;
+    if (thread_context->sim_jitter > 0) {
+	/* xorshift, good enough for spreading edges */
+	*rng ^= *rng << 13;
+	*rng ^= *rng >> 7;
+	*rng ^= *rng << 17;
+	at += (long long)(*rng % (2 * (unsigned long)thread_context->sim_jitter
+				  + 1)) - thread_context->sim_jitter;
+    }
+    memset(&when, 0, sizeof(when));
+    when.it_value.tv_sec = now.tv_sec + 1 + (time_t)(at / NS_IN_SEC);
+    when.it_value.tv_nsec = (long)(at % NS_IN_SEC);
+    TS_NORM(&when.it_value);
+    if (timerfd_settime(inner_context->sim_fd, TFD_TIMER_ABSTIME,
+			&when, NULL) != 0
+	|| read(inner_context->sim_fd, &expirations, sizeof(expirations))
+	   != (ssize_t)sizeof(expirations)) {
+	thread_context->log_hook(thread_context, THREAD_ERROR,
+		    "SPPS:%s simulated edge failed: %s\n",
+		    thread_context->devicename, strerror(errno));
+	return -1;
+    }
+    (void)clock_gettime(CLOCK_REALTIME, clock_ts);
+    /* quick, grab a copy of last_fixtime before it changes */
+    read_fixin(thread_context, last_fixtime);
+    return 0;
+}
+#endif /* __linux__ */
+
 /* gpsd_ppsmonitor()
  *
  * the core loop of the PPS thread.
@@ -690,15 +836,26 @@ static void *gpsd_ppsmonitor(void *arg)
     struct timespec pulse_kpps[2] = { {0, 0}, {0, 0} };
 #endif /* defined(HAVE_SYS_TIMEPPS_H) */
     bool not_a_tty = false;
+    unsigned long sim_rng = 1;		/* same jitter every run */
+    struct timespec sim_pulse = {0, 0};
 
     /* Acknowledge that we've grabbed the inner_context data */
     ((volatile struct inner_context_t *)arg)->pps_thread = NULL;
 
+    thread_schedule(thread_context);
+
     /* before the loop, figure out how we can detect edges:
      * TIOMCIWAIT, which is linux specifix
      * RFC2783, a.k.a kernel PPS (KPPS)
      * or if KPPS is deficient a combination of the two */
-    if ( 0 > thread_context->devicefd
+    if (0 <= inner_context.sim_fd) {
+	thread_context->log_hook(thread_context, THREAD_INF,
+            "SPPS:%s simulated PPS, %ld ns after the second, +/- %ld ns\n",
+            thread_context->devicename,
+            thread_context->sim_offset, thread_context->sim_jitter);
+        /* never touch the device's own lines */
+        not_a_tty = true;
+    } else if ( 0 > thread_context->devicefd
       || 0 == isatty(thread_context->devicefd) ) {
 	thread_context->log_hook(thread_context, THREAD_PROG,
             "KPPS:%s gps_fd:%d not a tty, can not use TIOMCIWAIT\n",
@@ -764,6 +921,7 @@ static void *gpsd_ppsmonitor(void *arg)
 	bool ok = false;
 	char *log = NULL;
         char *edge_str = "";
+	int source = PPS_SOURCE_TIOCMIWAIT;
 
 	if (++unchanged == 10) {
             /* last ten edges no good, stop spinning, just wait 10 seconds */
@@ -775,6 +933,30 @@ static void *gpsd_ppsmonitor(void *arg)
         }
 
         /* Stage One; wait for the next edge */
+#ifdef __linux__
+	if (0 <= inner_context.sim_fd) {
+	    if (0 != get_edge_simulated(&inner_context, &clock_ts,
+					&sim_rng, &last_fixtime)) {
+		thread_context->log_hook(thread_context, THREAD_PROG,
+			    "PPS:%s die: simulated PPS Error\n",
+			    thread_context->devicename);
+		break;
+	    }
+	    /* an invisible pulse: asserts only, like a 1us strobe */
+	    ok = true;
+	    state = edge = 1;
+	    edge_str = "Assert";
+	    cycle = timespec_diff_ns(clock_ts, sim_pulse) / 1000;
+	    duration = 0;
+	    sim_pulse = clock_ts;
+	    source = PPS_SOURCE_SIMULATED;
+
+	    timespec_str( &clock_ts, ts_str1, sizeof(ts_str1) );
+	    thread_context->log_hook(thread_context, THREAD_PROG,
+		    "SPPS:%s %.10s, cycle: %lld @ %s\n",
+		    thread_context->devicename, edge_str, cycle, ts_str1);
+	}
+#endif /* __linux__ */
 #if defined(TIOCMIWAIT)
         if ( !not_a_tty && !inner_context.pps_canwait ) {
             int ret;
@@ -885,6 +1067,7 @@ static void *gpsd_ppsmonitor(void *arg)
 	    clock_ts = clock_ts_kpps;
 	    cycle = cycle_kpps;
 	    duration = duration_kpps;
+	    source = PPS_SOURCE_KPPS;
 
 	    timespec_str( &clock_ts_kpps, ts_str1, sizeof(ts_str1) );
 	    thread_context->log_hook(thread_context, THREAD_PROG,
@@ -896,7 +1079,8 @@ static void *gpsd_ppsmonitor(void *arg)
 	}
 #endif /* defined(HAVE_SYS_TIMEPPS_H) */
 
-        if ( not_a_tty && !inner_context.pps_canwait ) {
+        if ( not_a_tty && !inner_context.pps_canwait
+	     && 0 > inner_context.sim_fd ) {
 	    /* uh, oh, no TIOMCIWAIT, nor RFC2783, die */
 	    thread_context->log_hook(thread_context, THREAD_WARN,
 			"PPS:%s die: no TIOMCIWAIT, nor RFC2783 CANWAIT\n",
@@ -944,6 +1128,7 @@ static void *gpsd_ppsmonitor(void *arg)
         /* else, unchannged state, and weird cycle time */
 
 	state_last = state;
+	count_jitter(thread_context, cycle);
 	timespec_str( &clock_ts, ts_str1, sizeof(ts_str1) );
 	thread_context->log_hook(thread_context, THREAD_PROG,
 	    "PPS:%s %.10s cycle: %7lld, duration: %7lld @ %s\n",
@@ -952,6 +1137,7 @@ static void *gpsd_ppsmonitor(void *arg)
 	    cycle, duration, ts_str1);
 	if (unchanged) {
 	    // strange, try again
+	    pps_publish(thread_context, &clock_ts, edge, source, NULL);
 	    continue;
 	}
 
@@ -1109,6 +1295,7 @@ static void *gpsd_ppsmonitor(void *arg)
 	    thread_context->log_hook(thread_context, THREAD_PROG,
 			"PPS:%s %.10s ignored %.100s",
 			thread_context->devicename, edge_str,  log);
+	    pps_publish(thread_context, &clock_ts, edge, source, NULL);
 	    continue;
         }
 
@@ -1165,6 +1352,7 @@ static void *gpsd_ppsmonitor(void *arg)
 			edge_str,
 			delay_str);
 	    log1 = "system clock went backwards";
+	    pps_publish(thread_context, &clock_ts, edge, source, NULL);
 	} else if ( ( 2 < delay.tv_sec)
 	  || ( 1 == delay.tv_sec && 100000000 < delay.tv_nsec ) ) {
 	    /* system clock could be slewing so allow up to 1.1 sec delay */
@@ -1175,16 +1363,23 @@ static void *gpsd_ppsmonitor(void *arg)
 			edge_str,
 			delay_str);
 	    log1 = "timestamp out of range";
+	    pps_publish(thread_context, &clock_ts, edge, source, NULL);
 	} else {
 	    last_second_used = last_fixtime.real.tv_sec;
+	    thread_context->fix_delay = (long long)delay.tv_sec * NS_IN_SEC
+		+ delay.tv_nsec;
+	    /* before the hook, which may wake readers of the ring */
+	    pps_publish(thread_context, &clock_ts, edge, source, &ppstimes);
 	    if (thread_context->report_hook != NULL)
 		log1 = thread_context->report_hook(thread_context, &ppstimes);
 	    else
 		log1 = "no report hook";
-	    thread_lock(thread_context);
+	    thread_context->ppsout_lock++;
+	    memory_barrier();
 	    thread_context->pps_out = ppstimes;
 	    thread_context->ppsout_count++;
-	    thread_unlock(thread_context);
+	    memory_barrier();
+	    thread_context->ppsout_lock++;
 	    timespec_str( &ppstimes.clock, ts_str1, sizeof(ts_str1) );
 	    timespec_str( &ppstimes.real, ts_str2, sizeof(ts_str2) );
 	    thread_context->log_hook(thread_context, THREAD_INF,
@@ -1210,6 +1405,8 @@ static void *gpsd_ppsmonitor(void *arg)
 	(void)time_pps_destroy(inner_context.kernelpps_handle);
     }
 #endif
+    if (0 <= inner_context.sim_fd)
+	(void)close(inner_context.sim_fd);
     thread_context->log_hook(thread_context, THREAD_PROG,
 		"PPS:%s gpsd_ppsmonitor exited.\n",
 		thread_context->devicename);
@@ -1236,10 +1433,33 @@ void pps_thread_activate(volatile struct pps_thread_t *pps_thread)
     static struct inner_context_t	inner_context;
 
     inner_context.pps_thread = pps_thread;
+    inner_context.sim_fd = -1;
+    inner_context.pps_canwait = false;
+#if defined(HAVE_SYS_TIMEPPS_H)
+    inner_context.kernelpps_handle = -1;
+#endif /* HAVE_SYS_TIMEPPS_H */
+    if (pps_thread->simulate) {
+#ifdef __linux__
+	inner_context.sim_fd = timerfd_create(CLOCK_REALTIME, 0);
+	if (0 > inner_context.sim_fd)
+	    pps_thread->log_hook(pps_thread, THREAD_ERROR,
+			"SPPS:%s no timer for simulated PPS: %s\n",
+			pps_thread->devicename, strerror(errno));
+#else
+	pps_thread->log_hook(pps_thread, THREAD_ERROR,
+		    "SPPS:%s simulated PPS needs Linux timerfd\n",
+		    pps_thread->devicename);
+#endif /* __linux__ */
+	if (0 > inner_context.sim_fd)
+	    return;
+    }
 #if defined(HAVE_SYS_TIMEPPS_H)
     /* some operations in init_kernel_pps() require root privs */
-    (void)init_kernel_pps(&inner_context);
-    if ( 0 <= inner_context.kernelpps_handle ) {
+    if (!pps_thread->simulate)
+	(void)init_kernel_pps(&inner_context);
+    if (pps_thread->simulate) {
+	/* the timer is the only source */
+    } else if ( 0 <= inner_context.kernelpps_handle ) {
 	pps_thread->log_hook(pps_thread, THREAD_INF,
 		    "KPPS:%s kernel PPS will be used\n",
 		    pps_thread->devicename);
@@ -1249,9 +1469,10 @@ void pps_thread_activate(volatile struct pps_thread_t *pps_thread)
 		    pps_thread->devicename);
     }
 #else
-    pps_thread->log_hook(pps_thread, THREAD_WARN,
-		"KPPS:%s no HAVE_SYS_TIMEPPS_H, PPS accuracy will suffer\n",
-		pps_thread->devicename);
+    if (!pps_thread->simulate)
+	pps_thread->log_hook(pps_thread, THREAD_WARN,
+		    "KPPS:%s no HAVE_SYS_TIMEPPS_H, PPS accuracy will suffer\n",
+		    pps_thread->devicename);
 #endif
 
     memset( &pt, 0, sizeof(pt));
@@ -1277,24 +1498,69 @@ void pps_thread_fixin(volatile struct pps_thread_t *pps_thread,
 			      volatile struct timedelta_t *fix_in)
 /* thread-safe update of last fix time - only way we pass data in */
 {
-    thread_lock(pps_thread);
+    pps_thread->fixin_lock++;
+    memory_barrier();
     pps_thread->fix_in = *fix_in;
-    thread_unlock(pps_thread);
+    memory_barrier();
+    pps_thread->fixin_lock++;
 }
 
 int pps_thread_ppsout(volatile struct pps_thread_t *pps_thread,
 		       volatile struct timedelta_t *td)
 /* return the delta at the time of the last PPS - only way we pass data out */
 {
-    volatile int ret;
+    unsigned long lock;
+    int ret;
 
-    thread_lock(pps_thread);
-    *td = pps_thread->pps_out;
-    ret = pps_thread->ppsout_count;
-    thread_unlock(pps_thread);
+    do {
+	lock = pps_thread->ppsout_lock;
+	memory_barrier();
+	*td = pps_thread->pps_out;
+	ret = pps_thread->ppsout_count;
+	memory_barrier();
+    } while ((lock & 1) != 0 || lock != pps_thread->ppsout_lock);
 
     return ret;
 }
 
+int pps_thread_next(volatile struct pps_thread_t *pps_thread,
+		    struct pps_cursor_t *cursor, struct pps_edge_t *edge)
+/* copy out the next edge this reader has not seen; 0 if there is none */
+{
+    for (;;) {
+	unsigned long head = pps_thread->edges;
+	volatile struct pps_edge_t *slot;
+	unsigned long seq;
+
+	memory_barrier();
+	if (cursor->next == 0)
+	    /* new reader, start with the next edge */
+	    cursor->next = head + 1;
+	else if (cursor->next > head + 1)
+	    /* the thread was restarted, its count begins again */
+	    cursor->next = 1;
+	if (cursor->next > head)
+	    return 0;
+	if (head - cursor->next >= PPS_RING) {
+	    /* the writer lapped us */
+	    cursor->lost += head - PPS_RING + 1 - cursor->next;
+	    cursor->next = head - PPS_RING + 1;
+	}
+	slot = &pps_thread->ring[cursor->next % PPS_RING];
+	seq = slot->seq;
+	memory_barrier();
+	edge->td = slot->td;
+	edge->assert = slot->assert;
+	edge->source = slot->source;
+	memory_barrier();
+	if (seq == cursor->next && slot->seq == seq) {
+	    edge->seq = seq;
+	    cursor->next++;
+	    return 1;
+	}
+	/* overwritten while we copied, look at the head again */
+    }
+}
+
 /* end */
 
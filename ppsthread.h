@@ -6,6 +6,7 @@
 #ifndef PPSTHREAD_H
 #define PPSTHREAD_H
 
+#include <stdbool.h>
 #include <time.h>
 
 #ifndef TIMEDELTA_DEFINED
@@ -16,17 +17,61 @@ struct timedelta_t {
 };
 #endif /* TIMEDELTA_DEFINED */
 
+/*
+ * One edge seen by the PPS thread.  real is zero unless the edge was
+ * accepted as marking the start of a second and passed to the report hook.
+ */
+struct pps_edge_t {
+    unsigned long seq;		/* edge sequence number, counting from 1 */
+    struct timedelta_t td;	/* GPS & system time of the edge */
+    int assert;			/* 1 = assert edge, 0 = clear edge */
+    int source;			/* how the edge was captured */
+};
+
+#define PPS_SOURCE_TIOCMIWAIT	0
+#define PPS_SOURCE_KPPS		1
+#define PPS_SOURCE_SIMULATED	2
+
+#define PPS_RING	16	/* edges kept for readers */
+
+/*
+ * Cycle jitter histogram: bin 0 counts edges less than 1 usec from the
+ * nominal cycle, bin n those at least 2^(n-1) usec off, and the last
+ * bin everything from there up.
+ */
+#define PPS_JITTER_BINS	18
+
+/*
+ * Each reader of the edge ring keeps one of these; zero it to start
+ * reading from the next edge.  Readers never block the PPS thread, so
+ * one that falls more than PPS_RING edges behind loses the oldest.
+ */
+struct pps_cursor_t {
+    unsigned long next;		/* sequence number wanted next */
+    unsigned long lost;		/* edges overwritten before they were read */
+};
+
 /*
  * Set context, devicefd, and devicename at initialization time, before
  * you call pps_thread_activate().  The context pointer can be used to
  * pass data to the hook routines.
  *
- * Do not set the fix_in member or read the pps_out member directly,
- * these accesses need to be mutex-locked and that is what the last
- * two functions are for.
+ * Do not set the fix_in member or read the pps_out member or the edge
+ * ring directly; each has a single writer and is sequence-locked so
+ * that neither side ever waits on the other, and the functions below
+ * are what do the locking.
  *
  * The report hook is called when each PPS event is recognized.  The log
  * hook is called to log error and status indications from the thread.
+ *
+ * Set priority to run the thread SCHED_FIFO at that priority, and cpus
+ * to a bit mask to pin it to those CPUs; leave them zero for the
+ * default scheduling.  The report hook runs in the thread, so anything
+ * it does gets the same treatment.
+ *
+ * Set simulate to ignore the device's lines and make edges from a timer
+ * instead, sim_offset ns after each second, give or take sim_jitter ns;
+ * this is for tests, which get real edges on any device, pty included.
  */
 struct pps_thread_t {
     void *context;		/* PPS thread code leaves this alone */
@@ -39,6 +84,16 @@ struct pps_thread_t {
     struct timedelta_t fix_in;	/* real & clock time when in-band fix received */
     struct timedelta_t pps_out;	/* real & clock time of last PPS event */
     int ppsout_count;
+    unsigned long fixin_lock, ppsout_lock;	/* odd while being written */
+    struct pps_edge_t ring[PPS_RING];	/* the most recent edges */
+    unsigned long edges;	/* sequence number of the newest edge */
+    int priority;		/* SCHED_FIFO priority, 0 for none */
+    unsigned long cpus;		/* CPUs to run on, 0 for any */
+    unsigned long jitter[PPS_JITTER_BINS];	/* written by the thread only */
+    long long fix_delay;	/* ns from in-band fix to the edge being
+				 * reported, for the report hook */
+    bool simulate;		/* edges from a timer, not the device */
+    long sim_offset, sim_jitter;	/* ns, for simulated edges */
 };
 
 #define THREAD_ERROR	0
@@ -53,6 +108,8 @@ extern void pps_thread_fixin(volatile struct pps_thread_t *,
 				     volatile struct timedelta_t *);
 extern int pps_thread_ppsout(volatile struct pps_thread_t *,
 			      volatile struct timedelta_t *);
+extern int pps_thread_next(volatile struct pps_thread_t *,
+			   struct pps_cursor_t *, struct pps_edge_t *);
 int pps_check_fake(const char *);
 char *pps_get_first(void);
 
@@ -38,7 +38,8 @@ int json_rtcm3_read(const char *buf,
 	{"device",         t_string,   .addr.string = path, .len = pathlen}, \
 	{"length",         t_uinteger, .addr.uinteger = &rtcm3->length},
 
-    int status = 0, satcount = 0;
+    int status = 0, satcount = 0, cellcount = 0;
+    unsigned int type = 0;
 
 #define RTCM3FIELD(type, fld)	STRUCTOBJECT(struct rtcm3_ ## type ## _t, fld)
     const struct json_attr_t rtcm1001_satellite[] = {
@@ -82,6 +83,26 @@ int json_rtcm3_read(const char *buf,
 	{"CNR",       t_real,     RTCM3FIELD(1010, L1.CNR)},
 	{NULL},
     };
+
+    const struct json_attr_t msm_satellite[] = {
+	{"ident",     t_ushort,   STRUCTOBJECT(struct rtcm3_msm_sat, ident)},
+	{"rr",        t_real,     STRUCTOBJECT(struct rtcm3_msm_sat, rough_range)},
+	{"ext",       t_ushort,   STRUCTOBJECT(struct rtcm3_msm_sat, ext)},
+	{"rate",      t_real,     STRUCTOBJECT(struct rtcm3_msm_sat, rate)},
+	{NULL},
+    };
+
+    const struct json_attr_t msm_cell[] = {
+	{"sat",       t_ushort,   STRUCTOBJECT(struct rtcm3_msm_cell, sat)},
+	{"sig",       t_ushort,   STRUCTOBJECT(struct rtcm3_msm_cell, sig)},
+	{"prange",    t_real,     STRUCTOBJECT(struct rtcm3_msm_cell, pseudorange)},
+	{"cphase",    t_real,     STRUCTOBJECT(struct rtcm3_msm_cell, phaserange)},
+	{"lockt",     t_uinteger, STRUCTOBJECT(struct rtcm3_msm_cell, locktime)},
+	{"half",      t_boolean,  STRUCTOBJECT(struct rtcm3_msm_cell, half_cycle)},
+	{"CNR",       t_real,     STRUCTOBJECT(struct rtcm3_msm_cell, CNR)},
+	{"rate",      t_real,     STRUCTOBJECT(struct rtcm3_msm_cell, rate)},
+	{NULL},
+    };
 #undef RTCM3FIELD
 
 #define R1001	&rtcm3->rtcmtypes.rtcm3_1001.header
@@ -196,6 +217,39 @@ int json_rtcm3_read(const char *buf,
     };
 #undef R1033
 
+    const struct json_enum_t gnss_map[] = {
+	{"GPS",     msm_gps},
+	{"GLONASS", msm_glonass},
+	{"Galileo", msm_galileo},
+	{"SBAS",    msm_sbas},
+	{"QZSS",    msm_qzss},
+	{"BeiDou",  msm_beidou},
+	{NULL},
+    };
+
+#define RMSM	rtcm3->rtcmtypes.msm
+    const struct json_attr_t json_rtcm3_msm[] = {
+	RTCM3_HEADER
+	{"gnss",       t_integer,  .addr.integer = (int *)&RMSM.gnss,
+	                                 .map = gnss_map},
+	{"msm",        t_ushort,   .addr.ushortint = &RMSM.level},
+	{"station_id", t_uinteger, .addr.uinteger = &RMSM.station_id},
+	{"tow",        t_uinteger, .addr.uinteger = &RMSM.tow},
+	{"dow",        t_ushort,   .addr.ushortint = &RMSM.dow},
+	{"sync",       t_boolean,  .addr.boolean = &RMSM.sync},
+	{"iods",       t_ushort,   .addr.ushortint = &RMSM.iods},
+	{"steering",   t_ushort,   .addr.ushortint = &RMSM.steering},
+	{"ext_clock",  t_ushort,   .addr.ushortint = &RMSM.ext_clock},
+	{"smoothing",  t_boolean,  .addr.boolean = &RMSM.smoothing},
+	{"interval",   t_ushort,   .addr.ushortint = &RMSM.interval},
+	{"sats",       t_array,    STRUCTARRAY(RMSM.sats,
+					       msm_satellite, &satcount)},
+	{"cells",      t_array,    STRUCTARRAY(RMSM.cells,
+					       msm_cell, &cellcount)},
+	{NULL},
+    };
+#undef RMSM
+
     const struct json_attr_t json_rtcm3_fallback[] = {
 	RTCM3_HEADER
 	{"data",     t_array, .addr.array.element_type = t_string,
@@ -212,6 +266,9 @@ int json_rtcm3_read(const char *buf,
 
     memset(rtcm3, '\0', sizeof(struct rtcm3_t));
 
+    if (strstr(buf, "\"type\":") != NULL)
+	(void)sscanf(strstr(buf, "\"type\":"), "\"type\":%u", &type);
+
     if (strstr(buf, "\"type\":1001,") != NULL) {
 	status = json_read_object(buf, json_rtcm1001, endptr);
 	if (status == 0)
@@ -232,6 +289,24 @@ int json_rtcm3_read(const char *buf,
 	status = json_read_object(buf, json_rtcm1014, endptr);
     } else if (strstr(buf, "\"type\":1033,") != NULL) {
 	status = json_read_object(buf, json_rtcm1033, endptr);
+    } else if (type >= 1071 && type <= 1127
+	       && type % 10 >= 1 && type % 10 <= 7
+	       && strstr(buf, "\"cells\":") != NULL) {
+	status = json_read_object(buf, json_rtcm3_msm, endptr);
+	if (status == 0) {
+	    struct rtcm3_msm_t *msm = &rtcm3->rtcmtypes.msm;
+	    unsigned long sigmask = 0;
+	    int i;
+
+	    msm->nsat = (unsigned short)satcount;
+	    msm->ncell = (unsigned short)cellcount;
+	    /* signal count isn't shipped; recover it from the cells */
+	    for (i = 0; i < cellcount; i++)
+		if (msm->cells[i].sig >= 1 && msm->cells[i].sig <= 32)
+		    sigmask |= 1UL << (msm->cells[i].sig - 1);
+	    for (msm->nsig = 0; sigmask != 0; sigmask &= sigmask - 1)
+		msm->nsig++;
+	}
     } else {
 	int n;
 	status = json_read_object(buf, json_rtcm3_fallback, endptr);
@@ -247,7 +322,9 @@ int json_rtcm3_read(const char *buf,
 		    rtcm3->rtcmtypes.data[n] = (char)u;
 	    }
 	}
+	return status;		/* raw payload, so not decoded */
     }
+    rtcm3->decoded = (status == 0);
     return status;
 }
 #endif /* SOCKET_EXPORT_ENABLE */
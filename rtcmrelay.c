@@ -0,0 +1,481 @@
+/*
+ * rtcmrelay.c - fan DGPS/RTK corrections out to rovers and caster clients
+ *
+ * Every RTCM2 or RTCM3 frame a source device delivers is copied once
+ * into a ring shared by all sinks.  A sink is either a rover (a device
+ * whose driver has an rtcm_writer) or a TCP client that asked for the
+ * raw correction stream.  Each sink keeps its own cursor into the ring
+ * and is written with non-blocking I/O from the main loop, so a slow
+ * serial rover falls behind on its own instead of stalling the daemon.
+ *
+ * Each frame carries a count of the sinks that still want it.  When
+ * the producer laps a frame whose count is not yet zero, the sinks
+ * still owing it are charged a drop and skip ahead to the oldest
+ * frame that is still in the ring.  A sink caught part way through
+ * the lapped frame keeps the unwritten rest of it and finishes that
+ * first, so nobody ever sees the head of one frame spliced onto
+ * another.
+ *
+ * Sinks that still have a backlog after a pass are put in the main
+ * loop's write set, so the daemon sleeps until one of them has room.
+ * A sink that has made no progress at all for a while is reported as
+ * stalled, and the daemon hangs up on stalled caster clients.
+ *
+ * This file is Copyright (c) 2010 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+
+#include <string.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "gpsd.h"
+#include "strfuncs.h"
+
+#define RELAY_RING	64	/* frames buffered for slow sinks */
+#define RELAY_SINKS	(MAX_DEVICES + 8)	/* rovers plus caster clients */
+
+struct relay_sink_t {
+    socket_t fd;		/* -1 if this slot is free */
+    struct gps_device_t *device;	/* rover, or NULL for a TCP client */
+    unsigned long next;		/* sequence number of next frame to ship */
+    size_t offset;		/* bytes of that frame already written */
+    size_t taillen;		/* rest of a lapped frame still to write */
+    unsigned char tail[RTCM3_MAX];
+    time_t progress;		/* last write, or last time caught up */
+    int ntypes;			/* zero means pass everything */
+    unsigned int types[RELAY_TYPES_MAX];
+    unsigned long sent, dropped, filtered;
+};
+
+struct relay_frame_t {
+    struct gps_device_t *source;	/* where the frame came from */
+    unsigned long seq;		/* sequence number of this frame */
+    int refcount;		/* sinks that have yet to ship it */
+    unsigned int type;		/* RTCM message number */
+    size_t len;
+    unsigned char buf[RTCM3_MAX];
+};
+
+static struct {
+    unsigned long head;		/* sequence number of next frame in */
+    unsigned long frames;	/* frames accepted since startup */
+    unsigned long overruns;	/* frames lapped while still referenced */
+    struct relay_frame_t ring[RELAY_RING];
+    struct relay_sink_t sinks[RELAY_SINKS];
+} relay;
+
+static bool relay_wants(const struct relay_sink_t *sink, unsigned int type)
+/* does this sink's message-type filter pass the given type? */
+{
+    int i;
+
+    if (sink->ntypes == 0)
+	return true;
+    for (i = 0; i < sink->ntypes; i++)
+	if (sink->types[i] == type)
+	    return true;
+    return false;
+}
+
+static bool relay_owes(const struct relay_sink_t *sink,
+		       const struct relay_frame_t *frame)
+/* is this frame one the sink has to ship? */
+{
+    /* never echo corrections back where they came from */
+    if (sink->device != NULL && sink->device == frame->source)
+	return false;
+    return relay_wants(sink, frame->type);
+}
+
+int rtcm_relay_types(const char *spec, unsigned int *types, int maxtypes)
+/* parse a comma-separated list of message numbers; -1 on bad syntax */
+{
+    int n = 0;
+
+    while (*spec != '\0') {
+	char *end;
+	unsigned long type = strtoul(spec, &end, 10);
+
+	if (end == spec || type == 0 || type > 4095 || n >= maxtypes)
+	    return -1;
+	types[n++] = (unsigned int)type;
+	if (*end == ',')
+	    ++end;
+	else if (*end != '\0')
+	    return -1;
+	spec = end;
+    }
+    return n;
+}
+
+static struct relay_sink_t *relay_alloc(void)
+{
+    struct relay_sink_t *sink;
+
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++)
+	if (sink->fd < 0) {
+	    memset(sink, '\0', sizeof(*sink));
+	    /* only frames arriving from now on */
+	    sink->next = relay.head;
+	    sink->progress = time(NULL);
+	    return sink;
+	}
+    return NULL;
+}
+
+void rtcm_relay_init(void)
+/* mark every sink slot free */
+{
+    struct relay_sink_t *sink;
+
+    memset(&relay, '\0', sizeof(relay));
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++)
+	sink->fd = -1;
+}
+
+struct relay_sink_t *rtcm_relay_rover(struct gps_device_t *device)
+/* find or create the sink feeding a rover device */
+{
+    struct relay_sink_t *sink;
+
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++)
+	if (sink->fd >= 0 && sink->device == device) {
+	    /* device may have been reopened since we last looked */
+	    sink->fd = device->gpsdata.gps_fd;
+	    return sink;
+	}
+    if (BAD_SOCKET(device->gpsdata.gps_fd) || device->context->readonly)
+	return NULL;
+    if ((sink = relay_alloc()) == NULL) {
+	gpsd_log(&device->context->errout, LOG_WARN,
+		 "RELAY: no sink slot for rover %s\n",
+		 device->gpsdata.dev.path);
+	return NULL;
+    }
+    sink->fd = device->gpsdata.gps_fd;
+    sink->device = device;
+    gpsd_log(&device->context->errout, LOG_INF,
+	     "RELAY: %s added as rover\n", device->gpsdata.dev.path);
+    return sink;
+}
+
+static void relay_hold(struct relay_sink_t *sink, int delta)
+/* take (1) or give back (-1) a sink's count on the frames it owes */
+{
+    unsigned long seq;
+
+    for (seq = sink->next; seq < relay.head; seq++) {
+	struct relay_frame_t *frame = &relay.ring[seq % RELAY_RING];
+	if (frame->seq == seq && relay_owes(sink, frame))
+	    frame->refcount += delta;
+    }
+}
+
+void rtcm_relay_filter(struct relay_sink_t *sink,
+		       const unsigned int *types, int ntypes)
+/* set the message types a sink is to receive; none means all */
+{
+    /* the counts on queued frames were taken under the old filter */
+    relay_hold(sink, -1);
+    if (sink->offset > 0) {
+	/* part way through a frame; finish it whatever the new filter */
+	struct relay_frame_t *frame = &relay.ring[sink->next % RELAY_RING];
+
+	sink->taillen = frame->len - sink->offset;
+	memcpy(sink->tail, frame->buf + sink->offset, sink->taillen);
+	sink->offset = 0;
+	sink->next++;
+    }
+    if (ntypes > RELAY_TYPES_MAX)
+	ntypes = RELAY_TYPES_MAX;
+    memcpy(sink->types, types, sizeof(types[0]) * ntypes);
+    sink->ntypes = ntypes;
+    relay_hold(sink, 1);
+}
+
+struct relay_sink_t *rtcm_relay_client(socket_t fd,
+				       const unsigned int *types, int ntypes)
+/* attach a TCP client as a mini-caster sink */
+{
+    struct relay_sink_t *sink = relay_alloc();
+
+    if (sink == NULL)
+	return NULL;
+    sink->fd = fd;
+    sink->device = NULL;
+    rtcm_relay_filter(sink, types, ntypes);
+    return sink;
+}
+
+static void relay_release(struct relay_sink_t *sink)
+/* give back the frames a departing sink still held */
+{
+    relay_hold(sink, -1);
+    sink->fd = -1;
+    sink->device = NULL;
+}
+
+void rtcm_relay_forget(struct gps_device_t *device, socket_t fd)
+/* drop the sink for a rover being closed, or a client going away */
+{
+    struct relay_sink_t *sink;
+
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++)
+	if (sink->fd >= 0
+	    && (device != NULL ? sink->device == device
+		: (sink->device == NULL && sink->fd == fd)))
+	    relay_release(sink);
+}
+
+void rtcm_relay_put(struct gps_context_t *context,
+		    struct gps_device_t *source,
+		    unsigned int type,
+		    const unsigned char *buf, size_t len)
+/* queue one correction frame for every sink that wants it */
+{
+    struct relay_frame_t *frame = &relay.ring[relay.head % RELAY_RING];
+    struct relay_sink_t *sink;
+
+    if (len > sizeof(frame->buf))
+	return;
+
+    if (frame->refcount > 0) {
+	/* lapping a frame somebody still owes; charge them for it */
+	relay.overruns++;
+	for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++)
+	    if (sink->fd >= 0 && sink->next <= frame->seq) {
+		unsigned long oldest = relay.head - RELAY_RING + 1;
+		if (sink->offset > 0 && sink->next == frame->seq) {
+		    /* mid-frame; keep the rest so the frame goes out whole */
+		    sink->taillen = frame->len - sink->offset;
+		    memcpy(sink->tail, frame->buf + sink->offset,
+			   sink->taillen);
+		    sink->offset = 0;
+		    sink->next++;
+		}
+		for (; sink->next < oldest; sink->next++) {
+		    struct relay_frame_t *lost =
+			&relay.ring[sink->next % RELAY_RING];
+		    if (lost->seq == sink->next && relay_owes(sink, lost))
+			sink->dropped++;
+		}
+	    }
+	gpsd_log(&context->errout, LOG_INF,
+		 "RELAY: ring overrun, %d sink(s) behind\n",
+		 frame->refcount);
+    }
+
+    frame->source = source;
+    frame->seq = relay.head;
+    frame->type = type;
+    frame->len = len;
+    memcpy(frame->buf, buf, len);
+    frame->refcount = 0;
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++) {
+	if (sink->fd < 0 || (sink->device != NULL && sink->device == source))
+	    continue;
+	if (relay_wants(sink, type))
+	    frame->refcount++;
+	else
+	    sink->filtered++;
+    }
+    relay.head++;
+    relay.frames++;
+}
+
+static ssize_t relay_write(struct relay_sink_t *sink,
+			   const unsigned char *buf, size_t len)
+/* one write attempt that must not block; 0 means try again later */
+{
+    struct gps_device_t *device = sink->device;
+    struct pollfd pfd;
+    ssize_t status;
+    int oldfl;
+
+    pfd.fd = sink->fd;
+    pfd.events = POLLOUT;
+    if (poll(&pfd, 1, 0) <= 0 || (pfd.revents & POLLOUT) == 0)
+	return (pfd.revents & (POLLERR | POLLHUP | POLLNVAL)) != 0 ? -1 : 0;
+
+    if (device != NULL && device->device_type != NULL
+	&& device->device_type->rtcm_writer != gpsd_write) {
+	/*
+	 * The driver wraps corrections in its own framing, so we
+	 * can't resume it mid-frame.  Hand over whole frames, and
+	 * only when the line says it has room.
+	 */
+	status = device->device_type->rtcm_writer(device,
+						  (const char *)buf, len);
+	return status > 0 ? (ssize_t)len : -1;
+    }
+
+    /* device fds are blocking after setup; flip them just for this */
+    oldfl = fcntl(sink->fd, F_GETFL);
+    if (oldfl != -1 && (oldfl & O_NONBLOCK) == 0)
+	(void)fcntl(sink->fd, F_SETFL, oldfl | O_NONBLOCK);
+    status = write(sink->fd, buf, len);
+    if (oldfl != -1 && (oldfl & O_NONBLOCK) == 0)
+	(void)fcntl(sink->fd, F_SETFL, oldfl);
+    if (status < 0 && (errno == EAGAIN || errno == EINTR))
+	return 0;
+    return status;
+}
+
+static const char *relay_name(const struct relay_sink_t *sink)
+/* how to refer to a sink in the log */
+{
+    return sink->device != NULL ? sink->device->gpsdata.dev.path : "client";
+}
+
+static ssize_t relay_tail(struct gps_context_t *context,
+			  struct relay_sink_t *sink)
+/* write what we can of the remains of a lapped frame */
+{
+    ssize_t status = relay_write(sink, sink->tail, sink->taillen);
+
+    if (status <= 0)
+	return status;
+    sink->taillen -= (size_t)status;
+    memmove(sink->tail, sink->tail + status, sink->taillen);
+    if (sink->taillen > 0)
+	return status;
+    gpsd_log(&context->errout, LOG_IO,
+	     "<= DGPS: lapped RTCM frame finished to %s.\n",
+	     relay_name(sink));
+    sink->sent++;
+    return status;
+}
+
+bool rtcm_relay_service(struct gps_context_t *context, fd_set *wfds)
+/* push queued frames at every sink; add those still behind to wfds */
+{
+    struct relay_sink_t *sink;
+    bool backlog = false;
+    time_t now = time(NULL);
+
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++) {
+	bool behind = false;
+
+	if (sink->fd < 0)
+	    continue;
+	if (sink->taillen > 0) {
+	    ssize_t status = relay_tail(context, sink);
+
+	    if (status < 0) {
+		gpsd_log(&context->errout, LOG_WARN,
+			 "RELAY: write to %s failed, sink dropped\n",
+			 relay_name(sink));
+		relay_release(sink);
+		continue;
+	    }
+	    if (status > 0)
+		sink->progress = now;
+	    if (sink->taillen > 0)
+		behind = true;
+	}
+	while (!behind && sink->next < relay.head) {
+	    struct relay_frame_t *frame = &relay.ring[sink->next % RELAY_RING];
+	    ssize_t status;
+
+	    /* a slot reused since is not the frame this sink wants */
+	    if (frame->seq != sink->next || !relay_owes(sink, frame)) {
+		sink->next++;
+		continue;
+	    }
+	    status = relay_write(sink, frame->buf + sink->offset,
+				 frame->len - sink->offset);
+	    if (status < 0) {
+		gpsd_log(&context->errout, LOG_WARN,
+			 "RELAY: write to %s failed, sink dropped\n",
+			 relay_name(sink));
+		relay_release(sink);
+		break;
+	    } else if (status == 0) {
+		behind = true;
+		break;
+	    }
+	    sink->progress = now;
+	    sink->offset += (size_t)status;
+	    if (sink->offset < frame->len) {
+		behind = true;
+		break;
+	    }
+	    gpsd_log(&context->errout, LOG_IO,
+		     "<= DGPS: %zd bytes of RTCM relayed to %s.\n",
+		     frame->len, relay_name(sink));
+	    frame->refcount--;
+	    sink->sent++;
+	    sink->offset = 0;
+	    sink->next++;
+	}
+	if (sink->fd < 0)
+	    continue;
+	if (!behind)
+	    sink->progress = now;
+	else if (sink->fd < (socket_t)FD_SETSIZE) {
+	    FD_SET(sink->fd, wfds);
+	    backlog = true;
+	}
+    }
+    return backlog;
+}
+
+time_t rtcm_relay_stalled(socket_t fd)
+/* seconds a client sink has been behind without progress; -1 if none */
+{
+    struct relay_sink_t *sink;
+
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++)
+	if (sink->fd == fd && sink->device == NULL)
+	    return time(NULL) - sink->progress;
+    return -1;
+}
+
+void rtcm_relay_dump(char *reply, size_t replylen)
+/* dump the relay's state and per-sink counters as JSON */
+{
+    struct relay_sink_t *sink;
+    int i;
+
+    (void)snprintf(reply, replylen,
+		   "{\"class\":\"RELAY\",\"frames\":%lu,\"overruns\":%lu,"
+		   "\"sinks\":[",
+		   relay.frames, relay.overruns);
+    for (sink = relay.sinks; sink < relay.sinks + RELAY_SINKS; sink++) {
+	unsigned long seq, queued = 0;
+
+	if (sink->fd < 0)
+	    continue;
+	for (seq = sink->next; seq < relay.head; seq++) {
+	    struct relay_frame_t *frame = &relay.ring[seq % RELAY_RING];
+	    if (frame->seq == seq && relay_owes(sink, frame))
+		queued++;
+	}
+	if (sink->device != NULL)
+	    str_appendf(reply, replylen, "{\"device\":\"%s\",",
+			sink->device->gpsdata.dev.path);
+	else
+	    str_appendf(reply, replylen, "{\"client\":%d,", sink->fd);
+	if (sink->ntypes > 0) {
+	    (void)strlcat(reply, "\"types\":[", replylen);
+	    for (i = 0; i < sink->ntypes; i++)
+		str_appendf(reply, replylen, "%u,", sink->types[i]);
+	    str_rstrip_char(reply, ',');
+	    (void)strlcat(reply, "],", replylen);
+	}
+	str_appendf(reply, replylen,
+		    "\"sent\":%lu,\"queued\":%lu,\"dropped\":%lu,"
+		    "\"filtered\":%lu},",
+		    sink->sent, queued, sink->dropped, sink->filtered);
+    }
+    str_rstrip_char(reply, ',');
+    (void)strlcat(reply, "]}\r\n", replylen);
+}
+
+/* end */
@@ -9,6 +9,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
@@ -19,6 +20,7 @@
 #include <sys/param.h>		/* defines BSD */
 #ifdef __linux__
 #include <sys/sysmacros.h>	/* defines major() */
+#include <linux/serial.h>	/* for struct serial_icounter_struct */
 #endif	/* __linux__ */
 
 #include "gpsd_config.h"
@@ -30,6 +32,7 @@
 #endif /* ENABLE_BLUEZ */
 
 #include "gpsd.h"
+#include "timespec.h"
 
 /* Workaround for HP-UX 11.23, which is missing CRTSCTS */
 #ifndef CRTSCTS
@@ -245,6 +248,20 @@ int gpsd_get_stopbits(const struct gps_device_t *dev)
     return stopbits;
 }
 
+long long gpsd_line_time(const struct gps_device_t *dev, size_t chars)
+/* nanoseconds the line takes to carry chars at the current settings */
+{
+    /* a start bit, the data bits (7 with 2 stop bits, as we set them),
+     * the parity bit if any, and the stop bits */
+    unsigned int bits = 1 + (dev->gpsdata.dev.stopbits == 2 ? 7 : 8)
+	+ (dev->gpsdata.dev.parity == 'N' ? 0 : 1)
+	+ dev->gpsdata.dev.stopbits;
+
+    if (dev->gpsdata.dev.baudrate == 0)
+	return 0;
+    return (long long)chars * bits * NS_IN_SEC / dev->gpsdata.dev.baudrate;
+}
+
 bool gpsd_set_raw(struct gps_device_t * session)
 {
     (void)cfmakeraw(&session->ttyset);
@@ -257,6 +274,277 @@ bool gpsd_set_raw(struct gps_device_t * session)
     return true;
 }
 
+#ifndef FIXED_PORT_SPEED
+/* every rate we're likely to see on a GPS; 0 is whatever the port was at */
+static const unsigned int rates[] =
+    { 0, 4800, 9600, 19200, 38400, 57600, 115200, 230400};
+#define NRATES		(int)(sizeof(rates) / sizeof(rates[0]))
+
+#define AUTOBAUD_GAP	0.05	/* seconds between reads that ends a run */
+#define AUTOBAUD_MIN	64	/* characters before the timing counts */
+#define AUTOBAUD_ERRORS	8	/* one error in this many is a wrong setting */
+/* no packet in two of the longest: whatever this is, it isn't data */
+#define AUTOBAUD_CHARS	(MAX_PACKET_LENGTH * 2 + 128)
+
+static bool autobaud_icount(const struct gps_device_t *session,
+			    long *rx, long *errors)
+/* the UART's receive and error counts, where its driver keeps them */
+{
+#ifdef TIOCGICOUNT
+    struct serial_icounter_struct icount;
+
+    if (ioctl(session->gpsdata.gps_fd, TIOCGICOUNT, &icount) == 0) {
+	*rx = icount.rx;
+	*errors = icount.frame + icount.parity + icount.brk;
+	return true;
+    }
+#endif /* TIOCGICOUNT */
+    return false;
+}
+
+static void autobaud_reset(struct gps_device_t *session)
+/* a new hunt setting; start gathering evidence about it afresh */
+{
+    struct autobaud_t *ab = &session->autobaud;
+    unsigned int tried = ab->tried;
+    bool cached = ab->cached;
+
+    memset(ab, '\0', sizeof(*ab));
+    ab->tried = tried;
+    ab->cached = cached;
+    ab->icount = autobaud_icount(session, &ab->rx0, &ab->errors0);
+}
+
+unsigned int gpsd_hunt_rate(int index)
+/* the line speed at a hunt index, 0 past the end */
+{
+    return (index >= 0 && index < NRATES) ? rates[index] : 0;
+}
+
+void gpsd_autobaud_note(struct autobaud_t *ab, timestamp_t now, size_t len)
+/* note the timing of one read of len characters */
+{
+    /* reads close together mean the line was busy in between */
+    if (ab->last > 0 && now - ab->last < AUTOBAUD_GAP) {
+	ab->busy += now - ab->last;
+	ab->paced += (unsigned long)len;
+    }
+    ab->last = now;
+}
+
+void gpsd_autobaud_sample(struct gps_device_t *session, ssize_t len)
+/* note the arrival of characters while hunting */
+{
+    session->autobaud.chars += (unsigned long)len;
+    /* arrival times say nothing about the line on ptys and the like */
+    if (session->sourcetype != source_rs232
+	&& session->sourcetype != source_usb)
+	return;
+    gpsd_autobaud_note(&session->autobaud, timestamp(), (size_t)len);
+}
+
+double gpsd_autobaud_estimate(const struct autobaud_t *ab)
+/* the line rate in bits/sec that back-to-back reads imply, 0 if unknown */
+{
+    if (ab->paced < AUTOBAUD_MIN || ab->busy <= 0)
+	return 0;
+    return ab->paced * 10 / ab->busy;	/* start, 8 data, stop */
+}
+
+static bool autobaud_wrong(const struct gps_device_t *session)
+/* do the characters read at this setting say it can't be right? */
+{
+    const struct autobaud_t *ab = &session->autobaud;
+    long rx, errors;
+
+    if (session->device_type != NULL || ab->chars < AUTOBAUD_MIN)
+	return false;
+    if (ab->chars > AUTOBAUD_CHARS) {
+	gpsd_log(&session->context->errout, LOG_PROG,
+		 "SER: %s: %lu characters and no packet\n",
+		 session->gpsdata.dev.path, ab->chars);
+	return true;
+    }
+    /* a right setting gets next to no framing or parity errors */
+    if (ab->icount && autobaud_icount(session, &rx, &errors)
+	&& rx - ab->rx0 >= AUTOBAUD_MIN
+	&& (errors - ab->errors0) * AUTOBAUD_ERRORS > rx - ab->rx0) {
+	gpsd_log(&session->context->errout, LOG_PROG,
+		 "SER: %s: %ld of %ld characters garbled\n",
+		 session->gpsdata.dev.path, errors - ab->errors0,
+		 rx - ab->rx0);
+	return true;
+    }
+    return false;
+}
+
+int gpsd_autobaud_pick(unsigned int tried, double estimate, double current)
+/* the untried hunt rate the evidence favors, or -1 if all are tried */
+{
+    double target, bestscore = 0;
+    int i, best = -1;
+
+    /*
+     * A receiver set slower than the line is kept busy, so characters
+     * come in at about its own rate.  One set faster sees each real
+     * character as one or two, at up to twice the line's rate.  So a
+     * rate well below the setting points near the line's speed, while
+     * one near it could mean the line is faster or half as fast: try
+     * the neighbors, the faster first.  With no timing to go on, rates
+     * are tried in the usual order.
+     */
+    if (estimate <= 0 || current <= 0)
+	target = 0;
+    else if (estimate > current * 0.8)
+	target = current;
+    else
+	target = estimate * 0.75;
+    for (i = 1; i < NRATES; i++) {
+	double score;
+
+	if ((tried & (1u << i)) != 0)
+	    continue;
+	score = (target > 0) ? fabs(log(rates[i] / target)) : i;
+	if (best < 0 || score <= bestscore) {
+	    best = i;
+	    bestscore = score;
+	}
+    }
+    return best;
+}
+
+static int autobaud_rank(struct gps_device_t *session)
+/* pick the next hunt rate for a session; -1 once all are tried */
+{
+    struct autobaud_t *ab = &session->autobaud;
+    double estimate = gpsd_autobaud_estimate(ab);
+    double current = (double)gpsd_get_speed(session);
+    int i, best;
+
+    for (i = 0; i < NRATES; i++)
+	if (i == (int)session->baudindex || rates[i] == current)
+	    ab->tried |= 1u << i;
+    best = gpsd_autobaud_pick(ab->tried, estimate, current);
+    if (best >= 0)
+	gpsd_log(&session->context->errout, LOG_PROG,
+		 "SER: %s: line looks like %.0f bps at %.0f, trying %u\n",
+		 session->gpsdata.dev.path, estimate, current, rates[best]);
+    return best;
+}
+
+static int speedcache_find(const struct gps_context_t *context,
+			   const char *path)
+/* the remembered sync settings for a device, if any */
+{
+    int i;
+
+    for (i = 0; i < SPEEDCACHE_MAX; i++)
+	if (context->speedcache[i].path[0] != '\0'
+	    && strcmp(context->speedcache[i].path, path) == 0)
+	    return i;
+    return -1;
+}
+
+static bool speedcache_take(struct gps_context_t *context, int n,
+			    const char *path, const char *fields)
+/* one line of the saved sync settings; false if it can't be used */
+{
+    unsigned int baudrate, stopbits;
+    char parity;
+    long when;
+
+    if (sscanf(fields, "%u %c %u %ld",
+	       &baudrate, &parity, &stopbits, &when) != 4
+	|| baudrate == 0 || strchr("NEO", parity) == NULL
+	|| stopbits < 1 || stopbits > 2)
+	return false;
+    (void)strlcpy(context->speedcache[n].path, path,
+		  sizeof(context->speedcache[n].path));
+    context->speedcache[n].baudrate = baudrate;
+    context->speedcache[n].parity = parity;
+    context->speedcache[n].stopbits = stopbits;
+    context->speedcache[n].when = (time_t)when;
+    return true;
+}
+
+bool gpsd_speedcache_load(struct gps_context_t *context)
+/* read the saved sync settings; a missing file is not an error */
+{
+    return gpsd_keyfile_load(context, context->speedcache_path,
+			     "SER: sync settings", SPEEDCACHE_MAX,
+			     speedcache_take);
+}
+
+static void speedcache_put(const struct gps_context_t *context, int i,
+			   FILE *fp)
+/* write one slot of the sync settings, if it's in use */
+{
+    if (context->speedcache[i].path[0] != '\0')
+	(void)fprintf(fp, "%s %u %c %u %ld\n",
+		      context->speedcache[i].path,
+		      context->speedcache[i].baudrate,
+		      context->speedcache[i].parity,
+		      context->speedcache[i].stopbits,
+		      (long)context->speedcache[i].when);
+}
+
+void gpsd_speedcache_save(struct gps_context_t *context)
+/* write the sync settings out */
+{
+    gpsd_keyfile_save(context, context->speedcache_path,
+		      "SER: sync settings",
+		      "gpsd sync settings: device bps parity stopbits when",
+		      SPEEDCACHE_MAX, speedcache_put);
+    context->speedcache_dirty = false;
+}
+
+static void speedcache_record(struct gps_device_t *session, bool closing)
+/* remember the settings a device is synced at, and when */
+{
+    struct gps_context_t *context = session->context;
+    unsigned int baudrate = (unsigned int)gpsd_get_speed(session);
+    int i, slot;
+
+    if (context->speedcache_path == NULL || baudrate == 0
+	|| isatty(session->gpsdata.gps_fd) == 0)
+	return;
+    /*
+     * Even unchanged settings get a new time, so they are kept longest,
+     * but as this runs on every driver switch only a change of settings
+     * goes to disk at once; the times wait for the device to close.
+     */
+    if ((slot = speedcache_find(context, session->gpsdata.dev.path)) >= 0
+	&& context->speedcache[slot].baudrate == baudrate
+	&& context->speedcache[slot].parity == session->gpsdata.dev.parity
+	&& context->speedcache[slot].stopbits
+	   == session->gpsdata.dev.stopbits) {
+	context->speedcache[slot].when = time(NULL);
+	context->speedcache_dirty = true;
+	if (closing)
+	    gpsd_speedcache_save(context);
+	return;
+    }
+    if (slot < 0) {
+	/* a free slot, or failing that the stalest */
+	for (slot = i = 0; i < SPEEDCACHE_MAX; i++) {
+	    if (context->speedcache[i].path[0] == '\0') {
+		slot = i;
+		break;
+	    }
+	    if (context->speedcache[i].when < context->speedcache[slot].when)
+		slot = i;
+	}
+    }
+    (void)strlcpy(context->speedcache[slot].path, session->gpsdata.dev.path,
+		  sizeof(context->speedcache[slot].path));
+    context->speedcache[slot].baudrate = baudrate;
+    context->speedcache[slot].parity = session->gpsdata.dev.parity;
+    context->speedcache[slot].stopbits = session->gpsdata.dev.stopbits;
+    context->speedcache[slot].when = time(NULL);
+    gpsd_speedcache_save(context);
+}
+#endif /* FIXED_PORT_SPEED */
+
 void gpsd_set_speed(struct gps_device_t *session,
 		    speed_t speed, char parity, unsigned int stopbits)
 {
@@ -402,6 +690,9 @@ void gpsd_set_speed(struct gps_device_t *session,
     session->gpsdata.dev.baudrate = (unsigned int)speed;
     session->gpsdata.dev.parity = parity;
     session->gpsdata.dev.stopbits = stopbits;
+#ifndef FIXED_PORT_SPEED
+    autobaud_reset(session);
+#endif /* FIXED_PORT_SPEED */
 
     /*
      * The device might need a wakeup string before it will send data.
@@ -589,22 +880,45 @@ int gpsd_serial_open(struct gps_device_t *session)
 	session->ttyset.c_iflag = session->ttyset.c_oflag =
 	    session->ttyset.c_lflag = (tcflag_t) 0;
 
-#ifndef FIXED_PORT_SPEED
-	session->baudindex = 0;
-#endif /* FIXED_PORT_SPEED */
-	gpsd_set_speed(session,
 #ifdef FIXED_PORT_SPEED
-		       FIXED_PORT_SPEED,
-#else
-		       gpsd_get_speed_old(session),
-#endif /* FIXED_PORT_SPEED */
-		       'N',
+	gpsd_set_speed(session, FIXED_PORT_SPEED, 'N',
 #ifdef FIXED_STOP_BITS
 		       FIXED_STOP_BITS
 #else
 		       1
 #endif /* FIXED_STOP_BITS */
 	    );
+#else
+	{
+	    speed_t speed = gpsd_get_speed_old(session);
+	    char parity = 'N';
+	    unsigned int stopbits = 1;
+	    int i = speedcache_find(session->context,
+				    session->gpsdata.dev.path);
+
+	    session->autobaud.cached = false;
+	    /*
+	     * Where it last synced is the best bet, as after a hotplug.
+	     * It gets one try; then the hunt starts over from 8N1.
+	     */
+	    if (i >= 0) {
+		session->autobaud.cached = true;
+		speed = (speed_t)session->context->speedcache[i].baudrate;
+		parity = session->context->speedcache[i].parity;
+		stopbits = session->context->speedcache[i].stopbits;
+		gpsd_log(&session->context->errout, LOG_INF,
+			 "SER: %s last synced at %u %d%c%u\n",
+			 session->gpsdata.dev.path, (unsigned int)speed,
+			 9 - stopbits, parity, stopbits);
+	    }
+#ifdef FIXED_STOP_BITS
+	    stopbits = FIXED_STOP_BITS;
+#endif /* FIXED_STOP_BITS */
+	    session->baudindex = 0;
+	    session->autobaud.tried = 0;
+	    gpsd_set_speed(session, speed, parity, stopbits);
+	}
+#endif /* FIXED_PORT_SPEED */
     }
 
     /* Probably want to switch back to blocking I/O now that CLOCAL is set. */
@@ -669,17 +983,50 @@ bool gpsd_next_hunt_setting(struct gps_device_t * session)
     if (session->sourcetype == source_pps)
 	return false;
 
+#ifndef FIXED_PORT_SPEED
+    /* no need to wait out the retries if this setting is plainly wrong */
+    if (autobaud_wrong(session))
+	session->lexer.retry_counter = SNIFF_RETRIES;
+#endif /* FIXED_PORT_SPEED */
+
     if (session->lexer.retry_counter++ >= SNIFF_RETRIES) {
 #ifdef FIXED_PORT_SPEED
 	return false;
 #else
-	/* every rate we're likely to see on a GPS */
-	static unsigned int rates[] =
-	    { 0, 4800, 9600, 19200, 38400, 57600, 115200, 230400};
+	int next;
 
-	if (session->baudindex++ >=
-	    (unsigned int)(sizeof(rates) / sizeof(rates[0])) - 1) {
+	if (session->autobaud.cached) {
+	    /* remembered settings didn't work; hunt as if there were none */
+	    session->autobaud.cached = false;
+	    if (session->gpsdata.dev.parity != 'N'
+#ifndef FIXED_STOP_BITS
+		|| session->gpsdata.dev.stopbits != 1
+#endif /* FIXED_STOP_BITS */
+		) {
+		gpsd_log(&session->context->errout, LOG_PROG,
+			 "SER: %s: no sync at remembered %c%u, back to 8N1\n",
+			 session->gpsdata.dev.path,
+			 session->gpsdata.dev.parity,
+			 session->gpsdata.dev.stopbits);
+		session->autobaud.tried = 0;
+		gpsd_set_speed(session, gpsd_get_speed(session), 'N',
+#ifdef FIXED_STOP_BITS
+			       FIXED_STOP_BITS
+#else
+			       1
+#endif /* FIXED_STOP_BITS */
+		    );
+		session->lexer.retry_counter = 0;
+		session->huntspeeds++;
+		return true;
+	    }
+	}
+	next = autobaud_rank(session);
+	if (next >= 0)
+	    session->baudindex = (unsigned int)next;
+	else {
 	    session->baudindex = 0;
+	    session->autobaud.tried = 0;
 #ifdef FIXED_STOP_BITS
 	    return false;	/* hunt is over, no sync */
 #else
@@ -703,6 +1050,7 @@ bool gpsd_next_hunt_setting(struct gps_device_t * session)
 #endif /* FIXED_STOP_BITS */
 	    );
 	session->lexer.retry_counter = 0;
+	session->huntspeeds++;
     }
 
     return true;		/* keep hunting */
@@ -719,6 +1067,9 @@ void gpsd_assert_sync(struct gps_device_t *session)
      */
     if (session->saved_baud == -1)
 	session->saved_baud = (int)cfgetispeed(&session->ttyset);
+#ifndef FIXED_PORT_SPEED
+    speedcache_record(session, false);
+#endif /* FIXED_PORT_SPEED */
 }
 
 void gpsd_close(struct gps_device_t *session)
@@ -728,6 +1079,11 @@ void gpsd_close(struct gps_device_t *session)
 	(void)ioctl(session->gpsdata.gps_fd, (unsigned long)TIOCNXCL);
 #endif /* TIOCNXCL */
 	(void)tcdrain(session->gpsdata.gps_fd);
+#ifndef FIXED_PORT_SPEED
+	/* a driver may have changed speed since sync; keep that one */
+	if (session->device_type != NULL)
+	    speedcache_record(session, true);
+#endif /* FIXED_PORT_SPEED */
 	if (isatty(session->gpsdata.gps_fd) != 0) {
 	    /* force hangup on close on systems that don't do HUPCL properly */
 	    (void)cfsetispeed(&session->ttyset, (speed_t) B0);
@@ -17,6 +17,7 @@ PERMISSIONS
 
 #include <math.h>
 #include <stdbool.h>
+#include <string.h>
 
 #include "gpsd.h"
 #ifdef SOCKET_EXPORT_ENABLE
@@ -53,6 +54,7 @@ int json_device_read(const char *buf,
 				        .dflt.real = NAN},
 	{"mincycle",   t_real,       .addr.real = &dev->mincycle,
 				        .dflt.real = NAN},
+	{"fixoffset",  t_ignore},
 	{NULL},
     };
     /* *INDENT-ON* */
@@ -73,11 +75,30 @@ int json_device_read(const char *buf,
     return 0;
 }
 
+/* report class names accepted in a WATCH filter */
+const struct json_enum_t json_class_names[] = {
+    {"TPV",      CLASS_TPV},
+    {"SKY",      CLASS_SKY},
+    {"GST",      CLASS_GST},
+    {"ATT",      CLASS_ATT},
+    {"SUBFRAME", CLASS_SUBFRAME},
+    {"RTCM2",    CLASS_RTCM2},
+    {"RTCM3",    CLASS_RTCM3},
+    {"AIS",      CLASS_AIS},
+    {"OSC",      CLASS_OSC},
+    {NULL,       0},
+};
+
 int json_watch_read(const char *buf,
-		    struct policy_t *ccp,
+		    struct policy_t *ccp_out,
 		    const char **endptr)
+/* parse a WATCH; the policy is changed only if the whole of it is good */
 {
+    struct policy_t policy = *ccp_out, *ccp = &policy;
     bool dummy_pps_flag;
+    char classstore[GPS_JSON_COMMAND_MAX], *classptrs[NITEMS(json_class_names)];
+    int aisstore[32];
+    int classcount = 0, aiscount = 0, i;
     /* *INDENT-OFF* */
     struct json_attr_t chanconfig_attrs[] = {
 	{"class",          t_check,    .dflt.check = "WATCH"},
@@ -100,13 +121,57 @@ int json_watch_read(const char *buf,
 	                                  .len = sizeof(ccp->remote)},
 	{"pps",            t_boolean,  .addr.boolean = &dummy_pps_flag,
                                           .nodefault = false},
+	{"classes",        t_array,
+	    .addr.array.element_type = t_string,
+	    .addr.array.arr.strings.ptrs = classptrs,
+	    .addr.array.arr.strings.store = classstore,
+	    .addr.array.arr.strings.storelen = sizeof(classstore),
+	    .addr.array.count = &classcount,
+	    .addr.array.maxlen = NITEMS(classptrs)},
+	{"aistypes",       t_array,
+	    .addr.array.element_type = t_integer,
+	    .addr.array.arr.integers.store = aisstore,
+	    .addr.array.count = &aiscount,
+	    .addr.array.maxlen = NITEMS(aisstore)},
+	{"mmsi",           t_array,
+	    .addr.array.element_type = t_uinteger,
+	    .addr.array.arr.uintegers.store = ccp->mmsi,
+	    .addr.array.count = &ccp->nmmsi,
+	    .addr.array.maxlen = NITEMS(ccp->mmsi)},
+	{"minmode",        t_integer,  .addr.integer = &ccp->minmode,
+                                          .dflt.integer = 0},
+	{"interval",       t_real,     .addr.real = &ccp->interval,
+                                          .dflt.real = 0},
 	{NULL},
     };
     /* *INDENT-ON* */
     int status;
 
+    /* like the other policy members, filters not mentioned are cleared */
+    ccp->nmmsi = 0;
     status = json_read_object(buf, chanconfig_attrs, endptr);
-    return status;
+    if (status != 0)
+	return status;
+
+    /* compile the filter lists into bitmasks */
+    ccp->classes = 0;
+    for (i = 0; i < classcount; i++) {
+	const struct json_enum_t *cp;
+	for (cp = json_class_names; cp->name != NULL; cp++)
+	    if (strcmp(cp->name, classptrs[i]) == 0)
+		break;
+	if (cp->name == NULL)
+	    return JSON_ERR_BADENUM;
+	ccp->classes |= (unsigned int)cp->value;
+    }
+    ccp->aistypes = 0;
+    for (i = 0; i < aiscount; i++) {
+	if (aisstore[i] < 1 || aisstore[i] > 31)
+	    return JSON_ERR_MISC;
+	ccp->aistypes |= 1u << aisstore[i];
+    }
+    *ccp_out = policy;
+    return 0;
 }
 
 #endif /* SOCKET_EXPORT_ENABLE */
@@ -0,0 +1,272 @@
+/*
+ * Unit test for the columnar archive format: write fixes and AIS
+ * positions across several blocks, then read back time ranges.  AIS
+ * heard before any time was known must still be found.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "archive.h"
+
+#define BASE	1500000000.0
+#define NFIX	(ARCHIVE_BLOCK * 2 + 100)	/* two full blocks and a short */
+#define NAIS	(ARCHIVE_BLOCK + 10)
+
+static int failures = 0;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+	(void)fprintf(stderr, "test_archive: FAILED %s\n", what);
+	failures++;
+    }
+}
+
+struct seen_t {
+    int count;
+    double first, last;
+    bool bad;
+};
+
+static void fix_hook(const struct archive_fix_t *fix, void *arg)
+{
+    struct seen_t *seen = (struct seen_t *)arg;
+    int i = (int)(fix->time - BASE);
+
+    if (seen->count++ == 0)
+	seen->first = fix->time;
+    seen->last = fix->time;
+    /* what fill() put in */
+    if (fix->lat != (int32_t)lround((40.0 + i * 1e-5) * 1e7)
+	|| fix->lon != (int32_t)lround((-75.0 - i * 1e-5) * 1e7)
+	|| fix->alt != i
+	|| fix->mode != MODE_3D
+	|| (i % 7 == 0) != isnan(fix->speed))
+	seen->bad = true;
+}
+
+static void ais_hook(const struct archive_ais_t *ais, void *arg)
+{
+    struct seen_t *seen = (struct seen_t *)arg;
+
+    if (seen->count++ == 0)
+	seen->first = ais->time;
+    seen->last = ais->time;
+    if (ais->mmsi != 244000000 + (uint32_t)(ais->time - BASE) % 5
+	|| ais->type != 1
+	|| ais->lat != 520000000 || ais->lon != ARCHIVE_NO_POS
+	|| ais->speed != 123 || ais->heading != ARCHIVE_NO_VALUE
+	|| ais->status != 5)
+	seen->bad = true;
+}
+
+static void fill(FILE *fp)
+/* write the test archive */
+{
+    static struct archive_writer_t writer;
+    struct gps_fix_t fix;
+    struct ais_t ais;
+    int i;
+
+    archive_writer_init(&writer, fp);
+    for (i = 0; i < NFIX; i++) {
+	gps_clear_fix(&fix);
+	fix.mode = MODE_3D;
+	fix.time = BASE + i;
+	fix.latitude = 40.0 + i * 1e-5;
+	fix.longitude = -75.0 - i * 1e-5;
+	fix.altitude = i / 1000.0;
+	if (i % 7 != 0)
+	    fix.speed = 1.5;
+	check(archive_put_fix(&writer, &fix) == 0, "fix write");
+    }
+    /* a 2D fix without a time is no use to anybody */
+    gps_clear_fix(&fix);
+    fix.mode = MODE_2D;
+    check(archive_put_fix(&writer, &fix) == 0, "timeless fix");
+
+    for (i = 0; i < NAIS; i++) {
+	memset(&ais, '\0', sizeof(ais));
+	ais.type = 1;
+	ais.mmsi = 244000000 + i % 5;
+	ais.type1.status = 5;
+	ais.type1.lat = 52 * AIS_LATLON_DIV;
+	ais.type1.lon = AIS_LON_NOT_AVAILABLE;
+	ais.type1.speed = 123;
+	ais.type1.course = 900;
+	ais.type1.heading = AIS_HEADING_NOT_AVAILABLE;
+	check(archive_put_ais(&writer, &ais, BASE + i) == 0, "AIS write");
+	/* static data has no place in the archive */
+	ais.type = 5;
+	check(archive_put_ais(&writer, &ais, BASE + i) == 0, "AIS skip");
+    }
+    check(archive_flush(&writer) == 0, "flush");
+}
+
+static void count_hook(const struct archive_ais_t *ais, void *arg)
+{
+    struct seen_t *seen = (struct seen_t *)arg;
+
+    if (seen->count++ == 0)
+	seen->first = ais->time;
+    seen->last = ais->time;
+}
+
+static void test_untimed(void)
+/* AIS put with no time yet: in a block of its own, then one that isn't */
+{
+    static struct archive_writer_t writer;
+    char path[] = "/tmp/test_archiveXXXXXX";
+    struct archive_reader_t reader;
+    struct archive_query_t query;
+    struct seen_t seen;
+    struct ais_t ais;
+    FILE *fp;
+    int fd, i;
+
+    if ((fd = mkstemp(path)) < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+	check(false, "untimed archive");
+	return;
+    }
+    memset(&ais, '\0', sizeof(ais));
+    ais.type = 1;
+    ais.mmsi = 244000000;
+    ais.type1.lat = 52 * AIS_LATLON_DIV;
+    ais.type1.lon = 4 * AIS_LATLON_DIV;
+    archive_writer_init(&writer, fp);
+    for (i = 0; i < 3; i++)
+	(void)archive_put_ais(&writer, &ais, NAN);
+    (void)archive_flush(&writer);	/* out before any time is known */
+    for (i = 0; i < 2; i++)
+	(void)archive_put_ais(&writer, &ais, NAN);
+    (void)archive_put_ais(&writer, &ais, BASE);
+    check(archive_flush(&writer) == 0, "untimed flush");
+    (void)fclose(fp);
+
+    check(archive_open(&reader, path) == 0, "untimed open");
+    query.start = -INFINITY;
+    query.end = INFINITY;
+    query.mmsi = 0;
+    memset(&seen, '\0', sizeof(seen));
+    check(archive_read_ais(&reader, &query, count_hook, &seen) == 6
+	  && seen.first == -INFINITY && seen.last == BASE,
+	  "untimed AIS found");
+    /* the pending ones were heard by the first time that came along */
+    query.start = query.end = BASE;
+    memset(&seen, '\0', sizeof(seen));
+    check(archive_read_ais(&reader, &query, count_hook, &seen) == 3,
+	  "untimed AIS given a time");
+    archive_close(&reader);
+    (void)unlink(path);
+}
+
+static void test_oversized(void)
+/* a block whose count times width wraps 32 bits to its length */
+{
+    char path[] = "/tmp/test_archiveXXXXXX";
+    struct archive_reader_t reader;
+    unsigned char header[ARCHIVE_HEADER];
+    unsigned char body[ARCHIVE_FIX_WIDTH];
+    uint64_t count = (UINT64_C(1) << 32) / ARCHIVE_FIX_WIDTH + 1;
+    uint32_t length = (uint32_t)(count * ARCHIVE_FIX_WIDTH);
+    FILE *fp;
+    int fd;
+
+    if ((fd = mkstemp(path)) < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+	check(false, "oversized archive");
+	return;
+    }
+    fill(fp);
+    memset(header, '\0', sizeof(header));
+    memcpy(header, "GPAR", 4);
+    header[4] = ARCHIVE_FIX;
+    header[5] = ARCHIVE_VERSION;
+    header[8] = (unsigned char)count;
+    header[9] = (unsigned char)(count >> 8);
+    header[10] = (unsigned char)(count >> 16);
+    header[11] = (unsigned char)(count >> 24);
+    header[12] = (unsigned char)length;
+    header[13] = (unsigned char)(length >> 8);
+    header[14] = (unsigned char)(length >> 16);
+    header[15] = (unsigned char)(length >> 24);
+    memset(body, '\0', sizeof(body));
+    (void)fwrite(header, sizeof(header), 1, fp);
+    (void)fwrite(body, length, 1, fp);
+    (void)fclose(fp);
+
+    check(archive_open(&reader, path) == 0 && reader.nblocks == 5,
+	  "oversized block refused");
+    archive_close(&reader);
+    (void)unlink(path);
+}
+
+int main(void)
+{
+    char path[] = "/tmp/test_archiveXXXXXX";
+    struct archive_reader_t reader;
+    struct archive_query_t query;
+    struct seen_t seen;
+    FILE *fp;
+    int fd, n;
+
+    if ((fd = mkstemp(path)) < 0 || (fp = fdopen(fd, "wb")) == NULL) {
+	perror("test_archive");
+	return EXIT_FAILURE;
+    }
+    fill(fp);
+    /* a torn block at the end, as a crash would leave */
+    (void)fwrite("GPAR\001\001", 6, 1, fp);
+    (void)fclose(fp);
+
+    check(archive_open(&reader, path) == 0, "open");
+    /* fix blocks of 4096, 4096, 100 and AIS blocks of 4096, 10 */
+    check(reader.nblocks == 5, "block count");
+
+    query.start = -INFINITY;
+    query.end = INFINITY;
+    query.mmsi = 0;
+    memset(&seen, '\0', sizeof(seen));
+    n = archive_read_fixes(&reader, &query, fix_hook, &seen);
+    check(n == NFIX && seen.count == NFIX && !seen.bad, "all fixes");
+
+    /* a range straddling the first block boundary */
+    query.start = BASE + ARCHIVE_BLOCK - 3;
+    query.end = BASE + ARCHIVE_BLOCK + 2;
+    memset(&seen, '\0', sizeof(seen));
+    n = archive_read_fixes(&reader, &query, fix_hook, &seen);
+    check(n == 6 && seen.first == query.start && seen.last == query.end
+	  && !seen.bad, "fix range");
+
+    query.start = BASE + NFIX;
+    query.end = INFINITY;
+    check(archive_read_fixes(&reader, &query, fix_hook, &seen) == 0,
+	  "empty range");
+
+    query.start = BASE + 100;
+    query.end = BASE + 199;
+    query.mmsi = 244000003;
+    memset(&seen, '\0', sizeof(seen));
+    n = archive_read_ais(&reader, &query, ais_hook, &seen);
+    check(n == 20 && seen.first == BASE + 103 && !seen.bad, "AIS by MMSI");
+
+    query.mmsi = 366000000;
+    check(archive_read_ais(&reader, &query, ais_hook, &seen) == 0,
+	  "AIS absent MMSI");
+    archive_close(&reader);
+    (void)unlink(path);
+
+    test_untimed();
+    test_oversized();
+
+    if (failures == 0)
+	(void)printf("test_archive: all tests passed\n");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* end */
@@ -0,0 +1,265 @@
+/*
+ * Unit test for the serial hunt's autobaud heuristics and its cache of
+ * sync settings.
+ *
+ * Reads are timed as a receiver set to one speed would see a GPS
+ * talking at another, in once-a-second bursts: at the right speed
+ * characters arrive at the line's rate, a receiver set too slow is kept
+ * busy at its own rate, and one set too fast reads each character as
+ * one or two.  The rate estimate must come out at the line's speed when
+ * the setting is right, and the ranked hunt must reach the line's speed
+ * from every starting speed in no more speed changes, all told, than
+ * trying the rates in order.  With -v the speed-change counts of both
+ * are printed.
+ *
+ * The cache is saved, read back, and must come back the same; lines
+ * with impossible settings must be refused.
+ *
+ * The line time that time stamps are backed off by must count every
+ * bit a character takes on the wire at each framing gpsd sets.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpsd.h"
+
+#define BURST	600	/* characters a second, as a chatty NMEA receiver */
+#define CHUNK	16	/* characters per read */
+#define BURSTS	3	/* seconds of data per hunt setting */
+
+static int failures = 0;
+static bool verbose = false;
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+	(void)fprintf(stderr, "test_autobaud: FAILED %s\n", what);
+	failures++;
+    }
+}
+
+static void simulate(struct autobaud_t *ab, double line, double setting)
+/* time the reads made at setting while the line runs at line bps */
+{
+    double cps, chars, t = 1000.0;
+    int burst;
+
+    if (setting == line)
+	cps = line / 10;
+    else if (setting < line)
+	cps = setting / 10;
+    else
+	cps = line / 10 * 1.5;
+    /* however it's read, the burst lasts as long as the line takes */
+    chars = cps * BURST * 10 / line;
+
+    memset(ab, '\0', sizeof(*ab));
+    for (burst = 0; burst < BURSTS; burst++) {
+	double n;
+
+	for (n = 0; n < chars; n += CHUNK) {
+	    t += CHUNK / cps;
+	    gpsd_autobaud_note(ab, t, CHUNK);
+	}
+	t = ceil(t) + 0.1;
+    }
+}
+
+static int hunt(double line, int start, bool timed)
+/* speed changes the ranked hunt makes to get from start to line */
+{
+    struct autobaud_t ab;
+    unsigned int tried = 0;
+    int index = start, changes = 0;
+
+    while (gpsd_hunt_rate(index) != line) {
+	double current = gpsd_hunt_rate(index);
+	double estimate = 0;
+
+	if (timed) {
+	    simulate(&ab, line, current);
+	    estimate = gpsd_autobaud_estimate(&ab);
+	}
+	tried |= 1u << index;
+	if ((index = gpsd_autobaud_pick(tried, estimate, current)) < 0)
+	    return -1;
+	changes++;
+    }
+    return changes;
+}
+
+static void test_estimate(void)
+{
+    struct autobaud_t ab;
+    int i;
+
+    for (i = 1; gpsd_hunt_rate(i) != 0; i++) {
+	double rate = gpsd_hunt_rate(i);
+	char what[64];
+
+	simulate(&ab, rate, rate);
+	(void)snprintf(what, sizeof(what), "estimate at %.0f", rate);
+	check(fabs(gpsd_autobaud_estimate(&ab) / rate - 1) < 0.02, what);
+    }
+
+    /* too few characters to go on */
+    memset(&ab, '\0', sizeof(ab));
+    gpsd_autobaud_note(&ab, 1.0, CHUNK);
+    gpsd_autobaud_note(&ab, 1.01, CHUNK);
+    check(gpsd_autobaud_estimate(&ab) == 0, "estimate from one read");
+}
+
+static void test_hunt(void)
+{
+    int line, start, ranked = 0, untimed = 0, plain = 0, worst = 0;
+    int pairs = 0;
+
+    for (line = 1; gpsd_hunt_rate(line) != 0; line++)
+	for (start = 1; gpsd_hunt_rate(start) != 0; start++) {
+	    int timed = hunt(gpsd_hunt_rate(line), start, true);
+	    int blind = hunt(gpsd_hunt_rate(line), start, false);
+	    char what[64];
+
+	    (void)snprintf(what, sizeof(what), "hunt for %u from %u",
+			   gpsd_hunt_rate(line), gpsd_hunt_rate(start));
+	    check(timed >= 0 && blind >= 0, what);
+	    ranked += timed;
+	    untimed += blind;
+	    if (timed > worst)
+		worst = timed;
+	    /* the old hunt went through the rates in order, every time */
+	    plain += (line == start) ? 0 : line;
+	    pairs++;
+	}
+    check(ranked <= plain, "ranked hunt no slower than in order");
+    if (verbose)
+	(void)printf("speed changes over %d line/start pairs: "
+		     "in order %d (%.2f each), untimed %d (%.2f), "
+		     "ranked %d (%.2f, worst %d)\n",
+		     pairs, plain, (double)plain / pairs,
+		     untimed, (double)untimed / pairs,
+		     ranked, (double)ranked / pairs, worst);
+}
+
+static void test_cache(void)
+{
+    static struct gps_context_t context;
+    static const struct {
+	const char *path;
+	unsigned int baudrate;
+	char parity;
+	unsigned int stopbits;
+	time_t when;
+    } saved[] = {
+	{"/dev/ttyUSB0", 9600,   'N', 1, 1500000000},
+	{"/dev/ttyS1",   38400,  'O', 2, 1500000100},
+	{"/dev/ttyACM0", 115200, 'E', 1, 1500000200},
+    };
+    char path[] = "/tmp/test_autobaudXXXXXX";
+    FILE *fp;
+    int fd, i, n;
+
+    gps_context_init(&context, "test_autobaud");
+    context.errout.debug = LOG_ERROR - 1;	/* bad lines are expected */
+    if ((fd = mkstemp(path)) < 0) {
+	check(false, "temporary file");
+	return;
+    }
+    (void)close(fd);
+    context.speedcache_path = path;
+
+    for (i = 0; i < (int)(sizeof(saved) / sizeof(saved[0])); i++) {
+	(void)strlcpy(context.speedcache[i].path, saved[i].path,
+		      sizeof(context.speedcache[i].path));
+	context.speedcache[i].baudrate = saved[i].baudrate;
+	context.speedcache[i].parity = saved[i].parity;
+	context.speedcache[i].stopbits = saved[i].stopbits;
+	context.speedcache[i].when = saved[i].when;
+    }
+    gpsd_speedcache_save(&context);
+
+    memset(context.speedcache, '\0', sizeof(context.speedcache));
+    check(gpsd_speedcache_load(&context), "load");
+    for (i = 0; i < (int)(sizeof(saved) / sizeof(saved[0])); i++)
+	check(strcmp(context.speedcache[i].path, saved[i].path) == 0
+	      && context.speedcache[i].baudrate == saved[i].baudrate
+	      && context.speedcache[i].parity == saved[i].parity
+	      && context.speedcache[i].stopbits == saved[i].stopbits
+	      && context.speedcache[i].when == saved[i].when,
+	      "settings round trip");
+    check(context.speedcache[i].path[0] == '\0', "nothing extra loaded");
+
+    /* hand-edited or corrupt lines must not become hunt settings */
+    if ((fp = fopen(path, "a")) != NULL) {
+	(void)fputs("/dev/ttyS2 4800 X 1 1500000300\n"
+		    "/dev/ttyS3 4800 N 3 1500000300\n"
+		    "/dev/ttyS4 0 N 1 1500000300\n"
+		    "/dev/ttyS5 fast\n", fp);
+	(void)fclose(fp);
+    }
+    memset(context.speedcache, '\0', sizeof(context.speedcache));
+    check(gpsd_speedcache_load(&context), "load with bad lines");
+    for (n = 0; n < SPEEDCACHE_MAX; n++)
+	if (context.speedcache[n].path[0] == '\0')
+	    break;
+    check(n == (int)(sizeof(saved) / sizeof(saved[0])), "bad lines refused");
+
+    (void)unlink(path);
+}
+
+static void test_line_time(void)
+{
+    static struct gps_device_t session;	/* big, so not on the stack */
+    static const struct {
+	unsigned int baudrate;
+	char parity;
+	unsigned int stopbits;
+	size_t chars;
+	long long ns;
+    } cases[] = {
+	{9600,   'N', 1, 1,  1041666},		/* 8N1: 10 bits */
+	{9600,   'N', 1, 80, 83333333},		/* a sentence's worth */
+	{4800,   'O', 1, 1,  2291666},		/* 8O1: 11 bits */
+	{4800,   'E', 2, 1,  2291666},		/* 7E2: 11 bits */
+	{4800,   'N', 2, 1,  2083333},		/* 7N2: 10 bits */
+	{115200, 'N', 1, 3,  260416},
+	{0,      'N', 1, 80, 0},		/* speed unknown */
+    };
+    int i;
+
+    for (i = 0; i < (int)(sizeof(cases) / sizeof(cases[0])); i++) {
+	char what[64];
+
+	session.gpsdata.dev.baudrate = cases[i].baudrate;
+	session.gpsdata.dev.parity = cases[i].parity;
+	session.gpsdata.dev.stopbits = cases[i].stopbits;
+	(void)snprintf(what, sizeof(what), "line time of %zu at %u %c%u",
+		       cases[i].chars, cases[i].baudrate, cases[i].parity,
+		       cases[i].stopbits);
+	check(gpsd_line_time(&session, cases[i].chars) == cases[i].ns, what);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int option;
+
+    while ((option = getopt(argc, argv, "v")) != -1)
+	if (option == 'v')
+	    verbose = true;
+
+    test_estimate();
+    test_hunt();
+    test_cache();
+    test_line_time();
+
+    if (failures == 0 && verbose)
+	(void)printf("test_autobaud: all tests passed\n");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
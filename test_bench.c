@@ -0,0 +1,517 @@
+/*
+ * Microbenchmarks for the hot paths of the daemon and client library:
+ * packetizing, NMEA parsing, AIS and RTCM3 unpacking, JSON reports both
+ * ways, and the error model.  Inputs are cut from the logs named on the
+ * command line once, up front, so a benchmark times only the function
+ * it is named for.
+ *
+ * The packet_parse_noise benchmarks feed the lexer the same logs with
+ * bursts of random bytes spliced in, as a noisy serial line would, and
+ * report what resynchronizing cost: bytes discarded, losses of sync,
+ * and the time per discarded byte over and above clean input.
+ *
+ * Each result is a JSON object on a line of its own, so runs on two
+ * commits can be compared with devtools/benchcompare.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "gpsd.h"
+#include "gps_json.h"
+#include "revision.h"
+#include "strfuncs.h"
+#include "timespec.h"
+
+#define MAX_SNAPSHOTS	256	/* sky views kept, at 9K apiece */
+
+struct input_t {
+    char *name;
+    unsigned char *data;
+    size_t len;
+};
+
+struct packet_t {
+    unsigned char *data;
+    size_t len;
+};
+
+struct corpus_t {
+    struct packet_t *packets;
+    size_t count, room, bytes;
+};
+
+struct ais_bits_t {
+    unsigned char bits[128];	/* 1008 bits and a little */
+    size_t bitlen;
+};
+
+static struct gps_context_t context;
+static struct gps_device_t session;	/* big, so not on the stack */
+static struct policy_t policy;
+
+static struct input_t *inputs;
+static int ninputs;
+static size_t input_bytes;
+static struct corpus_t nmea, rtcm3, tpv, sky;
+static struct ais_bits_t *ais;
+static size_t nais, ais_room;
+static struct gps_fix_t *fixes;
+static size_t nfixes, fix_room;
+static struct gps_data_t *skyviews;
+static size_t nskyviews;
+
+/* the same logs with line noise in them, 10% and 50% by volume */
+static struct input_t *noisy[2];
+static size_t noisy_bytes[2];
+static const int noise_percent[2] = {10, 50};
+
+/* what the last lexer pass threw away, and what a clean pass took */
+static unsigned long discarded, resyncs;
+static double clean_ns_per_pass;
+
+static volatile size_t sink;	/* keeps results from being optimized out */
+
+static void *grow(void *base, size_t *room, size_t need, size_t size)
+/* make room in a growable array */
+{
+    if (need <= *room)
+	return base;
+    *room = *room ? *room * 2 : 256;
+    if ((base = realloc(base, *room * size)) == NULL) {
+	(void)fputs("test_bench: out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+    }
+    return base;
+}
+
+static void corpus_add(struct corpus_t *corpus, const void *data, size_t len)
+/* keep a copy of a packet, NUL-terminated since text parsers want that */
+{
+    struct packet_t *packet;
+
+    corpus->packets = grow(corpus->packets, &corpus->room, corpus->count + 1,
+			   sizeof(*packet));
+    packet = &corpus->packets[corpus->count++];
+    if ((packet->data = malloc(len + 1)) == NULL) {
+	(void)fputs("test_bench: out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+    }
+    memcpy(packet->data, data, len);
+    packet->data[len] = '\0';
+    packet->len = len;
+    corpus->bytes += len;
+}
+
+static void ais_add(const char *sentence)
+/* de-armor the payload of a single-fragment AIVDM sentence */
+{
+    struct ais_bits_t *msg;
+    const char *p = sentence;
+    int field;
+
+    if (strncmp(sentence + 3, "VDM,1,1,", 8) != 0
+	&& strncmp(sentence + 3, "VDO,1,1,", 8) != 0)
+	return;
+    for (field = 0; field < 5 && p != NULL; field++)
+	if ((p = strchr(p, ',')) != NULL)
+	    p++;
+    if (p == NULL)
+	return;
+    ais = grow(ais, &ais_room, nais + 1, sizeof(*ais));
+    msg = &ais[nais];
+    memset(msg, '\0', sizeof(*msg));
+    for (; *p != ',' && *p != '\0'; p++) {
+	unsigned int ch = (unsigned int)(*p - 48), i;
+
+	if (ch > 40)
+	    ch -= 8;
+	for (i = 0; i < 6 && msg->bitlen < sizeof(msg->bits) * 8; i++) {
+	    if ((ch >> (5 - i)) & 1)
+		msg->bits[msg->bitlen / 8] |=
+		    (unsigned char)(1 << (7 - msg->bitlen % 8));
+	    msg->bitlen++;
+	}
+    }
+    if (msg->bitlen >= 38)
+	nais++;
+}
+
+static bool load(struct input_t *input, const char *name)
+/* read a log into memory */
+{
+    struct stat sb;
+    int fd = open(name, O_RDONLY);
+
+    if (fd < 0 || fstat(fd, &sb) != 0) {
+	(void)fprintf(stderr, "test_bench: %s: %s\n", name, strerror(errno));
+	return false;
+    }
+    input->name = (char *)name;
+    input->len = (size_t)sb.st_size;
+    if ((input->data = malloc(input->len + 1)) == NULL
+	|| read(fd, input->data, input->len) != (ssize_t)input->len) {
+	(void)fprintf(stderr, "test_bench: can't read %s\n", name);
+	return false;
+    }
+    (void)close(fd);
+    input_bytes += input->len;
+    return true;
+}
+
+static void harvest(struct input_t *input)
+/* run a log through the daemon once, keeping what the benchmarks need */
+{
+    char buf[GPS_JSON_RESPONSE_MAX * 4];
+
+    gpsd_time_init(&context, time(NULL));
+    context.readonly = true;
+    gpsd_init(&session, &context, NULL);
+    gpsd_clear(&session);
+    session.gpsdata.gps_fd = -1;
+    session.gpsdata.dev.baudrate = 38400;	/* as gpsdecode does */
+    (void)strlcpy(session.gpsdata.dev.path, input->name,
+		  sizeof(session.gpsdata.dev.path));
+    packet_map(&session.lexer, input->data, input->len);
+    for (;;) {
+	gps_mask_t changed = gpsd_poll(&session);
+
+	if (changed == ERROR_SET || changed == NODATA_IS)
+	    break;
+	if ((changed & PACKET_SET) == 0)
+	    continue;
+	switch (session.lexer.type) {
+	case NMEA_PACKET:
+	    corpus_add(&nmea, session.lexer.outbuffer,
+		       session.lexer.outbuflen);
+	    break;
+	case AIVDM_PACKET:
+	    ais_add((char *)session.lexer.outbuffer);
+	    break;
+	case RTCM3_PACKET:
+	    corpus_add(&rtcm3, session.lexer.outbuffer,
+		       session.lexer.outbuflen);
+	    break;
+	case COMMENT_PACKET:
+	    gpsd_set_century(&session);
+	    break;
+	}
+	if ((changed & REPORT_IS) != 0) {
+	    fixes = grow(fixes, &fix_room, nfixes + 1, sizeof(*fixes));
+	    fixes[nfixes++] = session.gpsdata.fix;
+	    json_tpv_dump(&session, &policy, buf, sizeof(buf));
+	    corpus_add(&tpv, buf, strlen(buf));
+	}
+	if ((changed & SATELLITE_SET) != 0 && nskyviews < MAX_SNAPSHOTS) {
+	    skyviews[nskyviews++] = session.gpsdata;
+	    json_sky_dump(&session.gpsdata, buf, sizeof(buf));
+	    corpus_add(&sky, buf, strlen(buf));
+	}
+    }
+}
+
+static void add_noise(int level)
+/* splice random bursts into copies of the inputs, deterministically */
+{
+    unsigned long rng = 12345;
+    int i;
+
+    if ((noisy[level] = calloc((size_t)ninputs, sizeof(struct input_t)))
+	== NULL) {
+	(void)fputs("test_bench: out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < ninputs; i++) {
+	struct input_t *in = &inputs[i], *out = &noisy[level][i];
+	size_t room = in->len * 3 + 64, j;
+
+	if ((out->data = malloc(room)) == NULL) {
+	    (void)fputs("test_bench: out of memory\n", stderr);
+	    exit(EXIT_FAILURE);
+	}
+	out->name = in->name;
+	for (j = 0; j < in->len; j++) {
+	    rng = rng * 1103515245 + 12345;
+	    /* a burst of up to 64 bytes, averaging the requested share */
+	    if ((rng >> 16) % 3200 < (unsigned long)noise_percent[level] * 100
+		/ (100 - noise_percent[level])) {
+		int burst = 1 + (int)((rng >> 8) % 64);
+
+		while (burst-- > 0 && out->len < room - 1) {
+		    rng = rng * 1103515245 + 12345;
+		    out->data[out->len++] = (unsigned char)(rng >> 16);
+		}
+	    }
+	    if (out->len < room)
+		out->data[out->len++] = in->data[j];
+	}
+	noisy_bytes[level] += out->len;
+    }
+}
+
+/* the benchmarks; each makes one pass over its input, counting ops */
+
+static size_t lex(const struct input_t *in)
+/* packetize a set of inputs, noting what was thrown away */
+{
+    static struct gps_lexer_t lexer;
+    size_t ops = 0;
+    int i;
+
+    discarded = resyncs = 0;
+    for (i = 0; i < ninputs; i++) {
+	lexer_init(&lexer);
+	lexer.errout.debug = LOG_ERROR - 1;
+	packet_map(&lexer, in[i].data, in[i].len);
+	while (packet_get(-1, &lexer) > 0)
+	    ops++;
+	discarded += lexer.discarded;
+	resyncs += lexer.resyncs;
+    }
+    return ops;
+}
+
+static size_t bench_packet_parse(void)
+{
+    return lex(inputs);
+}
+
+static size_t bench_packet_parse_noise10(void)
+{
+    return lex(noisy[0]);
+}
+
+static size_t bench_packet_parse_noise50(void)
+{
+    return lex(noisy[1]);
+}
+
+static size_t bench_nmea_parse(void)
+{
+    char buf[MAX_PACKET_LENGTH + 1];
+    size_t i;
+
+    gpsd_clear(&session);
+    for (i = 0; i < nmea.count; i++) {
+	/* the parser splits its input in place */
+	memcpy(buf, nmea.packets[i].data, nmea.packets[i].len + 1);
+	sink += nmea_parse(buf, &session);
+    }
+    return nmea.count;
+}
+
+static size_t bench_ais_binary_decode(void)
+{
+    static struct ais_t msg;
+    static struct ais_type24_queue_t queue;
+    size_t i;
+
+    for (i = 0; i < nais; i++)
+	sink += ais_binary_decode(&context.errout, &msg,
+				  ais[i].bits, ais[i].bitlen, &queue);
+    return nais;
+}
+
+static size_t bench_rtcm3_unpack(void)
+{
+    static struct rtcm3_t msg;
+    size_t i;
+
+    for (i = 0; i < rtcm3.count; i++) {
+	rtcm3_unpack(&context, &msg, (char *)rtcm3.packets[i].data);
+	sink += msg.type;
+    }
+    return rtcm3.count;
+}
+
+static size_t bench_json_tpv_dump(void)
+{
+    char buf[GPS_JSON_RESPONSE_MAX];
+    size_t i;
+
+    for (i = 0; i < nfixes; i++) {
+	/* a fix is small; the session it lives in is not */
+	session.gpsdata.fix = fixes[i];
+	json_tpv_dump(&session, &policy, buf, sizeof(buf));
+	sink += strlen(buf);
+    }
+    return nfixes;
+}
+
+static size_t bench_json_sky_dump(void)
+{
+    char buf[GPS_JSON_RESPONSE_MAX];
+    size_t i;
+
+    for (i = 0; i < nskyviews; i++) {
+	json_sky_dump(&skyviews[i], buf, sizeof(buf));
+	sink += strlen(buf);
+    }
+    return nskyviews;
+}
+
+static size_t bench_json_read_object(void)
+{
+    static struct gps_data_t gpsdata;
+    size_t i;
+
+    /* json_read_object() as clients reach it, on the reports made above */
+    for (i = 0; i < tpv.count; i++)
+	sink += (size_t)libgps_json_unpack((char *)tpv.packets[i].data,
+					   &gpsdata, NULL);
+    for (i = 0; i < sky.count; i++)
+	sink += (size_t)libgps_json_unpack((char *)sky.packets[i].data,
+					   &gpsdata, NULL);
+    return tpv.count + sky.count;
+}
+
+static size_t bench_gpsd_error_model(void)
+{
+    struct gps_fix_t fix, oldfix;
+    size_t i;
+
+    gps_clear_fix(&oldfix);
+    for (i = 0; i < nfixes; i++) {
+	fix = fixes[i];
+	gpsd_error_model(&session, &fix, &oldfix);
+	oldfix = fix;
+    }
+    return nfixes;
+}
+
+static const struct bench_t {
+    const char *name;
+    size_t (*run)(void);
+    size_t *bytes;		/* of input per pass, if that means anything */
+    bool lexer;			/* report what resyncing cost */
+} benches[] = {
+    {"packet_parse", bench_packet_parse, &input_bytes, true},
+    {"packet_parse_noise10", bench_packet_parse_noise10, &noisy_bytes[0],
+     true},
+    {"packet_parse_noise50", bench_packet_parse_noise50, &noisy_bytes[1],
+     true},
+    {"nmea_parse", bench_nmea_parse, &nmea.bytes},
+    {"ais_binary_decode", bench_ais_binary_decode, NULL},
+    {"rtcm3_unpack", bench_rtcm3_unpack, &rtcm3.bytes},
+    {"json_read_object", bench_json_read_object, NULL},
+    {"json_tpv_dump", bench_json_tpv_dump, NULL},
+    {"json_sky_dump", bench_json_sky_dump, NULL},
+    {"gpsd_error_model", bench_gpsd_error_model, NULL},
+};
+
+static void run(const struct bench_t *bench, double mintime)
+/* make passes until enough time has gone by, and report */
+{
+    struct timespec start, now;
+    size_t ops = 0, passes = 0, bytes;
+    double seconds;
+
+    /* one untimed pass to warm the caches */
+    if (bench->run() == 0) {
+	(void)printf("{\"class\":\"BENCH\",\"name\":\"%s\",\"ops\":0}\n",
+		     bench->name);
+	return;
+    }
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+	ops += bench->run();
+	passes++;
+	(void)clock_gettime(CLOCK_MONOTONIC, &now);
+	seconds = (double)timespec_diff_ns(now, start) / 1e9;
+    } while (seconds < mintime);
+    bytes = bench->bytes != NULL ? *bench->bytes * passes : 0;
+    (void)printf("{\"class\":\"BENCH\",\"name\":\"%s\",\"ops\":%zu,"
+		 "\"passes\":%zu,\"seconds\":%.6f,\"ns_per_op\":%.2f",
+		 bench->name, ops, passes, seconds, seconds * 1e9 / ops);
+    if (bytes > 0)
+	(void)printf(",\"bytes\":%zu,\"mb_per_sec\":%.3f",
+		     bytes, bytes / seconds / 1e6);
+    if (bench->lexer) {
+	double ns_per_pass = seconds * 1e9 / passes;
+
+	/* the noisy inputs come after the clean one */
+	(void)printf(",\"discarded\":%lu,\"resyncs\":%lu", discarded, resyncs);
+	if (clean_ns_per_pass == 0)
+	    clean_ns_per_pass = ns_per_pass;
+	else if (discarded > 0)
+	    (void)printf(",\"ns_per_discard\":%.2f",
+			 (ns_per_pass - clean_ns_per_pass) / discarded);
+    }
+    (void)printf("}\n");
+    (void)fflush(stdout);
+}
+
+static void usage(void)
+{
+    (void)fputs("usage: test_bench [-b benchmark] [-t seconds] logfile...\n",
+		stderr);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *only = NULL;
+    double mintime = 1.0;
+    int option, i;
+    size_t b;
+
+    while ((option = getopt(argc, argv, "b:t:")) != -1) {
+	switch (option) {
+	case 'b':
+	    only = optarg;
+	    break;
+	case 't':
+	    mintime = safe_atof(optarg);
+	    break;
+	default:
+	    usage();
+	}
+    }
+    if (optind >= argc)
+	usage();
+
+    gps_context_init(&context, "test_bench");
+    context.errout.debug = LOG_ERROR - 1;	/* bad input is not news here */
+    memset(&policy, '\0', sizeof(policy));
+    policy.json = true;
+    ninputs = argc - optind;
+    inputs = calloc((size_t)ninputs, sizeof(*inputs));
+    skyviews = calloc(MAX_SNAPSHOTS, sizeof(*skyviews));
+    if (inputs == NULL || skyviews == NULL) {
+	(void)fputs("test_bench: out of memory\n", stderr);
+	exit(EXIT_FAILURE);
+    }
+    for (i = 0; i < ninputs; i++) {
+	if (!load(&inputs[i], argv[optind + i]))
+	    exit(EXIT_FAILURE);
+	harvest(&inputs[i]);
+    }
+    add_noise(0);
+    add_noise(1);
+    /* benchmarks that use a session want one of their own making */
+    gpsd_init(&session, &context, NULL);
+    gpsd_clear(&session);
+    (void)strlcpy(session.gpsdata.dev.path, "/dev/ttyBENCH",
+		  sizeof(session.gpsdata.dev.path));
+
+    (void)printf("{\"class\":\"BENCH_INFO\",\"revision\":\"%s\","
+		 "\"inputs\":%d,\"bytes\":%zu,\"nmea\":%zu,\"ais\":%zu,"
+		 "\"rtcm3\":%zu,\"fixes\":%zu,\"skyviews\":%zu}\n",
+		 REVISION, ninputs, input_bytes, nmea.count, nais,
+		 rtcm3.count, nfixes, nskyviews);
+    for (b = 0; b < sizeof(benches) / sizeof(benches[0]); b++)
+	if (only == NULL || strcmp(only, benches[b].name) == 0)
+	    run(&benches[b], mintime);
+    return EXIT_SUCCESS;
+}
+
+/* end */
@@ -0,0 +1,225 @@
+/*
+ * Unit test for packet captures: record packets from two devices
+ * across several index records with capture_packet(), then replay them
+ * through replay:// and check what comes out of the pipe.  A replay
+ * must give back one device's packets, byte for byte and in order; must
+ * start from a seek point when asked to skip; must cope with a capture
+ * that has lost its trailer or been torn mid-record, as a crash leaves
+ * it; and must keep to the recorded pace when not told to hurry.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpsd.h"
+#include "strfuncs.h"
+#include "timespec.h"
+
+#define INDEX_EVERY	1024		/* as capture.c writes them */
+#define NPACKETS	(INDEX_EVERY * 2 + 100)
+#define EVERY		10		/* one packet in EVERY is device 0's */
+#define STEP		10000000	/* nanoseconds between packets */
+#define BASE		1500000000
+
+static int failures = 0;
+static struct gps_context_t context;
+static struct gps_device_t session;	/* big, so not on the stack */
+
+static void check(bool ok, const char *what)
+{
+    if (!ok) {
+	(void)fprintf(stderr, "test_capture: FAILED %s\n", what);
+	failures++;
+    }
+}
+
+static size_t packet(int i, char *buf, size_t len)
+/* the sentence recorded as packet i */
+{
+    (void)snprintf(buf, len, "$GPTXT,01,01,%02d,packet %d*00\r\n",
+		   i % EVERY == 0, i);
+    return strlen(buf);
+}
+
+static size_t expected(int device, int from, char *buf, size_t len)
+/* what a replay of one device from packet from on should deliver;
+ * packet 0 comes from the minor device, so it is device 0 */
+{
+    size_t n = 0;
+    int i;
+
+    for (i = from; i < NPACKETS; i++)
+	if ((i % EVERY == 0) == (device == 0))
+	    n += packet(i, buf + n, len - n);
+    return n;
+}
+
+static void record(const char *path)
+/* write the test capture */
+{
+    static struct gps_device_t minor;
+    struct gps_device_t *devices[2] = {&session, &minor};
+    int i;
+
+    check(capture_start(&context.errout, path), "capture start");
+    minor.context = &context;
+    (void)strlcpy(minor.gpsdata.dev.path, "/dev/ttyS1",
+		  sizeof(minor.gpsdata.dev.path));
+    for (i = 0; i < NPACKETS; i++) {
+	struct gps_device_t *dev = devices[i % EVERY == 0];
+	int64_t stamp = (int64_t)i * STEP;
+
+	dev->lexer.type = NMEA_PACKET;
+	dev->lexer.outbuflen = packet(i, (char *)dev->lexer.outbuffer,
+				      sizeof(dev->lexer.outbuffer));
+	dev->lexer.first_stamp.tv_sec = BASE + (time_t)(stamp / NS_IN_SEC);
+	dev->lexer.first_stamp.tv_nsec = (long)(stamp % NS_IN_SEC);
+	capture_packet(dev);
+    }
+    capture_stop();
+}
+
+static size_t replay(const char *path, const char *options,
+		     char *buf, size_t len, double *elapsed)
+/* everything a replay:// device delivers, until the thread is done */
+{
+    struct timespec start, end;
+    struct pollfd pfd;
+    size_t n = 0;
+    socket_t fd;
+
+    (void)snprintf(session.gpsdata.dev.path, sizeof(session.gpsdata.dev.path),
+		   "replay://%s%s", path, options);
+    (void)clock_gettime(CLOCK_MONOTONIC, &start);
+    if ((fd = replay_open(&session)) < 0) {
+	check(false, "replay open");
+	return 0;
+    }
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    for (;;) {
+	ssize_t got;
+
+	if (poll(&pfd, 1, 5000) <= 0)
+	    break;
+	got = read(fd, buf + n, len - n);
+	if (got < 0 && (errno == EAGAIN || errno == EINTR))
+	    continue;
+	if (got <= 0)
+	    break;
+	n += (size_t)got;
+    }
+    (void)clock_gettime(CLOCK_MONOTONIC, &end);
+    (void)close(fd);
+    if (elapsed != NULL)	/* seconds */
+	*elapsed = TSTONS(&end) - TSTONS(&start);
+    return n;
+}
+
+static void same(const char *what, const char *want, size_t wantlen,
+		 const char *got, size_t gotlen)
+{
+    check(wantlen == gotlen && memcmp(want, got, wantlen) == 0, what);
+}
+
+static bool truncated(const char *from, const char *to, long cut)
+/* copy a capture, less its last cut bytes */
+{
+    FILE *in, *out;
+    long size;
+    char *data;
+    bool ok;
+
+    if ((in = fopen(from, "rb")) == NULL)
+	return false;
+    (void)fseek(in, 0L, SEEK_END);
+    size = ftell(in) - cut;
+    rewind(in);
+    if ((data = malloc((size_t)size)) == NULL
+	|| (out = fopen(to, "wb")) == NULL) {
+	free(data);
+	(void)fclose(in);
+	return false;
+    }
+    ok = fread(data, (size_t)size, 1, in) == 1
+	&& fwrite(data, (size_t)size, 1, out) == 1;
+    (void)fclose(in);
+    ok = fclose(out) == 0 && ok;
+    free(data);
+    return ok;
+}
+
+int main(void)
+{
+    char path[] = "/tmp/test_captureXXXXXX";
+    char torn[sizeof(path) + 5], options[64];
+    size_t len = (size_t)NPACKETS * 64;
+    char *want = malloc(len), *got = malloc(len);
+    size_t wantlen, gotlen;
+    double elapsed;
+    int fd, from;
+
+    if (want == NULL || got == NULL || (fd = mkstemp(path)) < 0) {
+	perror("test_capture");
+	return EXIT_FAILURE;
+    }
+    (void)close(fd);
+    (void)snprintf(torn, sizeof(torn), "%s.torn", path);
+    gps_context_init(&context, "test_capture");
+    context.errout.debug = LOG_ERROR - 1;
+    session.context = &context;
+    (void)strlcpy(session.gpsdata.dev.path, "/dev/ttyS0",
+		  sizeof(session.gpsdata.dev.path));
+    record(path);
+
+    /* the first device heard from is the default */
+    wantlen = expected(0, 0, want, len);
+    gotlen = replay(path, "?speed=0", got, len, NULL);
+    same("replay of the first device", want, wantlen, got, gotlen);
+
+    wantlen = expected(1, 0, want, len);
+    gotlen = replay(path, "?speed=0&device=1", got, len, NULL);
+    same("replay of the second device", want, wantlen, got, gotlen);
+
+    /* past two index records: a seek, then the stragglers skipped */
+    from = INDEX_EVERY * 2 + 50;
+    wantlen = expected(0, from, want, len);
+    (void)snprintf(options, sizeof(options), "?speed=0&skip=%.2f",
+		   (double)from * STEP / NS_IN_SEC);
+    gotlen = replay(path, options, got, len, NULL);
+    same("replay with skip", want, wantlen, got, gotlen);
+
+    /* no trailer: the seek points come from a scan */
+    wantlen = expected(0, 0, want, len);
+    check(truncated(path, torn, 16), "copy without trailer");
+    gotlen = replay(torn, "?speed=0", got, len, NULL);
+    same("replay without trailer", want, wantlen, got, gotlen);
+
+    /* torn inside the last record, the final index: every packet */
+    check(truncated(path, torn, 16 + 5), "copy torn in a record");
+    gotlen = replay(torn, "?speed=0", got, len, NULL);
+    same("replay of torn capture", want, wantlen, got, gotlen);
+    (void)unlink(torn);
+
+    /* at a hundred times the recorded pace, device 0's last packet
+     * is due a hundredth of its recorded time in */
+    gotlen = replay(path, "?speed=100", got, len, &elapsed);
+    same("paced replay", want, wantlen, got, gotlen);
+    check(elapsed >= (NPACKETS - 1) / EVERY * EVERY * (double)STEP
+	  / NS_IN_SEC / 100, "paced replay kept to the pace");
+
+    (void)unlink(path);
+    free(want);
+    free(got);
+    if (failures == 0)
+	(void)printf("test_capture: all tests passed\n");
+    return failures == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* end */
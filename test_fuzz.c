@@ -0,0 +1,257 @@
+/*
+ * Fuzz harness for the packet lexer and the drivers behind it.
+ *
+ * The first byte of an input picks a driver; the rest goes through
+ * packet_parse(), and each packet of the driver's type is handed to its
+ * parse_packet method, as gpsd_poll() would.  So a fuzzer learns both
+ * to frame packets and to steer at one driver at a time.
+ *
+ * Built as is, this reads each file named (or standard input, for AFL)
+ * as one input, so a corpus can be replayed as a regression test.  For
+ * libFuzzer, compile with clang -fsanitize=fuzzer -DLIBFUZZER and the
+ * usual gpsd flags and libraries; it supplies the main().
+ *
+ * test_fuzz -C dir log... writes a seed corpus to dir: one input for
+ * each kind of packet, by type and leading bytes, found in the logs.
+ *
+ * This file is Copyright (c) 2017 by the GPSD project
+ * BSD terms apply: see the file COPYING in the distribution root for details.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "gpsd.h"
+
+#define MAX_PARSERS	64
+#define SIGNATURE	6	/* most leading bytes that tell packets apart */
+
+static struct gps_context_t context;
+static struct gps_device_t session;	/* big, so not on the stack */
+static const struct gps_type_t *parsers[MAX_PARSERS];
+static int nparsers;
+
+static void setup(void)
+/* find the drivers that parse packets, once */
+{
+    const struct gps_type_t **dp;
+
+    if (nparsers > 0)
+	return;
+    gps_context_init(&context, "test_fuzz");
+    context.errout.debug = LOG_ERROR - 1;	/* garbage is expected */
+    context.readonly = true;
+    for (dp = gpsd_drivers; *dp != NULL && nparsers < MAX_PARSERS; dp++)
+	if ((*dp)->parse_packet != NULL && (*dp)->packet_type != COMMENT_PACKET)
+	    parsers[nparsers++] = *dp;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    const struct gps_type_t *driver;
+
+    setup();
+    if (size < 1)
+	return 0;
+    driver = parsers[data[0] % nparsers];
+    gpsd_init(&session, &context, NULL);
+    session.gpsdata.gps_fd = -1;
+    session.device_type = driver;
+    session.lexer.errout.debug = context.errout.debug;
+    packet_map(&session.lexer, data + 1, size - 1);
+    while (packet_get(-1, &session.lexer) > 0)
+	if (session.lexer.type == driver->packet_type)
+	    (void)driver->parse_packet(&session);
+    return 0;
+}
+
+#ifndef LIBFUZZER
+static unsigned char *slurp(FILE *fp, size_t *len)
+/* read all of a file */
+{
+    unsigned char *buf = NULL;
+    size_t room = 0;
+    size_t n;
+
+    *len = 0;
+    do {
+	if (*len == room) {
+	    room = room ? room * 2 : 65536;
+	    if ((buf = realloc(buf, room)) == NULL) {
+		(void)fputs("test_fuzz: out of memory\n", stderr);
+		exit(EXIT_FAILURE);
+	    }
+	}
+	n = fread(buf + *len, 1, room - *len, fp);
+	*len += n;
+    } while (n > 0);
+    return buf;
+}
+
+static int selector(int packet_type)
+/* the first driver for a packet type, as an input's first byte */
+{
+    int i;
+
+    for (i = 0; i < nparsers; i++)
+	if (parsers[i]->packet_type == packet_type)
+	    return i;
+    return -1;
+}
+
+static size_t signature(const struct gps_lexer_t *lexer, unsigned char *key)
+/* what tells one kind of packet from another: type and message ID */
+{
+    size_t len;
+
+    switch (lexer->type) {
+    case RTCM3_PACKET:
+	/* the 12-bit message number follows the 3-byte header */
+	if (lexer->outbuflen < 5)
+	    return 0;
+	key[0] = lexer->outbuffer[3];
+	key[1] = lexer->outbuffer[4] & 0xf0;
+	return 2;
+    case TSIP_PACKET:
+	len = 3;		/* DLE, ID, subcode */
+	break;
+    case SIRF_PACKET:
+	len = 5;		/* start, length, ID */
+	break;
+    case UBX_PACKET:
+    case ZODIAC_PACKET:
+    case NAVCOM_PACKET:
+    case ITALK_PACKET:
+	len = 4;
+	break;
+    case SUPERSTAR2_PACKET:
+	len = 2;
+	break;
+    case RTCM2_PACKET:
+    case JSON_PACKET:
+	len = 0;		/* one of each will do */
+	break;
+    default:
+	len = SIGNATURE;	/* a sentence tag, mostly */
+	break;
+    }
+    if (len > lexer->outbuflen)
+	len = lexer->outbuflen;
+    memcpy(key, lexer->outbuffer, len);
+    return len;
+}
+
+static int seed(const char *dir, char **logs, int nlogs)
+/* cut a corpus from logs: one input per kind of packet */
+{
+    static struct gps_lexer_t lexer;
+    unsigned char (*seen)[SIGNATURE + 1] = NULL;
+    size_t nseen = 0, room = 0, i;
+    int f;
+
+    for (f = 0; f < nlogs; f++) {
+	FILE *fp = fopen(logs[f], "rb");
+	unsigned char *data;
+	size_t len;
+
+	if (fp == NULL) {
+	    (void)fprintf(stderr, "test_fuzz: %s: %s\n",
+			  logs[f], strerror(errno));
+	    return EXIT_FAILURE;
+	}
+	data = slurp(fp, &len);
+	(void)fclose(fp);
+	lexer_init(&lexer);
+	lexer.errout.debug = LOG_ERROR - 1;
+	packet_map(&lexer, data, len);
+	while (packet_get(-1, &lexer) > 0) {
+	    unsigned char key[SIGNATURE + 1];
+	    char path[PATH_MAX];
+	    int sel = selector(lexer.type);
+
+	    if (sel < 0)
+		continue;
+	    memset(key, '\0', sizeof(key));
+	    key[0] = (unsigned char)lexer.type;
+	    (void)signature(&lexer, key + 1);
+	    for (i = 0; i < nseen; i++)
+		if (memcmp(seen[i], key, sizeof(key)) == 0)
+		    break;
+	    if (i < nseen)
+		continue;
+	    if (nseen == room) {
+		room = room ? room * 2 : 256;
+		if ((seen = realloc(seen, room * sizeof(*seen))) == NULL) {
+		    (void)fputs("test_fuzz: out of memory\n", stderr);
+		    return EXIT_FAILURE;
+		}
+	    }
+	    memcpy(seen[nseen++], key, sizeof(key));
+	    (void)snprintf(path, sizeof(path), "%s/%02d-%04zu",
+			   dir, lexer.type, nseen);
+	    if ((fp = fopen(path, "wb")) == NULL) {
+		(void)fprintf(stderr, "test_fuzz: %s: %s\n",
+			      path, strerror(errno));
+		return EXIT_FAILURE;
+	    }
+	    (void)fputc(sel, fp);
+	    (void)fwrite(lexer.outbuffer, 1, lexer.outbuflen, fp);
+	    (void)fclose(fp);
+	}
+	free(data);
+    }
+    (void)printf("test_fuzz: %zu seeds written to %s\n", nseen, dir);
+    return EXIT_SUCCESS;
+}
+
+int main(int argc, char **argv)
+{
+    unsigned char *data;
+    size_t len;
+    int option, i;
+    char *corpus = NULL;
+
+    while ((option = getopt(argc, argv, "C:")) != -1) {
+	switch (option) {
+	case 'C':
+	    corpus = optarg;
+	    break;
+	default:
+	    (void)fputs("usage: test_fuzz [-C dir log...] [input...]\n",
+			stderr);
+	    exit(EXIT_FAILURE);
+	}
+    }
+    setup();
+    if (corpus != NULL)
+	return seed(corpus, argv + optind, argc - optind);
+
+    if (optind == argc) {
+	data = slurp(stdin, &len);
+	(void)LLVMFuzzerTestOneInput(data, len);
+	free(data);
+	return EXIT_SUCCESS;
+    }
+    for (i = optind; i < argc; i++) {
+	FILE *fp = fopen(argv[i], "rb");
+
+	if (fp == NULL) {
+	    (void)fprintf(stderr, "test_fuzz: %s: %s\n",
+			  argv[i], strerror(errno));
+	    return EXIT_FAILURE;
+	}
+	data = slurp(fp, &len);
+	(void)fclose(fp);
+	(void)LLVMFuzzerTestOneInput(data, len);
+	free(data);
+    }
+    return EXIT_SUCCESS;
+}
+#endif /* LIBFUZZER */
+
+/* end */
@@ -229,8 +229,33 @@ static const char *json_strOSC = "{\"class\":\"OSC\",\"device\":\"GPS#1\"," \
     "\"running\":true,\"reference\":true,\"disciplined\":false," \
     "\"delta\":67}";
 
+/* Case 13: test parsing of WATCH content filters */
+
+static const char *json_strWATCH = "{\"class\":\"WATCH\",\"json\":true," \
+    "\"classes\":[\"TPV\",\"AIS\"],\"aistypes\":[1,2,3]," \
+    "\"mmsi\":[244660000,366982000],\"minmode\":3,\"interval\":1.5}";
+
+static const char *json_strBadWATCH = "{\"class\":\"WATCH\",\"json\":false," \
+    "\"minmode\":2,\"classes\":[\"BOGUS\"]}";
+
+/* Case 14: test parsing of an RTCM3 Multiple Signal Message */
+
+static const char *json_strMSM = "{\"class\":\"RTCM3\",\"type\":1077," \
+    "\"length\":438,\"gnss\":\"GPS\",\"msm\":7,\"station_id\":633," \
+    "\"tow\":333498000,\"sync\":true,\"iods\":0,\"steering\":2," \
+    "\"ext_clock\":0,\"smoothing\":false,\"interval\":0," \
+    "\"sats\":[{\"ident\":5,\"rr\":81.2929687500,\"ext\":0,\"rate\":-363}," \
+    "{\"ident\":7,\"rr\":69.3662109375,\"ext\":0,\"rate\":-117}]," \
+    "\"cells\":[{\"sat\":5,\"sig\":2,\"prange\":24370904.1436," \
+    "\"cphase\":24370842.7204,\"lockt\":542,\"half\":false," \
+    "\"CNR\":42.7500,\"rate\":-362.8333},{\"sat\":5,\"sig\":4," \
+    "\"prange\":24370904.2988,\"cphase\":24370852.0941,\"lockt\":542," \
+    "\"half\":false,\"CNR\":26.2500,\"rate\":-362.8333},{\"sat\":7," \
+    "\"sig\":2,\"prange\":20795339.2273,\"cphase\":20795469.3563," \
+    "\"lockt\":621,\"half\":true,\"CNR\":49.5000,\"rate\":-117.1501}]}";
+
 #ifndef JSON_MINIMAL
-/* Case 13: Read array of integers */
+/* Case 15: Read array of integers */
 
 static const char *json_strInt = "[23,-17,5]";
 static int intstore[4], intcount;
@@ -242,7 +267,7 @@ static const struct json_array_t json_array_Int = {
     .maxlen = sizeof(intstore)/sizeof(intstore[0]),
 };
 
-/* Case 14: Read array of booleans */
+/* Case 16: Read array of booleans */
 
 static const char *json_strBool = "[true,false,true]";
 static bool boolstore[4];
@@ -255,7 +280,7 @@ static const struct json_array_t json_array_Bool = {
     .maxlen = sizeof(boolstore)/sizeof(boolstore[0]),
 };
 
-/* Case 15: Read array of reals */
+/* Case 17: Read array of reals */
 
 static const char *json_str15 = "[23.1,-17.2,5.3]";
 static double realstore[4];
@@ -402,10 +427,54 @@ static void jsontest(int i)
 	assert_integer("delta", gpsdata.osc.delta, 67);
 	break;
 
+    case 13:
+	status = json_watch_read(json_strWATCH, &gpsdata.policy, NULL);
+	assert_case(13, status);
+	assert_boolean("json", gpsdata.policy.json, true);
+	assert_uinteger("classes", gpsdata.policy.classes,
+			CLASS_TPV | CLASS_AIS);
+	assert_uinteger("aistypes", gpsdata.policy.aistypes, 0x0e);
+	assert_integer("nmmsi", gpsdata.policy.nmmsi, 2);
+	assert_uinteger("mmsi[1]", gpsdata.policy.mmsi[1], 366982000);
+	assert_integer("minmode", gpsdata.policy.minmode, 3);
+	assert_real("interval", gpsdata.policy.interval, 1.5);
+	/* a bad WATCH leaves the policy as it was */
+	status = json_watch_read(json_strBadWATCH, &gpsdata.policy, NULL);
+	assert_integer("bad WATCH", status, JSON_ERR_BADENUM);
+	assert_boolean("json", gpsdata.policy.json, true);
+	assert_uinteger("classes", gpsdata.policy.classes,
+			CLASS_TPV | CLASS_AIS);
+	assert_integer("minmode", gpsdata.policy.minmode, 3);
+	break;
+
+    case 14:
+	status = libgps_json_unpack(json_strMSM, &gpsdata, NULL);
+	assert_case(14, status);
+	assert_uinteger("type", gpsdata.rtcm3.type, 1077);
+	assert_boolean("decoded", gpsdata.rtcm3.decoded, true);
+	assert_integer("gnss", (int)gpsdata.rtcm3.rtcmtypes.msm.gnss, msm_gps);
+	assert_integer("msm", gpsdata.rtcm3.rtcmtypes.msm.level, 7);
+	assert_uinteger("tow", gpsdata.rtcm3.rtcmtypes.msm.tow, 333498000);
+	assert_integer("nsat", gpsdata.rtcm3.rtcmtypes.msm.nsat, 2);
+	assert_integer("nsig", gpsdata.rtcm3.rtcmtypes.msm.nsig, 2);
+	assert_integer("ncell", gpsdata.rtcm3.rtcmtypes.msm.ncell, 3);
+	assert_integer("sats[1].ident",
+		       gpsdata.rtcm3.rtcmtypes.msm.sats[1].ident, 7);
+	assert_integer("cells[2].sat",
+		       gpsdata.rtcm3.rtcmtypes.msm.cells[2].sat, 7);
+	assert_real("cells[1].prange",
+		    gpsdata.rtcm3.rtcmtypes.msm.cells[1].pseudorange,
+		    24370904.2988);
+	assert_boolean("cells[2].half",
+		       gpsdata.rtcm3.rtcmtypes.msm.cells[2].half_cycle, true);
+	assert_real("cells[2].CNR", gpsdata.rtcm3.rtcmtypes.msm.cells[2].CNR,
+		    49.5);
+	break;
+
 #ifdef JSON_MINIMAL
-#define MAXTEST 12
+#define MAXTEST 14
 #else
-    case 13:
+    case 15:
 	status = json_read_array(json_strInt, &json_array_Int, NULL);
 	assert_integer("count", intcount, 3);
 	assert_integer("intstore[0]", intstore[0], 23);
@@ -414,7 +483,7 @@ static void jsontest(int i)
 	assert_integer("intstore[3]", intstore[3], 0);
 	break;
 
-    case 14:
+    case 16:
 	status = json_read_array(json_strBool, &json_array_Bool, NULL);
 	assert_integer("count", boolcount, 3);
 	assert_boolean("boolstore[0]", boolstore[0], true);
@@ -423,7 +492,7 @@ static void jsontest(int i)
 	assert_boolean("boolstore[3]", boolstore[3], false);
 	break;
 
-    case 15:
+    case 17:
 	status = json_read_array(json_str15, &json_array_15, NULL);
 	assert_integer("count", realcount, 3);
 	assert_real("realstore[0]", realstore[0], 23.1);
@@ -432,7 +501,7 @@ static void jsontest(int i)
 	assert_real("realstore[3]", realstore[3], 0);
 	break;
 
-#define MAXTEST 15
+#define MAXTEST 17
 #endif /* JSON_MINIMAL */
 
     default:
@@ -0,0 +1,104 @@
+#!/usr/bin/env python
+#
+# Test the simulated PPS that gpsd -Y gives pty devices.
+#
+# A pty is fed an NMEA fix just after each second, while gpsd makes
+# PPS edges for it from a timer a known offset after the second.  The
+# PPS reports a watcher gets must carry a system-clock stamp that
+# offset into its second, give or take the host's scheduling latency,
+# paired with a whole second of GPS time: the one after the last fix,
+# as for a real receiver.  This runs the whole edge path: timer, edge
+# categorization, pairing with the fix, and the report hook.
+#
+# This code runs compatibly under Python 2 and 3.x for x >= 2.
+# Preserve this property!
+from __future__ import absolute_import, print_function, division
+
+import os
+import pty
+import stat
+import sys
+import threading
+import time
+import tty
+
+import gps
+import gps.fake
+
+OFFSET = 250000         # microseconds after the second, for -Y
+SLACK = 50000           # microseconds of wakeup latency we tolerate
+WANTED = 3              # PPS reports needed to pass
+DEADLINE = 30           # seconds to wait for them
+
+if not sys.platform.startswith("linux"):
+    # simulated PPS needs timerfd
+    sys.exit(0)
+
+
+def nmea(body):
+    "Wrap a sentence body with delimiters and checksum."
+    csum = 0
+    for c in body:
+        csum ^= ord(c)
+    return gps.polybytes("$%s*%02X\r\n" % (body, csum))
+
+
+def feed(fd, stop):
+    "Send a fix for each second, just after the second starts."
+    while not stop.is_set():
+        now = time.gmtime()
+        hms = time.strftime("%H%M%S", now) + ".00"
+        dmy = time.strftime("%d%m%y", now)
+        os.write(fd, nmea("GPRMC,%s,A,4000.000,N,07500.000,W,0.0,0.0,%s,,,A"
+                          % (hms, dmy)))
+        os.write(fd, nmea("GPGGA,%s,4000.000,N,07500.000,W,1,08,1.0,10.0,"
+                          "M,0.0,M,," % hms))
+        time.sleep(1.05 - time.time() % 1.0)
+
+
+port = gps.fake.freeport()
+daemon = gps.fake.DaemonInstance()
+daemon.spawn(background=True, port=port, options="-n -Y %d,0" % OFFSET)
+daemon.wait_ready()
+(master, slave) = pty.openpty()
+tty.setraw(slave)
+# the daemon may have dropped privileges already
+os.chmod(os.ttyname(slave), stat.S_IRUSR | stat.S_IWUSR | stat.S_IRGRP
+         | stat.S_IWGRP | stat.S_IROTH | stat.S_IWOTH)
+daemon.add_device(os.ttyname(slave))
+
+stop = threading.Event()
+feeder = threading.Thread(target=feed, args=(master, stop))
+feeder.daemon = True
+feeder.start()
+
+errors = 0
+seen = 0
+session = gps.gps(port=port)
+session.stream(gps.WATCH_ENABLE | gps.WATCH_JSON | gps.WATCH_PPS)
+start = time.time()
+while seen < WANTED and time.time() - start < DEADLINE:
+    if not session.waiting(1):
+        continue
+    if session.read() == -1:
+        break
+    if session.data.get("class") != "PPS":
+        continue
+    seen += 1
+    late = session.data["clock_nsec"] // 1000
+    ahead = session.data["real_sec"] - session.data["clock_sec"]
+    if session.data["real_nsec"] != 0 or ahead not in (0, 1) \
+       or not OFFSET <= late < OFFSET + SLACK:
+        sys.stderr.write("test_ppssim: bad edge %s, %d usec into second\n"
+                         % (session.response.strip(), late))
+        errors += 1
+
+stop.set()
+session.close()
+daemon.kill()
+
+if seen < WANTED:
+    sys.stderr.write("test_ppssim: %d PPS reports in %d seconds, wanted %d\n"
+                     % (seen, DEADLINE, WANTED))
+    errors += 1
+sys.exit(errors)
@@ -0,0 +1,140 @@
+#!/usr/bin/env python
+#
+# Replay a packet capture, in the format gpsd -W writes, both ways it
+# can be replayed: through gpsd's own replay:// device, as fast as the
+# daemon will read, and through gpsfake -R, at twice the recorded
+# pace.  Either way a watcher must see a TPV for every fix in the
+# capture, in order; and gpsfake must take at least the scaled time the
+# capture spans, which it would not if the arrival stamps were ignored.
+#
+# The capture is written here, one RMC a second from two devices, so
+# the replays also have to pick out the device heard from first.  It
+# has no index trailer, as one cut short by a crash would not.
+#
+# This code runs compatibly under Python 2 and 3.x for x >= 2.
+# Preserve this property!
+from __future__ import absolute_import, print_function, division
+
+import os
+import struct
+import subprocess
+import sys
+import tempfile
+import time
+
+import gps
+import gps.fake
+
+FIXES = 10              # seconds of fixes in the capture
+RATE = 2                # gpsfake -R speedup
+DEADLINE = 30           # seconds to wait for a replay's reports
+BASE = 1500000000       # capture time of the first fix
+
+RECORD = struct.Struct("<BBHIq")
+PACKET = 1
+DEVICE = 2
+
+
+def nmea(body):
+    "Wrap a sentence body with delimiters and checksum."
+    csum = 0
+    for c in body:
+        csum ^= ord(c)
+    return gps.polybytes("$%s*%02X\r\n" % (body, csum))
+
+
+def fix_time(i):
+    "The ISO8601 time of fix i."
+    return time.strftime("%Y-%m-%dT%H:%M:%S.000Z", time.gmtime(BASE + i))
+
+
+def write_capture(fp):
+    "A capture of FIXES RMCs from one device, interleaved with another's."
+    fp.write(b"GPSDCAP1")
+    for (dev, path) in ((0, b"/dev/ttyS0"), (1, b"/dev/ttyS1")):
+        fp.write(RECORD.pack(DEVICE, 0, dev, len(path), 0) + path)
+    for i in range(FIXES):
+        now = time.gmtime(BASE + i)
+        stamp = (BASE + i) * 10**9
+        rmc = nmea("GPRMC,%s.00,A,4000.000,N,07500.000,W,0.0,0.0,%s,,,A"
+                   % (time.strftime("%H%M%S", now),
+                      time.strftime("%d%m%y", now)))
+        fp.write(RECORD.pack(PACKET, 1, 0, len(rmc), stamp) + rmc)
+        # the other device is off by an hour, so its fixes would show
+        rmc = nmea("GPRMC,%s.00,A,4100.000,N,07500.000,W,0.0,0.0,%s,,,A"
+                   % (time.strftime("%H%M%S", time.gmtime(BASE + i + 3600)),
+                      time.strftime("%d%m%y", now)))
+        fp.write(RECORD.pack(PACKET, 1, 1, len(rmc), stamp + 10**8) + rmc)
+    fp.flush()
+
+
+def check(how, times, elapsed=None):
+    "Compare the TPV times a replay gave with the fixes captured."
+    errors = 0
+    # a fix may be reported more than once; each must come, in order
+    seen = []
+    for t in times:
+        if not seen or seen[-1] != t:
+            seen.append(t)
+    want = [fix_time(i) for i in range(FIXES)]
+    if seen != want:
+        sys.stderr.write("test_replay: %s gave fixes %s, wanted %s\n"
+                         % (how, seen, want))
+        errors += 1
+    if elapsed is not None and elapsed < (FIXES - 1) / RATE:
+        sys.stderr.write("test_replay: %s took %.2f seconds, "
+                         "under the %.2f the capture spans at -R %d\n"
+                         % (how, elapsed, (FIXES - 1) / RATE, RATE))
+        errors += 1
+    return errors
+
+
+def via_replay(capture):
+    "TPV times from gpsd reading the capture through replay://."
+    port = gps.fake.freeport()
+    daemon = gps.fake.DaemonInstance()
+    daemon.spawn(background=True, port=port, options="")
+    daemon.wait_ready()
+    session = gps.gps(port=port)
+    session.stream(gps.WATCH_ENABLE | gps.WATCH_JSON)
+    daemon.add_device("replay://%s?speed=0" % capture)
+    times = []
+    start = time.time()
+    while len(times) < FIXES and time.time() - start < DEADLINE:
+        if not session.waiting(1):
+            continue
+        if session.read() == -1:
+            break
+        if session.data.get("class") == "TPV" and "time" in session.data:
+            times.append(session.data["time"])
+    session.close()
+    daemon.kill()
+    return times
+
+
+def via_gpsfake(capture):
+    "TPV times from gpsfake feeding the capture at -R RATE, and how long."
+    gpsfake = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                           "gpsfake")
+    start = time.time()
+    output = subprocess.check_output(
+        [sys.executable, gpsfake, "-1", "-p", "-q", "-R", str(RATE),
+         "-P", str(gps.fake.freeport()), capture])
+    elapsed = time.time() - start
+    times = []
+    for line in gps.polystr(output).splitlines():
+        if '"class":"TPV"' in line and '"time":"' in line:
+            times.append(line.split('"time":"')[1].split('"')[0])
+    return (times, elapsed)
+
+
+tmp = tempfile.NamedTemporaryFile(suffix=".cap")
+write_capture(tmp)
+# the daemon may have dropped privileges already
+os.chmod(tmp.name, 0o644)
+
+errors = check("replay://", via_replay(tmp.name))
+(times, elapsed) = via_gpsfake(tmp.name)
+errors += check("gpsfake -R", times, elapsed)
+tmp.close()
+sys.exit(errors)
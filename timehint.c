@@ -19,7 +19,9 @@
 /* snprintf() needs _DARWIN_C_SOURCE */
 #define _DARWIN_C_SOURCE
 
+#include <stdio.h>
 #include <string.h>
+#include <stdlib.h>
 #include <libgen.h>
 #include <stdbool.h>
 #include <math.h>
@@ -33,6 +35,7 @@
 
 #include "timespec.h"
 #include "gpsd.h"
+#include "strfuncs.h"
 
 #ifdef NTPSHM_ENABLE
 #include "ntpshm.h"
@@ -158,47 +161,155 @@ static volatile struct shmTime *getShmTime(struct gps_context_t *context, int un
     return p;
 }
 
+static bool ntpshm_attach(struct gps_context_t *context, int unit)
+/* attach a unit's segment and its extended twin, if not yet done */
+{
+    if (context->shmTime[unit] != NULL)
+	return true;
+    context->shmTime[unit] = getShmTime(context, unit);
+    if (context->shmTime[unit] == NULL)
+	return false;
+    /* the extended segment is a bonus; ntpd only needs the other */
+    context->shmTimeX[unit] = shmx_get(unit, true, unit >= 2);
+    if (context->shmTimeX[unit] == NULL)
+	gpsd_log(&context->errout, LOG_WARN,
+		 "NTP: no extended segment for unit %d: %s\n",
+		 unit, strerror(errno));
+    return true;
+}
+
+bool ntpshm_map(struct gps_context_t *context, const char *spec)
+/* take a "device=clockunit[,ppsunit]" mapping from the command line */
+{
+    const char *eq = strrchr(spec, '=');
+    char *end;
+    long clock, pps = -1;
+    int i;
+
+    if (eq == NULL || eq == spec || (size_t)(eq - spec) >= GPS_PATH_MAX)
+	return false;
+    clock = strtol(eq + 1, &end, 10);
+    if (end == eq + 1 || clock < 0 || clock >= NTPSHMSEGS)
+	return false;
+    if (*end == ',') {
+	const char *p = end + 1;
+
+	pps = strtol(p, &end, 10);
+	if (end == p || pps < 0 || pps >= NTPSHMSEGS || pps == clock)
+	    return false;
+    }
+    if (*end != '\0')
+	return false;
+
+    for (i = 0; i < MAX_DEVICES; i++)
+	if (context->shmUnits[i].path[0] == '\0') {
+	    memcpy(context->shmUnits[i].path, spec, (size_t)(eq - spec));
+	    context->shmUnits[i].path[eq - spec] = '\0';
+	    context->shmUnits[i].clock = (int)clock;
+	    context->shmUnits[i].pps = (int)pps;
+	    return true;
+	}
+    return false;
+}
+
 void ntpshm_context_init(struct gps_context_t *context)
-/* Attach all NTP SHM segments. Called once at startup, while still root. */
+/* Attach the usual NTP SHM segments and any mapped ones.  Called once
+ * at startup, while still root; more are attached later as needed. */
 {
     int i;
 
-    for (i = 0; i < NTPSHMSEGS; i++) {
+    for (i = 0; i < NTPSHM_PREALLOC; i++) {
 	// Only grab the first two when running as root.
 	if (2 <= i || 0 == getuid()) {
-	    context->shmTime[i] = getShmTime(context, i);
+	    (void)ntpshm_attach(context, i);
 	}
     }
+    for (i = 0; i < MAX_DEVICES; i++)
+	if (context->shmUnits[i].path[0] != '\0') {
+	    (void)ntpshm_attach(context, context->shmUnits[i].clock);
+	    if (context->shmUnits[i].pps >= 0)
+		(void)ntpshm_attach(context, context->shmUnits[i].pps);
+	}
     memset(context->shmTimeInuse, 0, sizeof(context->shmTimeInuse));
 }
 
-static volatile struct shmTime *ntpshm_alloc(struct gps_context_t *context)
-/* allocate NTP SHM segment.  return its segment number, or -1 */
+static bool ntpshm_mapped(struct gps_context_t *context, int unit)
+/* is this unit reserved for some device by -U? */
 {
     int i;
 
-    for (i = 0; i < NTPSHMSEGS; i++)
-	if (context->shmTime[i] != NULL && !context->shmTimeInuse[i]) {
-	    context->shmTimeInuse[i] = true;
+    for (i = 0; i < MAX_DEVICES; i++)
+	if (context->shmUnits[i].path[0] != '\0'
+	    && (unit == context->shmUnits[i].clock
+		|| unit == context->shmUnits[i].pps))
+	    return true;
+    return false;
+}
 
-	    /*
-	     * In case this segment gets sent to ntpd before an
-	     * ephemeris is available, the LEAP_NOTINSYNC value will
-	     * tell ntpd that this source is in a "clock alarm" state
-	     * and should be ignored.  The goal is to prevent ntpd
-	     * from declaring the GPS a falseticker before it gets
-	     * all its marbles together.
-	     */
-	    memset((void *)context->shmTime[i], 0, sizeof(struct shmTime));
-	    context->shmTime[i]->mode = 1;
-	    context->shmTime[i]->leap = LEAP_NOTINSYNC;
-	    context->shmTime[i]->precision = -20;/* initially 1 micro sec */
-	    context->shmTime[i]->nsamples = 3;	/* stages of median filter */
+static int ntpshm_alloc(struct gps_context_t *context, int want,
+			const char *path)
+/* allocate NTP SHM segment for a device, the unit wanted if not -1.
+ * return its segment number, or -1 */
+{
+    int i;
 
-	    return context->shmTime[i];
+    if (want >= 0) {
+	if (context->shmTimeInuse[want]) {
+	    gpsd_log(&context->errout, LOG_WARN,
+		     "NTP: unit %d is already in use\n", want);
+	    want = -1;
+	} else if (!ntpshm_attach(context, want))
+	    want = -1;
+    }
+    if ((i = want) < 0) {
+	for (i = 0; i < NTPSHMSEGS; i++)
+	    if (context->shmTime[i] != NULL && !context->shmTimeInuse[i]
+		&& !ntpshm_mapped(context, i))
+		break;
+	if (i == NTPSHMSEGS) {
+	    /* all attached units are busy, try for another */
+	    for (i = 2; i < NTPSHMSEGS; i++)
+		if (context->shmTime[i] == NULL && !ntpshm_mapped(context, i)
+		    && ntpshm_attach(context, i))
+		    break;
+	    if (i == NTPSHMSEGS)
+		return -1;
 	}
+    }
+
+    context->shmTimeInuse[i] = true;
+
+    /*
+     * In case this segment gets sent to ntpd before an
+     * ephemeris is available, the LEAP_NOTINSYNC value will
+     * tell ntpd that this source is in a "clock alarm" state
+     * and should be ignored.  The goal is to prevent ntpd
+     * from declaring the GPS a falseticker before it gets
+     * all its marbles together.
+     */
+    memset((void *)context->shmTime[i], 0, sizeof(struct shmTime));
+    context->shmTime[i]->mode = 1;
+    context->shmTime[i]->leap = LEAP_NOTINSYNC;
+    context->shmTime[i]->precision = -20;/* initially 1 micro sec */
+    context->shmTime[i]->nsamples = 3;	/* stages of median filter */
+
+    if (context->shmTimeX[i] != NULL) {
+	volatile struct shmTimeX *x = context->shmTimeX[i];
 
-    return NULL;
+	/* invalidate first, so no reader trusts a half-built segment */
+	x->magic = 0;
+	memory_barrier();
+	memset((void *)x, 0, sizeof(struct shmTimeX));
+	x->version = NTPX_VERSION;
+	x->unit = i;
+	x->leap = LEAP_NOTINSYNC;
+	x->precision = -20;
+	(void)strlcpy((char *)x->device, path, sizeof(x->device));
+	memory_barrier();
+	x->magic = NTPX_MAGIC;
+    }
+
+    return i;
 }
 
 static bool ntpshm_free(struct gps_context_t * context, volatile struct shmTime *s)
@@ -220,18 +331,46 @@ void ntpshm_session_init(struct gps_device_t *session)
 #ifdef NTPSHM_ENABLE
     /* mark NTPD shared memory segments as unused */
     session->shm_clock = NULL;
+    session->shmx_clock = NULL;
 #endif /* NTPSHM_ENABLE */
 #ifdef PPS_ENABLE
     session->shm_pps = NULL;
+    session->shmx_pps = NULL;
+    (void)pthread_mutex_init(&session->ntp_lock, NULL);
+    session->pps_shipped = 0;
 #endif	/* PPS_ENABLE */
 }
 
-int ntpshm_put(struct gps_device_t *session, volatile struct shmTime *shmseg, struct timedelta_t *td)
-/* put a received fix time into shared memory for NTP */
+static void ntpshm_store(struct gps_device_t *session,
+			 volatile struct shmTime *shmseg,
+			 struct timedelta_t *td, int precision)
+/* write a time to a segment and its extended twin */
 {
     char real_str[TIMESPEC_LEN];
     char clock_str[TIMESPEC_LEN];
 
+    ntp_write(shmseg, td, precision, session->context->leap_notify);
+    if (shmseg == session->shm_clock && session->shmx_clock != NULL)
+	ntpx_write(session->shmx_clock, td, precision,
+		   session->context->leap_notify);
+#ifdef PPS_ENABLE
+    if (shmseg == session->shm_pps && session->shmx_pps != NULL)
+	ntpx_write(session->shmx_pps, td, precision,
+		   session->context->leap_notify);
+#endif	/* PPS_ENABLE */
+
+    timespec_str( &td->real, real_str, sizeof(real_str) );
+    timespec_str( &td->clock, clock_str, sizeof(clock_str) );
+    gpsd_log(&session->context->errout, LOG_PROG,
+	     "NTP: ntpshm_put(%s,%d) %s @ %s\n",
+	     session->gpsdata.dev.path,
+	     precision,
+	     real_str, clock_str);
+}
+
+int ntpshm_put(struct gps_device_t *session, volatile struct shmTime *shmseg, struct timedelta_t *td)
+/* put a received fix time into shared memory for NTP */
+{
     /* Any NMEA will be about -1 or -2. Garmin GPS-18/USB is around -6 or -7. */
     int precision = -20; /* default precision, 1 micro sec */
 
@@ -253,16 +392,7 @@ int ntpshm_put(struct gps_device_t *session, volatile struct shmTime *shmseg, st
     }
 #endif	/* PPS_ENABLE */
 
-    ntp_write(shmseg, td, precision, session->context->leap_notify);
-
-    timespec_str( &td->real, real_str, sizeof(real_str) );
-    timespec_str( &td->clock, clock_str, sizeof(clock_str) );
-    gpsd_log(&session->context->errout, LOG_PROG,
-	     "NTP: ntpshm_put(%s,%d) %s @ %s\n",
-	     session->gpsdata.dev.path,
-	     precision,
-	     real_str, clock_str);
-
+    ntpshm_store(session, shmseg, td, precision);
     return 1;
 }
 
@@ -278,24 +408,13 @@ struct sock_sample {
     int magic;      /* must be SOCK_MAGIC */
 };
 
-static void init_hook(struct gps_device_t *session)
-/* for chrony SOCK interface, which allows nSec timekeeping */
-{
-    /* open the chrony socket */
-    char chrony_path[GPS_PATH_MAX];
+#define CHRONY_RETRY	10	/* seconds between tries to reach chronyd */
+#define CHRONY_MAXAGE	4	/* seconds a queued sample stays useful */
 
-    session->chronyfd = -1;
-    if ( 0 == getuid() ) {
-	/* this case will fire on command-line devices;
-	 * they're opened before priv-dropping.  Matters because
-         * only root can use /var/run.
-	 */
-	(void)snprintf(chrony_path, sizeof (chrony_path),
-		"/var/run/chrony.%s.sock", basename(session->gpsdata.dev.path));
-    } else {
-	(void)snprintf(chrony_path, sizeof (chrony_path),
-		"/tmp/chrony.%s.sock", 	basename(session->gpsdata.dev.path));
-    }
+static void chrony_connect(struct gps_device_t *session)
+/* open our socket to chronyd, if chronyd has created its end */
+{
+    const char *chrony_path = session->chrony.path;
 
     if (access(chrony_path, F_OK) != 0) {
 	gpsd_log(&session->context->errout, LOG_PROG,
@@ -315,17 +434,51 @@ static void init_hook(struct gps_device_t *session)
     }
 }
 
+static void init_hook(struct gps_device_t *session)
+/* for chrony SOCK interface, which allows nSec timekeeping */
+{
+    /* open the chrony socket */
+    char *chrony_path = session->chrony.path;
 
-/* td is the real time and clock time of the edge */
-/* offset is actual_ts - clock_ts */
-static void chrony_send(struct gps_device_t *session, struct timedelta_t *td)
+    memset(&session->chrony, 0, sizeof(session->chrony));
+    session->chronyfd = -1;
+    if ( 0 == getuid() ) {
+	/* this case will fire on command-line devices;
+	 * they're opened before priv-dropping.  Matters because
+         * only root can use /var/run.
+	 */
+	(void)snprintf(chrony_path, sizeof (session->chrony.path),
+		"/var/run/chrony.%s.sock", basename(session->gpsdata.dev.path));
+    } else {
+	(void)snprintf(chrony_path, sizeof (session->chrony.path),
+		"/tmp/chrony.%s.sock", 	basename(session->gpsdata.dev.path));
+    }
+    chrony_connect(session);
+}
+
+static void chrony_pack(struct sock_sample *wire, struct timedelta_t *td,
+			int leap)
+/* fill in a sample as chronyd's SOCK refclock wants it */
 {
-    char real_str[TIMESPEC_LEN];
-    char clock_str[TIMESPEC_LEN];
     struct timespec offset;
-    struct sock_sample sample;
+
+    memset(wire, 0, sizeof(*wire));
+    /* chrony expects tv-sec since Jan 1970 */
+    wire->pulse = 0;
+    wire->leap = leap;
+    wire->magic = SOCK_MAGIC;
+    /* chronyd wants a timeval, not a timespec */
+    TSTOTV(&wire->tv, &td->clock);
+    TS_SUB( &offset, &td->real, &td->clock);
+    /* if tv_sec greater than 2 then tv_nsec loses precision, but
+     * not a big deal as slewing will be required */
+    wire->offset = TSTONS( &offset );
+}
+
+static int chrony_leap(struct timedelta_t *td, int leap_notify)
+/* the leap notification chronyd should get with this sample */
+{
     struct tm tm;
-    int leap_notify = session->context->leap_notify;
 
     /*
      * insist that leap seconds only happen in june and december
@@ -341,28 +494,104 @@ static void chrony_send(struct gps_device_t *session, struct timedelta_t *td)
         /* Not june, not December, no way */
         leap_notify = LEAP_NOWARNING;
     }
+    return leap_notify;
+}
 
+static bool chrony_write(struct gps_device_t *session,
+			 struct chrony_sample_t *sample)
+/* offer chronyd one sample; false if it should be kept for later */
+{
+    char real_str[TIMESPEC_LEN];
+    char clock_str[TIMESPEC_LEN];
+    struct sock_sample wire;
 
-    /* chrony expects tv-sec since Jan 1970 */
-    sample.pulse = 0;
-    sample.leap = leap_notify;
-    sample.magic = SOCK_MAGIC;
-    /* chronyd wants a timeval, not a timspec, not to worry, it is
-     * just the top of the second */
-    TSTOTV(&sample.tv, &td->clock);
-    /* calculate the offset as a timespec to not lose precision */
-    TS_SUB( &offset, &td->real, &td->clock);
-    /* if tv_sec greater than 2 then tv_nsec loses precision, but
-     * not a big deal as slewing will be required */
-    sample.offset = TSTONS( &offset );
-    sample._pad = 0;
+    chrony_pack(&wire, &sample->td, sample->leap);
 
-    timespec_str( &td->real, real_str, sizeof(real_str) );
-    timespec_str( &td->clock, clock_str, sizeof(clock_str) );
+    timespec_str( &sample->td.real, real_str, sizeof(real_str) );
+    timespec_str( &sample->td.clock, clock_str, sizeof(clock_str) );
     gpsd_log(&session->context->errout, LOG_RAW,
-	     "PPS chrony_send %s @ %s Offset: %0.9f\n",
-	     real_str, clock_str, sample.offset);
-    (void)send(session->chronyfd, &sample, sizeof (sample), 0);
+	     "PPS chrony_send #%lu %s @ %s Offset: %0.9f\n",
+	     sample->seq, real_str, clock_str, wire.offset);
+
+    /* never wait on chronyd, this is the PPS thread */
+    if (send(session->chronyfd, &wire, sizeof(wire), MSG_DONTWAIT)
+	== (ssize_t)sizeof(wire)) {
+	session->chrony.sent++;
+	return true;
+    }
+    switch (errno) {
+    case EAGAIN:
+#if EWOULDBLOCK != EAGAIN
+    case EWOULDBLOCK:
+#endif
+    case ENOBUFS:
+	/* chronyd is not keeping up, try again with the next sample */
+	return false;
+    case ECONNREFUSED:
+    case ENOTCONN:
+    case ENOENT:
+	/* chronyd went away, maybe restarting with a fresh socket */
+	gpsd_log(&session->context->errout, LOG_WARN,
+		 "PPS:%s chrony socket %s lost: %s\n",
+		 session->gpsdata.dev.path, session->chrony.path,
+		 strerror(errno));
+	(void)close(session->chronyfd);
+	session->chronyfd = -1;
+	return false;
+    default:
+	gpsd_log(&session->context->errout, LOG_PROG,
+		 "PPS:%s chrony send failed: %s\n",
+		 session->gpsdata.dev.path, strerror(errno));
+	session->chrony.dropped++;
+	return true;
+    }
+}
+
+/* td is the real time and clock time of the edge */
+/* offset is actual_ts - clock_ts */
+static void chrony_send(struct gps_device_t *session, struct timedelta_t *td,
+			int precision)
+/* queue a sample for chronyd, then send as much as it will take */
+{
+    struct chrony_t *chrony = &session->chrony;
+    struct chrony_sample_t *sample;
+
+    chrony->seq++;
+    if (session->chronyfd < 0) {
+	if (td->clock.tv_sec < chrony->retry)
+	    return;
+	chrony->retry = td->clock.tv_sec + CHRONY_RETRY;
+	chrony_connect(session);
+	if (session->chronyfd < 0)
+	    return;
+	chrony->reconnects++;
+    }
+
+    if (chrony->count == CHRONY_QUEUE) {
+	/* full, so the oldest goes */
+	chrony->head = (chrony->head + 1) % CHRONY_QUEUE;
+	chrony->count--;
+	chrony->dropped++;
+    }
+    sample = &chrony->queue[(chrony->head + chrony->count) % CHRONY_QUEUE];
+    chrony->count++;
+    sample->seq = chrony->seq;
+    sample->td = *td;
+    sample->leap = chrony_leap(td, session->context->leap_notify);
+    sample->precision = precision;
+
+    while (chrony->count > 0) {
+	sample = &chrony->queue[chrony->head];
+	if (td->clock.tv_sec - sample->td.clock.tv_sec > CHRONY_MAXAGE)
+	    /* too old for chronyd to want */
+	    chrony->dropped++;
+	else if (!chrony_write(session, sample))
+	    break;
+	else if (sample->seq != chrony->seq)
+	    chrony->deferred++;
+	chrony->head = (chrony->head + 1) % CHRONY_QUEUE;
+	chrony->count--;
+    }
 }
 
 static char *report_hook(volatile struct pps_thread_t *pps_thread,
@@ -371,6 +600,10 @@ static char *report_hook(volatile struct pps_thread_t *pps_thread,
 {
     char *log1;
     struct gps_device_t *session = (struct gps_device_t *)pps_thread->context;
+    struct timespec now;
+
+    hist_record(&session->pps_offset, timespec_diff_ns(td->real, td->clock));
+    hist_record(&session->pps_fixdelta, pps_thread->fix_delay);
 
     /* PPS only source never get any serial info
      * so no NTPTIME_IS or fixcnt */
@@ -394,12 +627,19 @@ static char *report_hook(volatile struct pps_thread_t *pps_thread,
 
     /* FIXME?  how to log socket AND shm reported? */
     log1 = "accepted";
-    if ( 0 <= session->chronyfd ) {
-	log1 = "accepted chrony sock";
-	chrony_send(session, td);
+    (void)pthread_mutex_lock(&session->ntp_lock);
+    if (session->chrony.path[0] != '\0') {
+	chrony_send(session, td,
+		    source_usb == session->sourcetype ? -10 : -20);
+	if (0 <= session->chronyfd)
+	    log1 = "accepted chrony sock";
     }
     if (session->shm_pps != NULL)
 	(void)ntpshm_put(session, session->shm_pps, td);
+    session->pps_shipped = td->real.tv_sec;
+    (void)pthread_mutex_unlock(&session->ntp_lock);
+    (void)clock_gettime(CLOCK_REALTIME, &now);
+    hist_record(&session->pps_latency, timespec_diff_ns(now, td->clock));
 
     /* session context might have a hook set, too */
     if (session->context->pps_hook != NULL)
@@ -415,48 +655,105 @@ void ntpshm_link_deactivate(struct gps_device_t *session)
     if (session->shm_clock != NULL) {
 	(void)ntpshm_free(session->context, session->shm_clock);
 	session->shm_clock = NULL;
+	session->shmx_clock = NULL;
     }
 #if defined(PPS_ENABLE)
     if (session->shm_pps != NULL) {
 	pps_thread_deactivate(&session->pps_thread);
 	if (session->chronyfd != -1)
 	    (void)close(session->chronyfd);
+	session->chronyfd = -1;
 	(void)ntpshm_free(session->context, session->shm_pps);
 	session->shm_pps = NULL;
+	session->shmx_pps = NULL;
     }
 #endif	/* PPS_ENABLE */
 }
 
+#if defined(PPS_ENABLE)
+static bool pps_simulated(struct gps_device_t *session)
+/* should this session's PPS come from a timer?  See gpsd -Y */
+{
+    if (!session->context->pps_simulate)
+	return false;
+    if (session->sourcetype != source_pty) {
+	/* a real line has real PPS; never fake it */
+	gpsd_log(&session->context->errout, LOG_WARN,
+		 "NTP:%s is not a pty, simulated PPS not used\n",
+		 session->gpsdata.dev.path);
+	return false;
+    }
+    session->pps_thread.sim_offset = session->context->pps_sim_offset;
+    session->pps_thread.sim_jitter = session->context->pps_sim_jitter;
+    return true;
+}
+#endif /* PPS_ENABLE */
+
 void ntpshm_link_activate(struct gps_device_t *session)
 /* set up ntpshm storage for a session */
 {
-    /* don't talk to NTP when we're running inside the test harness */
-    if (session->sourcetype == source_pty)
+    struct gps_context_t *context = session->context;
+    int i, unit, clock_unit = -1, pps_unit = -1;
+    bool simulate = false;
+
+#if defined(PPS_ENABLE)
+    simulate = pps_simulated(session);
+#endif /* PPS_ENABLE */
+    /*
+     * Don't talk to NTP when we're running inside the test harness,
+     * unless the test asked for simulated PPS, nor when replaying a
+     * capture, whose times are long past.
+     */
+    if (session->sourcetype == source_pty && !simulate)
 	return;
+    if (str_starts_with(session->gpsdata.dev.path, "replay://"))
+	return;
+
+    /* units fixed with -U */
+    for (i = 0; i < MAX_DEVICES; i++)
+	if (strcmp(context->shmUnits[i].path, session->gpsdata.dev.path) == 0) {
+	    clock_unit = context->shmUnits[i].clock;
+	    pps_unit = context->shmUnits[i].pps;
+	    if (session->sourcetype == source_pps && pps_unit < 0)
+		pps_unit = clock_unit;
+	    break;
+	}
 
     if (session->sourcetype != source_pps ) {
 	/* allocate a shared-memory segment for "NMEA" time data */
-	session->shm_clock = ntpshm_alloc(session->context);
+	unit = ntpshm_alloc(context, clock_unit,
+			    session->gpsdata.dev.path);
 
-	if (session->shm_clock == NULL) {
+	if (unit < 0) {
 	    gpsd_log(&session->context->errout, LOG_WARN,
 		     "NTP: ntpshm_alloc() failed\n");
 	    return;
         }
+	session->shm_clock = context->shmTime[unit];
+	session->shmx_clock = context->shmTimeX[unit];
+	gpsd_log(&context->errout, LOG_INF,
+		 "NTP:%s time on unit %d\n", session->gpsdata.dev.path, unit);
     }
 
 #if defined(PPS_ENABLE)
-    if (session->sourcetype == source_usb
+    if (simulate
+            || session->sourcetype == source_usb
             || session->sourcetype == source_rs232
             || session->sourcetype == source_pps) {
 	/* We also have the 1pps capability, allocate a shared-memory segment
 	 * for the 1pps time data and launch a thread to capture the 1pps
 	 * transitions
 	 */
-	if ((session->shm_pps = ntpshm_alloc(session->context)) == NULL) {
+	if ((unit = ntpshm_alloc(context, pps_unit,
+				 session->gpsdata.dev.path)) < 0) {
 	    gpsd_log(&session->context->errout, LOG_WARN,
 		     "PPS: ntpshm_alloc(1) failed\n");
 	} else {
+	    session->shm_pps = context->shmTime[unit];
+	    session->shmx_pps = context->shmTimeX[unit];
+	    gpsd_log(&context->errout, LOG_INF,
+		     "NTP:%s PPS on unit %d\n", session->gpsdata.dev.path,
+		     unit);
 	    init_hook(session);
 	    session->pps_thread.report_hook = report_hook;
 	    #ifdef MAGIC_HAT_ENABLE
@@ -474,11 +771,389 @@ void ntpshm_link_activate(struct gps_device_t *session)
 			session->pps_thread.devicename = first_pps;
 		}
 	    #endif /* MAGIC_HAT_ENABLE */
+	    session->pps_thread.priority = session->context->pps_priority;
+	    session->pps_thread.cpus = session->context->pps_cpus;
+	    session->pps_thread.simulate = simulate;
 	    pps_thread_activate(&session->pps_thread);
 	}
     }
 #endif /* PPS_ENABLE */
 }
 
+#if defined(PPS_ENABLE)
+/* the clock holdover is fitted against, as no time service steers it */
+#ifdef CLOCK_MONOTONIC_RAW
+#define HOLDOVER_CLOCK	CLOCK_MONOTONIC_RAW
+#else
+#define HOLDOVER_CLOCK	CLOCK_MONOTONIC
+#endif /* CLOCK_MONOTONIC_RAW */
+
+static void holdover_predict(const struct holdover_t *ho,
+			     struct timespec *gps, struct timespec *now)
+/* the model's GPS time for this moment, and the system clock's */
+{
+    struct timespec raw;
+    long long ns;
+
+    (void)clock_gettime(CLOCK_REALTIME, now);
+    (void)clock_gettime(HOLDOVER_CLOCK, &raw);
+    ns = (long long)((ho->intercept
+		      + ho->slope * (double)(now->tv_sec - ho->tref)) * 1e9);
+    gps->tv_sec = raw.tv_sec + ho->base + (time_t)(ns / NS_IN_SEC);
+    gps->tv_nsec = raw.tv_nsec + (long)(ns % NS_IN_SEC);
+    TS_NORM(gps);
+}
+
+void pps_stats_dump(const struct gps_device_t *session,
+		    char *reply, size_t replylen)
+/* append a device's PPS statistics as a JSON object, plus a comma */
+{
+    volatile const struct pps_thread_t *pps = &session->pps_thread;
+    int i;
+
+    if (session->shm_pps == NULL)
+	return;
+    str_appendf(reply, replylen,
+		"{\"path\":\"%s\",\"edges\":%lu,\"accepted\":%d,"
+		"\"priority\":%d,\"cpus\":%lu,\"jitter\":[",
+		session->gpsdata.dev.path, pps->edges, pps->ppsout_count,
+		pps->priority, pps->cpus);
+    for (i = 0; i < PPS_JITTER_BINS; i++)
+	str_appendf(reply, replylen, "%lu,", pps->jitter[i]);
+    str_rstrip_char(reply, ',');
+    (void)strlcat(reply, "],", replylen);
+    hist_dump(&session->pps_offset, "offset", reply, replylen);
+    hist_dump(&session->pps_latency, "latency", reply, replylen);
+    hist_dump(&session->pps_fixdelta, "fixdelta", reply, replylen);
+    if (session->holdover.valid) {
+	struct timespec gps, now;
+
+	holdover_predict(&session->holdover, &gps, &now);
+	str_appendf(reply, replylen,
+		    "\"holdover\":{\"active\":%s,\"offset\":%.9f,"
+		    "\"ppm\":%.4f,\"residual\":%.9f,\"minutes\":%d,"
+		    "\"hints\":%lu},",
+		    session->holdover.last_hint > session->holdover.last_edge
+		    ? "true" : "false",
+		    timespec_diff_ns(gps, now) / 1e9,
+		    session->holdover.slope * 1e6,
+		    session->holdover.residual,
+		    session->holdover.count, session->holdover.hints);
+    }
+    if (session->chrony.path[0] != '\0')
+	str_appendf(reply, replylen,
+		    "\"chrony\":{\"connected\":%s,\"sent\":%lu,"
+		    "\"deferred\":%lu,\"dropped\":%lu,\"queued\":%d,"
+		    "\"reconnects\":%lu},",
+		    session->chronyfd >= 0 ? "true" : "false",
+		    session->chrony.sent, session->chrony.deferred,
+		    session->chrony.dropped, session->chrony.count,
+		    session->chrony.reconnects);
+    str_rstrip_char(reply, ',');
+    (void)strlcat(reply, "},", replylen);
+}
+
+static int fixoffset_cmp(const void *a, const void *b)
+/* for sorting latencies */
+{
+    long long x = *(const long long *)a, y = *(const long long *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void fixoffset_seed(struct gps_device_t *session)
+/* start learning afresh, from a saved offset for this device if any */
+{
+    struct gps_context_t *context = session->context;
+    struct fixoffset_t *fo = &session->fixoffset;
+    int i;
+
+    memset(fo, 0, sizeof(*fo));
+    fo->baudrate = session->gpsdata.dev.baudrate;
+    for (i = 0; i < FIXCAL_MAX; i++)
+	if (context->fixcal[i].samples > 0
+	    && context->fixcal[i].baudrate == fo->baudrate
+	    && strcmp(context->fixcal[i].path,
+		      session->gpsdata.dev.path) == 0) {
+	    fo->offset = context->fixcal[i].offset;
+	    fo->valid = true;
+	    gpsd_log(&context->errout, LOG_INF,
+		     "NTP:%s starting from saved fix offset %lld ns\n",
+		     session->gpsdata.dev.path, fo->offset);
+	    break;
+	}
+}
+
+void fixoffset_update(struct gps_device_t *session, struct timedelta_t *td)
+/* learn how long after the PPS edge the fix naming that second arrives */
+{
+    struct fixoffset_t *fo = &session->fixoffset;
+    struct timedelta_t edge;
+    long long sorted[FIXOFFSET_WINDOW], median;
+
+    /* the delay depends on line speed, so a new speed starts over */
+    if (fo->baudrate != session->gpsdata.dev.baudrate)
+	fixoffset_seed(session);
+
+    /* compare with the edge that started this fix's second, if seen */
+    if (pps_thread_ppsout(&session->pps_thread, &edge) <= 0
+	|| edge.real.tv_sec != (time_t)floor(session->newdata.time))
+	return;
+    median = timespec_diff_ns(td->clock, edge.clock);
+    if (median < 0 || median >= NS_IN_SEC)
+	return;		/* a fix ahead of its edge, or a missed edge */
+
+    fo->window[fo->next] = median;
+    fo->next = (fo->next + 1) % FIXOFFSET_WINDOW;
+    if (fo->count < FIXOFFSET_WINDOW)
+	fo->count++;
+    fo->samples++;
+
+    /* median of the window, so a stray late read can't drag it */
+    memcpy(sorted, fo->window, fo->count * sizeof(long long));
+    qsort(sorted, fo->count, sizeof(long long), fixoffset_cmp);
+    median = sorted[fo->count / 2];
+    if (fo->valid)
+	fo->offset += (median - fo->offset) / FIXOFFSET_GAIN;
+    else if (fo->count >= FIXOFFSET_MIN) {
+	fo->offset = median;
+	fo->valid = true;
+	gpsd_log(&session->context->errout, LOG_INF,
+		 "NTP:%s learned fix offset %lld ns\n",
+		 session->gpsdata.dev.path, fo->offset);
+    }
+}
+
+static bool fixoffset_take(struct gps_context_t *context, int n,
+			   const char *path, const char *fields)
+/* one line of the saved offsets; false if it can't be used */
+{
+    unsigned int baudrate;
+    long long offset;
+    unsigned long samples;
+
+    if (sscanf(fields, "%u %lld %lu", &baudrate, &offset, &samples) != 3)
+	return false;
+    (void)strlcpy(context->fixcal[n].path, path,
+		  sizeof(context->fixcal[n].path));
+    context->fixcal[n].baudrate = baudrate;
+    context->fixcal[n].offset = offset;
+    context->fixcal[n].samples = samples;
+    return true;
+}
+
+bool fixoffset_load(struct gps_context_t *context)
+/* read the saved offsets; a missing file is not an error */
+{
+    return gpsd_keyfile_load(context, context->fixcal_path,
+			     "NTP: fix offsets", FIXCAL_MAX, fixoffset_take);
+}
+
+static void fixoffset_put(const struct gps_context_t *context, int i,
+			  FILE *fp)
+/* write one slot of the offsets, if it's in use */
+{
+    if (context->fixcal[i].samples > 0)
+	(void)fprintf(fp, "%s %u %lld %lu\n",
+		      context->fixcal[i].path, context->fixcal[i].baudrate,
+		      context->fixcal[i].offset, context->fixcal[i].samples);
+}
+
+void fixoffset_save(struct gps_context_t *context,
+		    struct gps_device_t *devices, int ndevices)
+/* fold the devices' estimates into the saved set and write it out */
+{
+    int d, i;
+
+    for (d = 0; d < ndevices; d++) {
+	struct fixoffset_t *fo = &devices[d].fixoffset;
+	int slot = -1;
+
+	if (!fo->valid || fo->samples == 0)
+	    continue;
+	for (i = 0; i < FIXCAL_MAX; i++)
+	    if (context->fixcal[i].samples == 0) {
+		if (slot < 0)
+		    slot = i;
+	    } else if (context->fixcal[i].baudrate == fo->baudrate
+		       && strcmp(context->fixcal[i].path,
+				 devices[d].gpsdata.dev.path) == 0) {
+		slot = i;
+		break;
+	    }
+	if (slot < 0)
+	    continue;		/* full; keep what we had */
+	(void)strlcpy(context->fixcal[slot].path, devices[d].gpsdata.dev.path,
+		      sizeof(context->fixcal[slot].path));
+	context->fixcal[slot].baudrate = fo->baudrate;
+	context->fixcal[slot].offset = fo->offset;
+	if (context->fixcal[slot].samples < fo->samples)
+	    context->fixcal[slot].samples = fo->samples;
+    }
+
+    gpsd_keyfile_save(context, context->fixcal_path, "NTP: fix offsets",
+		      "gpsd learned fix offsets: device bps ns samples",
+		      FIXCAL_MAX, fixoffset_put);
+}
+
+#define HOLDOVER_EDGES	30	/* edges in a minute for it to count */
+#define HOLDOVER_GRACE	0.5	/* seconds late before an edge is missed */
+#define HOLDOVER_WANDER	1e-8	/* assumed drift off the fit, s/s */
+#define HOLDOVER_STALE	0.1	/* seconds after which an edge isn't used */
+
+static void holdover_fit(struct holdover_t *ho)
+/* least-squares line through the per-minute offsets */
+{
+    double tsum = 0, ysum = 0, sxy = 0, sse = 0;
+    int i;
+
+    ho->valid = false;
+    if (ho->count < HOLDOVER_MIN)
+	return;
+    /* times relative to the newest point, to keep the doubles exact */
+    ho->tref = ho->points[(ho->next + HOLDOVER_POINTS - 1)
+			  % HOLDOVER_POINTS].when;
+    for (i = 0; i < ho->count; i++) {
+	tsum += (double)(ho->points[i].when - ho->tref);
+	ysum += ho->points[i].offset;
+    }
+    ho->tbar = tsum / ho->count;
+    ysum /= ho->count;
+    ho->sxx = 0;
+    for (i = 0; i < ho->count; i++) {
+	double dt = (double)(ho->points[i].when - ho->tref) - ho->tbar;
+
+	ho->sxx += dt * dt;
+	sxy += dt * (ho->points[i].offset - ysum);
+    }
+    if (ho->sxx <= 0)
+	return;
+    ho->slope = sxy / ho->sxx;
+    ho->intercept = ysum - ho->slope * ho->tbar;
+    for (i = 0; i < ho->count; i++) {
+	double e = ho->points[i].offset - ho->intercept
+	    - ho->slope * (double)(ho->points[i].when - ho->tref);
+
+	sse += e * e;
+    }
+    ho->residual = sqrt(sse / (ho->count - 2));
+    ho->valid = true;
+}
+
+void holdover_edge(struct gps_device_t *session, struct timedelta_t *td)
+/* fold a real PPS edge into the holdover model */
+{
+    struct holdover_t *ho = &session->holdover;
+    time_t minute = td->real.tv_sec / 60;
+    struct timespec now, raw, age;
+
+    /*
+     * Where the raw clock was at the edge.  The system clock may be
+     * slewing, but not by enough to matter over the moment since; an
+     * edge we're late in hearing of could be off, so it isn't used.
+     */
+    (void)clock_gettime(CLOCK_REALTIME, &now);
+    (void)clock_gettime(HOLDOVER_CLOCK, &raw);
+    TS_SUB(&age, &now, &td->clock);
+    TS_SUB(&raw, &raw, &age);
+    if (ho->base == 0)
+	ho->base = td->real.tv_sec - raw.tv_sec;
+
+    if (minute != ho->minute) {
+	if (ho->edges >= HOLDOVER_EDGES) {
+	    ho->points[ho->next].when = ho->minute * 60 + 30;
+	    ho->points[ho->next].offset = ho->sum / ho->edges;
+	    ho->next = (ho->next + 1) % HOLDOVER_POINTS;
+	    if (ho->count < HOLDOVER_POINTS)
+		ho->count++;
+	    holdover_fit(ho);
+	}
+	ho->minute = minute;
+	ho->sum = 0;
+	ho->edges = 0;
+    }
+    if (TSTONS(&age) < HOLDOVER_STALE) {
+	ho->sum += (double)(td->real.tv_sec - raw.tv_sec - ho->base)
+	    + (td->real.tv_nsec - raw.tv_nsec) / 1e9;
+	ho->edges++;
+    }
+
+    if (ho->last_hint > ho->last_edge)
+	gpsd_log(&session->context->errout, LOG_WARN,
+		 "PPS:%s back after %ld seconds of holdover\n",
+		 session->gpsdata.dev.path,
+		 (long)(td->real.tv_sec - ho->last_edge));
+    ho->last_edge = td->real.tv_sec;
+}
+
+bool holdover_tick(struct gps_device_t *session, struct timedelta_t *td,
+		   int *precision)
+/* if a PPS edge is overdue, stand in for it from the model */
+{
+    struct holdover_t *ho = &session->holdover;
+    struct timespec gps, now;
+    time_t second;
+    double elapsed, sigma, dt;
+    bool shipped;
+
+    if (!ho->valid || session->shm_pps == NULL)
+	return false;
+    holdover_predict(ho, &gps, &now);
+    /* the latest second whose edge should have been seen by now */
+    second = gps.tv_sec;
+    if (gps.tv_nsec < (long)(HOLDOVER_GRACE * NS_IN_SEC))
+	second--;
+    if (second <= ho->last_edge || second <= ho->last_hint)
+	return false;
+    elapsed = (double)(second - ho->last_edge);
+    if (elapsed > HOLDOVER_MAX) {
+	if (ho->last_hint > ho->last_edge + HOLDOVER_MAX)
+	    return false;
+	if (ho->last_hint > ho->last_edge)
+	    gpsd_log(&session->context->errout, LOG_WARN,
+		     "PPS:%s holdover given up after %d seconds\n",
+		     session->gpsdata.dev.path, HOLDOVER_MAX);
+	ho->last_hint = ho->last_edge + HOLDOVER_MAX + 1;
+	return false;
+    }
+    if (ho->last_hint <= ho->last_edge)
+	gpsd_log(&session->context->errout, LOG_WARN,
+		 "PPS:%s lost, holding over on a %.3f ppm trend\n",
+		 session->gpsdata.dev.path, ho->slope * 1e6);
+
+    /* say how far the prediction is to be trusted */
+    dt = (double)(second - ho->tref) - ho->tbar;
+    sigma = ho->residual * sqrt(1.0 / ho->count + dt * dt / ho->sxx)
+	+ HOLDOVER_WANDER * elapsed;
+    *precision = (int)ceil(log2(sigma > 1e-9 ? sigma : 1e-9));
+    if (*precision > -1)
+	*precision = -1;
+
+    /* the system clock now, against the GPS time the model gives it */
+    td->real = gps;
+    td->clock = now;
+
+    /*
+     * The PPS thread writes the same segment and chrony queue, and may
+     * have an edge for us that we haven't heard of yet.  Since the
+     * model never saw the system clock, ntpd and chronyd can both have
+     * the stand-in without it feeding back their own steering.
+     */
+    (void)pthread_mutex_lock(&session->ntp_lock);
+    shipped = session->pps_shipped > ho->last_edge;
+    if (!shipped) {
+	ntpshm_store(session, session->shm_pps, td, *precision);
+	if (session->chrony.path[0] != '\0')
+	    chrony_send(session, td, *precision);
+    }
+    (void)pthread_mutex_unlock(&session->ntp_lock);
+    if (shipped)
+	return false;
+    ho->last_hint = second;
+    ho->hints++;
+    return true;
+}
+#endif /* PPS_ENABLE */
+
 #endif /* NTPSHM_ENABLE */
 /* end */